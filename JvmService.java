@@ -0,0 +1,211 @@
+/* Warm JVM for hw3 .j files (make run-warm, make test). Assembles them with
+ * Jasmin in-process and runs main from a class loader of its own, so a job
+ * costs no JVM start and the JIT stays warm from one job to the next.
+ *
+ *   java -cp jasmin.jar:. JvmService           requests on stdin, replies on stdout
+ *   java -cp jasmin.jar:. JvmService <socket>  the same on every connection to
+ *                                              a Unix socket (Java 16 or later)
+ *
+ * Requests, one per line; paths are as the service sees them:
+ *   run <file.j>             assemble and run main, capturing its stdout
+ *   assemble <dir> <file.j>  write <dir>/<class>.class, as jasmin.jar -d does
+ *   stop                     exit the service
+ * Reply per request:
+ *   <status> <assemble us> <run us> <output bytes> <message bytes>\n
+ * then the program's stdout and the message. status is ok, assemble-error,
+ * verify-error, exception (the message is the line java prints for it) or
+ * error. Connections are served at once, each on its own thread; a program
+ * that never ends keeps its thread until the service stops. */
+import java.io.*;
+import java.lang.reflect.InvocationTargetException;
+import java.lang.reflect.Method;
+import java.net.StandardProtocolFamily;
+import java.net.UnixDomainSocketAddress;
+import java.nio.channels.Channels;
+import java.nio.channels.ServerSocketChannel;
+import java.nio.channels.SocketChannel;
+import java.nio.file.Files;
+import java.nio.file.Path;
+
+public class JvmService {
+    static final ThreadLocal<OutputStream> outTarget = new ThreadLocal<>(), errTarget = new ThreadLocal<>();
+
+    /* System.out or System.err as seen from the thread of each request */
+    static class Router extends OutputStream {
+        final ThreadLocal<OutputStream> target;
+        final OutputStream fallback;
+
+        Router(ThreadLocal<OutputStream> target, OutputStream fallback) {
+            this.target = target;
+            this.fallback = fallback;
+        }
+
+        OutputStream out() {
+            OutputStream o = target.get();
+            return o != null ? o : fallback;
+        }
+
+        @Override
+        public void write(int b) throws IOException {
+            out().write(b);
+        }
+
+        @Override
+        public void write(byte[] b, int off, int len) throws IOException {
+            out().write(b, off, len);
+        }
+
+        @Override
+        public void flush() throws IOException {
+            out().flush();
+        }
+    }
+
+    static class Loader extends ClassLoader {
+        Loader() {
+            super(JvmService.class.getClassLoader());
+        }
+
+        Class<?> define(String name, byte[] code) {
+            return defineClass(name, code, 0, code.length);
+        }
+    }
+
+    static class Reply {
+        String status = "ok";
+        long assembleUs, runUs;
+        ByteArrayOutputStream out = new ByteArrayOutputStream(), msg = new ByteArrayOutputStream();
+
+        void fail(String status, Object message) {
+            this.status = status;
+            try {
+                msg.write((message + "\n").getBytes("UTF-8"));
+            } catch (IOException e) {
+                /* not for a byte array */
+            }
+        }
+    }
+
+    /* Assembles path into code; null if it has errors */
+    static jasmin.ClassFile assemble(String path, Reply r, ByteArrayOutputStream code) {
+        long t0 = System.nanoTime();
+        try {
+            jasmin.ClassFile cf = new jasmin.ClassFile();
+            try (Reader in = new BufferedReader(new InputStreamReader(new FileInputStream(path), "UTF-8"))) {
+                cf.readJasmin(in, path, false);
+            }
+            if (cf.errorCount() == 0) {
+                cf.write(code);
+                return cf;
+            }
+            r.status = "assemble-error";
+        } catch (Throwable e) {
+            r.fail("assemble-error", e);
+        } finally {
+            r.assembleUs = (System.nanoTime() - t0) / 1000;
+        }
+        return null;
+    }
+
+    static void run(String path, Reply r) {
+        ByteArrayOutputStream code = new ByteArrayOutputStream();
+        jasmin.ClassFile cf = assemble(path, r, code);
+        if (cf == null) return;
+        long t0 = System.nanoTime();
+        try {
+            Class<?> c = new Loader().define(cf.getClassName().replace('/', '.'), code.toByteArray());
+            Method main = c.getMethod("main", String[].class);
+            outTarget.set(r.out);
+            main.invoke(null, (Object) new String[0]);
+        } catch (InvocationTargetException e) {
+            r.fail("exception", "Exception in thread \"main\" " + e.getCause());
+        } catch (VerifyError e) {
+            r.fail("verify-error", e);
+        } catch (Throwable e) {
+            r.fail("error", e);
+        } finally {
+            outTarget.set(r.msg);
+            r.runUs = (System.nanoTime() - t0) / 1000;
+        }
+    }
+
+    static void assembleTo(String dir, String path, Reply r) {
+        ByteArrayOutputStream code = new ByteArrayOutputStream();
+        jasmin.ClassFile cf = assemble(path, r, code);
+        if (cf == null) return;
+        try (OutputStream out = new FileOutputStream(new File(dir, cf.getClassName() + ".class"))) {
+            code.writeTo(out);
+        } catch (IOException e) {
+            r.fail("error", e);
+        }
+    }
+
+    static Reply handle(String line) {
+        Reply r = new Reply();
+        /* Jasmin reports errors on either stream */
+        outTarget.set(r.msg);
+        errTarget.set(r.msg);
+        try {
+            String[] word = line.split(" ", 3);
+            if (word[0].equals("run") && word.length >= 2) {
+                run(line.substring(4), r);
+            } else if (word[0].equals("assemble") && word.length == 3) {
+                assembleTo(word[1], word[2], r);
+            } else {
+                r.fail("error", "unknown request: " + line);
+            }
+        } finally {
+            outTarget.remove();
+            errTarget.remove();
+        }
+        return r;
+    }
+
+    static void serve(InputStream in, OutputStream out) throws IOException {
+        BufferedReader requests = new BufferedReader(new InputStreamReader(in, "UTF-8"));
+        OutputStream reply = new BufferedOutputStream(out);
+        for (String line; (line = requests.readLine()) != null;) {
+            if (line.equals("stop")) System.exit(0);
+            Reply r = handle(line);
+            String header = String.format("%s %d %d %d %d\n", r.status, r.assembleUs, r.runUs, r.out.size(),
+                                          r.msg.size());
+            reply.write(header.getBytes("US-ASCII"));
+            r.out.writeTo(reply);
+            r.msg.writeTo(reply);
+            reply.flush();
+        }
+    }
+
+    public static void main(String[] args) throws IOException {
+        OutputStream stdout = new FileOutputStream(FileDescriptor.out);
+        System.setOut(new PrintStream(new Router(outTarget, System.out), true, "UTF-8"));
+        System.setErr(new PrintStream(new Router(errTarget, System.err), true, "UTF-8"));
+        if (args.length == 0) {
+            serve(System.in, stdout);
+            return;
+        }
+        Path socket = Path.of(args[0]);
+        Files.deleteIfExists(socket);
+        ServerSocketChannel server = ServerSocketChannel.open(StandardProtocolFamily.UNIX);
+        server.bind(UnixDomainSocketAddress.of(socket));
+        Runtime.getRuntime().addShutdownHook(new Thread(() -> {
+            try {
+                Files.deleteIfExists(socket);
+            } catch (IOException e) {
+                /* gone already */
+            }
+        }));
+        for (;;) {
+            SocketChannel client = server.accept();
+            Thread t = new Thread(() -> {
+                try (SocketChannel c = client) {
+                    serve(Channels.newInputStream(c), Channels.newOutputStream(c));
+                } catch (IOException e) {
+                    /* the client went away */
+                }
+            });
+            t.setDaemon(true);
+            t.start();
+        }
+    }
+}
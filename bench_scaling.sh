@@ -0,0 +1,33 @@
+#!/bin/sh
+# Batch compile time with 1 to N jobs (make bench-scaling).
+# usage: bench_scaling.sh [copies of input/*.rs, default 200] [max jobs, default nproc]
+copies=${1:-200}
+max=${2:-$(nproc)}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/src"
+i=0
+while [ $i -lt "$copies" ]; do
+    for f in input/*.rs; do
+        cp "$f" "$dir/src/$(basename "$f" .rs)_$i.rs"
+    done
+    i=$((i + 1))
+done
+nfiles=$(ls "$dir/src" | wc -l)
+
+echo "$nfiles files"
+printf "%6s %10s %8s\n" jobs seconds speedup
+base=
+j=1
+while [ $j -le "$max" ]; do
+    rm -rf "$dir/out"
+    start=$(date +%s.%N)
+    ./mycompiler -j $j -o "$dir/out" "$dir"/src/*.rs > /dev/null
+    end=$(date +%s.%N)
+    t=$(awk "BEGIN { print $end - $start }")
+    [ -z "$base" ] && base=$t
+    awk "BEGIN { printf \"%6d %10.3f %8.2f\\n\", $j, $t, $base / $t }"
+    j=$((j * 2))
+    if [ $j -gt "$max" ] && [ $((j / 2)) -lt "$max" ]; then j=$max; fi
+done
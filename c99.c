@@ -0,0 +1,286 @@
+/* C backend (--emit=c).
+ *
+ * Methods are taken to SSA form and every value becomes a local of its C
+ * type; blocks become labels and branches gotos, leaving loop structure
+ * and register allocation to the C compiler. int and long arithmetic goes
+ * through the unsigned types so overflow wraps as on the JVM instead of
+ * being undefined, and float results are cast back to float so no excess
+ * precision survives a step. Phis are assigned through temporaries on each
+ * incoming edge. Printing and the division-by-zero exception use the same
+ * runtime as the x86 backend (runtime.c). */
+#include "compiler_common.h"
+#include <math.h>
+
+typedef struct {
+    FILE *out;
+    IrFunc *f;
+    bool *fused;     /* valueOf printed straight away by rt_print_int/float */
+    bool is_main;
+} CGen;
+
+static const char *c_type(IrType t) {
+    switch (t) {
+    case IR_INT: return "int32_t";
+    case IR_FLOAT: return "float";
+    case IR_LONG: return "int64_t";
+    default: return "const char *";
+    }
+}
+
+/* "int32_t x" but "const char *x" */
+static const char *c_space(IrType t) {
+    return t == IR_REF ? "" : " ";
+}
+
+static const char *c_cond(Opcode op) {
+    switch (op) {
+    case OP_IFEQ: case OP_IF_ICMPEQ: return "==";
+    case OP_IFNE: case OP_IF_ICMPNE: return "!=";
+    case OP_IFLT: case OP_IF_ICMPLT: return "<";
+    case OP_IFGE: case OP_IF_ICMPGE: return ">=";
+    case OP_IFGT: case OP_IF_ICMPGT: return ">";
+    default: return "<=";
+    }
+}
+
+/* Hex floats are exact; NAN and INFINITY come from <math.h> */
+static void write_float(FILE *out, float f) {
+    if (isnan(f)) fprintf(out, "NAN");
+    else if (isinf(f)) fprintf(out, f > 0 ? "INFINITY" : "-INFINITY");
+    else fprintf(out, "%af", f);
+}
+
+static void write_string(FILE *out, const char *s) {
+    char *bytes = string_unescape(s, NULL);
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)bytes; *p; p++) {
+        if (*p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\' && *p != '?') fputc(*p, out);
+        else fprintf(out, "\\%03o", *p);
+    }
+    fputc('"', out);
+    free(bytes);
+}
+
+static bool emit_value(CGen *c, int id) {
+    const IrValue *v = &c->f->vals[id];
+    FILE *out = c->out;
+    const int *a = v->args;
+    static const char *wrap_ops[OP_COUNT] = {
+        [OP_IADD] = "+", [OP_ISUB] = "-", [OP_IMUL] = "*",
+    };
+    static const char *bit_ops[OP_COUNT] = {
+        [OP_IAND] = "&", [OP_IOR] = "|", [OP_IXOR] = "^",
+    };
+    static const char *float_ops[OP_COUNT] = {
+        [OP_FADD] = "+", [OP_FSUB] = "-", [OP_FMUL] = "*", [OP_FDIV] = "/",
+    };
+    static const char *long_ops[OP_COUNT] = {
+        [OP_LADD] = "+", [OP_LSUB] = "-", [OP_LMUL] = "*",
+    };
+
+    if (c->fused[id]) return true;
+    if (wrap_ops[v->op]) {
+        fprintf(out, "\tv%d = (int32_t)((uint32_t)v%d %s (uint32_t)v%d);\n", id, a[0], wrap_ops[v->op], a[1]);
+        return true;
+    }
+    if (bit_ops[v->op]) {
+        fprintf(out, "\tv%d = v%d %s v%d;\n", id, a[0], bit_ops[v->op], a[1]);
+        return true;
+    }
+    if (float_ops[v->op]) {
+        fprintf(out, "\tv%d = (float)(v%d %s v%d);\n", id, a[0], float_ops[v->op], a[1]);
+        return true;
+    }
+    if (long_ops[v->op]) {
+        fprintf(out, "\tv%d = (int64_t)((uint64_t)v%d %s (uint64_t)v%d);\n", id, a[0], long_ops[v->op], a[1]);
+        return true;
+    }
+
+    switch (v->op) {
+    case OP_ICONST:
+        fprintf(out, "\tv%d = %d;\n", id, v->ival);
+        return true;
+    case OP_FCONST:
+        fprintf(out, "\tv%d = ", id);
+        write_float(out, v->fval);
+        fprintf(out, ";\n");
+        return true;
+    case OP_LCONST:
+        fprintf(out, "\tv%d = %d;\n", id, v->ival);
+        return true;
+    case OP_SCONST:
+        fprintf(out, "\tv%d = ", id);
+        write_string(out, v->sval);
+        fprintf(out, ";\n");
+        return true;
+    case OP_GETSTATIC:
+        /* System.out; printing goes through the runtime */
+        if (strcmp(v->sval, "java/lang/System/out Ljava/io/PrintStream;") != 0) return false;
+        fprintf(out, "\tv%d = 0;\n", id);
+        return true;
+    case OP_INEG:
+        fprintf(out, "\tv%d = (int32_t)(0u - (uint32_t)v%d);\n", id, a[0]);
+        return true;
+    case OP_FNEG:
+        fprintf(out, "\tv%d = -v%d;\n", id, a[0]);
+        return true;
+    case OP_ISHL:
+        fprintf(out, "\tv%d = (int32_t)((uint32_t)v%d << (v%d & 31));\n", id, a[0], a[1]);
+        return true;
+    case OP_ISHR:
+        fprintf(out, "\tv%d = v%d >> (v%d & 31);\n", id, a[0], a[1]);
+        return true;
+    case OP_IUSHR:
+        fprintf(out, "\tv%d = (int32_t)((uint32_t)v%d >> (v%d & 31));\n", id, a[0], a[1]);
+        return true;
+    case OP_IDIV:
+        /* the runtime only for the exception, so constant divisors fold */
+        fprintf(out, "\tv%d = v%d == 0 ? rt_idiv(v%d, 0) : v%d == -1 ? (int32_t)(0u - (uint32_t)v%d) : v%d / v%d;\n",
+                id, a[1], a[0], a[1], a[0], a[0], a[1]);
+        return true;
+    case OP_IREM:
+        fprintf(out, "\tv%d = v%d == 0 ? rt_irem(v%d, 0) : v%d == -1 ? 0 : v%d %% v%d;\n",
+                id, a[1], a[0], a[1], a[0], a[1]);
+        return true;
+    case OP_I2F:
+        fprintf(out, "\tv%d = (float)v%d;\n", id, a[0]);
+        return true;
+    case OP_F2I:
+        fprintf(out, "\tv%d = v%d != v%d ? 0 : v%d >= 2147483648.0f ? INT32_MAX : "
+                     "v%d <= -2147483648.0f ? INT32_MIN : (int32_t)v%d;\n",
+                id, a[0], a[0], a[0], a[0], a[0]);
+        return true;
+    case OP_FCMPL:
+    case OP_FCMPG:
+        fprintf(out, "\tv%d = v%d != v%d || v%d != v%d ? %d : (v%d > v%d) - (v%d < v%d);\n",
+                id, a[0], a[0], a[1], a[1], v->op == OP_FCMPL ? -1 : 1, a[0], a[1], a[0], a[1]);
+        return true;
+    case OP_LUSHR:
+        fprintf(out, "\tv%d = (int64_t)((uint64_t)v%d >> (v%d & 63));\n", id, a[0], a[1]);
+        return true;
+    case OP_LCMP:
+        fprintf(out, "\tv%d = (v%d > v%d) - (v%d < v%d);\n", id, a[0], a[1], a[0], a[1]);
+        return true;
+    case OP_I2L:
+        fprintf(out, "\tv%d = v%d;\n", id, a[0]);
+        return true;
+    case OP_L2I:
+        fprintf(out, "\tv%d = (int32_t)(uint32_t)v%d;\n", id, a[0]);
+        return true;
+    case OP_INVOKESTATIC:
+        if (ir_is_value_of(v, 'I')) fprintf(out, "\tv%d = rt_str_int(v%d);\n", id, a[0]);
+        else if (ir_is_value_of(v, 'F')) fprintf(out, "\tv%d = rt_str_float(v%d);\n", id, a[0]);
+        else return false;
+        return true;
+    case OP_INVOKEVIRTUAL: {
+        bool ln = strcmp(v->sval, "java/io/PrintStream/println(Ljava/lang/String;)V") == 0;
+        if (!ln && strcmp(v->sval, "java/io/PrintStream/print(Ljava/lang/String;)V") != 0) return false;
+        const IrValue *s = &c->f->vals[a[1]];
+        if (c->fused[a[1]]) {
+            fprintf(out, "\trt_%s_%s(v%d);\n", ln ? "println" : "print",
+                    ir_is_value_of(s, 'I') ? "int" : "float", s->args[0]);
+        } else {
+            fprintf(out, "\trt_%s(v%d);\n", ln ? "println" : "print", a[1]);
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* Phi copies for the edge from -> to, read into temporaries first so the
+ * assignments act in parallel */
+static void emit_copies(CGen *c, int from, int to, const char *indent) {
+    const IrFunc *f = c->f;
+    const IrBlock *bb = &f->blocks[to];
+    int idx = 0;
+    while (bb->preds.v[idx] != from) idx++;
+    fprintf(c->out, "%s{\n", indent);
+    for (int k = 0; k < bb->phis.n; k++) {
+        int phi = bb->phis.v[k];
+        const IrValue *v = &f->vals[phi];
+        if (v->dead || v->args[idx] == phi) continue;
+        fprintf(c->out, "%s\t%s%st%d = v%d;\n", indent, c_type(v->type), c_space(v->type), k, v->args[idx]);
+    }
+    for (int k = 0; k < bb->phis.n; k++) {
+        int phi = bb->phis.v[k];
+        const IrValue *v = &f->vals[phi];
+        if (v->dead || v->args[idx] == phi) continue;
+        fprintf(c->out, "%s\tv%d = t%d;\n", indent, phi, k);
+    }
+    fprintf(c->out, "%s}\n", indent);
+}
+
+static void emit_jump(CGen *c, int from, int to, const char *indent) {
+    if (ir_has_copies(c->f, to)) emit_copies(c, from, to, indent);
+    fprintf(c->out, "%sgoto b%d;\n", indent, to);
+}
+
+static bool emit_function(CGen *c, const char *fname) {
+    IrFunc *f = c->f;
+    FILE *out = c->out;
+    fprintf(out, "\n%s %s(void) {\n", c->is_main ? "int" : "void", fname);
+    for (int v = 0; v < f->nvals; v++) {
+        const IrValue *x = &f->vals[v];
+        if (x->dead || x->type == IR_VOID || c->fused[v]) continue;
+        /* parameters are not supported; main's arguments are never read */
+        fprintf(out, "\t%s%sv%d%s;\n", c_type(x->type), c_space(x->type), v, x->kind == IR_ARG ? " = 0" : "");
+    }
+
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable) continue;
+        /* the entry block has no predecessors, so nothing jumps to it */
+        if (b > 0) fprintf(out, "b%d:\n", b);
+        for (int k = 0; k < bb->insns.n; k++) {
+            int id = bb->insns.v[k];
+            if (f->vals[id].dead) continue;
+            if (!emit_value(c, id)) return false;
+        }
+        const int *a = bb->term_args;
+        if (opcode_flags(bb->term) & OPF_END) {
+            fprintf(out, c->is_main ? "\trt_flush();\n\treturn 0;\n" : "\treturn;\n");
+            continue;
+        }
+        if (bb->term != OP_GOTO) {
+            if (bb->nterm_args == 2) fprintf(out, "\tif (v%d %s v%d) {\n", a[0], c_cond(bb->term), a[1]);
+            else fprintf(out, "\tif (v%d %s 0) {\n", a[0], c_cond(bb->term));
+            emit_jump(c, b, bb->succ[bb->nsucc - 1], "\t\t");
+            fprintf(out, "\t}\n");
+            if (bb->nsucc < 2) continue;
+        } else if (bb->nsucc == 0) {
+            continue;
+        }
+        emit_jump(c, b, bb->succ[0], "\t");
+    }
+    fprintf(out, "}\n");
+    return true;
+}
+
+void c_write_prelude(FILE *out) {
+    fprintf(out, "/* build with runtime.c: cc -O2 hw3.c runtime.c -lm */\n");
+    fprintf(out, "#include <math.h>\n#include <stdint.h>\n#include \"runtime.h\"\n");
+}
+
+bool c_write_method(FILE *out, Method *m) {
+    IrFunc f;
+    if (!ir_build(&f, m)) return false;
+
+    CGen c;
+    memset(&c, 0, sizeof(c));
+    c.out = out;
+    c.f = &f;
+    c.is_main = strncmp(m->name, "main(", 5) == 0;
+    c.fused = ir_fused_prints(&f);
+
+    /* main keeps its C name; other functions get a prefix */
+    char fname[128];
+    size_t n = strcspn(m->name, "(");
+    snprintf(fname, sizeof(fname), "%s%.*s", c.is_main ? "" : "rs_", (int)n, m->name);
+
+    bool ok = emit_function(&c, fname);
+    free(c.fused);
+    ir_free(&f);
+    return ok;
+}
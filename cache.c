@@ -0,0 +1,195 @@
+/* Content-addressed store on disk; see cache.h.
+ *
+ * An entry is the file <dir>/<FNV-1a of the key, in hex>: the magic
+ * "HW3CACHE", the key length and the key itself, the number of parts, and
+ * each part as its length and bytes; lengths are native u64. The key is
+ * compared in full on a hit, so two keys with one hash only cost a miss.
+ * A hit touches the file, and eviction removes the files touched least
+ * recently until the cache is down to three quarters of its limit. The
+ * directory is scanned at the first store of a process and then only once
+ * its stores since would take it over the limit, so that a compile storing
+ * each of many methods does not rescan it every time. Threads may share
+ * the cache. */
+#include "cache.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAGIC "HW3CACHE"
+
+typedef struct {
+    char name[32];
+    long size;
+    struct timespec mtime;
+} Entry;
+
+static char cache_dir[PATH_MAX];
+static long cache_max;
+static bool cache_ready;
+static long cache_known = -1;  /* bytes at the last scan plus the stores since; -1 before a scan */
+static long tmp_counter;
+
+static uint64_t fnv1a(const void *p, size_t n) {
+    const unsigned char *s = p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void entry_path(char *path, size_t size, const void *key, size_t key_len) {
+    snprintf(path, size, "%s/%016llx", cache_dir, (unsigned long long)fnv1a(key, key_len));
+}
+
+const char *cache_default_dir(void) {
+    static char dir[PATH_MAX];
+    if (getenv("HW3_CACHE_DIR"))
+        snprintf(dir, sizeof(dir), "%s", getenv("HW3_CACHE_DIR"));
+    else if (getenv("XDG_CACHE_HOME"))
+        snprintf(dir, sizeof(dir), "%s/hw3", getenv("XDG_CACHE_HOME"));
+    else if (getenv("HOME"))
+        snprintf(dir, sizeof(dir), "%s/.cache/hw3", getenv("HOME"));
+    else
+        snprintf(dir, sizeof(dir), "/tmp/hw3-cache-%d", (int)getuid());
+    return dir;
+}
+
+/* Creates dir and any missing parents */
+static bool make_dirs(const char *dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0777);
+        *p = '/';
+    }
+    return mkdir(path, 0777) == 0 || access(path, W_OK) == 0;
+}
+
+bool cache_open(const char *dir, long max_bytes) {
+    snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    cache_max = max_bytes;
+    cache_ready = make_dirs(cache_dir);
+    return cache_ready;
+}
+
+static bool take(const char **p, const char *end, void *out, size_t n) {
+    if ((size_t)(end - *p) < n) return false;
+    memcpy(out, *p, n);
+    *p += n;
+    return true;
+}
+
+bool cache_get(const void *key, size_t key_len, int nparts, char **parts, size_t *lens) {
+    if (!cache_ready) return false;
+    char path[PATH_MAX + 32];
+    entry_path(path, sizeof(path), key, key_len);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    char *buf = NULL;
+    bool hit = false;
+    if (fstat(fd, &st) == 0 && (buf = malloc(st.st_size + 1)) && read(fd, buf, st.st_size) == st.st_size) {
+        const char *p = buf, *end = buf + st.st_size;
+        char magic[8];
+        uint64_t n;
+        uint32_t np;
+        hit = take(&p, end, magic, 8) && memcmp(magic, MAGIC, 8) == 0 && take(&p, end, &n, sizeof(n)) &&
+              n == key_len && (size_t)(end - p) >= n && memcmp(p, key, n) == 0;
+        if (hit) p += n;
+        hit = hit && take(&p, end, &np, sizeof(np)) && (int)np == nparts;
+        int got = 0;
+        while (hit && got < nparts) {
+            hit = take(&p, end, &n, sizeof(n)) && (size_t)(end - p) >= n;
+            if (!hit) break;
+            parts[got] = malloc(n + 1);
+            memcpy(parts[got], p, n);
+            parts[got][n] = '\0';
+            lens[got++] = n;
+            p += n;
+        }
+        if (!hit) {
+            while (got > 0) free(parts[--got]);
+        }
+    }
+    close(fd);
+    free(buf);
+    if (hit) utimensat(AT_FDCWD, path, NULL, 0);
+    return hit;
+}
+
+static int by_mtime(const void *a, const void *b) {
+    const Entry *x = a, *y = b;
+    if (x->mtime.tv_sec != y->mtime.tv_sec) return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+    return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : x->mtime.tv_nsec > y->mtime.tv_nsec;
+}
+
+static void evict(void) {
+    DIR *d = opendir(cache_dir);
+    if (!d) return;
+    Entry *es = NULL;
+    int n = 0, cap = 0;
+    long total = 0;
+    for (struct dirent *de; (de = readdir(d));) {
+        char path[PATH_MAX + 300];
+        struct stat st;
+        if (strlen(de->d_name) != 16) continue;  /* entries only, not temporaries */
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (n == cap) es = realloc(es, (cap = cap ? cap * 2 : 64) * sizeof(Entry));
+        memcpy(es[n].name, de->d_name, 17);
+        es[n].size = st.st_size;
+        es[n].mtime = st.st_mtim;
+        total += es[n++].size;
+    }
+    closedir(d);
+    if (total > cache_max) {
+        qsort(es, n, sizeof(Entry), by_mtime);
+        for (int i = 0; i < n && total > cache_max / 4 * 3; i++) {
+            char path[PATH_MAX + 40];
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, es[i].name);
+            if (unlink(path) == 0) total -= es[i].size;
+        }
+    }
+    __atomic_store_n(&cache_known, total, __ATOMIC_RELAXED);
+    free(es);
+}
+
+void cache_put(const void *key, size_t key_len, int nparts, const char *const *parts, const size_t *lens) {
+    if (!cache_ready) return;
+    char path[PATH_MAX + 32], tmp[PATH_MAX + 64];
+    entry_path(path, sizeof(path), key, key_len);
+    snprintf(tmp, sizeof(tmp), "%s.%d.%ld.tmp", path, (int)getpid(),
+             __atomic_add_fetch(&tmp_counter, 1, __ATOMIC_RELAXED));
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return;
+    uint64_t n = key_len;
+    uint32_t np = nparts;
+    long size = 8 + sizeof(n) + key_len + sizeof(np);
+    fwrite(MAGIC, 1, 8, f);
+    fwrite(&n, sizeof(n), 1, f);
+    fwrite(key, 1, key_len, f);
+    fwrite(&np, sizeof(np), 1, f);
+    for (int i = 0; i < nparts; i++) {
+        n = lens[i];
+        fwrite(&n, sizeof(n), 1, f);
+        fwrite(parts[i], 1, lens[i], f);
+        size += sizeof(n) + lens[i];
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+    if (__atomic_load_n(&cache_known, __ATOMIC_RELAXED) < 0 ||
+        __atomic_add_fetch(&cache_known, size, __ATOMIC_RELAXED) > cache_max)
+        evict();
+}
@@ -0,0 +1,22 @@
+/* Content-addressed store on disk (cache.c), used by mycompiler --cache
+ * and testrunner -c. An entry is a few byte strings (parts) filed under a
+ * key, which can be any bytes: the source and everything else the result
+ * depends on. Entries are written whole or not at all, so processes can
+ * share a cache; the least recently used go once it outgrows its limit. */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CACHE_DEFAULT_MAX (64L << 20)
+
+/* $HW3_CACHE_DIR, else $XDG_CACHE_HOME/hw3, else ~/.cache/hw3 */
+const char *cache_default_dir(void);
+bool cache_open(const char *dir, long max_bytes);
+
+/* parts[i] are malloc'ed and NUL-terminated; false on a miss */
+bool cache_get(const void *key, size_t key_len, int nparts, char **parts, size_t *lens);
+void cache_put(const void *key, size_t key_len, int nparts, const char *const *parts, const size_t *lens);
+
+#endif /* CACHE_H */
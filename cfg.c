@@ -0,0 +1,268 @@
+/* Basic blocks, edges, dominators and loops over a buffered method */
+#include "compiler_common.h"
+
+static void add_pred(BasicBlock *b, int pred) {
+    b->preds = realloc(b->preds, (b->npreds + 1) * sizeof(int));
+    b->preds[b->npreds++] = pred;
+}
+
+void cfg_build(Cfg *g, Method *m) {
+    memset(g, 0, sizeof(*g));
+    g->m = m;
+    g->insn_block = malloc((m->len + 1) * sizeof(int));
+    g->label_block = malloc((m->nlabels + 1) * sizeof(int));
+    for (int i = 0; i < m->nlabels; i++) g->label_block[i] = -1;
+
+    /* A block starts at the method entry, at every label and right after
+     * every jump or return. */
+    bool *leader = calloc(m->len + 1, sizeof(bool));
+    leader[0] = true;
+    for (int i = 0; i < m->len; i++) {
+        const Insn *in = &m->code[i];
+        if (in->op == OP_LABEL) leader[i] = true;
+        if (insn_is_branch(in) || (opcode_flags(in->op) & OPF_END)) leader[i + 1] = true;
+    }
+    int cap = 0;
+    for (int i = 0; i < m->len; i++) cap += leader[i];
+    g->blocks = calloc(cap ? cap : 1, sizeof(BasicBlock));
+    for (int i = 0; i < m->len; i++) {
+        if (leader[i]) {
+            BasicBlock *b = &g->blocks[g->nblocks++];
+            b->start = i;
+            if (g->nblocks > 1) g->blocks[g->nblocks - 2].end = i;
+        }
+        g->insn_block[i] = g->nblocks - 1;
+        if (m->code[i].op == OP_LABEL && g->label_block[m->code[i].ival] < 0)
+            g->label_block[m->code[i].ival] = g->nblocks - 1;
+    }
+    if (g->nblocks > 0) g->blocks[g->nblocks - 1].end = m->len;
+    free(leader);
+
+    for (int b = 0; b < g->nblocks; b++) {
+        BasicBlock *bb = &g->blocks[b];
+        const Insn *last = &m->code[bb->end - 1];
+        int flags = opcode_flags(last->op);
+        /* A jump to a label that is never placed has no successor */
+        if (flags & OPF_JUMP) {
+            if (g->label_block[last->ival] >= 0) bb->succ[bb->nsucc++] = g->label_block[last->ival];
+        } else if (!(flags & OPF_END)) {
+            if (b + 1 < g->nblocks) bb->succ[bb->nsucc++] = b + 1;
+            if ((flags & OPF_BRANCH) && g->label_block[last->ival] >= 0)
+                bb->succ[bb->nsucc++] = g->label_block[last->ival];
+        }
+        for (int s = 0; s < bb->nsucc; s++) add_pred(&g->blocks[bb->succ[s]], b);
+    }
+
+    /* Reachability from the entry block */
+    if (g->nblocks == 0) return;
+    int *stack = malloc(g->nblocks * sizeof(int));
+    int sp = 0;
+    stack[sp++] = 0;
+    g->blocks[0].reachable = true;
+    while (sp > 0) {
+        BasicBlock *bb = &g->blocks[stack[--sp]];
+        for (int s = 0; s < bb->nsucc; s++) {
+            BasicBlock *succ = &g->blocks[bb->succ[s]];
+            if (!succ->reachable) {
+                succ->reachable = true;
+                stack[sp++] = bb->succ[s];
+            }
+        }
+    }
+    free(stack);
+}
+
+void cfg_free(Cfg *g) {
+    for (int b = 0; b < g->nblocks; b++) free(g->blocks[b].preds);
+    for (int l = 0; l < g->nloops; l++) free(g->loops[l].body);
+    free(g->blocks);
+    free(g->label_block);
+    free(g->insn_block);
+    free(g->idom);
+    free(g->rpo);
+    free(g->loops);
+    memset(g, 0, sizeof(*g));
+}
+
+static void postorder(Cfg *g, int b, bool *seen, int *order, int *n) {
+    seen[b] = true;
+    for (int s = 0; s < g->blocks[b].nsucc; s++) {
+        if (!seen[g->blocks[b].succ[s]]) postorder(g, g->blocks[b].succ[s], seen, order, n);
+    }
+    order[(*n)++] = b;
+}
+
+static int intersect(const Cfg *g, const int *rpo_index, int a, int b) {
+    while (a != b) {
+        while (rpo_index[a] > rpo_index[b]) a = g->idom[a];
+        while (rpo_index[b] > rpo_index[a]) b = g->idom[b];
+    }
+    return a;
+}
+
+bool cfg_dominates(const Cfg *g, int a, int b) {
+    while (b >= 0) {
+        if (a == b) return true;
+        if (g->idom[b] == b) return false;
+        b = g->idom[b];
+    }
+    return false;
+}
+
+/* Dominators (Cooper, Harvey and Kennedy) and natural loops. Back edges
+ * into the same header form one loop; nesting follows block sets. */
+void cfg_find_loops(Cfg *g) {
+    int n = g->nblocks;
+    if (n == 0) return;
+    bool *seen = calloc(n, sizeof(bool));
+    int *order = malloc(n * sizeof(int));
+    int *rpo_index = malloc(n * sizeof(int));
+    int cnt = 0;
+    postorder(g, 0, seen, order, &cnt);
+    g->rpo = malloc(n * sizeof(int));
+    g->nrpo = cnt;
+    for (int k = 0; k < cnt; k++) g->rpo[k] = order[cnt - 1 - k];
+    for (int b = 0; b < n; b++) rpo_index[b] = n;
+    for (int k = 0; k < cnt; k++) rpo_index[g->rpo[k]] = k;
+
+    g->idom = malloc(n * sizeof(int));
+    for (int b = 0; b < n; b++) g->idom[b] = -1;
+    g->idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int k = 1; k < cnt; k++) {
+            int b = g->rpo[k], nd = -1;
+            for (int p = 0; p < g->blocks[b].npreds; p++) {
+                int pred = g->blocks[b].preds[p];
+                if (g->idom[pred] < 0) continue;
+                nd = nd < 0 ? pred : intersect(g, rpo_index, pred, nd);
+            }
+            if (nd != g->idom[b]) {
+                g->idom[b] = nd;
+                changed = true;
+            }
+        }
+    }
+
+    int *stack = malloc(n * sizeof(int));
+    for (int t = 0; t < n; t++) {
+        if (g->idom[t] < 0) continue;
+        for (int s = 0; s < g->blocks[t].nsucc; s++) {
+            int h = g->blocks[t].succ[s];
+            if (!cfg_dominates(g, h, t)) continue;
+            int l = 0;
+            while (l < g->nloops && g->loops[l].header != h) l++;
+            if (l == g->nloops) {
+                g->loops = realloc(g->loops, (g->nloops + 1) * sizeof(Loop));
+                g->loops[l].header = h;
+                g->loops[l].body = calloc(n, sizeof(bool));
+                g->loops[l].body[h] = true;
+                g->nloops++;
+            }
+            bool *body = g->loops[l].body;
+            int sp = 0;
+            if (!body[t]) {
+                body[t] = true;
+                stack[sp++] = t;
+            }
+            while (sp > 0) {
+                int b = stack[--sp];
+                for (int p = 0; p < g->blocks[b].npreds; p++) {
+                    int pred = g->blocks[b].preds[p];
+                    if (!body[pred] && g->idom[pred] >= 0) {
+                        body[pred] = true;
+                        stack[sp++] = pred;
+                    }
+                }
+            }
+        }
+    }
+    free(stack);
+
+    /* parent = smallest other loop containing the header */
+    for (int l = 0; l < g->nloops; l++) {
+        int best = -1, best_size = n + 1;
+        for (int o = 0; o < g->nloops; o++) {
+            if (o == l || !g->loops[o].body[g->loops[l].header]) continue;
+            int size = 0;
+            for (int b = 0; b < n; b++) size += g->loops[o].body[b];
+            if (size < best_size && !(g->loops[o].header == g->loops[l].header)) {
+                best = o;
+                best_size = size;
+            }
+        }
+        g->loops[l].parent = best;
+    }
+    for (int l = 0; l < g->nloops; l++) {
+        int d = 1;
+        for (int p = g->loops[l].parent; p >= 0; p = g->loops[p].parent) d++;
+        g->loops[l].depth = d;
+    }
+    free(seen);
+    free(order);
+    free(rpo_index);
+}
+
+/* Operand stack depth at the start of every reachable block, in values.
+ * Returns the largest depth seen, or -1 if two paths disagree. Unreached
+ * blocks get -1. */
+int cfg_stack_depths(Cfg *g, int *entry_depth) {
+    int max = 0;
+    for (int b = 0; b < g->nblocks; b++) entry_depth[b] = -1;
+    if (g->nblocks == 0) return 0;
+    int *work = malloc(g->nblocks * sizeof(int));
+    int n = 0;
+    entry_depth[0] = 0;
+    work[n++] = 0;
+    while (n > 0) {
+        int b = work[--n];
+        BasicBlock *bb = &g->blocks[b];
+        int depth = entry_depth[b];
+        for (int i = bb->start; i < bb->end; i++) {
+            const Insn *in = &g->m->code[i];
+            depth -= insn_pops(in);
+            if (depth < 0) {
+                free(work);
+                return -1;
+            }
+            depth += insn_pushes(in);
+            if (depth > max) max = depth;
+        }
+        for (int s = 0; s < bb->nsucc; s++) {
+            int t = bb->succ[s];
+            if (entry_depth[t] < 0) {
+                entry_depth[t] = depth;
+                work[n++] = t;
+            } else if (entry_depth[t] != depth) {
+                free(work);
+                return -1;
+            }
+        }
+    }
+    free(work);
+    return max;
+}
+
+/* Instruction index of the header label when a preheader can go right in
+ * front of it, -1 when a block of the loop falls through into that spot */
+int cfg_preheader_at(const Cfg *g, const Loop *lp) {
+    const Method *m = g->m;
+    int h = lp->header, head = g->blocks[h].start;
+    if (h == 0 || m->code[head].op != OP_LABEL) return -1;
+    const BasicBlock *prev = &g->blocks[h - 1];
+    if (lp->body[h - 1] && prev->end > prev->start &&
+        !(opcode_flags(m->code[prev->end - 1].op) & (OPF_JUMP | OPF_END)))
+        return -1;
+    return head;
+}
+
+/* Branches from outside the loop enter through label instead */
+void cfg_redirect_entries(Cfg *g, const Loop *lp, int label) {
+    int hdr = g->m->code[g->blocks[lp->header].start].ival;
+    for (int b = 0; b < g->nblocks; b++) {
+        if (lp->body[b] || g->blocks[b].end == g->blocks[b].start) continue;
+        Insn *last = &g->m->code[g->blocks[b].end - 1];
+        if (insn_is_branch(last) && last->ival == hdr) last->ival = label;
+    }
+}
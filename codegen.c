@@ -0,0 +1,605 @@
+/* Method code buffer: CODEGEN output inside a method body is parsed into
+ * instructions, optimized as a whole and written out at the method end. */
+#include "compiler_common.h"
+#include "cache.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+typedef struct {
+    const char *mnemonic;
+    int pops, pushes, flags;
+} OpInfo;
+
+static const OpInfo op_info[OP_COUNT] = {
+#define X(name, mnem, pops, pushes, flags) { mnem, pops, pushes, flags },
+    OPCODE_LIST(X)
+#undef X
+};
+
+static Method cur_method;
+static bool in_method = false;
+
+const char *opcode_name(Opcode op) {
+    return op_info[op].mnemonic;
+}
+
+int opcode_flags(Opcode op) {
+    return op_info[op].flags;
+}
+
+/* Number of argument values in a descriptor such as "(IF)V", plus whether
+ * it returns a value. */
+static int descriptor_args(const char *ref, bool *returns) {
+    const char *p = strchr(ref, '(');
+    int n = 0;
+    *returns = false;
+    if (!p) return 0;
+    for (p++; *p && *p != ')'; p++) {
+        while (*p == '[') p++;
+        if (*p == 'L') {
+            while (*p && *p != ';') p++;
+        }
+        n++;
+    }
+    if (*p == ')') *returns = p[1] != 'V';
+    return n;
+}
+
+int insn_pops(const Insn *in) {
+    bool ret;
+    switch (in->op) {
+    case OP_INVOKESTATIC:
+        return descriptor_args(in->sval, &ret);
+    case OP_INVOKEVIRTUAL:
+        return descriptor_args(in->sval, &ret) + 1;
+    default:
+        return op_info[in->op].pops;
+    }
+}
+
+int insn_pushes(const Insn *in) {
+    bool ret;
+    switch (in->op) {
+    case OP_INVOKESTATIC:
+    case OP_INVOKEVIRTUAL:
+        descriptor_args(in->sval, &ret);
+        return ret ? 1 : 0;
+    default:
+        return op_info[in->op].pushes;
+    }
+}
+
+/* True if instruction i can be deleted when its result is unused. Division
+ * only qualifies when the divisor right before it is a non-zero constant. */
+bool insn_is_pure(const Method *m, int i) {
+    const Insn *in = &m->code[i];
+    if (op_info[in->op].flags & OPF_PURE) return true;
+    switch (in->op) {
+    case OP_INVOKESTATIC:
+        return strncmp(in->sval, "java/lang/String/valueOf(", 25) == 0;
+    case OP_IDIV:
+    case OP_IREM:
+        return i > 0 && m->code[i - 1].op == OP_ICONST && m->code[i - 1].ival != 0;
+    default:
+        return false;
+    }
+}
+
+bool insn_is_branch(const Insn *in) {
+    return (op_info[in->op].flags & (OPF_BRANCH | OPF_JUMP)) != 0;
+}
+
+/* Type of the value a single-push instruction leaves on the stack */
+bool opcode_yields_float(Opcode op) {
+    switch (op) {
+    case OP_FCONST: case OP_FLOAD: case OP_FADD: case OP_FSUB: case OP_FMUL:
+    case OP_FDIV: case OP_FNEG: case OP_I2F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static Insn *method_push(Method *m) {
+    if (m->len == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 64;
+        m->code = realloc(m->code, m->cap * sizeof(Insn));
+    }
+    Insn *in = &m->code[m->len++];
+    memset(in, 0, sizeof(*in));
+    in->lineno = yylineno;
+    return in;
+}
+
+Insn *method_insert(Method *m, int at, Opcode op, int ival) {
+    method_push(m);
+    memmove(&m->code[at + 1], &m->code[at], (m->len - 1 - at) * sizeof(Insn));
+    Insn *in = &m->code[at];
+    memset(in, 0, sizeof(*in));
+    in->op = op;
+    in->ival = ival;
+    if (at + 1 < m->len) in->lineno = m->code[at + 1].lineno;
+    return in;
+}
+
+static int intern_label(Method *m, const char *name) {
+    for (int i = 0; i < m->nlabels; i++) {
+        if (strcmp(m->labels[i], name) == 0) return i;
+    }
+    if (m->nlabels == m->labels_cap) {
+        m->labels_cap = m->labels_cap ? m->labels_cap * 2 : 32;
+        m->labels = realloc(m->labels, m->labels_cap * sizeof(char *));
+    }
+    m->labels[m->nlabels] = strdup(name);
+    return m->nlabels++;
+}
+
+/* Labels made by the optimizer; the "L_opt_" prefix keeps them apart from
+ * the parser's L_if_/L_end_/... names. */
+int method_new_label(Method *m, const char *prefix) {
+    char name[64];
+    snprintf(name, sizeof(name), "L_opt_%s_%d", prefix, m->nlabels);
+    return intern_label(m, name);
+}
+
+int method_new_local(Method *m) {
+    return m->next_local++;
+}
+
+/* Drops NOPs left behind by the passes */
+void method_compact(Method *m) {
+    int j = 0;
+    for (int i = 0; i < m->len; i++) {
+        if (m->code[i].op != OP_NOP)
+            m->code[j++] = m->code[i];
+        else
+            free(m->code[i].sval);
+    }
+    m->len = j;
+}
+
+static void note_local(Method *m, int slot) {
+    if (slot + 1 > m->next_local) m->next_local = slot + 1;
+}
+
+/* Decodes the escapes of a Jasmin string literal into UTF-8 bytes. The
+ * result is NUL-terminated and malloc'ed; *len gets its length. */
+char *string_unescape(const char *s, size_t *len) {
+    char *out = malloc(strlen(s) * 3 + 1);
+    size_t n = 0;
+    while (*s) {
+        if (*s != '\\' || !s[1]) {
+            out[n++] = *s++;
+            continue;
+        }
+        s++;
+        switch (*s) {
+        case 'n': out[n++] = '\n'; break;
+        case 't': out[n++] = '\t'; break;
+        case 'r': out[n++] = '\r'; break;
+        case 'b': out[n++] = '\b'; break;
+        case 'f': out[n++] = '\f'; break;
+        case '0': out[n++] = '\0'; break;
+        case 'u': {
+            unsigned c = 0;
+            int k;
+            for (k = 1; k <= 4 && isxdigit((unsigned char)s[k]); k++)
+                c = c * 16 + (isdigit((unsigned char)s[k]) ? s[k] - '0' : (tolower(s[k]) - 'a' + 10));
+            if (c < 0x80) {
+                out[n++] = c;
+            } else if (c < 0x800) {
+                out[n++] = 0xc0 | (c >> 6);
+                out[n++] = 0x80 | (c & 0x3f);
+            } else {
+                out[n++] = 0xe0 | (c >> 12);
+                out[n++] = 0x80 | ((c >> 6) & 0x3f);
+                out[n++] = 0x80 | (c & 0x3f);
+            }
+            s += k - 1;
+            break;
+        }
+        default: out[n++] = *s; break;
+        }
+        s++;
+    }
+    out[n] = '\0';
+    if (len) *len = n;
+    return out;
+}
+
+/* Parses one line of Jasmin text into an instruction. Anything the
+ * optimizer does not know is kept as RAW text. The line is trimmed in
+ * place, and its argument is used where it lies, however long. */
+static void parse_line(Method *m, char *line) {
+    char mnem[32];
+    while (isspace((unsigned char)*line)) line++;
+    size_t n = strlen(line);
+    while (n > 0 && isspace((unsigned char)line[n - 1])) n--;
+    if (n == 0) return;
+    line[n] = '\0';
+
+    if (line[n - 1] == ':') {
+        line[n - 1] = '\0';
+        Insn *in = method_push(m);
+        in->op = OP_LABEL;
+        in->ival = intern_label(m, line);
+        return;
+    }
+
+    size_t k = 0;
+    while (k < n && !isspace((unsigned char)line[k]) && k < sizeof(mnem) - 1) {
+        mnem[k] = line[k];
+        k++;
+    }
+    mnem[k] = '\0';
+    while (k < n && isspace((unsigned char)line[k])) k++;
+    const char *arg = line + k;
+
+    Insn *in = method_push(m);
+    if (strncmp(mnem, "iconst_", 7) == 0) {
+        in->op = OP_ICONST;
+        in->ival = strcmp(mnem + 7, "m1") == 0 ? -1 : atoi(mnem + 7);
+        return;
+    }
+    if (strcmp(mnem, "ldc") == 0) {
+        if (arg[0] == '"') {
+            in->op = OP_SCONST;
+            in->sval = strndup(arg + 1, strlen(arg) - 2);
+        } else if (strpbrk(arg, ".eE")) {
+            in->op = OP_FCONST;
+            in->fval = strtof(arg, NULL);
+        } else {
+            in->op = OP_ICONST;
+            in->ival = (int)strtol(arg, NULL, 10);
+        }
+        return;
+    }
+    for (int op = OP_ILOAD; op < OP_RAW; op++) {
+        if (strcmp(mnem, op_info[op].mnemonic) != 0) continue;
+        in->op = op;
+        if (op_info[op].flags & (OPF_BRANCH | OPF_JUMP)) {
+            in->ival = intern_label(m, arg);
+        } else if (op == OP_GETSTATIC || op == OP_INVOKESTATIC || op == OP_INVOKEVIRTUAL) {
+            in->sval = strdup(arg);
+        } else if (arg[0]) {
+            in->ival = atoi(arg);
+            note_local(m, in->ival);
+        }
+        return;
+    }
+    in->op = OP_RAW;
+    in->sval = strndup(line, n);
+}
+
+/* Shortest decimal text that reads back as the same float. Always has a
+ * '.' so Jasmin treats it as a float constant. */
+void format_float(float f, char *buf, size_t size) {
+    for (int prec = 1; prec <= 60; prec++) {
+        snprintf(buf, size, "%.*f", prec, f);
+        if (strtof(buf, NULL) == f) break;
+    }
+    char *end = buf + strlen(buf) - 1;
+    while (end > buf && *end == '0' && end[-1] != '.') *end-- = '\0';
+}
+
+static void write_insn(FILE *out, const Method *m, const Insn *in) {
+    char buf[96];
+    switch (in->op) {
+    case OP_NOP:
+        return;
+    case OP_LABEL:
+        fprintf(out, "\t%s:\n", m->labels[in->ival]);
+        return;
+    case OP_ICONST:
+        if (in->ival == -1)
+            fprintf(out, "\ticonst_m1\n");
+        else if (in->ival >= 0 && in->ival <= 5)
+            fprintf(out, "\ticonst_%d\n", in->ival);
+        else if (in->ival >= -128 && in->ival <= 127)
+            fprintf(out, "\tbipush %d\n", in->ival);
+        else if (in->ival >= -32768 && in->ival <= 32767)
+            fprintf(out, "\tsipush %d\n", in->ival);
+        else
+            fprintf(out, "\tldc %d\n", in->ival);
+        return;
+    case OP_FCONST:
+        format_float(in->fval, buf, sizeof(buf));
+        fprintf(out, "\tldc %s\n", buf);
+        return;
+    case OP_SCONST:
+        fprintf(out, "\tldc \"%s\"\n", in->sval);
+        return;
+    case OP_LCONST:
+        fprintf(out, "\tlconst_%d\n", in->ival);
+        return;
+    case OP_RAW:
+        fprintf(out, "\t%s\n", in->sval);
+        return;
+    default:
+        break;
+    }
+    if (insn_is_branch(in))
+        fprintf(out, "\t%s %s\n", op_info[in->op].mnemonic, m->labels[in->ival]);
+    else if (in->sval)
+        fprintf(out, "\t%s %s\n", op_info[in->op].mnemonic, in->sval);
+    else if (op_info[in->op].flags & OPF_STORE || (in->op >= OP_ILOAD && in->op <= OP_LLOAD))
+        fprintf(out, "\t%s %d\n", op_info[in->op].mnemonic, in->ival);
+    else
+        fprintf(out, "\t%s\n", op_info[in->op].mnemonic);
+}
+
+static void method_write(FILE *out, const Method *m) {
+    int locals = m->next_local > 100 ? m->next_local : 100;
+    fprintf(out, "\n.method public static %s\n", m->name);
+    fprintf(out, ".limit stack 100\n");
+    fprintf(out, ".limit locals %d\n", locals);
+    for (int i = 0; i < m->len; i++) {
+        write_insn(out, m, &m->code[i]);
+    }
+    fprintf(out, ".end method\n");
+}
+
+static void method_free(Method *m) {
+    for (int i = 0; i < m->len; i++) free(m->code[i].sval);
+    for (int i = 0; i < m->nlabels; i++) free(m->labels[i]);
+    for (int i = 0; i < m->nslot_names; i++) free(m->slot_names[i]);
+    free(m->code);
+    free(m->labels);
+    free(m->slot_names);
+    free(m->name);
+    memset(m, 0, sizeof(*m));
+}
+
+void method_begin(const char *name) {
+    memset(&cur_method, 0, sizeof(cur_method));
+    cur_method.name = strdup(name);
+    in_method = true;
+}
+
+/* Records the source name of a variable slot for error messages */
+void method_name_local(int slot, const char *name) {
+    Method *m = &cur_method;
+    if (!in_method || slot < 0) return;
+    if (slot >= m->nslot_names) {
+        m->slot_names = realloc(m->slot_names, (slot + 1) * sizeof(char *));
+        memset(m->slot_names + m->nslot_names, 0, (slot + 1 - m->nslot_names) * sizeof(char *));
+        m->nslot_names = slot + 1;
+    }
+    free(m->slot_names[slot]);
+    m->slot_names[slot] = strdup(name);
+}
+
+/* Checks, optimizes and writes out one method. Diagnostics go to msgs and
+ * use lineno, where the method ended; false if there were any. */
+static bool method_compile(Method *m, int lineno, FILE *out, FILE *msgs) {
+    bool ok = true;
+    trace_begin(m->name);
+    phase_begin("check");
+    if (report_uninitialized(m, msgs)) ok = false;
+    phase_end();
+    phase_begin("optimize");
+    optimize_method(m);
+    phase_end();
+    if (g_opt.peval_fuel > 0 && strncmp(m->name, "main(", 5) == 0) {
+        phase_begin("partial-eval");
+        partial_eval(m, g_opt.peval_fuel);
+        phase_end();
+    }
+    phase_begin("emit");
+    if (g_opt.run && strncmp(m->name, "main(", 5) == 0 && !vm_load(m)) {
+        fprintf(msgs, "error:%d: `%s` cannot be run\n", lineno, m->name);
+        ok = false;
+    }
+    if (g_opt.emit == EMIT_X86) {
+        if (!x86_write_method(out, m)) {
+            fprintf(msgs, "error:%d: `%s` cannot be compiled to x86-64\n", lineno, m->name);
+            ok = false;
+        }
+    } else if (g_opt.emit == EMIT_C) {
+        if (!c_write_method(out, m)) {
+            fprintf(msgs, "error:%d: `%s` cannot be compiled to C\n", lineno, m->name);
+            ok = false;
+        }
+    } else {
+        method_write(out, m);
+    }
+    phase_end();
+    trace_counter("heap bytes", heap_in_use());
+    trace_counter("method instructions", m->len);
+    trace_end();
+    method_free(m);
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* Methods from the cache (--cache)                                    */
+/* ------------------------------------------------------------------ */
+
+/* A file the cache has not seen whole is compiled through it method by
+ * method. A method's key is its code as the parser left it, before any
+ * check or optimization, and its entry is the text method_compile wrote.
+ * The language has no calls and no globals, and the parser numbers labels
+ * and locals per method, so nothing outside a method shapes its code: each
+ * method is keyed on its own code alone, an edit recompiles only the
+ * functions it touched, and the rest is copied. Line numbers are not part
+ * of the key, so a function that only moved keeps its entry; diagnostics
+ * carry them, so methods with any are not stored.
+ * Neither is main under --run, whose compile loads it into the VM. */
+static const char *method_cache;  /* start of every key, NULL when off */
+static size_t method_cache_len;
+
+void codegen_cache(const char *context, size_t len) {
+    method_cache = context;
+    method_cache_len = len;
+}
+
+static char *method_key(const Method *m, size_t *len) {
+    char *key;
+    FILE *f = open_memstream(&key, len);
+    fwrite(method_cache, 1, method_cache_len, f);
+    fprintf(f, "method %s\n%d %d\n", m->name, m->next_local, m->nlabels);
+    for (int i = 0; i < m->nlabels; i++) fprintf(f, "%s\n", m->labels[i]);
+    for (int i = 0; i < m->len; i++) {
+        const Insn *in = &m->code[i];
+        uint32_t bits;
+        memcpy(&bits, &in->fval, sizeof(bits));
+        size_t n = in->sval ? strlen(in->sval) : 0;
+        fprintf(f, "%d %d %x %zu:", in->op, in->ival, bits, n);
+        fwrite(in->sval ? in->sval : "", 1, n, f);
+    }
+    fclose(f);
+    return key;
+}
+
+static bool method_compile_cached(Method *m, int lineno, FILE *out, FILE *msgs) {
+    if (!method_cache || (g_opt.run && strncmp(m->name, "main(", 5) == 0))
+        return method_compile(m, lineno, out, msgs);
+    size_t key_len, text_len, errs_len;
+    char *key = method_key(m, &key_len), *text, *errs;
+    if (cache_get(key, key_len, 1, &text, &text_len)) {
+        fwrite(text, 1, text_len, out);
+        free(text);
+        free(key);
+        method_free(m);
+        return true;
+    }
+    FILE *text_out = open_memstream(&text, &text_len);
+    FILE *errs_out = open_memstream(&errs, &errs_len);
+    bool ok = method_compile(m, lineno, text_out, errs_out);
+    fclose(text_out);
+    fclose(errs_out);
+    if (ok && errs_len == 0) cache_put(key, key_len, 1, (const char *const *)&text, &text_len);
+    fwrite(text, 1, text_len, out);
+    fwrite(errs, 1, errs_len, msgs);
+    free(text);
+    free(errs);
+    free(key);
+    return ok;
+}
+
+/* ------------------------------------------------------------------ */
+/* Methods on several threads (--threads=<n>)                          */
+/* ------------------------------------------------------------------ */
+
+/* With more than one thread, finished methods and the class-level text
+ * between them are kept as units in source order. codegen_finish compiles
+ * the methods on the thread pool, each into its own output and diagnostic
+ * buffers, and then writes the buffers out in that order; so the file is
+ * the same for any number of threads. Diagnostics of the methods come
+ * after the parser's. */
+typedef struct {
+    Method m;        /* name is NULL for class-level text */
+    int lineno;
+    char *out;       /* the text, or the method's code once compiled */
+    size_t out_len;
+    char *msgs;
+    size_t msgs_len;
+    bool ok;
+} Unit;
+
+static Unit *units;
+static int nunits, units_cap;
+static FILE *text_out;  /* class-level text since the last method */
+
+static Unit *unit_push(void) {
+    if (nunits == units_cap) {
+        units_cap = units_cap ? units_cap * 2 : 64;
+        units = realloc(units, units_cap * sizeof(Unit));
+    }
+    Unit *u = &units[nunits++];
+    memset(u, 0, sizeof(*u));
+    u->ok = true;
+    return u;
+}
+
+static void text_close(void) {
+    if (text_out) fclose(text_out);
+    text_out = NULL;
+}
+
+static void compile_unit(int i, void *ctx) {
+    Unit *u = &units[i];
+    if (!u->m.name) return;
+    FILE *out = open_memstream(&u->out, &u->out_len);
+    FILE *msgs = open_memstream(&u->msgs, &u->msgs_len);
+    u->ok = method_compile_cached(&u->m, u->lineno, out, msgs);
+    fclose(out);
+    fclose(msgs);
+}
+
+static void units_free(void) {
+    text_close();
+    for (int i = 0; i < nunits; i++) {
+        if (units[i].m.name) method_free(&units[i].m);
+        free(units[i].out);
+        free(units[i].msgs);
+    }
+    free(units);
+    units = NULL;
+    nunits = units_cap = 0;
+}
+
+/* Drops a method a syntax error left open, before the next file */
+void codegen_reset(void) {
+    if (in_method) method_free(&cur_method);
+    in_method = false;
+    units_free();
+}
+
+/* Compiles the methods kept since the file began and writes them out */
+void codegen_finish(void) {
+    text_close();
+    pool_for(nunits, g_opt.threads, compile_unit, NULL);
+    for (int i = 0; i < nunits; i++) {
+        const Unit *u = &units[i];
+        if (u->out_len) fwrite(u->out, 1, u->out_len, fout);
+        if (u->msgs_len) fwrite(u->msgs, 1, u->msgs_len, stdout);
+        if (!u->ok) g_has_error = true;
+    }
+    units_free();
+}
+
+void method_end(void) {
+    in_method = false;
+    if (g_opt.threads > 1) {
+        text_close();
+        Unit *u = unit_push();
+        u->m = cur_method;
+        u->lineno = yylineno;
+        memset(&cur_method, 0, sizeof(cur_method));
+        return;
+    }
+    if (!method_compile_cached(&cur_method, yylineno, fout, stdout)) g_has_error = true;
+}
+
+void code_emit(const char *fmt, ...) {
+    /* sized from the text, so a long string literal stays whole */
+    va_list ap, again;
+    va_start(ap, fmt);
+    va_copy(again, ap);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *line = malloc(len + 1);
+    vsnprintf(line, len + 1, fmt, again);
+    va_end(again);
+
+    if (in_method) {
+        parse_line(&cur_method, line);
+    } else if (g_opt.emit == EMIT_JASMIN) {
+        /* class-level Jasmin directives mean nothing to the native backend */
+        FILE *out = fout;
+        if (g_opt.threads > 1) {
+            if (!text_out) {
+                Unit *u = unit_push();
+                text_out = open_memstream(&u->out, &u->out_len);
+            }
+            out = text_out;
+        }
+        for (int i = 0; i < g_indent_cnt; i++) {
+            fprintf(out, "\t");
+        }
+        fputs(line, out);
+    }
+    free(line);
+}
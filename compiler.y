@@ -4,10 +4,14 @@
 /* Definition section */
 %{
     #include "compiler_common.h" //Extern variables that communicate with lex
+    #include "cache.h"
+    #include <ctype.h>
+    #include <stdarg.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
     // #define YYDEBUG 1
     // int yydebug = 1;
 
-    #define MAX_SYMBOLS 256
     #define MAX_SCOPE 10
 
     typedef struct {
@@ -20,64 +24,71 @@
     } Symbol;
 
     typedef struct {
-        Symbol symbols[MAX_SYMBOLS];
-        int count;
+        Symbol *symbols;  /* grows; kept for the next scope at this level */
+        int count, cap;
         int level;
     } Scope;
 
-    static Scope scope_stack[MAX_SCOPE];
-    static int scope_top = -1;
-    static int addr_counter = 0;
+    /* The parser's scope state for one file, passed to it as ps. Only this
+     * moved out of globals: the scanner (yyin, yylineno), the globals
+     * below and codegen.c's method buffer are still shared, so the front
+     * end compiles one file at a time per process. */
+    struct ParseState {
+        Scope scopes[MAX_SCOPE];
+        int scope_top;
+        int addr_counter;
+        int label_id;
+        bool has_error;
+    };
 
     extern int yylineno;
-    extern int yylex();
     extern FILE *yyin;
 
     int yylex_destroy ();
-    void yyerror (char const *s)
+    void yyerror (ParseState *ps, char const *s)
     {
         printf("error:%d: %s\n", yylineno, s);
     }
 
-    extern int yylineno;
-    extern int yylex();
-    extern FILE *yyin;
-
     /* Used to generate code */
     /* As printf; the usage: CODEGEN("%d - %s\n", 100, "Hello world"); */
-    /* We do not enforce the use of this macro */
-    #define CODEGEN(...) \
-        do { \
-            for (int i = 0; i < g_indent_cnt; i++) { \
-                fprintf(fout, "\t"); \
-            } \
-            fprintf(fout, __VA_ARGS__); \
-        } while (0)
+    /* Inside a method body the line is buffered and optimized (codegen.c) */
+    #define CODEGEN(...) code_emit(__VA_ARGS__)
 
     /* Symbol table function - you can add new functions if needed. */
     /* parameters and return type can be changed */
-    static void create_symbol();
-    static void init_symbol();
-    static int insert_symbol(const char *name, const char *type, int addr, int lineno, const char *sig);
-    static int lookup_symbol(const char *name);
-    static void dump_symbol();
-    static int next_addr();
-    static int get_scope_level();
-    static const char* get_symbol_type(const char *name);
+    static void create_symbol(ParseState *ps);
+    static void init_symbol(ParseState *ps);
+    static void free_symbols(ParseState *ps);
+    static int insert_symbol(ParseState *ps, const char *name, const char *type, int addr, int lineno, const char *sig);
+    static int lookup_symbol(ParseState *ps, const char *name);
+    static void dump_symbol(ParseState *ps);
+    static int next_addr(ParseState *ps);
+    static int get_scope_level(ParseState *ps);
+    static const char* get_symbol_type(ParseState *ps, const char *name);
+    static void trace_symbols(ParseState *ps);
 
     /* Global variables */
     bool g_has_error = false;
     FILE *fout = NULL;
     int g_indent_cnt = 0;
-    bool HAS_ERROR = false;
-    static int label_id = 0;
-    int last_if_id;
-
-    int is_mutable(const char* name) {
-        for (int i = scope_top; i >= 0; --i) {
-            for (int j = 0; j < scope_stack[i].count; ++j) {
-                if (strcmp(scope_stack[i].symbols[j].name, name) == 0) {
-                    return scope_stack[i].symbols[j].mut;
+
+    /* Reports an error in the source at the current line; the file then
+     * counts as failed, for the exit status of a batch and the cache */
+    static void compile_error(ParseState *ps, const char *fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        printf("error:%d: ", yylineno);
+        vprintf(fmt, ap);
+        va_end(ap);
+        ps->has_error = true;
+    }
+
+    int is_mutable(ParseState *ps, const char* name) {
+        for (int i = ps->scope_top; i >= 0; --i) {
+            for (int j = 0; j < ps->scopes[i].count; ++j) {
+                if (strcmp(ps->scopes[i].symbols[j].name, name) == 0) {
+                    return ps->scopes[i].symbols[j].mut;
                 }
             }
         }
@@ -85,6 +96,8 @@
     }
 %}
 
+%define api.pure full
+%parse-param {ParseState *ps}
 %define parse.error verbose
 
 /* Use variable or self-defined structure to represent
@@ -98,6 +111,20 @@
     char* type; /* i32, f32, str, bool */
 }
 
+%code {
+    int yylex(YYSTYPE *lval);
+
+    /* The scanner as the parser calls it, timed for --time-report; not
+     * traced, as that would be a span per token */
+    static int timed_yylex(YYSTYPE *lval) {
+        time_begin("lex");
+        int token = yylex(lval);
+        time_end();
+        return token;
+    }
+    #define yylex timed_yylex
+}
+
 /* Token without return */
 %token LET MUT NEWLINE
 %token INT FLOAT BOOL STR
@@ -152,22 +179,25 @@ GlobalStatement
 
 FunctionDeclStmt
     : FUNC ID '(' ')' {
-        create_symbol();
-        insert_symbol($2, "func", -1, yylineno, "(V)V");
+        if (ps->scope_top < 0) create_symbol(ps);  // 所有 function 共用 global scope
+        insert_symbol(ps, $2, "func", -1, yylineno, "(V)V");
+        ps->addr_counter = 0;  // local slot 從每個 function 的 0 開始
+        ps->label_id = 0;      /* labels are per method too, so a method's code
+                                * does not depend on the ones before it */
 
         // 如果是 main，產生帶參數的 main
         if (strcmp($2, "main") == 0) {
-            CODEGEN("\n.method public static main([Ljava/lang/String;)V\n");
+            method_begin("main([Ljava/lang/String;)V");
         } else {
-            CODEGEN("\n.method public static %s()V\n", $2);
+            char sig[96];
+            snprintf(sig, sizeof(sig), "%s()V", $2);
+            method_begin(sig);
         }
-        CODEGEN(".limit stack 100\n");
-        CODEGEN(".limit locals 100\n");
         g_indent_cnt++;  // 進入 function 增加縮排
     } Block {
         g_indent_cnt--;
         CODEGEN("return\n");
-        CODEGEN(".end method\n");
+        method_end();   // 最佳化後寫出 .method ... .end method
         free($2);
     }
 ;
@@ -194,13 +224,13 @@ Type
     | STR     { $$ = "str"; }
     | '&' STR { $$ = "str"; }
     | BOOL    { $$ = "bool"; }
-    | '[' Type ';' INT_LIT ']' { printf("INT_LIT %d\n", $4); $$ = "array"; }
+    | '[' Type ';' INT_LIT ']' { if (g_opt.verbose >= 2) printf("INT_LIT %d\n", $4); $$ = "array"; }
 ;
 
 VarDeclStmt
     : LET ID '=' Expression ';' {
-        int addr = next_addr();
-        insert_symbol($2, $4, addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, $2, $4, addr, yylineno, "-");
 
         if (strcmp($4, "i32") == 0) {
             CODEGEN("istore %d\n", addr);  // 把 stack top 儲存到 local addr
@@ -212,8 +242,8 @@ VarDeclStmt
         free($2);
     }
     | LET ID ':' Type '=' Expression ';' {
-        int addr = next_addr();
-        insert_symbol($2, $4, addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, $2, $4, addr, yylineno, "-");
 
         if (strcmp($4, "i32") == 0) {
             CODEGEN("istore %d\n", addr); 
@@ -225,13 +255,13 @@ VarDeclStmt
         free($2);
     }
     | LET ID ':' Type ';' {
-        int addr = next_addr();
-        insert_symbol($2, $4, addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, $2, $4, addr, yylineno, "-");
         free($2);
     }    
     | LET MUT ID ':' Type '=' Expression ';' {
-        int addr = next_addr();
-        insert_symbol($3, $5, addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, $3, $5, addr, yylineno, "-");
 
         if (strcmp($5, "i32") == 0) {
             CODEGEN("istore %d\n", addr);
@@ -240,18 +270,18 @@ VarDeclStmt
         } else if (strcmp($5, "str") == 0) {
             CODEGEN("astore %d\n", addr);
         }
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free($3);
     }
     | LET MUT ID ':' Type ';' {
-        int addr = next_addr();
-        insert_symbol($3, $5, addr, yylineno, "-");
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        int addr = next_addr(ps);
+        insert_symbol(ps, $3, $5, addr, yylineno, "-");
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free($3);
     }
     | LET MUT ID '=' Expression ';' {
-        int addr = next_addr();
-        insert_symbol($3, $5, addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, $3, $5, addr, yylineno, "-");
 
         if (strcmp($5, "i32") == 0) {
             CODEGEN("istore %d\n", addr);
@@ -260,21 +290,21 @@ VarDeclStmt
         } else if (strcmp($5, "str") == 0) {
             CODEGEN("astore %d\n", addr);
         }
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free($3);
     }
 ;
 
 AssignmentStmt
     : ID '=' Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0)
                     CODEGEN("istore %d\n", addr);
                 else if (strcmp(type, "f32") == 0)
@@ -286,14 +316,14 @@ AssignmentStmt
         free($1);
     }
     | ID ADD_ASSIGN Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);   // put x onto stack
                     CODEGEN("swap\n"); // x on the top
@@ -307,20 +337,20 @@ AssignmentStmt
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free($1);
     }
     | ID SUB_ASSIGN Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -334,20 +364,20 @@ AssignmentStmt
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free($1);
     }
     | ID MUL_ASSIGN Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -361,20 +391,20 @@ AssignmentStmt
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free($1);
     }
     | ID DIV_ASSIGN Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -388,20 +418,20 @@ AssignmentStmt
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free($1);
     }
     | ID REM_ASSIGN Expression ';' {
-        int addr = lookup_symbol($1);
+        int addr = lookup_symbol(ps, $1);
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
         } else {
-            if (!is_mutable($1)) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, $1);
+            if (!is_mutable(ps, $1)) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", $1);
             } else {
-                const char* type = get_symbol_type($1);
+                const char* type = get_symbol_type(ps, $1);
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -409,7 +439,7 @@ AssignmentStmt
                     CODEGEN("istore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free($1);
@@ -439,10 +469,10 @@ OptElse
 
 RelExprJump
     : AddExpr '>' AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpgt L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -453,10 +483,10 @@ RelExprJump
         // CODEGEN("L_if_%d:\n", id);
     }
     | AddExpr '<' AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmplt L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -467,10 +497,10 @@ RelExprJump
         // CODEGEN("L_if_%d:\n", id);
     }
     | AddExpr EQL AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpeq L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -481,10 +511,10 @@ RelExprJump
         // CODEGEN("L_if_%d:\n", id);
     }
     | AddExpr NEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpne L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -495,10 +525,10 @@ RelExprJump
         // CODEGEN("L_if_%d:\n", id);
     }
     | AddExpr GEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `>=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `>=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpge L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -509,10 +539,10 @@ RelExprJump
         // CODEGEN("L_if_%d:\n", id);
     }
     | AddExpr LEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `<=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `<=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmple L_if_%d\n", id);
         } else if (strcmp($1, "f32") == 0) {
@@ -525,24 +555,24 @@ RelExprJump
 ;
 
 WhileStmt
-    : WHILE RelExprJump {
-        int id = label_id++;
+    : WHILE {
+        int id = ps->label_id++;
         $<i_val>$ = id;
         CODEGEN("L_loop_%d:\n", id);
     } RelExprForWhileJump Block {
-        int id = $<i_val>3;
+        int id = $<i_val>2;
         CODEGEN("goto L_loop_%d\n", id);
-        CODEGEN("L_end_%d:\n", id);
+        CODEGEN("L_end_%d:\n", $<i_val>3);   // 條件不成立時跳到這裡
     }
 ;
 
 RelExprForWhileJump
     : AddExpr '>' AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmple L_end_%d\n", id);  // <= 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -551,11 +581,11 @@ RelExprForWhileJump
         }
     }
     | AddExpr '<' AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpge L_end_%d\n", id);  // >= 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -564,11 +594,11 @@ RelExprForWhileJump
         }
     }
     | AddExpr EQL AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpne L_end_%d\n", id);  // != 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -577,11 +607,11 @@ RelExprForWhileJump
         }
     }
     | AddExpr NEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpeq L_end_%d\n", id);  // == 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -590,11 +620,11 @@ RelExprForWhileJump
         }
     }
     | AddExpr GEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `>=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `>=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmplt L_end_%d\n", id);  // < 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -603,11 +633,11 @@ RelExprForWhileJump
         }
     }
     | AddExpr LEQ AddExpr {
-        int id = label_id++;
+        int id = ps->label_id++;
         $<i_val>$ = id;
 
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `<=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `<=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpgt L_end_%d\n", id);  // > 就跳出
         } else if (strcmp($1, "f32") == 0) {
@@ -630,7 +660,7 @@ PrintStmt
             CODEGEN("swap\n");
             CODEGEN("invokevirtual java/io/PrintStream/print(Ljava/lang/String;)V\n");
         } else if (strcmp($2, "bool") == 0) {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             // Stack top: boolean (int)
             CODEGEN("ifeq L_false_%d\n", curr);       // if 0 → false
             CODEGEN("ldc \"true\"\n");                // if != 0 → push "true"
@@ -665,7 +695,7 @@ PrintlnStmt
             CODEGEN("swap\n");
             CODEGEN("invokevirtual java/io/PrintStream/println(Ljava/lang/String;)V\n");
         } else if (strcmp($2, "bool") == 0) {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             // Stack top: boolean (int)
             CODEGEN("ifeq L_false_%d\n", curr);       // if 0 → false
             CODEGEN("ldc \"true\"\n");                // if != 0 → push "true"
@@ -689,9 +719,9 @@ PrintlnStmt
 
 Block
     : '{' {
-        create_symbol();    // 進入新scope時建立table
+        create_symbol(ps);    // 進入新scope時建立table
     } StatementList '}' {
-        dump_symbol();      // 離開時丟出table
+        dump_symbol(ps);      // 離開時丟出table
     }
 ;
 
@@ -734,9 +764,9 @@ AndExpr
 
 RelExpr
     : AddExpr '>' AddExpr {
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpgt L_true_%d\n", curr);
         } else if (strcmp($1, "f32") == 0) {
@@ -751,9 +781,9 @@ RelExpr
         $$ = "bool";
     }
     | AddExpr '<' AddExpr { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmplt L_true_%d\n", curr);
         } else if (strcmp($1, "f32") == 0) {
@@ -768,9 +798,9 @@ RelExpr
         $$ = "bool";
     }
     | AddExpr EQL AddExpr { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpeq L_true_%d\n", curr);
         } else if (strcmp($1, "f32") == 0) {
@@ -785,9 +815,9 @@ RelExpr
         $$ = "bool";
     }
     | AddExpr NEQ AddExpr { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp($1, $3) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, $1, $3);
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", $1, $3);
         } else if (strcmp($1, "i32") == 0) {
             CODEGEN("if_icmpne L_true_%d\n", curr);
         } else if (strcmp($1, "f32") == 0) {
@@ -803,7 +833,7 @@ RelExpr
     }
     | AddExpr LSHIFT AddExpr {
         if (!(strcmp($1, "i32") == 0 && strcmp($3, "i32") == 0)) {
-            printf("error:%d: invalid operation: LSHIFT (mismatched types %s and %s)\n", yylineno, $1, $3);
+            compile_error(ps, "invalid operation: LSHIFT (mismatched types %s and %s)\n", $1, $3);
         } else {
             CODEGEN("ishl\n");
         }
@@ -811,7 +841,7 @@ RelExpr
     }
     | AddExpr RSHIFT AddExpr { 
         if (!(strcmp($1, "i32") == 0 && strcmp($3, "i32") == 0)) {
-            printf("error:%d: invalid operation: RSHIFT (mismatched types %s and %s)\n", yylineno, $1, $3);
+            compile_error(ps, "invalid operation: RSHIFT (mismatched types %s and %s)\n", $1, $3);
         } else {
             CODEGEN("iushr\n");
         }
@@ -871,10 +901,10 @@ UnaryExpr
     }
     | '!' UnaryExpr {
         if (strcmp($2, "bool") != 0) {
-            printf("error:%d: unary `!` can only be applied to bool, got %s\n", yylineno, $2);
+            compile_error(ps, "unary `!` can only be applied to bool, got %s\n", $2);
             $$ = strdup("bool");  // 為防止錯誤後續 propagation，可回傳預設型別
         } else {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             CODEGEN("ifeq L_true_%d\n", curr);
             CODEGEN("iconst_0\n");
             CODEGEN("goto L_end_%d\n", curr);
@@ -895,11 +925,10 @@ Primary
     | TRUE  { CODEGEN("iconst_1\n"); $$ = "bool"; }
     | FALSE { CODEGEN("iconst_0\n"); $$ = "bool"; }
     | ID {
-        int ref = lookup_symbol($1);
-        const char* type = get_symbol_type($1);
+        int ref = lookup_symbol(ps, $1);
+        const char* type = get_symbol_type(ps, $1);
         if (ref == -1) {
-            HAS_ERROR = true;
-            printf("error:%d: undefined: %s\n", yylineno, $1);
+            compile_error(ps, "undefined: %s\n", $1);
             $$ = strdup("undefined");
         } else {
             if (strcmp(type, "i32") == 0)
@@ -921,10 +950,9 @@ Primary
 
 ArrayIndexExpr
     : ID '[' INT_LIT ']' {
-        int ref = lookup_symbol($1);
+        int ref = lookup_symbol(ps, $1);
         if (ref == -1) {
-            HAS_ERROR = true;
-            printf("error:%d: undefined variable %s\n", yylineno, $1);
+            compile_error(ps, "undefined variable %s\n", $1);
         } else {
             // printf("IDENT (name=%s, address=%d)\n", $1, ref);
             // printf("INT_LIT %d\n", $3);
@@ -937,60 +965,347 @@ ArrayIndexExpr
 %%
 
 /* C code section */
-int main(int argc, char *argv[])
-{
-    if (argc == 2) {
-        yyin = fopen(argv[1], "r");
-    } else {
-        yyin = stdin;
-    }
-    if (!yyin) {
-        printf("file `%s` doesn't exists or cannot be opened\n", argv[1]);
-        exit(1);
-    }
+
+/* Per-file codegen state back to how a fresh process starts; the parser
+ * starts each file from a new ParseState */
+static void reset_state() {
+    g_indent_cnt = 0;
+    g_has_error = false;
+    codegen_reset();
+    vm_unload();
+}
+
+/* Compiles yyin to out_path as class class_name; false on any error,
+ * though only codegen errors remove the output, as they always have */
+static bool compile_file(const char *out_path, const char *class_name) {
+    reset_state();
+    lex_reset(yyin);
 
     /* Codegen output init */
-    char *bytecode_filename = "hw3.j";
-    fout = fopen(bytecode_filename, "w");
-    CODEGEN(".source hw3.j\n");
-    CODEGEN(".class public Main\n");
+    fout = fopen(out_path, "w");
+    if (!fout) {
+        printf("file `%s` cannot be opened for writing\n", out_path);
+        return false;
+    }
+    if (g_opt.emit == EMIT_C) c_write_prelude(fout);
+    CODEGEN(".source %s\n", strrchr(out_path, '/') ? strrchr(out_path, '/') + 1 : out_path);
+    CODEGEN(".class public %s\n", class_name);
     CODEGEN(".super java/lang/Object\n");
 
     /* Symbol table init */
     // Add your code
-    init_symbol();
+    ParseState ps;
+    init_symbol(&ps);
 
     yylineno = 0;
-    yyparse();
+    phase_begin("parse");
+    bool parsed = yyparse(&ps) == 0;
+    phase_end();
+    codegen_finish();
 
     /* Symbol table dump */
     // Add your code
-    dump_symbol();
+    phase_begin("output");
+    /* an empty or all-comment input never opens a scope */
+    if (ps.scope_top >= 0) dump_symbol(&ps);
 
-	printf("Total lines: %d\n", yylineno);
+    if (g_opt.verbose >= 1) printf("Total lines: %d\n", yylineno);
     fclose(fout);
-    fclose(yyin);
+    phase_end();
 
     if (g_has_error) {
-        remove(bytecode_filename);
+        remove(out_path);
+    } else if (g_opt.run) {
+        fflush(stdout);
+        phase_begin("run");
+        vm_run();
+        phase_end();
     }
+    free_symbols(&ps);
+    return parsed && !ps.has_error && !g_has_error;
+}
+
+/* ------------------------------------------------------------------ */
+/* --cache                                                             */
+/* ------------------------------------------------------------------ */
+
+/* Makefile passes a checksum of the sources */
+#ifndef COMPILER_VERSION
+#define COMPILER_VERSION __DATE__ " " __TIME__
+#endif
+
+/* The compiler and the options that shape its output, the start of every
+ * key; NULL when the cache is off */
+static char *cache_context;
+static size_t cache_context_len;
+
+/* stdout of the compile in progress; written out as well if --run ends
+ * the process early */
+static FILE *capture;
+static int capture_saved = -1;
+
+static char *read_stream(FILE *f, size_t *len) {
+    size_t cap = 4096, n = 0, k;
+    char *s = malloc(cap);
+    while ((k = fread(s + n, 1, cap - n, f)) > 0) {
+        n += k;
+        if (n == cap) s = realloc(s, cap *= 2);
+    }
+    *len = n;
+    return s;
+}
+
+/* Puts stdout back and returns what was written to it meanwhile */
+static char *capture_end(size_t *len) {
+    fflush(stdout);
+    dup2(capture_saved, 1);
+    close(capture_saved);
+    rewind(capture);
+    char *s = read_stream(capture, len);
+    fclose(capture);
+    capture = NULL;
+    fwrite(s, 1, *len, stdout);
+    return s;
+}
+
+static void capture_exit(void) {
+    size_t len;
+    if (capture) free(capture_end(&len));
+}
+
+static bool capture_begin(void) {
+    static bool registered;
+    fflush(stdout);
+    if (!(capture = tmpfile())) return false;
+    /* at the first capture, so that this runs before pool.c's handler */
+    if (!registered) atexit(capture_exit);
+    registered = true;
+    capture_saved = dup(1);
+    dup2(fileno(capture), 1);
+    return true;
+}
+
+/* compile_file through the --cache store: a source compiled before with
+ * the same compiler, options and output name gets its output file and
+ * messages back from there */
+static bool compile_cached(const char *out_path, const char *class_name) {
+    if (!cache_context) return compile_file(out_path, class_name);
+    size_t src_len;
+    char *src = read_stream(yyin, &src_len);
+    const char *base = strrchr(out_path, '/') ? strrchr(out_path, '/') + 1 : out_path;
+    size_t class_len = strlen(class_name) + 1, base_len = strlen(base) + 1;
+    size_t key_len = cache_context_len + class_len + base_len + src_len;
+    char *key = malloc(key_len);
+    memcpy(key, cache_context, cache_context_len);
+    memcpy(key + cache_context_len, class_name, class_len);
+    memcpy(key + cache_context_len + class_len, base, base_len);
+    memcpy(key + cache_context_len + class_len + base_len, src, src_len);
+
+    /* "<ok><has output file>", the output file, stdout */
+    char *parts[3];
+    size_t lens[3];
+    bool ok;
+    if (cache_get(key, key_len, 3, parts, lens)) {
+        ok = parts[0][0] == '1';
+        FILE *f = parts[0][1] == '1' ? fopen(out_path, "wb") : NULL;
+        if (f) {
+            fwrite(parts[1], 1, lens[1], f);
+            fclose(f);
+        } else {
+            remove(out_path);
+        }
+        fwrite(parts[2], 1, lens[2], stdout);
+        for (int k = 0; k < 3; k++) free(parts[k]);
+    } else {
+        FILE *in = yyin;
+        if (src_len > 0) yyin = fmemopen(src, src_len, "r");
+        bool captured = capture_begin();
+        ok = compile_file(out_path, class_name);
+        size_t log_len = 0, out_len = 0;
+        char *log = captured ? capture_end(&log_len) : NULL;
+        if (yyin != in) fclose(yyin);
+        yyin = in;
+        FILE *f = fopen(out_path, "rb");
+        char *out = f ? read_stream(f, &out_len) : NULL;
+        if (f) fclose(f);
+        char flags[3] = { ok ? '1' : '0', out ? '1' : '0', '\0' };
+        const char *ps[3] = { flags, out ? out : "", log ? log : "" };
+        size_t ls[3] = { 2, out_len, log_len };
+        if (captured) cache_put(key, key_len, 3, ps, ls);
+        free(out);
+        free(log);
+    }
+    free(key);
+    free(src);
+    return ok;
+}
+
+/* A Java class name from the file name: no directory or extension, and
+ * anything but letters, digits, _ and $ replaced by _ */
+static void class_name_of(const char *path, char *name, size_t size) {
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t n = strcspn(base, ".");
+    if (n == 0) n = strlen(base);
+    size_t k = 0;
+    if (isdigit((unsigned char)base[0]) && k + 1 < size) name[k++] = '_';
+    for (size_t i = 0; i < n && k + 1 < size; i++) {
+        unsigned char c = base[i];
+        name[k++] = isalnum(c) || c == '_' || c == '$' ? c : '_';
+    }
+    name[k] = '\0';
+}
+
+static const char *output_extension() {
+    return g_opt.emit == EMIT_X86 ? "s" : g_opt.emit == EMIT_C ? "c" : "j";
+}
+
+typedef struct {
+    const char **inputs;
+    char (*names)[256];
+    const char *outdir;
+} Batch;
+
+/* One batch file to <outdir>/<class>.<ext> */
+static bool compile_input(int i, void *ctx) {
+    Batch *b = ctx;
+    yyin = fopen(b->inputs[i], "r");
+    if (!yyin) {
+        printf("file `%s` doesn't exists or cannot be opened\n", b->inputs[i]);
+        return false;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.%s", b->outdir, b->names[i], output_extension());
+    if (g_opt.verbose >= 1) printf("> Compile `%s` to `%s`\n", b->inputs[i], path);
+    bool ok = compile_cached(path, b->names[i]);
+    fclose(yyin);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char **inputs = calloc(argc, sizeof(char *));
+    int ninputs = 0;
+    const char *outdir = NULL;
+    char flags[4096] = "";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outdir = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            g_opt.jobs = atoi(argv[++i]);
+            if (g_opt.jobs <= 0) g_opt.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            continue;
+        }
+        if (opt_parse_flag(argv[i])) {
+            /* these do not change what comes out */
+            if (strncmp(argv[i], "--cache", 7) != 0 && strncmp(argv[i], "--threads=", 10) != 0)
+                snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), " %s", argv[i]);
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            printf("unknown option `%s`\n", argv[i]);
+            exit(1);
+        }
+        inputs[ninputs++] = argv[i];
+    }
+    /* these collect over the whole run in this process only */
+    if (g_opt.jobs > 1 && (g_opt.trace_file || g_opt.symtab_format != SYMTAB_OFF ||
+                           g_opt.time_report != REPORT_OFF || g_opt.pass_stats)) {
+        printf("-j cannot be combined with --trace, --symtab, --time-report or --pass-stats\n");
+        exit(1);
+    }
+    if (g_opt.threads > 1 && (g_opt.trace_file || g_opt.time_report != REPORT_OFF || g_opt.pass_stats ||
+                              g_opt.dump_ir)) {
+        printf("--threads cannot be combined with --trace, --time-report, --pass-stats or --dump-ir\n");
+        exit(1);
+    }
+    if (g_opt.trace_file && !trace_open(g_opt.trace_file)) {
+        printf("file `%s` cannot be opened for the trace\n", g_opt.trace_file);
+        exit(1);
+    }
+    if (!symtab_open()) {
+        printf("file `%s` cannot be opened for the symbol table\n", g_opt.symtab_file);
+        exit(1);
+    }
+    /* a hit skips the compile, and with it these reports */
+    if (g_opt.cache_dir && !g_opt.trace_file && g_opt.symtab_format == SYMTAB_OFF &&
+        g_opt.time_report == REPORT_OFF && !g_opt.pass_stats && !g_opt.dump_ir &&
+        cache_open(g_opt.cache_dir, g_opt.cache_max)) {
+        cache_context_len = strlen("mycompiler " COMPILER_VERSION) + strlen(flags) + 1;
+        cache_context = malloc(cache_context_len + 1);
+        snprintf(cache_context, cache_context_len + 1, "mycompiler " COMPILER_VERSION "%s\n", flags);
+        codegen_cache(cache_context, cache_context_len);
+    }
+
+    int failed = 0;
+    if (!outdir && ninputs <= 1) {
+        /* one file (or stdin) to hw3.j as class Main */
+        yyin = ninputs ? fopen(inputs[0], "r") : stdin;
+        if (!yyin) {
+            printf("file `%s` doesn't exists or cannot be opened\n", inputs[0]);
+            exit(1);
+        }
+        char path[16];
+        snprintf(path, sizeof(path), "hw3.%s", output_extension());
+        compile_cached(path, "Main");
+        fclose(yyin);
+    } else {
+        /* batch: every file to <outdir>/<class>.<ext> */
+        Batch b = { inputs, calloc(ninputs, sizeof(*b.names)), outdir ? outdir : "." };
+        mkdir(b.outdir, 0777);
+        for (int i = 0; i < ninputs; i++) {
+            class_name_of(inputs[i], b.names[i], sizeof(b.names[i]));
+            for (int j = 0; j < i; j++) {
+                if (strcmp(b.names[i], b.names[j]) == 0) {
+                    printf("error: `%s` and `%s` both compile to class %s\n", inputs[j], inputs[i], b.names[i]);
+                    exit(1);
+                }
+            }
+        }
+        if (g_opt.jobs > 1) {
+            failed = pool_run(ninputs, g_opt.jobs, compile_input, &b);
+        } else {
+            for (int i = 0; i < ninputs; i++) {
+                if (!compile_input(i, &b)) failed++;
+            }
+        }
+        free(b.names);
+    }
+
+    if (g_opt.pass_stats) opt_print_stats(stderr);
+    time_report_print(stderr);
+    trace_close();
+    symtab_close();
     yylex_destroy();
-    return 0;
+    free(cache_context);
+    free(inputs);
+    /* the single-file mode reports errors on stdout only, as it always has */
+    return outdir || ninputs > 1 ? failed > 0 : 0;
 }
 
-static void create_symbol() {
-    scope_top++;
-    scope_stack[scope_top].count = 0;
-    scope_stack[scope_top].level = scope_top;
-    printf("> Create symbol table (scope level %d)\n", scope_top);
+static void create_symbol(ParseState *ps) {
+    ps->scope_top++;
+    ps->scopes[ps->scope_top].count = 0;
+    ps->scopes[ps->scope_top].level = ps->scope_top;
+    if (g_opt.verbose >= 2) printf("> Create symbol table (scope level %d)\n", ps->scope_top);
 }
 
-static void init_symbol() {
-    scope_top = -1;
+static void init_symbol(ParseState *ps) {
+    memset(ps, 0, sizeof(*ps));
+    ps->scope_top = -1;
 }
 
-static int insert_symbol(const char *name, const char *type, int addr, int lineno, const char *sig) {
-    Scope *current = &scope_stack[scope_top];
+static void free_symbols(ParseState *ps) {
+    for (int i = 0; i < MAX_SCOPE; i++) free(ps->scopes[i].symbols);
+}
+
+static int insert_symbol(ParseState *ps, const char *name, const char *type, int addr, int lineno, const char *sig) {
+    Scope *current = &ps->scopes[ps->scope_top];
+    if (current->count == current->cap) {
+        current->cap = current->cap ? current->cap * 2 : 64;
+        current->symbols = realloc(current->symbols, current->cap * sizeof(Symbol));
+    }
     Symbol *s = &current->symbols[current->count++];
     strcpy(s->name, name);
     strcpy(s->type, type);
@@ -1004,13 +1319,15 @@ static int insert_symbol(const char *name, const char *type, int addr, int linen
         s->mut = 0;
     }
     strcpy(s->func_sig, sig);
-    printf("> Insert `%s` (addr: %d) to scope level %d\n", name, addr, get_scope_level());
+    method_name_local(addr, name);
+    if (g_opt.verbose >= 2) printf("> Insert `%s` (addr: %d) to scope level %d\n", name, addr, get_scope_level(ps));
+    trace_symbols(ps);
     return addr;
 }
 
-static int lookup_symbol(const char *name) {
-    for (int i = scope_top; i >= 0; i--) {
-        Scope *s = &scope_stack[i];
+static int lookup_symbol(ParseState *ps, const char *name) {
+    for (int i = ps->scope_top; i >= 0; i--) {
+        Scope *s = &ps->scopes[i];
         for (int j = 0; j < s->count; j++) {
             if (strcmp(s->symbols[j].name, name) == 0) {
                 return s->symbols[j].addr;
@@ -1020,22 +1337,39 @@ static int lookup_symbol(const char *name) {
     return -1;
 }
 
-static void dump_symbol() {
-    Scope *current = &scope_stack[scope_top];
-    printf("\n> Dump symbol table (scope level: %d)\n", current->level);
-    printf("%-10s%-10s%-10s%-10s%-10s%-10s%-10s\n",
-        "Index", "Name", "Mut", "Type", "Addr", "Lineno", "Func_sig");
+static void dump_symbol(ParseState *ps) {
+    Scope *current = &ps->scopes[ps->scope_top];
+    symtab_scope(current->level, current->count);
     for (int i = 0; i < current->count; i++) {
         Symbol *s = &current->symbols[i];
-        printf("%-10d%-10s%-10d%-10s%-10d%-10d%-10s\n",
-            i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+        symtab_symbol(i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+    }
+    if (g_opt.verbose >= 2) {
+        printf("\n> Dump symbol table (scope level: %d)\n", current->level);
+        printf("%-10s%-10s%-10s%-10s%-10s%-10s%-10s\n",
+            "Index", "Name", "Mut", "Type", "Addr", "Lineno", "Func_sig");
+        for (int i = 0; i < current->count; i++) {
+            Symbol *s = &current->symbols[i];
+            printf("%-10d%-10s%-10d%-10s%-10d%-10d%-10s\n",
+                i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+        }
+    }
+    ps->scope_top--;
+    trace_symbols(ps);
+}
+
+/* Symbols in all open scopes, as a --trace counter */
+static void trace_symbols(ParseState *ps) {
+    long n = 0;
+    for (int i = 0; i <= ps->scope_top; i++) {
+        n += ps->scopes[i].count;
     }
-    scope_top--;
+    trace_counter("symbols", n);
 }
 
-static const char* get_symbol_type(const char *name) {
-    for (int i = scope_top; i >= 0; i--) {
-        Scope *s = &scope_stack[i];
+static const char* get_symbol_type(ParseState *ps, const char *name) {
+    for (int i = ps->scope_top; i >= 0; i--) {
+        Scope *s = &ps->scopes[i];
         for (int j = 0; j < s->count; j++) {
             if (strcmp(s->symbols[j].name, name) == 0) {
                 return s->symbols[j].type;
@@ -1045,10 +1379,10 @@ static const char* get_symbol_type(const char *name) {
     return NULL;
 }
 
-static int next_addr() {
-    return addr_counter++;
+static int next_addr(ParseState *ps) {
+    return ps->addr_counter++;
 }
 
-static int get_scope_level() {
-    return scope_top;
+static int get_scope_level(ParseState *ps) {
+    return ps->scope_top;
 }
\ No newline at end of file
@@ -7,4 +7,407 @@
 #include <stdbool.h>
 /* Add what you need */
 
-#endif /* COMPILER_COMMON_H */
\ No newline at end of file
+/* Shared with the parser */
+extern FILE *fout;
+extern int g_indent_cnt;
+extern int yylineno;
+extern bool g_has_error;
+void lex_reset(FILE *f);
+typedef struct ParseState ParseState;  /* the parser's own, in compiler.y */
+
+/* ------------------------------------------------------------------ */
+/* Buffered method code                                                */
+/* ------------------------------------------------------------------ */
+
+/* Every instruction CODEGEN produces inside a method body is parsed into
+ * an Insn and kept until the method ends, so the optimizer can work on a
+ * whole method before it is written to the .j file.
+ *
+ * X(name, mnemonic, pops, pushes, flags); pops/pushes count values, not
+ * JVM words, and -1 means "depends on the member descriptor". */
+#define OPCODE_LIST(X) \
+    X(NOP,           "nop",           0, 0, OPF_PURE) \
+    X(LABEL,         "",              0, 0, 0) \
+    X(ICONST,        "ldc",           0, 1, OPF_PURE) \
+    X(FCONST,        "ldc",           0, 1, OPF_PURE) \
+    X(SCONST,        "ldc",           0, 1, OPF_PURE) \
+    X(ILOAD,         "iload",         0, 1, OPF_PURE) \
+    X(FLOAD,         "fload",         0, 1, OPF_PURE) \
+    X(ALOAD,         "aload",         0, 1, OPF_PURE) \
+    X(LLOAD,         "lload",         0, 1, OPF_PURE | OPF_LONG) \
+    X(ISTORE,        "istore",        1, 0, OPF_STORE) \
+    X(FSTORE,        "fstore",        1, 0, OPF_STORE) \
+    X(ASTORE,        "astore",        1, 0, OPF_STORE) \
+    X(LSTORE,        "lstore",        1, 0, OPF_STORE | OPF_LONG) \
+    X(IADD,          "iadd",          2, 1, OPF_PURE) \
+    X(ISUB,          "isub",          2, 1, OPF_PURE) \
+    X(IMUL,          "imul",          2, 1, OPF_PURE) \
+    X(IDIV,          "idiv",          2, 1, OPF_THROWS) \
+    X(IREM,          "irem",          2, 1, OPF_THROWS) \
+    X(INEG,          "ineg",          1, 1, OPF_PURE) \
+    X(ISHL,          "ishl",          2, 1, OPF_PURE) \
+    X(ISHR,          "ishr",          2, 1, OPF_PURE) \
+    X(IUSHR,         "iushr",         2, 1, OPF_PURE) \
+    X(IAND,          "iand",          2, 1, OPF_PURE) \
+    X(IOR,           "ior",           2, 1, OPF_PURE) \
+    X(IXOR,          "ixor",          2, 1, OPF_PURE) \
+    X(FADD,          "fadd",          2, 1, OPF_PURE) \
+    X(FSUB,          "fsub",          2, 1, OPF_PURE) \
+    X(FMUL,          "fmul",          2, 1, OPF_PURE) \
+    X(FDIV,          "fdiv",          2, 1, OPF_PURE) \
+    X(FNEG,          "fneg",          1, 1, OPF_PURE) \
+    X(I2F,           "i2f",           1, 1, OPF_PURE) \
+    X(F2I,           "f2i",           1, 1, OPF_PURE) \
+    X(FCMPL,         "fcmpl",         2, 1, OPF_PURE) \
+    X(FCMPG,         "fcmpg",         2, 1, OPF_PURE) \
+    X(LCONST,        "lconst",        0, 1, OPF_PURE | OPF_LONG) \
+    X(LADD,          "ladd",          2, 1, OPF_PURE | OPF_LONG) \
+    X(LSUB,          "lsub",          2, 1, OPF_PURE | OPF_LONG) \
+    X(LMUL,          "lmul",          2, 1, OPF_PURE | OPF_LONG) \
+    X(LUSHR,         "lushr",         2, 1, OPF_PURE | OPF_LONG) \
+    X(LCMP,          "lcmp",          2, 1, OPF_PURE | OPF_LONG) \
+    X(I2L,           "i2l",           1, 1, OPF_PURE | OPF_LONG) \
+    X(L2I,           "l2i",           1, 1, OPF_PURE | OPF_LONG) \
+    X(LDUP,          "dup2",          1, 2, OPF_PURE | OPF_LONG) \
+    X(LPOP,          "pop2",          1, 0, OPF_PURE | OPF_LONG) \
+    X(IFEQ,          "ifeq",          1, 0, OPF_BRANCH) \
+    X(IFNE,          "ifne",          1, 0, OPF_BRANCH) \
+    X(IFLT,          "iflt",          1, 0, OPF_BRANCH) \
+    X(IFGE,          "ifge",          1, 0, OPF_BRANCH) \
+    X(IFGT,          "ifgt",          1, 0, OPF_BRANCH) \
+    X(IFLE,          "ifle",          1, 0, OPF_BRANCH) \
+    X(IF_ICMPEQ,     "if_icmpeq",     2, 0, OPF_BRANCH) \
+    X(IF_ICMPNE,     "if_icmpne",     2, 0, OPF_BRANCH) \
+    X(IF_ICMPLT,     "if_icmplt",     2, 0, OPF_BRANCH) \
+    X(IF_ICMPGE,     "if_icmpge",     2, 0, OPF_BRANCH) \
+    X(IF_ICMPGT,     "if_icmpgt",     2, 0, OPF_BRANCH) \
+    X(IF_ICMPLE,     "if_icmple",     2, 0, OPF_BRANCH) \
+    X(GOTO,          "goto",          0, 0, OPF_JUMP) \
+    X(DUP,           "dup",           1, 2, OPF_PURE) \
+    X(POP,           "pop",           1, 0, OPF_PURE) \
+    X(SWAP,          "swap",          2, 2, OPF_PURE) \
+    X(GETSTATIC,     "getstatic",     0, 1, OPF_PURE) \
+    X(INVOKESTATIC,  "invokestatic",  -1, -1, OPF_EFFECT) \
+    X(INVOKEVIRTUAL, "invokevirtual", -1, -1, OPF_EFFECT) \
+    X(RETURN,        "return",        0, 0, OPF_END) \
+    X(RAW,           "",              0, 0, OPF_EFFECT)
+
+#define OPF_PURE   0x01 /* no side effect, cannot throw */
+#define OPF_STORE  0x02 /* writes a local slot */
+#define OPF_THROWS 0x04 /* may raise an exception */
+#define OPF_BRANCH 0x08 /* conditional jump to ival */
+#define OPF_JUMP   0x10 /* unconditional jump to ival */
+#define OPF_END    0x20 /* leaves the method */
+#define OPF_EFFECT 0x40 /* observable side effect or unknown */
+#define OPF_LONG   0x80 /* reads or writes a long (two JVM words, one value here) */
+
+typedef enum {
+#define X(name, mnem, pops, pushes, flags) OP_##name,
+    OPCODE_LIST(X)
+#undef X
+    OP_COUNT
+} Opcode;
+
+typedef struct {
+    Opcode op;
+    int ival;     /* int or lconst_<n> constant, local slot or label index */
+    float fval;   /* float constant */
+    char *sval;   /* string literal (still escaped), member ref or raw text */
+    int lineno;
+} Insn;
+
+typedef struct {
+    char *name;   /* method name and descriptor, e.g. "main([Ljava/lang/String;)V" */
+    Insn *code;
+    int len, cap;
+    char **labels; /* label names, indexed by Insn.ival of LABEL and jumps */
+    int nlabels, labels_cap;
+    int next_local; /* first local slot not used by the method */
+    char **slot_names; /* source variable of each slot, NULL for temporaries */
+    int nslot_names;
+} Method;
+
+/* codegen.c */
+void code_emit(const char *fmt, ...);
+void method_begin(const char *name);
+void method_end(void);
+void codegen_reset(void);
+void codegen_finish(void);
+void codegen_cache(const char *context, size_t len);
+void method_name_local(int slot, const char *name);
+const char *opcode_name(Opcode op);
+int opcode_flags(Opcode op);
+int insn_pops(const Insn *in);
+int insn_pushes(const Insn *in);
+bool insn_is_pure(const Method *m, int i);
+bool insn_is_branch(const Insn *in);
+bool opcode_yields_float(Opcode op);
+Insn *method_insert(Method *m, int at, Opcode op, int ival);
+int method_new_label(Method *m, const char *prefix);
+int method_new_local(Method *m);
+void method_compact(Method *m);
+void format_float(float f, char *buf, size_t size);
+char *string_unescape(const char *s, size_t *len);
+
+/* ------------------------------------------------------------------ */
+/* Control-flow graph over a method                                    */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    int start, end;  /* instruction range [start, end) */
+    int succ[2];     /* succ[0] = fallthrough or jump target, succ[1] = branch target */
+    int nsucc;
+    int *preds;
+    int npreds;
+    bool reachable;
+} BasicBlock;
+
+typedef struct {
+    int header;
+    bool *body;    /* per block: part of this loop (nested loops included) */
+    int parent;    /* innermost enclosing loop, -1 for outermost */
+    int depth;     /* 1 for outermost */
+} Loop;
+
+typedef struct {
+    Method *m;
+    BasicBlock *blocks;
+    int nblocks;
+    int *label_block; /* label index -> block that starts with it */
+    int *insn_block;  /* instruction index -> block */
+    /* filled by cfg_find_loops */
+    int *idom;        /* immediate dominator, -1 if unreachable */
+    int *rpo;         /* reachable blocks in reverse postorder */
+    int nrpo;
+    Loop *loops;
+    int nloops;
+} Cfg;
+
+/* cfg.c */
+void cfg_build(Cfg *g, Method *m);
+void cfg_free(Cfg *g);
+int cfg_stack_depths(Cfg *g, int *entry_depth);
+void cfg_find_loops(Cfg *g);
+bool cfg_dominates(const Cfg *g, int a, int b);
+int cfg_preheader_at(const Cfg *g, const Loop *lp);
+void cfg_redirect_entries(Cfg *g, const Loop *lp, int label);
+
+/* optimizer.c */
+typedef enum {
+    EMIT_JASMIN,  /* hw3.j for jasmin.jar */
+    EMIT_X86,     /* hw3.s, linked with runtime.c */
+    EMIT_C        /* hw3.c, likewise */
+} Backend;
+
+typedef enum {
+    REPORT_OFF,
+    REPORT_TEXT,  /* a table on stderr */
+    REPORT_JSON   /* one JSON object on stderr */
+} TimeReport;
+
+typedef enum {
+    SYMTAB_OFF,
+    SYMTAB_JSON,
+    SYMTAB_BINARY
+} SymtabFormat;
+
+typedef struct {
+    int level;             /* -O0 .. -O2; -f<pass>/-fno-<pass> override single passes */
+    bool pass_stats;       /* print per-pass runs, changes and time */
+    bool dump_ir;          /* print the SSA form of each method after every pass */
+    int unroll_factor;     /* loop body copies per iteration, 1 turns it off */
+    int unroll_full_limit; /* largest fully unrolled loop, in instructions */
+    long peval_fuel;       /* instructions --partial-eval may run, 0 when off */
+    Backend emit;          /* --emit=jasmin|x86|c */
+    bool run;              /* --run: interpret main after compiling */
+    TimeReport time_report; /* --time-report[=json] */
+    const char *trace_file; /* --trace=<file>, NULL when off */
+    int verbose;           /* 0 errors only, 1 (-v) totals, 2 (-vv) scope and symbol-table trace */
+    SymtabFormat symtab_format; /* --symtab=json|bin:<file> */
+    const char *symtab_file;
+    int jobs;              /* -j <n>: batch files compiled at once */
+    int threads;           /* --threads=<n>: methods of a file compiled at once */
+    const char *cache_dir; /* --cache[=<dir>], NULL when off */
+    long cache_max;        /* --cache-size, in bytes */
+} OptOptions;
+
+extern OptOptions g_opt;
+bool opt_parse_flag(const char *arg);
+void optimize_method(Method *m);
+void opt_print_stats(FILE *out);
+
+/* Passes return the number of changes they made */
+int pass_dce(Method *m);
+int pass_sccp(Method *m);
+int pass_cse(Method *m);
+int pass_licm(Method *m);
+int pass_iv(Method *m);
+int pass_unroll(Method *m);
+int pass_scev(Method *m);
+
+/* A while loop counting i by a constant step towards a constant or
+ * invariant bound (opt_unroll.c) */
+typedef struct {
+    int head;          /* header label; the exit branch is at head + 3 */
+    int latch;         /* the goto back to the header; the body is [head + 4, latch) */
+    int slot, step;
+    Insn bound;        /* ICONST or ILOAD of an invariant slot */
+    Opcode exit_op;
+    int exit_label;
+    bool start_known;
+    int start;         /* counter value on entry, if start_known */
+    long long trips;   /* -1 when unknown */
+} CountedLoop;
+
+bool counted_loop_match(const Cfg *g, int l, const int *depth, CountedLoop *cl);
+
+/* opt_iv.c */
+bool iv_match_increment(const Method *m, int at, int *slot, int *step);
+
+/* peval.c: runs the method at compile time and replaces it with its
+ * output; false (method unchanged) if it did not finish within fuel */
+bool partial_eval(Method *m, long fuel);
+
+/* ------------------------------------------------------------------ */
+/* Bit-vector dataflow (dataflow.c)                                    */
+/* ------------------------------------------------------------------ */
+
+typedef unsigned long long BitWord;
+
+typedef struct {
+    Cfg *g;
+    int nbits, nwords;
+    bool forward;  /* facts flow along edges, else against them */
+    bool must;     /* meet is intersection, else union */
+    BitWord *gen, *kill, *in, *out; /* one row of nwords per block */
+} Dataflow;
+
+bool bits_test(const BitWord *s, int i);
+void bits_set(BitWord *s, int i);
+void bits_clear(BitWord *s, int i);
+BitWord *df_row(const Dataflow *df, BitWord *sets, int b);
+void df_init(Dataflow *df, Cfg *g, int nbits, bool forward, bool must);
+void df_solve(Dataflow *df, const BitWord *boundary);
+void df_free(Dataflow *df);
+void df_liveness(Dataflow *df, Cfg *g);
+void df_reaching_defs(Dataflow *df, Cfg *g, int *def_bit);
+int report_uninitialized(Method *m, FILE *out);
+
+/* ------------------------------------------------------------------ */
+/* SSA form (ssa.c)                                                    */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    int *v;
+    int n, cap;
+} IntList;
+
+void list_push(IntList *l, int x);
+
+typedef enum { IR_VOID, IR_INT, IR_FLOAT, IR_LONG, IR_REF } IrType;
+
+typedef enum {
+    IR_INSN,  /* a JVM operation on SSA operands */
+    IR_PHI,   /* one operand per predecessor of its block */
+    IR_ARG    /* a local slot's value on entry; ival is the slot */
+} IrKind;
+
+typedef struct {
+    IrKind kind;
+    Opcode op;
+    IrType type;   /* IR_VOID if the operation produces nothing */
+    int *args;     /* value numbers, in push order */
+    int nargs;
+    int ival;
+    float fval;
+    char *sval;
+    int block;
+    int lineno;
+    bool dead;
+} IrValue;
+
+typedef struct {
+    bool reachable;
+    int idom;          /* -1 for the entry block */
+    int label;         /* method label the block starts with, -1 if none */
+    int entry_depth;   /* operand stack entries live on entry */
+    IntList preds;
+    IntList phis;
+    IntList insns;     /* IR_INSN values in execution order */
+    Opcode term;       /* GOTO (also for fallthrough), a conditional branch or RETURN */
+    int term_label;
+    int term_args[2];
+    int nterm_args;
+    int succ[2], nsucc; /* as in BasicBlock */
+    int lineno;
+} IrBlock;
+
+typedef struct {
+    Method *m;
+    IrValue *vals;
+    int nvals, cap;
+    IrBlock *blocks;   /* one per CFG block, same numbering */
+    int nblocks;
+} IrFunc;
+
+bool ir_build(IrFunc *f, Method *m);
+void ir_lower(IrFunc *f, Method *m);
+void ir_free(IrFunc *f);
+void ir_dump(FILE *out, const IrFunc *f, const char *tag);
+void ir_dump_method(FILE *out, Method *m, const char *tag);
+int pass_ssa(Method *m);
+bool ir_has_copies(const IrFunc *f, int to);
+bool ir_is_value_of(const IrValue *v, char type);
+bool *ir_fused_prints(const IrFunc *f);
+
+/* x86.c: false if the method uses something the backend lacks */
+bool x86_write_method(FILE *out, Method *m);
+
+/* c99.c: likewise; the prelude goes first in the file */
+void c_write_prelude(FILE *out);
+bool c_write_method(FILE *out, Method *m);
+
+/* timing.c: --time-report; phases nest and are charged their own time.
+ * Phases are traced too; time_begin/time_end leave the trace out, and
+ * trace_begin/trace_end add spans to the trace only. */
+void phase_begin(const char *name);
+void phase_end(void);
+void time_begin(const char *name);
+void time_end(void);
+void time_report_print(FILE *out);
+bool trace_open(const char *path);
+void trace_begin(const char *name);
+void trace_end(void);
+void trace_counter(const char *name, long value);
+void trace_close(void);
+long heap_in_use(void);
+void write_json_string(FILE *out, const char *s);
+
+/* symdump.c: symbol tables for --symtab, one call per closed scope and
+ * then one per symbol in it */
+bool symtab_open(void);
+void symtab_scope(int level, int count);
+void symtab_symbol(int index, const char *name, int mut, const char *type, int addr, int lineno,
+                   const char *func_sig);
+void symtab_close(void);
+
+/* pool.c: runs work(0..n-1) in up to jobs forked children, printing
+ * each one's stdout in index order; returns how many failed */
+int pool_run(int n, int jobs, bool (*work)(int index, void *ctx), void *ctx);
+/* runs work(0..n-1) on up to threads threads with work stealing */
+void pool_for(int n, int threads, void (*work)(int index, void *ctx), void *ctx);
+
+/* vm.c: vm_load keeps main for --run, false if it uses something the
+ * interpreter lacks; vm_run runs it once */
+bool vm_load(Method *m);
+void vm_run(void);
+void vm_unload(void);
+
+/* opt_sccp.c: constant evaluation with JVM semantics */
+bool eval_int_binop(Opcode op, int a, int b, int *out);
+float eval_float_binop(Opcode op, float a, float b);
+bool eval_compare(Opcode op, int a, int b);
+int java_f2i(float f);
+int java_fcmp(float a, float b, int nan_result);
+
+#endif /* COMPILER_COMMON_H */
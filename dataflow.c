@@ -0,0 +1,252 @@
+/* Bit-vector dataflow problems over a Cfg.
+ *
+ * A problem gives every block a gen and a kill set; the solver computes
+ * in/out sets with out = gen | (in & ~kill) (or the mirror image for
+ * backward problems), meeting predecessors by union or intersection.
+ * Blocks are visited in reverse postorder (postorder when backward) and
+ * only while one of their neighbours changed, so a reducible graph
+ * settles after a number of sweeps bounded by its loop nesting.
+ *
+ * Clients here: live local slots, reaching definitions, and the check that
+ * every local is stored before it is read. */
+#include "compiler_common.h"
+
+static size_t row_bytes(const Dataflow *df) {
+    return df->nwords * sizeof(BitWord);
+}
+
+bool bits_test(const BitWord *s, int i) {
+    return (s[i / 64] >> (i % 64)) & 1;
+}
+
+void bits_set(BitWord *s, int i) {
+    s[i / 64] |= (BitWord)1 << (i % 64);
+}
+
+void bits_clear(BitWord *s, int i) {
+    s[i / 64] &= ~((BitWord)1 << (i % 64));
+}
+
+BitWord *df_row(const Dataflow *df, BitWord *sets, int b) {
+    return sets + (size_t)b * df->nwords;
+}
+
+void df_init(Dataflow *df, Cfg *g, int nbits, bool forward, bool must) {
+    memset(df, 0, sizeof(*df));
+    df->g = g;
+    df->nbits = nbits;
+    df->nwords = nbits / 64 + 1;
+    df->forward = forward;
+    df->must = must;
+    size_t n = (size_t)(g->nblocks + 1) * df->nwords;
+    df->gen = calloc(n, sizeof(BitWord));
+    df->kill = calloc(n, sizeof(BitWord));
+    df->in = calloc(n, sizeof(BitWord));
+    df->out = calloc(n, sizeof(BitWord));
+    if (!g->rpo) cfg_find_loops(g);
+}
+
+void df_free(Dataflow *df) {
+    free(df->gen);
+    free(df->kill);
+    free(df->in);
+    free(df->out);
+    memset(df, 0, sizeof(*df));
+}
+
+/* boundary is the value on entry (forward) or at every exit (backward);
+ * NULL means the empty set */
+void df_solve(Dataflow *df, const BitWord *boundary) {
+    const Cfg *g = df->g;
+    int nw = df->nwords;
+    BitWord *meet_in = df->forward ? df->in : df->out;
+    BitWord *result = df->forward ? df->out : df->in;
+    BitWord *tmp = malloc(row_bytes(df));
+    bool *dirty = calloc(g->nblocks + 1, sizeof(bool));
+
+    /* optimistic start: everything for must problems, nothing for may */
+    for (int k = 0; k < g->nrpo; k++) {
+        int b = g->rpo[k];
+        memset(df_row(df, result, b), df->must ? 0xff : 0, row_bytes(df));
+        dirty[b] = true;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int k = 0; k < g->nrpo; k++) {
+            int b = g->rpo[df->forward ? k : g->nrpo - 1 - k];
+            if (!dirty[b]) continue;
+            dirty[b] = false;
+            const BasicBlock *bb = &g->blocks[b];
+            const int *nbr = df->forward ? bb->preds : bb->succ;
+            int nnbr = df->forward ? bb->npreds : bb->nsucc;
+
+            BitWord *x = df_row(df, meet_in, b);
+            bool first = true;
+            for (int p = 0; p < nnbr; p++) {
+                if (g->idom[nbr[p]] < 0) continue;
+                const BitWord *y = df_row(df, result, nbr[p]);
+                for (int w = 0; w < nw; w++) {
+                    if (first) x[w] = y[w];
+                    else if (df->must) x[w] &= y[w];
+                    else x[w] |= y[w];
+                }
+                first = false;
+            }
+            bool at_boundary = df->forward ? b == 0 : nnbr == 0;
+            if (at_boundary) {
+                for (int w = 0; w < nw; w++) {
+                    BitWord v = boundary ? boundary[w] : 0;
+                    x[w] = first ? v : df->must ? x[w] & v : x[w] | v;
+                }
+            } else if (first) {
+                memset(x, 0, row_bytes(df));
+            }
+
+            const BitWord *gen = df_row(df, df->gen, b), *kill = df_row(df, df->kill, b);
+            BitWord *r = df_row(df, result, b);
+            bool diff = false;
+            for (int w = 0; w < nw; w++) {
+                tmp[w] = gen[w] | (x[w] & ~kill[w]);
+                diff |= tmp[w] != r[w];
+            }
+            if (!diff) continue;
+            memcpy(r, tmp, row_bytes(df));
+            changed = true;
+            const int *next = df->forward ? bb->succ : bb->preds;
+            int nnext = df->forward ? bb->nsucc : bb->npreds;
+            for (int s = 0; s < nnext; s++) dirty[next[s]] = true;
+        }
+    }
+    free(tmp);
+    free(dirty);
+}
+
+static bool is_load(Opcode op) {
+    return op == OP_ILOAD || op == OP_FLOAD || op == OP_ALOAD || op == OP_LLOAD;
+}
+
+/* Backward, may: bit s is set in out[b] if slot s can be read after b
+ * before it is stored again. Raw instructions count as reading every slot. */
+void df_liveness(Dataflow *df, Cfg *g) {
+    const Method *m = g->m;
+    df_init(df, g, m->next_local, false, false);
+    for (int b = 0; b < g->nblocks; b++) {
+        BitWord *gen = df_row(df, df->gen, b), *kill = df_row(df, df->kill, b);
+        for (int i = g->blocks[b].end - 1; i >= g->blocks[b].start; i--) {
+            const Insn *in = &m->code[i];
+            if (opcode_flags(in->op) & OPF_STORE) {
+                bits_set(kill, in->ival);
+                bits_clear(gen, in->ival);
+            } else if (is_load(in->op)) {
+                bits_set(gen, in->ival);
+            } else if (in->op == OP_RAW) {
+                memset(gen, 0xff, row_bytes(df));
+            }
+        }
+    }
+    df_solve(df, NULL);
+}
+
+/* Forward, may. Bits [0, next_local) stand for the value a slot has on
+ * entry, and every store instruction i gets bit def_bit[i] (-1 for other
+ * instructions). */
+void df_reaching_defs(Dataflow *df, Cfg *g, int *def_bit) {
+    const Method *m = g->m;
+    int nslots = m->next_local, nbits = nslots;
+    for (int i = 0; i < m->len; i++) {
+        def_bit[i] = opcode_flags(m->code[i].op) & OPF_STORE ? nbits++ : -1;
+    }
+    df_init(df, g, nbits, true, false);
+
+    /* all definitions of each slot, entry value included */
+    BitWord *defs_of = calloc((size_t)(nslots + 1) * df->nwords, sizeof(BitWord));
+    for (int s = 0; s < nslots; s++) bits_set(df_row(df, defs_of, s), s);
+    for (int i = 0; i < m->len; i++) {
+        if (def_bit[i] >= 0) bits_set(df_row(df, defs_of, m->code[i].ival), def_bit[i]);
+    }
+    for (int b = 0; b < g->nblocks; b++) {
+        BitWord *gen = df_row(df, df->gen, b), *kill = df_row(df, df->kill, b);
+        for (int i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (def_bit[i] < 0) continue;
+            const BitWord *all = df_row(df, defs_of, m->code[i].ival);
+            for (int w = 0; w < df->nwords; w++) {
+                kill[w] |= all[w];
+                gen[w] &= ~all[w];
+            }
+            bits_set(gen, def_bit[i]);
+        }
+    }
+    free(defs_of);
+
+    BitWord *entry = calloc(df->nwords, sizeof(BitWord));
+    for (int s = 0; s < nslots; s++) bits_set(entry, s);
+    df_solve(df, entry);
+    free(entry);
+}
+
+static Opcode param_load(char c) {
+    switch (c) {
+    case 'I': case 'Z': return OP_ILOAD;
+    case 'F': return OP_FLOAD;
+    case 'J': return OP_LLOAD;
+    default: return OP_ALOAD;
+    }
+}
+
+/* The load a parameter slot is read with, OP_NOP if the slot is no parameter */
+static Opcode *param_loads(const Method *m) {
+    Opcode *kinds = calloc(m->next_local + 1, sizeof(Opcode));
+    const char *p = strchr(m->name, '(');
+    int slot = 0;
+    while (p && *++p && *p != ')') {
+        char c = *p;
+        while (*p == '[') p++;
+        if (*p == 'L') p = strchr(p, ';');
+        if (slot < m->next_local) kinds[slot] = param_load(c);
+        slot += c == 'J' ? 2 : 1;
+    }
+    return kinds;
+}
+
+/* Reports every load that can run before any store to its slot, other than
+ * a parameter read with its own type, to out. Returns the number of errors. */
+int report_uninitialized(Method *m, FILE *out) {
+    Cfg g;
+    Dataflow df;
+    int errors = 0;
+    cfg_build(&g, m);
+    if (g.nblocks == 0) {
+        cfg_free(&g);
+        return 0;
+    }
+    int *def_bit = malloc((m->len + 1) * sizeof(int));
+    Opcode *params = param_loads(m);
+    bool *reported = calloc(m->next_local + 1, sizeof(bool));
+    df_reaching_defs(&df, &g, def_bit);
+    BitWord *cur = malloc(df.nwords * sizeof(BitWord));
+    for (int b = 0; b < g.nblocks; b++) {
+        if (g.idom[b] < 0) continue;
+        memcpy(cur, df_row(&df, df.in, b), df.nwords * sizeof(BitWord));
+        for (int i = g.blocks[b].start; i < g.blocks[b].end; i++) {
+            const Insn *in = &m->code[i];
+            if (def_bit[i] >= 0) {
+                bits_clear(cur, in->ival);
+            } else if (is_load(in->op) && bits_test(cur, in->ival) &&
+                       params[in->ival] != in->op && !reported[in->ival]) {
+                const char *name = in->ival < m->nslot_names ? m->slot_names[in->ival] : NULL;
+                fprintf(out, "error:%d: used binding `%s` isn't initialized\n", in->lineno, name ? name : "?");
+                reported[in->ival] = true;
+                errors++;
+            }
+        }
+    }
+    free(cur);
+    free(reported);
+    free(params);
+    free(def_bit);
+    df_free(&df);
+    cfg_free(&g);
+    return errors;
+}
@@ -0,0 +1,7 @@
+fn main() {
+    let s: str = "The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal.";
+    println(s);
+    print("The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every character of this literal. The quick brown fox jumps over the lazy dog while the compiler keeps every chara");
+    println("");
+    println("done");
+}
@@ -0,0 +1,15 @@
+fn main() {
+    let mut x: i32 = 6;
+    let mut y: i32 = 0;
+    let mut i: i32 = 0;
+    while i < 5 {
+        let waste: i32 = x * 9 + i;
+        y = x * 2;
+        y = i + x;
+        x = x + i;
+        i = i + 1;
+    }
+    x * 3 + 1;
+    println(x);
+    println(y);
+}
@@ -0,0 +1,25 @@
+fn main() {
+    let a: i32 = 12;
+    let b: i32 = a * 4 - 6;
+    let c: i32 = (b + a) % 7 + (b << 2);
+    let f: f32 = 2.5;
+    let g: f32 = f * 4.0 + 0.25;
+    let h: i32 = g as i32 * 3;
+    let mut n: i32 = 0;
+    while b < 10 {
+        n = n + 1000;
+        println("never");
+    }
+    let mut m: i32 = 0;
+    while m < c {
+        m = m + a - 5;
+    }
+    println(b);
+    println(c);
+    println(g);
+    println(h);
+    println(n);
+    println(m);
+    println(b > 40 && a < 20);
+    println(-c + h * 2);
+}
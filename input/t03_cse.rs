@@ -0,0 +1,16 @@
+fn main() {
+    let mut a: i32 = 7;
+    let mut b: i32 = 0;
+    let mut x: f32 = 1.5;
+    let mut k: i32 = 0;
+    while k < 40 {
+        b = b + 3;
+        a = (a * b + 5) - (a * b + 5) / 3 + (a * b + 5) % 7;
+        x = x * 0.5 + (x * 0.5) / 2.0 + 1.0;
+        k = k + 1;
+    }
+    println(a);
+    println(x);
+    let s: i32 = (a + b) * (a + b) - (a - b) * (a - b);
+    println(s);
+}
@@ -0,0 +1,20 @@
+fn main() {
+    let mut w: i32 = 0;
+    let mut h: i32 = 3;
+    while w < 50 {
+        h = h + w % 3;
+        w = w + 1;
+    }
+    let scale: f32 = 0.5;
+    let mut i: i32 = 0;
+    let mut sum: i32 = 0;
+    let mut fsum: f32 = 0.0;
+    while i < 60 {
+        sum = sum + (w * h + 17) / 4 + i;
+        fsum = fsum + scale * 3.0;
+        i = i + 1;
+    }
+    println(h);
+    println(sum);
+    println(fsum);
+}
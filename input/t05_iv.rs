@@ -0,0 +1,20 @@
+fn main() {
+    let mut i: i32 = 3;
+    let mut acc: i32 = 0;
+    let mut total: i32 = 0;
+    while i < 60 {
+        acc = acc + i * 12 + 5;
+        total = total + (i * 8 - 1) % 5;
+        println(i * 4);
+        i = i + 3;
+    }
+    println(acc);
+    println(total);
+    let mut j: i32 = 0;
+    let mut steps: i32 = 0;
+    while j < 50 {
+        steps = steps + 1;
+        j = j + 5;
+    }
+    println(steps);
+}
@@ -0,0 +1,33 @@
+fn main() {
+    let mut i: i32 = 0;
+    while i < 10 {
+        print(i);
+        print(" ");
+        i = i + 1;
+    }
+    println("");
+    let n: i32 = 37;
+    let mut j: i32 = 0;
+    let mut p: i32 = 1;
+    while j < n {
+        p = p * 3 + j;
+        j = j + 2;
+    }
+    println(p);
+    let mut k: i32 = 100;
+    let mut f: f32 = 1.0;
+    while k > 0 {
+        f = f * 1.125 - 0.0625;
+        k = k - 7;
+    }
+    println(f);
+    let mut lim: i32 = p % 50 + 20;
+    let mut r: i32 = 0;
+    let mut cnt: i32 = 0;
+    while r < lim {
+        cnt = cnt + r % 4;
+        r = r + 1;
+    }
+    println(lim);
+    println(cnt);
+}
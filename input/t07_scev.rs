@@ -0,0 +1,28 @@
+fn main() {
+    let mut i: i32 = 0;
+    let mut s: i32 = 0;
+    let mut q: i32 = 5;
+    while i < 1000 {
+        s = s + i;
+        q = q + i * i + 3 * i + 1;
+        i = i + 1;
+    }
+    println(i);
+    println(s);
+    println(q);
+    let mut w: i32 = 0;
+    let mut big: i32 = 0;
+    while w < 100000 {
+        big = big + w * w;
+        w = w + 1;
+    }
+    println(big);
+    let mut m: i32 = 0;
+    let mut limit: i32 = s / 1000;
+    let mut t: i32 = 0;
+    while m < limit {
+        t = t + 2 * m + 1;
+        m = m + 1;
+    }
+    println(t);
+}
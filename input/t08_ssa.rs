@@ -0,0 +1,32 @@
+fn main() {
+    let mut a: i32 = 1;
+    let mut b: i32 = 2;
+    let mut c: i32 = 0;
+    let mut i: i32 = 0;
+    while i < 12 {
+        c = a + b;
+        a = b;
+        b = c;
+        let mut j: i32 = 0;
+        while j < i % 3 {
+            let t: i32 = a;
+            a = b - t;
+            b = t + j;
+            j = j + 1;
+        }
+        println(a + b * c);
+        i = i + 1;
+    }
+    let mut x: f32 = 0.5;
+    let mut y: f32 = 2.0;
+    let mut n: i32 = 0;
+    while n < 5 {
+        let tmp: f32 = x;
+        x = y;
+        y = tmp + y;
+        n = n + 1;
+    }
+    println(x);
+    println(y);
+    println(a > b || c == 0);
+}
@@ -0,0 +1,126 @@
+/* Client of the warm JVM (JvmService.java): sends one request over its
+ * Unix socket and starts the service first if none answers, so only the
+ * first job of a session pays for a JVM start.
+ *
+ * usage: jvmc run <file.j>             assemble and run, as make run
+ *        jvmc assemble <dir> <file.j>  as java -jar jasmin.jar -d <dir>
+ *        jvmc stop
+ * The socket is $HW3_JVM_SOCKET, or /tmp/hw3-jvm-<uid>.sock. The program's
+ * output goes to stdout and messages to stderr; the exit status is 0 only
+ * if the request succeeded. */
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define START_TIMEOUT_MS 10000
+
+static int connect_to(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Starts the service in the background, detached from the terminal */
+static void start_service(const char *path) {
+    if (fork() != 0) return;
+    setsid();
+    FILE *null = fopen("/dev/null", "r+");
+    if (null) {
+        dup2(fileno(null), 0);
+        dup2(fileno(null), 1);
+        dup2(fileno(null), 2);
+    }
+    execlp("java", "java", "-cp", "jasmin.jar:.", "JvmService", path, (char *)NULL);
+    _exit(127);
+}
+
+static bool write_all(int fd, const char *s, size_t n) {
+    while (n > 0) {
+        ssize_t k = write(fd, s, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        s += k;
+        n -= k;
+    }
+    return true;
+}
+
+/* Copies n bytes of the reply to out */
+static bool copy_reply(FILE *in, size_t n, FILE *out) {
+    char chunk[8192];
+    while (n > 0) {
+        size_t k = fread(chunk, 1, n < sizeof(chunk) ? n : sizeof(chunk), in);
+        if (k == 0) return false;
+        fwrite(chunk, 1, k, out);
+        n -= k;
+    }
+    return true;
+}
+
+static const char *usage = "usage: jvmc run <file.j> | jvmc assemble <dir> <file.j> | jvmc stop\n";
+
+int main(int argc, char *argv[]) {
+    /* the service may run in another directory, so paths go absolute */
+    char request[2 * PATH_MAX + 32], file[PATH_MAX], dir[PATH_MAX];
+    if (argc == 3 && strcmp(argv[1], "run") == 0 && realpath(argv[2], file)) {
+        snprintf(request, sizeof(request), "run %s\n", file);
+    } else if (argc == 4 && strcmp(argv[1], "assemble") == 0 && realpath(argv[2], dir) && realpath(argv[3], file)) {
+        snprintf(request, sizeof(request), "assemble %s %s\n", dir, file);
+    } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        snprintf(request, sizeof(request), "stop\n");
+    } else {
+        fputs(argc >= 3 ? "jvmc: no such file or directory\n" : usage, stderr);
+        return 2;
+    }
+
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    if (getenv("HW3_JVM_SOCKET"))
+        snprintf(path, sizeof(path), "%s", getenv("HW3_JVM_SOCKET"));
+    else
+        snprintf(path, sizeof(path), "/tmp/hw3-jvm-%d.sock", (int)getuid());
+
+    int fd = connect_to(path);
+    if (fd < 0) {
+        if (strcmp(argv[1], "stop") == 0) return 0;
+        start_service(path);
+        struct timespec pause = { 0, 50 * 1000000L };
+        for (int waited = 0; fd < 0 && waited < START_TIMEOUT_MS; waited += 50) {
+            nanosleep(&pause, NULL);
+            fd = connect_to(path);
+        }
+        if (fd < 0) {
+            fprintf(stderr, "jvmc: the JVM service did not start (is java 16 or later on the PATH?)\n");
+            return 1;
+        }
+    }
+    if (!write_all(fd, request, strlen(request))) {
+        fprintf(stderr, "jvmc: cannot reach the JVM service\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "stop") == 0) return 0;
+
+    FILE *in = fdopen(fd, "rb");
+    char status[32];
+    long asm_us, run_us;
+    size_t out_len, msg_len;
+    if (fscanf(in, "%31s %ld %ld %zu %zu", status, &asm_us, &run_us, &out_len, &msg_len) != 5 || fgetc(in) != '\n' ||
+        !copy_reply(in, out_len, stdout) || !copy_reply(in, msg_len, stderr)) {
+        fprintf(stderr, "jvmc: bad reply from the JVM service\n");
+        return 1;
+    }
+    fclose(in);
+    return strcmp(status, "ok") == 0 ? 0 : 1;
+}
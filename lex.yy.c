@@ -584,16 +584,21 @@ char *yytext;
 #line 3 "compiler.l"
     #include "compiler_common.h"
     #include "y.tab.h"	/* header file generated by bison */
-    extern YYSTYPE yylval;
+    /* the parser is pure and passes where each token's value goes */
+    #define YY_DECL int yylex(YYSTYPE *yylval_p)
+    #define yylval (*yylval_p)
 
     #define YY_NO_UNPUT
     #define YY_NO_INPUT
     #define XXX printf("not implemented yet!\n")
-#line 593 "lex.yy.c"
+    /* unmatched input, i.e. the newlines, is echoed only at -vv */
+    #define ECHO do { if (g_opt.verbose >= 2 && fwrite(yytext, (size_t)yyleng, 1, yyout)) {} } while (0)
+    static int eof_seen = 0;  /* the second EOF ends a file; lex_reset rearms it */
+#line 598 "lex.yy.c"
 /* Define regular expression label */
 
 /* Rules section */
-#line 597 "lex.yy.c"
+#line 602 "lex.yy.c"
 
 #define INITIAL 0
 #define CMT 1
@@ -812,10 +817,10 @@ YY_DECL
 		}
 
 	{
-#line 24 "compiler.l"
+#line 29 "compiler.l"
 
 
-#line 819 "lex.yy.c"
+#line 824 "lex.yy.c"
 
 	while ( /*CONSTCOND*/1 )		/* loops until end-of-file is reached */
 		{
@@ -884,40 +889,40 @@ do_action:	/* This label is used only to access EOF actions. */
 
 case 1:
 YY_RULE_SETUP
-#line 26 "compiler.l"
+#line 31 "compiler.l"
 { BEGIN(CMT); }
 	YY_BREAK
 case 2:
 YY_RULE_SETUP
-#line 27 "compiler.l"
+#line 32 "compiler.l"
 { BEGIN(INITIAL); }
 	YY_BREAK
 case 3:
 /* rule 3 can match eol */
 YY_RULE_SETUP
-#line 28 "compiler.l"
+#line 33 "compiler.l"
 {;}
 	YY_BREAK
 case 4:
 YY_RULE_SETUP
-#line 29 "compiler.l"
+#line 34 "compiler.l"
 {;}
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 30 "compiler.l"
+#line 35 "compiler.l"
 {;}
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 31 "compiler.l"
+#line 36 "compiler.l"
 { BEGIN(STRCOND);
                 return '"';
             }
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 34 "compiler.l"
+#line 39 "compiler.l"
 { BEGIN(INITIAL);
                 return '"';
             }
@@ -925,316 +930,316 @@ YY_RULE_SETUP
 case 8:
 /* rule 8 can match eol */
 YY_RULE_SETUP
-#line 37 "compiler.l"
+#line 42 "compiler.l"
 { yylval.s_val = strdup(yytext);
                 return STRING_LIT;
             }
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 40 "compiler.l"
+#line 45 "compiler.l"
 { return STR; }
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 41 "compiler.l"
+#line 46 "compiler.l"
 { return RSHIFT; }
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 42 "compiler.l"
+#line 47 "compiler.l"
 { return LSHIFT; }
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 43 "compiler.l"
+#line 48 "compiler.l"
 { return '+'; }
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 44 "compiler.l"
+#line 49 "compiler.l"
 { return '-'; }
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 45 "compiler.l"
+#line 50 "compiler.l"
 { return '*'; }
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 46 "compiler.l"
+#line 51 "compiler.l"
 { return '/'; }
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 47 "compiler.l"
+#line 52 "compiler.l"
 { return '%'; }
 	YY_BREAK
 case 17:
 YY_RULE_SETUP
-#line 48 "compiler.l"
+#line 53 "compiler.l"
 { return '>'; }
 	YY_BREAK
 case 18:
 YY_RULE_SETUP
-#line 49 "compiler.l"
+#line 54 "compiler.l"
 { return '<'; }
 	YY_BREAK
 case 19:
 YY_RULE_SETUP
-#line 50 "compiler.l"
+#line 55 "compiler.l"
 { return GEQ; }
 	YY_BREAK
 case 20:
 YY_RULE_SETUP
-#line 51 "compiler.l"
+#line 56 "compiler.l"
 { return LEQ; }
 	YY_BREAK
 case 21:
 YY_RULE_SETUP
-#line 52 "compiler.l"
+#line 57 "compiler.l"
 { return EQL; }
 	YY_BREAK
 case 22:
 YY_RULE_SETUP
-#line 53 "compiler.l"
+#line 58 "compiler.l"
 { return NEQ; }
 	YY_BREAK
 case 23:
 YY_RULE_SETUP
-#line 54 "compiler.l"
+#line 59 "compiler.l"
 { return '='; }
 	YY_BREAK
 case 24:
 YY_RULE_SETUP
-#line 55 "compiler.l"
+#line 60 "compiler.l"
 { return ADD_ASSIGN; }
 	YY_BREAK
 case 25:
 YY_RULE_SETUP
-#line 56 "compiler.l"
+#line 61 "compiler.l"
 { return SUB_ASSIGN; }
 	YY_BREAK
 case 26:
 YY_RULE_SETUP
-#line 57 "compiler.l"
+#line 62 "compiler.l"
 { return MUL_ASSIGN; }
 	YY_BREAK
 case 27:
 YY_RULE_SETUP
-#line 58 "compiler.l"
+#line 63 "compiler.l"
 { return DIV_ASSIGN; }
 	YY_BREAK
 case 28:
 YY_RULE_SETUP
-#line 59 "compiler.l"
+#line 64 "compiler.l"
 { return REM_ASSIGN; }
 	YY_BREAK
 case 29:
 YY_RULE_SETUP
-#line 60 "compiler.l"
+#line 65 "compiler.l"
 { return LAND; }
 	YY_BREAK
 case 30:
 YY_RULE_SETUP
-#line 61 "compiler.l"
+#line 66 "compiler.l"
 { return LOR; }
 	YY_BREAK
 case 31:
 YY_RULE_SETUP
-#line 62 "compiler.l"
+#line 67 "compiler.l"
 { return '!'; }
 	YY_BREAK
 case 32:
 YY_RULE_SETUP
-#line 63 "compiler.l"
+#line 68 "compiler.l"
 { return '&'; }
 	YY_BREAK
 case 33:
 YY_RULE_SETUP
-#line 64 "compiler.l"
+#line 69 "compiler.l"
 { return '|'; }
 	YY_BREAK
 case 34:
 YY_RULE_SETUP
-#line 65 "compiler.l"
+#line 70 "compiler.l"
 { return '~'; }
 	YY_BREAK
 case 35:
 YY_RULE_SETUP
-#line 66 "compiler.l"
+#line 71 "compiler.l"
 { return '('; }
 	YY_BREAK
 case 36:
 YY_RULE_SETUP
-#line 67 "compiler.l"
+#line 72 "compiler.l"
 { return ')'; }
 	YY_BREAK
 case 37:
 YY_RULE_SETUP
-#line 68 "compiler.l"
+#line 73 "compiler.l"
 { return '['; }
 	YY_BREAK
 case 38:
 YY_RULE_SETUP
-#line 69 "compiler.l"
+#line 74 "compiler.l"
 { return ']'; }
 	YY_BREAK
 case 39:
 YY_RULE_SETUP
-#line 70 "compiler.l"
+#line 75 "compiler.l"
 { return '{'; }
 	YY_BREAK
 case 40:
 YY_RULE_SETUP
-#line 71 "compiler.l"
+#line 76 "compiler.l"
 { return '}'; }
 	YY_BREAK
 case 41:
 YY_RULE_SETUP
-#line 72 "compiler.l"
+#line 77 "compiler.l"
 { return ':'; }
 	YY_BREAK
 case 42:
 YY_RULE_SETUP
-#line 73 "compiler.l"
+#line 78 "compiler.l"
 { return ';'; }
 	YY_BREAK
 case 43:
 YY_RULE_SETUP
-#line 74 "compiler.l"
+#line 79 "compiler.l"
 { return ','; }
 	YY_BREAK
 case 44:
 YY_RULE_SETUP
-#line 75 "compiler.l"
+#line 80 "compiler.l"
 { return ARROW; }
 	YY_BREAK
 case 45:
 YY_RULE_SETUP
-#line 76 "compiler.l"
+#line 81 "compiler.l"
 { return PRINT; }
 	YY_BREAK
 case 46:
 YY_RULE_SETUP
-#line 77 "compiler.l"
+#line 82 "compiler.l"
 { return PRINTLN; }
 	YY_BREAK
 case 47:
 YY_RULE_SETUP
-#line 78 "compiler.l"
+#line 83 "compiler.l"
 { return DOTDOT; }
 	YY_BREAK
 case 48:
 YY_RULE_SETUP
-#line 79 "compiler.l"
+#line 84 "compiler.l"
 { return AS; }
 	YY_BREAK
 case 49:
 YY_RULE_SETUP
-#line 80 "compiler.l"
+#line 85 "compiler.l"
 { return IF; }
 	YY_BREAK
 case 50:
 YY_RULE_SETUP
-#line 81 "compiler.l"
+#line 86 "compiler.l"
 { return ELSE; }
 	YY_BREAK
 case 51:
 YY_RULE_SETUP
-#line 82 "compiler.l"
+#line 87 "compiler.l"
 { return FOR; }
 	YY_BREAK
 case 52:
 YY_RULE_SETUP
-#line 83 "compiler.l"
+#line 88 "compiler.l"
 { return WHILE; }
 	YY_BREAK
 case 53:
 YY_RULE_SETUP
-#line 84 "compiler.l"
+#line 89 "compiler.l"
 {return LOOP; }
 	YY_BREAK
 case 54:
 YY_RULE_SETUP
-#line 85 "compiler.l"
+#line 90 "compiler.l"
 { return INT; }
 	YY_BREAK
 case 55:
 YY_RULE_SETUP
-#line 86 "compiler.l"
+#line 91 "compiler.l"
 { return FLOAT;}
 	YY_BREAK
 case 56:
 YY_RULE_SETUP
-#line 87 "compiler.l"
+#line 92 "compiler.l"
 { return BOOL; }
 	YY_BREAK
 case 57:
 YY_RULE_SETUP
-#line 88 "compiler.l"
+#line 93 "compiler.l"
 { return TRUE; }
 	YY_BREAK
 case 58:
 YY_RULE_SETUP
-#line 89 "compiler.l"
+#line 94 "compiler.l"
 { return FALSE; }
 	YY_BREAK
 case 59:
 YY_RULE_SETUP
-#line 90 "compiler.l"
+#line 95 "compiler.l"
 { return FUNC; }
 	YY_BREAK
 case 60:
 YY_RULE_SETUP
-#line 91 "compiler.l"
+#line 96 "compiler.l"
 { return RETURN; }
 	YY_BREAK
 case 61:
 YY_RULE_SETUP
-#line 92 "compiler.l"
+#line 97 "compiler.l"
 { return LET; }
 	YY_BREAK
 case 62:
 YY_RULE_SETUP
-#line 93 "compiler.l"
+#line 98 "compiler.l"
 { return IN; }
 	YY_BREAK
 case 63:
 YY_RULE_SETUP
-#line 94 "compiler.l"
+#line 99 "compiler.l"
 { return MUT; }
 	YY_BREAK
 case 64:
 YY_RULE_SETUP
-#line 95 "compiler.l"
+#line 100 "compiler.l"
 { return BREAK; }
 	YY_BREAK
 case 65:
 YY_RULE_SETUP
-#line 96 "compiler.l"
+#line 101 "compiler.l"
 { yylval.i_val = atoi(yytext);
                 return INT_LIT;
             }
 	YY_BREAK
 case 66:
 YY_RULE_SETUP
-#line 99 "compiler.l"
+#line 104 "compiler.l"
 { yylval.f_val = atof(yytext);
                 return FLOAT_LIT;
             }
 	YY_BREAK
 case 67:
 YY_RULE_SETUP
-#line 102 "compiler.l"
+#line 107 "compiler.l"
 { yylval.s_val = strdup(yytext); return ID;}
 	YY_BREAK
 case YY_STATE_EOF(INITIAL):
 case YY_STATE_EOF(CMT):
 case YY_STATE_EOF(STRCOND):
-#line 103 "compiler.l"
-{ static int once = 0;
-                if (once++) {
+#line 108 "compiler.l"
+{
+                if (eof_seen++) {
                     yyterminate();
                 }
                 yylineno++;
@@ -1243,15 +1248,15 @@ case YY_STATE_EOF(STRCOND):
 	YY_BREAK
 case 68:
 YY_RULE_SETUP
-#line 110 "compiler.l"
+#line 115 "compiler.l"
 {;}
 	YY_BREAK
 case 69:
 YY_RULE_SETUP
-#line 111 "compiler.l"
+#line 116 "compiler.l"
 ECHO;
 	YY_BREAK
-#line 1255 "lex.yy.c"
+#line 1260 "lex.yy.c"
 
 	case YY_END_OF_BUFFER:
 		{
@@ -2266,10 +2271,17 @@ void yyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 111 "compiler.l"
+#line 116 "compiler.l"
 
 /*  C Code section */
 int yywrap(void)
 {
     return 1;
 }
+
+/* Starts scanning f as if the process were fresh */
+void lex_reset(FILE *f)
+{
+    eof_seen = 0;
+    yyrestart(f);
+}
@@ -0,0 +1,310 @@
+/* Local value numbering inside basic blocks.
+ *
+ * Each block is simulated on a stack of value numbers. Loads take the
+ * number of the slot's current value and stores give the slot a new one,
+ * so two expressions with the same number compute the same value. When a
+ * pure expression tree is computed again, its first result is kept in a
+ * fresh local (dup + store) and the later trees become a single load.
+ *
+ * Int arithmetic wraps the same way every time, so reusing a result never
+ * changes i32 overflow behaviour. Float operations are only merged when
+ * operator and operands match exactly; nothing is reassociated or
+ * commuted, so rounding is unchanged. */
+#include "compiler_common.h"
+
+typedef struct {
+    int vn;
+    int start; /* first instruction of the tree that produced it, -1 if none */
+} Entry;
+
+typedef struct {
+    int op, a, b, vn;
+} Key;
+
+typedef struct {
+    int vn, start, end;
+} Occurrence;
+
+typedef struct {
+    Key *keys;
+    int cap, nkeys;
+    int next_vn;
+    bool *is_float;  /* per value number */
+    int *def_at;     /* per value number: instruction that first computed it */
+    int vn_cap;
+} Table;
+
+static int new_vn(Table *t, bool is_float, int def_at) {
+    if (t->next_vn == t->vn_cap) {
+        t->vn_cap = t->vn_cap ? t->vn_cap * 2 : 64;
+        t->is_float = realloc(t->is_float, t->vn_cap * sizeof(bool));
+        t->def_at = realloc(t->def_at, t->vn_cap * sizeof(int));
+    }
+    t->is_float[t->next_vn] = is_float;
+    t->def_at[t->next_vn] = def_at;
+    return t->next_vn++;
+}
+
+static unsigned hash_key(int op, int a, int b) {
+    unsigned h = (unsigned)op * 2654435761u;
+    h ^= (unsigned)a * 40503u + 0x9e3779b9u + (h << 6) + (h >> 2);
+    h ^= (unsigned)b * 97u + 0x9e3779b9u + (h << 6) + (h >> 2);
+    return h;
+}
+
+static void table_grow(Table *t);
+
+/* Value number for (op, a, b); *found tells whether it existed before */
+static int table_lookup(Table *t, int op, int a, int b, bool is_float, int def_at, bool *found) {
+    if (t->cap == 0 || t->nkeys * 2 >= t->cap) table_grow(t);
+    unsigned i = hash_key(op, a, b) & (t->cap - 1);
+    while (t->keys[i].vn >= 0) {
+        Key *k = &t->keys[i];
+        if (k->op == op && k->a == a && k->b == b) {
+            *found = true;
+            return k->vn;
+        }
+        i = (i + 1) & (t->cap - 1);
+    }
+    *found = false;
+    Key k = { op, a, b, new_vn(t, is_float, def_at) };
+    t->keys[i] = k;
+    t->nkeys++;
+    return k.vn;
+}
+
+static void table_grow(Table *t) {
+    Key *old = t->keys;
+    int old_cap = t->cap;
+    t->cap = t->cap ? t->cap * 2 : 256;
+    t->keys = malloc(t->cap * sizeof(Key));
+    for (int i = 0; i < t->cap; i++) t->keys[i].vn = -1;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].vn < 0) continue;
+        unsigned j = hash_key(old[i].op, old[i].a, old[i].b) & (t->cap - 1);
+        while (t->keys[j].vn >= 0) j = (j + 1) & (t->cap - 1);
+        t->keys[j] = old[i];
+    }
+    free(old);
+}
+
+static bool is_commutative_int(Opcode op) {
+    return op == OP_IADD || op == OP_IMUL || op == OP_IAND || op == OP_IOR || op == OP_IXOR;
+}
+
+/* Operators whose repeated evaluation can reuse the first result. Division
+ * may throw, but a repeat with the same operands cannot once the first
+ * one has completed. */
+static bool is_numberable(Opcode op) {
+    switch (op) {
+    case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IREM: case OP_INEG:
+    case OP_ISHL: case OP_ISHR: case OP_IUSHR: case OP_IAND: case OP_IOR: case OP_IXOR:
+    case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV: case OP_FNEG:
+    case OP_I2F: case OP_F2I: case OP_FCMPL: case OP_FCMPG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* A tree can be replaced by a load if it only computes, and if it pushes
+ * exactly one value without consuming anything from below it. */
+static bool removable_tree(const Method *m, int start, int end) {
+    int depth = 0;
+    for (int i = start; i <= end; i++) {
+        const Insn *in = &m->code[i];
+        if (!(opcode_flags(in->op) & OPF_PURE) && !is_numberable(in->op)) return false;
+        if (in->op == OP_LABEL || in->op == OP_DUP || in->op == OP_SWAP) return false;
+        depth -= insn_pops(in);
+        if (depth < 0) return false;
+        depth += insn_pushes(in);
+    }
+    return depth == 1;
+}
+
+/* Numbers one block and appends its redundant trees to occ */
+static void number_block(const Method *m, const BasicBlock *bb, int in_depth, Table *t,
+                         Occurrence **occ, int *nocc, int *occ_cap) {
+    int nlocals = m->next_local;
+    int *slot_vn = malloc((nlocals + 1) * sizeof(int));
+    Entry *stack = malloc((bb->end - bb->start + in_depth + 1) * sizeof(Entry));
+    int sp = 0;
+    bool found;
+
+    for (int k = 0; k <= nlocals; k++) slot_vn[k] = -1;
+    for (int k = 0; k < in_depth; k++) {
+        stack[sp].vn = new_vn(t, false, -1);
+        stack[sp++].start = -1;
+    }
+    for (int i = bb->start; i < bb->end; i++) {
+        const Insn *in = &m->code[i];
+        Entry e, a, b;
+        switch (in->op) {
+        case OP_ICONST:
+        case OP_FCONST: {
+            int bits;
+            memcpy(&bits, in->op == OP_ICONST ? (const void *)&in->ival : (const void *)&in->fval, sizeof(int));
+            e.vn = table_lookup(t, in->op, bits, 0, in->op == OP_FCONST, i, &found);
+            e.start = i;
+            stack[sp++] = e;
+            continue;
+        }
+        case OP_ILOAD:
+        case OP_FLOAD:
+        case OP_ALOAD:
+            if (slot_vn[in->ival] < 0) slot_vn[in->ival] = new_vn(t, in->op == OP_FLOAD, -1);
+            e.vn = slot_vn[in->ival];
+            e.start = in->op == OP_ALOAD ? -1 : i;
+            stack[sp++] = e;
+            continue;
+        case OP_ISTORE:
+        case OP_FSTORE:
+        case OP_ASTORE:
+            slot_vn[in->ival] = stack[--sp].vn;
+            continue;
+        case OP_DUP:
+            e.vn = stack[sp - 1].vn;
+            e.start = -1;
+            stack[sp - 1].start = -1;
+            stack[sp++] = e;
+            continue;
+        case OP_SWAP:
+            a = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = a;
+            stack[sp - 1].start = stack[sp - 2].start = -1;
+            continue;
+        default:
+            break;
+        }
+
+        int pops = insn_pops(in);
+        if (!is_numberable(in->op)) {
+            sp -= pops;
+            for (int k = 0; k < insn_pushes(in); k++) {
+                stack[sp].vn = new_vn(t, false, -1);
+                stack[sp++].start = -1;
+            }
+            continue;
+        }
+        b = stack[sp - 1];
+        a = pops == 2 ? stack[sp - 2] : b;
+        sp -= pops;
+        int va = pops == 2 ? a.vn : b.vn, vb = pops == 2 ? b.vn : -1;
+        if (is_commutative_int(in->op) && va > vb) {
+            int tmp = va;
+            va = vb;
+            vb = tmp;
+        }
+        e.vn = table_lookup(t, in->op, va, vb, opcode_yields_float(in->op), i, &found);
+        e.start = (a.start >= 0 && b.start >= 0) ? a.start : -1;
+        if (found && e.start >= 0 && t->def_at[e.vn] >= 0) {
+            if (*nocc == *occ_cap) {
+                *occ_cap = *occ_cap ? *occ_cap * 2 : 16;
+                *occ = realloc(*occ, *occ_cap * sizeof(Occurrence));
+            }
+            Occurrence o = { e.vn, e.start, i };
+            (*occ)[(*nocc)++] = o;
+        }
+        stack[sp++] = e;
+    }
+    free(slot_vn);
+    free(stack);
+}
+
+static int cmp_occurrence(const void *x, const void *y) {
+    const Occurrence *a = x, *b = y;
+    if (a->start != b->start) return a->start - b->start;
+    return b->end - a->end;
+}
+
+int pass_cse(Method *m) {
+    Cfg g;
+    Table t;
+    Occurrence *occ = NULL;
+    int nocc = 0, occ_cap = 0, changes = 0;
+
+    cfg_build(&g, m);
+    int *depth = malloc((g.nblocks + 1) * sizeof(int));
+    if (g.nblocks == 0 || cfg_stack_depths(&g, depth) < 0) {
+        free(depth);
+        cfg_free(&g);
+        return 0;
+    }
+    memset(&t, 0, sizeof(t));
+    for (int b = 0; b < g.nblocks; b++) {
+        if (depth[b] < 0) continue;
+        free(t.keys);
+        t.keys = NULL;
+        t.cap = t.nkeys = 0;
+        number_block(m, &g.blocks[b], depth[b], &t, &occ, &nocc, &occ_cap);
+    }
+
+    /* Keep the outermost trees; nested repeats go away with them */
+    qsort(occ, nocc, sizeof(Occurrence), cmp_occurrence);
+    int kept = 0, last_end = -1;
+    for (int k = 0; k < nocc; k++) {
+        if (occ[k].start <= last_end || !removable_tree(m, occ[k].start, occ[k].end)) continue;
+        occ[kept++] = occ[k];
+        last_end = occ[k].end;
+    }
+
+    /* A reuse pays off once the removed instructions outweigh the extra
+     * dup/store at the first computation. */
+    int *saved = calloc(t.next_vn + 1, sizeof(int));
+    int *temp = malloc((t.next_vn + 1) * sizeof(int));
+    for (int k = 0; k < kept; k++) saved[occ[k].vn] += occ[k].end - occ[k].start;
+    for (int v = 0; v < t.next_vn; v++) temp[v] = saved[v] > 2 ? method_new_local(m) : -1;
+
+    int *replace_end = malloc((m->len + 1) * sizeof(int));
+    int *replace_vn = malloc((m->len + 1) * sizeof(int));
+    int *def_vn = malloc((m->len + 1) * sizeof(int));
+    for (int i = 0; i <= m->len; i++) replace_end[i] = def_vn[i] = -1;
+    for (int k = 0; k < kept; k++) {
+        int v = occ[k].vn;
+        if (temp[v] < 0) continue;
+        replace_end[occ[k].start] = occ[k].end;
+        replace_vn[occ[k].start] = v;
+        def_vn[t.def_at[v]] = v;
+    }
+
+    int cap = m->len * 3 + 1;
+    Insn *out = malloc(cap * sizeof(Insn));
+    int len = 0;
+    for (int i = 0; i < m->len; i++) {
+        if (replace_end[i] >= 0) {
+            int v = replace_vn[i];
+            for (int k = i; k <= replace_end[i]; k++) free(m->code[k].sval);
+            Insn load = { t.is_float[v] ? OP_FLOAD : OP_ILOAD, temp[v], 0, NULL, m->code[i].lineno };
+            out[len++] = load;
+            i = replace_end[i];
+            changes++;
+            continue;
+        }
+        out[len++] = m->code[i];
+        if (def_vn[i] >= 0) {
+            int v = def_vn[i];
+            Insn dup = { OP_DUP, 0, 0, NULL, m->code[i].lineno };
+            Insn store = { t.is_float[v] ? OP_FSTORE : OP_ISTORE, temp[v], 0, NULL, m->code[i].lineno };
+            out[len++] = dup;
+            out[len++] = store;
+        }
+    }
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = cap;
+
+    free(replace_end);
+    free(replace_vn);
+    free(def_vn);
+    free(saved);
+    free(temp);
+    free(occ);
+    free(t.keys);
+    free(t.is_float);
+    free(t.def_at);
+    free(depth);
+    cfg_free(&g);
+    return changes;
+}
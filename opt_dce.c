@@ -0,0 +1,167 @@
+/* Dead code elimination: unreachable blocks, jumps to the next
+ * instruction, unused labels, stores whose value is never read and pure
+ * computations whose result is popped. Prints and calls always stay. */
+#include "compiler_common.h"
+
+static int remove_unreachable(Method *m) {
+    Cfg g;
+    int removed = 0;
+    cfg_build(&g, m);
+    for (int b = 0; b < g.nblocks; b++) {
+        if (g.blocks[b].reachable) continue;
+        for (int i = g.blocks[b].start; i < g.blocks[b].end; i++) {
+            m->code[i].op = OP_NOP;
+            removed++;
+        }
+    }
+    cfg_free(&g);
+    return removed;
+}
+
+/* True if label lbl is placed in the run of labels right after insn i */
+static bool jumps_to_next(const Method *m, int i, int lbl) {
+    for (int j = i + 1; j < m->len; j++) {
+        if (m->code[j].op == OP_NOP) continue;
+        if (m->code[j].op != OP_LABEL) return false;
+        if (m->code[j].ival == lbl) return true;
+    }
+    return false;
+}
+
+/* Jumps to the next instruction become pops of their operands, and
+ * branches on constants become gotos or disappear. */
+static int fold_branches(Method *m) {
+    int changes = 0;
+    for (int i = 0; i < m->len; i++) {
+        Insn *in = &m->code[i];
+        if (!insn_is_branch(in)) continue;
+        int pops = insn_pops(in);
+        if (jumps_to_next(m, i, in->ival)) {
+            in->op = pops ? OP_POP : OP_NOP;
+            if (pops == 2) method_insert(m, i, OP_POP, 0);
+            changes++;
+            continue;
+        }
+        if (pops == 0 || i < pops) continue;
+        bool consts = true;
+        for (int k = 1; k <= pops; k++) consts &= m->code[i - k].op == OP_ICONST;
+        if (!consts) continue;
+        int a = m->code[i - pops].ival;
+        int b = pops == 2 ? m->code[i - 1].ival : 0;
+        for (int k = 1; k <= pops; k++) m->code[i - k].op = OP_NOP;
+        if (eval_compare(in->op, a, b))
+            in->op = OP_GOTO;
+        else
+            in->op = OP_NOP;
+        changes++;
+    }
+    return changes;
+}
+
+static int remove_unused_labels(Method *m) {
+    int changes = 0;
+    bool *used = calloc(m->nlabels + 1, sizeof(bool));
+    for (int i = 0; i < m->len; i++) {
+        if (insn_is_branch(&m->code[i])) used[m->code[i].ival] = true;
+    }
+    for (int i = 0; i < m->len; i++) {
+        if (m->code[i].op == OP_LABEL && !used[m->code[i].ival]) {
+            m->code[i].op = OP_NOP;
+            changes++;
+        }
+    }
+    free(used);
+    return changes;
+}
+
+/* A store whose slot is not live afterwards only pops */
+static int remove_dead_stores(Method *m) {
+    Cfg g;
+    Dataflow df;
+    int changes = 0;
+    cfg_build(&g, m);
+    if (g.nblocks == 0) {
+        cfg_free(&g);
+        return 0;
+    }
+    df_liveness(&df, &g);
+    BitWord *live = malloc(df.nwords * sizeof(BitWord));
+    for (int b = 0; b < g.nblocks; b++) {
+        if (g.idom[b] < 0) continue;
+        memcpy(live, df_row(&df, df.out, b), df.nwords * sizeof(BitWord));
+        for (int i = g.blocks[b].end - 1; i >= g.blocks[b].start; i--) {
+            Insn *in = &m->code[i];
+            if (opcode_flags(in->op) & OPF_STORE) {
+                if (!bits_test(live, in->ival)) {
+                    in->op = in->op == OP_LSTORE ? OP_LPOP : OP_POP;
+                    changes++;
+                }
+                bits_clear(live, in->ival);
+            } else if (in->op == OP_ILOAD || in->op == OP_FLOAD || in->op == OP_ALOAD || in->op == OP_LLOAD) {
+                bits_set(live, in->ival);
+            } else if (in->op == OP_RAW) {
+                memset(live, 0xff, df.nwords * sizeof(BitWord));
+            }
+        }
+    }
+    free(live);
+    df_free(&df);
+    cfg_free(&g);
+    return changes;
+}
+
+/* Walks each pop back into the instruction that produced the popped value:
+ * a pure producer is dropped and its own operands are popped instead. */
+static int remove_unused_values(Method *m) {
+    int changes = 0;
+    for (int i = 1; i < m->len; i++) {
+        if (m->code[i].op != OP_POP) continue;
+        int j = i - 1;
+        while (j >= 0 && m->code[j].op == OP_NOP) j--;
+        if (j >= 0 && m->code[j].op == OP_SWAP && i + 1 < m->len && m->code[i + 1].op == OP_POP) {
+            /* both swapped values are dropped anyway */
+            m->code[j].op = OP_NOP;
+            changes++;
+            i = j > 0 ? j - 1 : 0;
+            continue;
+        }
+        /* a pop only takes a one-word value, so long producers stay */
+        if (j < 0 || !insn_is_pure(m, j) || (opcode_flags(m->code[j].op) & OPF_LONG)) continue;
+        if (insn_pushes(&m->code[j]) != 1 && m->code[j].op != OP_DUP) continue;
+        int pops = insn_pops(&m->code[j]);
+        if (m->code[j].op == OP_DUP || pops == 0) {
+            m->code[j].op = OP_NOP;
+            m->code[i].op = OP_NOP;
+        } else if (pops == 1) {
+            m->code[j].op = OP_NOP;
+        } else if (pops == 2) {
+            if (m->code[j].op == OP_IDIV || m->code[j].op == OP_IREM) {
+                /* the non-zero divisor is the constant right before */
+                m->code[j - 1].op = OP_NOP;
+                m->code[j].op = OP_NOP;
+            } else {
+                m->code[j].op = OP_POP;
+            }
+        } else {
+            continue;
+        }
+        changes++;
+        /* the pop now refers to an earlier producer; look again */
+        i = j > 0 ? j - 1 : 0;
+    }
+    return changes;
+}
+
+int pass_dce(Method *m) {
+    int total = 0, changes;
+    do {
+        changes = remove_unreachable(m);
+        changes += fold_branches(m);
+        changes += remove_unused_labels(m);
+        changes += remove_dead_stores(m);
+        changes += remove_unused_values(m);
+        method_compact(m);
+        total += changes;
+    } while (changes);
+    return total;
+}
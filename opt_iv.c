@@ -0,0 +1,241 @@
+/* Induction variables and strength reduction.
+ *
+ * A basic induction variable is an int local whose only stores in a loop
+ * add a constant to itself (i = i + c). A product i * s (+ b) with constant
+ * s and b is then kept in a fresh local t: the preheader sets t = i * s + b
+ * and every increment of i also adds c * s to t, so the multiply in the
+ * loop becomes a load. Int arithmetic wraps, so (i + c) * s and i * s + c * s
+ * agree for every i.
+ *
+ * A basic induction variable that is read nowhere but in its own
+ * increments is dropped. Multiplies by a power of two become shifts, which
+ * give the same wrapped result for signed ints; divisions are left alone
+ * since a shift rounds negative values the other way. */
+#include "compiler_common.h"
+
+#define IV_MAX_ROUNDS 64
+
+typedef struct {
+    int at;    /* first instruction of the increment */
+    int slot;
+    int step;
+} Increment;
+
+typedef struct {
+    int slot, mul, add;
+    bool has_add;
+    int temp;
+} Derived;
+
+static int log2_exact(int v) {
+    if (v <= 1 || (v & (v - 1))) return -1;
+    int k = 0;
+    while ((1 << k) != v) k++;
+    return k;
+}
+
+/* x * 2^k -> x << k; exact for every int including overflow */
+static int multiplies_to_shifts(Method *m) {
+    int changes = 0;
+    for (int i = 1; i < m->len; i++) {
+        Insn *c = &m->code[i - 1];
+        if (m->code[i].op != OP_IMUL || c->op != OP_ICONST) continue;
+        int k = log2_exact(c->ival);
+        if (k < 0) continue;
+        c->ival = k;
+        m->code[i].op = OP_ISHL;
+        changes++;
+    }
+    return changes;
+}
+
+/* i = i + c written as "iload i; c; iadd|isub; istore i" or "c; iload i; iadd; istore i" */
+bool iv_match_increment(const Method *m, int at, int *slot, int *step) {
+    if (at + 3 >= m->len || m->code[at + 3].op != OP_ISTORE) return false;
+    const Insn *a = &m->code[at], *b = &m->code[at + 1], *op = &m->code[at + 2];
+    *slot = m->code[at + 3].ival;
+    if (a->op == OP_ILOAD && a->ival == *slot && b->op == OP_ICONST &&
+        (op->op == OP_IADD || op->op == OP_ISUB)) {
+        *step = op->op == OP_IADD ? b->ival : (int)(0u - (unsigned)b->ival);
+        return true;
+    }
+    if (a->op == OP_ICONST && b->op == OP_ILOAD && b->ival == *slot && op->op == OP_IADD) {
+        *step = a->ival;
+        return true;
+    }
+    return false;
+}
+
+/* i * s or s * i, optionally followed by "+ b"; returns the length or 0 */
+static int match_product(const Method *m, int at, const bool *basic, Derived *d) {
+    if (at + 2 >= m->len || m->code[at + 2].op != OP_IMUL) return 0;
+    const Insn *a = &m->code[at], *b = &m->code[at + 1];
+    if (a->op == OP_ILOAD && b->op == OP_ICONST) {
+        d->slot = a->ival;
+        d->mul = b->ival;
+    } else if (a->op == OP_ICONST && b->op == OP_ILOAD) {
+        d->slot = b->ival;
+        d->mul = a->ival;
+    } else {
+        return 0;
+    }
+    if (!basic[d->slot] || d->mul == 0 || d->mul == 1) return 0;
+    d->has_add = at + 4 < m->len && m->code[at + 3].op == OP_ICONST && m->code[at + 4].op == OP_IADD;
+    d->add = d->has_add ? m->code[at + 3].ival : 0;
+    return d->has_add ? 5 : 3;
+}
+
+static int find_derived(Derived *ds, int n, const Derived *d) {
+    for (int k = 0; k < n; k++) {
+        if (ds[k].slot == d->slot && ds[k].mul == d->mul &&
+            ds[k].has_add == d->has_add && ds[k].add == d->add)
+            return k;
+    }
+    return -1;
+}
+
+static Insn make_insn(Opcode op, int ival, int lineno) {
+    Insn in = { op, ival, 0, NULL, lineno };
+    return in;
+}
+
+static int reduce_loop(Method *m, Cfg *g, const Loop *lp) {
+    int nlocals = m->next_local;
+    int *stores = calloc(nlocals + 1, sizeof(int));
+    bool *basic = calloc(nlocals + 1, sizeof(bool));
+    int *inc_at = malloc((m->len + 1) * sizeof(int));
+    int *prod_at = malloc((m->len + 1) * sizeof(int));
+    int *prod_len = calloc(m->len + 1, sizeof(int));
+    Increment *incs = malloc((m->len + 1) * sizeof(Increment));
+    Derived *ds = malloc((m->len + 1) * sizeof(Derived));
+    int ninc = 0, nds = 0, changes = 0;
+
+    for (int i = 0; i <= m->len; i++) inc_at[i] = prod_at[i] = -1;
+    for (int b = 0; b < g->nblocks; b++) {
+        if (!lp->body[b]) continue;
+        for (int i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            Increment *inc = &incs[ninc];
+            if (i + 3 < g->blocks[b].end && iv_match_increment(m, i, &inc->slot, &inc->step)) {
+                inc->at = i;
+                basic[inc->slot] = true;
+                inc_at[i] = ninc++;
+                i += 3;
+            } else if (opcode_flags(m->code[i].op) & OPF_STORE) {
+                stores[m->code[i].ival]++;
+            }
+        }
+    }
+    for (int v = 0; v < nlocals; v++) basic[v] = basic[v] && stores[v] == 0;
+
+    /* products of a basic variable need a preheader for their start value;
+     * without one they are ordinary readers */
+    int head = cfg_preheader_at(g, lp);
+    int *readers = calloc(nlocals + 1, sizeof(int));
+    for (int i = 0; i < m->len; i++) {
+        if (inc_at[i] >= 0) {
+            i += 3;
+            continue;
+        }
+        Derived d;
+        int b = g->insn_block[i];
+        int len = head >= 0 && lp->body[b] ? match_product(m, i, basic, &d) : 0;
+        if (len && i + len <= g->blocks[b].end) {
+            int k = find_derived(ds, nds, &d);
+            if (k < 0) {
+                ds[nds] = d;
+                k = nds++;
+            }
+            prod_at[i] = k;
+            prod_len[i] = len;
+            i += len - 1;
+            continue;
+        }
+        if (m->code[i].op == OP_ILOAD) readers[m->code[i].ival]++;
+    }
+
+    bool any_dead = false;
+    for (int k = 0; k < ninc; k++) any_dead |= basic[incs[k].slot] && readers[incs[k].slot] == 0;
+    if (nds == 0 && !any_dead) goto done;
+
+    int pre = -1;
+    if (nds > 0) {
+        pre = method_new_label(m, "pre");
+        cfg_redirect_entries(g, lp, pre);
+        for (int k = 0; k < nds; k++) ds[k].temp = method_new_local(m);
+    }
+    int cap = m->len + 1 + nds * 6 + ninc * nds * 4;
+    Insn *out = malloc(cap * sizeof(Insn));
+    int len = 0;
+    for (int i = 0; i < m->len; i++) {
+        int lineno = m->code[i].lineno;
+        if (i == head && nds > 0) {
+            out[len++] = make_insn(OP_LABEL, pre, lineno);
+            for (int k = 0; k < nds; k++) {
+                out[len++] = make_insn(OP_ILOAD, ds[k].slot, lineno);
+                out[len++] = make_insn(OP_ICONST, ds[k].mul, lineno);
+                out[len++] = make_insn(OP_IMUL, 0, lineno);
+                if (ds[k].has_add) {
+                    out[len++] = make_insn(OP_ICONST, ds[k].add, lineno);
+                    out[len++] = make_insn(OP_IADD, 0, lineno);
+                }
+                out[len++] = make_insn(OP_ISTORE, ds[k].temp, lineno);
+            }
+        }
+        if (prod_at[i] >= 0) {
+            out[len++] = make_insn(OP_ILOAD, ds[prod_at[i]].temp, lineno);
+            i += prod_len[i] - 1;
+            changes++;
+            continue;
+        }
+        if (inc_at[i] >= 0) {
+            const Increment *inc = &incs[inc_at[i]];
+            if (basic[inc->slot] && readers[inc->slot] == 0) {
+                changes++;
+            } else {
+                for (int j = 0; j < 4; j++) out[len++] = m->code[i + j];
+            }
+            for (int k = 0; k < nds; k++) {
+                if (ds[k].slot != inc->slot) continue;
+                out[len++] = make_insn(OP_ILOAD, ds[k].temp, lineno);
+                out[len++] = make_insn(OP_ICONST, (int)((unsigned)inc->step * (unsigned)ds[k].mul), lineno);
+                out[len++] = make_insn(OP_IADD, 0, lineno);
+                out[len++] = make_insn(OP_ISTORE, ds[k].temp, lineno);
+            }
+            i += 3;
+            continue;
+        }
+        out[len++] = m->code[i];
+    }
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = cap;
+
+done:
+    free(stores);
+    free(basic);
+    free(inc_at);
+    free(prod_at);
+    free(prod_len);
+    free(incs);
+    free(ds);
+    free(readers);
+    return changes;
+}
+
+int pass_iv(Method *m) {
+    int total = 0;
+    for (int round = 0; round < IV_MAX_ROUNDS; round++) {
+        Cfg g;
+        int changes = 0;
+        cfg_build(&g, m);
+        if (g.nblocks > 0) {
+            cfg_find_loops(&g);
+            for (int l = 0; l < g.nloops && !changes; l++) changes = reduce_loop(m, &g, &g.loops[l]);
+        }
+        cfg_free(&g);
+        if (!changes) break;
+        total += changes;
+    }
+    return total + multiplies_to_shifts(m);
+}
@@ -0,0 +1,199 @@
+/* Loop-invariant code motion.
+ *
+ * A pure expression tree inside a loop whose loads only read slots the loop
+ * never stores computes the same value on every iteration. Such trees are
+ * computed once in a preheader in front of the loop header, kept in a fresh
+ * local, and the tree in the loop becomes a single load.
+ *
+ * Hoisted code runs even when the loop body does not, so only trees that
+ * cannot throw are moved: division needs a non-zero constant divisor.
+ * Loops are handled innermost first; after each hoist the CFG is rebuilt. */
+#include "compiler_common.h"
+
+#define LICM_MAX_ROUNDS 64
+
+typedef struct {
+    int start;      /* first instruction of the tree, -1 if not a tree */
+    bool invariant;
+    bool computes;  /* contains at least one operator */
+} Entry;
+
+typedef struct {
+    int start, end;
+} Range;
+
+static bool is_hoistable_op(const Method *m, int i) {
+    const Insn *in = &m->code[i];
+    int pops = insn_pops(in);
+    if (pops < 1 || pops > 2 || insn_pushes(in) != 1) return false;
+    if (in->op == OP_DUP || in->op == OP_SWAP || in->op == OP_INVOKESTATIC) return false;
+    if (opcode_flags(in->op) & OPF_LONG) return false;
+    return insn_is_pure(m, i);
+}
+
+static void add_range(Range **r, int *n, int *cap, int start, int end) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 8;
+        *r = realloc(*r, *cap * sizeof(Range));
+    }
+    Range x = { start, end };
+    (*r)[(*n)++] = x;
+}
+
+static void note_candidate(Entry e, int end, Range **r, int *n, int *cap) {
+    if (e.invariant && e.computes && e.start >= 0) add_range(r, n, cap, e.start, end);
+}
+
+/* Collects the maximal invariant trees of one block */
+static void scan_block(const Method *m, const BasicBlock *bb, int in_depth, const bool *stored,
+                       Range **r, int *n, int *cap) {
+    Entry *stack = malloc((bb->end - bb->start + in_depth + 1) * sizeof(Entry));
+    int *end_at = malloc((bb->end - bb->start + in_depth + 1) * sizeof(int));
+    int sp = 0;
+    for (int k = 0; k < in_depth; k++) {
+        Entry e = { -1, false, false };
+        end_at[sp] = -1;
+        stack[sp++] = e;
+    }
+    for (int i = bb->start; i < bb->end; i++) {
+        const Insn *in = &m->code[i];
+        Entry e = { i, false, false };
+        if (in->op == OP_ICONST || in->op == OP_FCONST) {
+            e.invariant = true;
+        } else if (in->op == OP_ILOAD || in->op == OP_FLOAD) {
+            e.invariant = !stored[in->ival];
+        } else if (is_hoistable_op(m, i)) {
+            int pops = insn_pops(in);
+            Entry a = stack[sp - pops], b = stack[sp - 1];
+            e.start = a.start;
+            e.invariant = a.invariant && b.invariant && a.start >= 0 && b.start >= 0 &&
+                          (pops == 1 || end_at[sp - 2] + 1 == b.start);
+            e.computes = true;
+            if (!e.invariant) {
+                for (int k = sp - pops; k < sp; k++) note_candidate(stack[k], end_at[k], r, n, cap);
+            }
+            sp -= pops;
+        } else {
+            int pops = insn_pops(in), pushes = insn_pushes(in);
+            for (int k = sp - pops; k < sp; k++) note_candidate(stack[k], end_at[k], r, n, cap);
+            sp -= pops;
+            for (int k = 0; k < pushes; k++) {
+                Entry x = { -1, false, false };
+                end_at[sp] = -1;
+                stack[sp++] = x;
+            }
+            continue;
+        }
+        end_at[sp] = i;
+        stack[sp++] = e;
+    }
+    for (int k = 0; k < sp; k++) note_candidate(stack[k], end_at[k], r, n, cap);
+    free(stack);
+    free(end_at);
+}
+
+/* Hoists the invariant trees of one loop; returns how many were moved */
+static int hoist_loop(Method *m, Cfg *g, const Loop *lp, const int *depth) {
+    int head = cfg_preheader_at(g, lp);
+    if (head < 0) return 0;
+
+    bool *stored = calloc(m->next_local + 1, sizeof(bool));
+    for (int b = 0; b < g->nblocks; b++) {
+        if (!lp->body[b]) continue;
+        for (int i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            const Insn *in = &m->code[i];
+            if (opcode_flags(in->op) & OPF_STORE) stored[in->ival] = true;
+            if (in->op == OP_RAW) {
+                free(stored);
+                return 0;
+            }
+        }
+    }
+
+    Range *r = NULL;
+    int n = 0, cap = 0;
+    for (int b = 0; b < g->nblocks; b++) {
+        if (lp->body[b] && depth[b] >= 0) scan_block(m, &g->blocks[b], depth[b], stored, &r, &n, &cap);
+    }
+    free(stored);
+    if (n == 0) {
+        free(r);
+        return 0;
+    }
+
+    int *temp = malloc(n * sizeof(int));
+    int *range_at = malloc((m->len + 1) * sizeof(int));
+    int extra = 1;
+    for (int i = 0; i <= m->len; i++) range_at[i] = -1;
+    for (int k = 0; k < n; k++) {
+        temp[k] = method_new_local(m);
+        range_at[r[k].start] = k;
+        extra += r[k].end - r[k].start + 2;
+    }
+
+    int pre = method_new_label(m, "pre");
+    cfg_redirect_entries(g, lp, pre);
+
+    int out_cap = m->len + extra;
+    Insn *out = malloc(out_cap * sizeof(Insn));
+    int len = 0;
+    for (int i = 0; i < m->len; i++) {
+        if (i == head) {
+            Insn label = { OP_LABEL, pre, 0, NULL, m->code[i].lineno };
+            out[len++] = label;
+            for (int k = 0; k < n; k++) {
+                for (int j = r[k].start; j <= r[k].end; j++) {
+                    out[len] = m->code[j];
+                    if (out[len].sval) out[len].sval = strdup(out[len].sval);
+                    len++;
+                }
+                bool is_float = opcode_yields_float(m->code[r[k].end].op);
+                Insn store = { is_float ? OP_FSTORE : OP_ISTORE, temp[k], 0, NULL, m->code[i].lineno };
+                out[len++] = store;
+            }
+        }
+        if (range_at[i] >= 0) {
+            int k = range_at[i];
+            bool is_float = opcode_yields_float(m->code[r[k].end].op);
+            for (int j = r[k].start; j <= r[k].end; j++) free(m->code[j].sval);
+            Insn load = { is_float ? OP_FLOAD : OP_ILOAD, temp[k], 0, NULL, m->code[i].lineno };
+            out[len++] = load;
+            i = r[k].end;
+            continue;
+        }
+        out[len++] = m->code[i];
+    }
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = out_cap;
+
+    free(r);
+    free(temp);
+    free(range_at);
+    return n;
+}
+
+int pass_licm(Method *m) {
+    int total = 0;
+    for (int round = 0; round < LICM_MAX_ROUNDS; round++) {
+        Cfg g;
+        int moved = 0;
+        cfg_build(&g, m);
+        int *depth = malloc((g.nblocks + 1) * sizeof(int));
+        if (g.nblocks > 0 && cfg_stack_depths(&g, depth) >= 0) {
+            cfg_find_loops(&g);
+            /* innermost loops first */
+            for (int d = g.nloops; d > 0 && !moved; d--) {
+                for (int l = 0; l < g.nloops && !moved; l++) {
+                    if (g.loops[l].depth == d) moved = hoist_loop(m, &g, &g.loops[l], depth);
+                }
+            }
+        }
+        free(depth);
+        cfg_free(&g);
+        if (!moved) break;
+        total += moved;
+    }
+    return total;
+}
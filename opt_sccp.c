@@ -0,0 +1,374 @@
+/* Sparse conditional constant propagation over the method CFG.
+ *
+ * The lattice tracks every local slot and every operand stack entry. Only
+ * edges that can actually be taken carry state, so a branch whose operands
+ * are constant keeps the other side from polluting its successors. Loads,
+ * arithmetic and branches that end up constant are rewritten; the pops
+ * this leaves behind are cleaned up by DCE. */
+#include "compiler_common.h"
+#include <math.h>
+#include <stdint.h>
+
+typedef enum { LAT_TOP, LAT_CONST, LAT_BOTTOM } LatKind;
+
+typedef struct {
+    unsigned char kind;
+    bool is_float;
+    int i;
+    float f;
+} Lat;
+
+typedef struct {
+    Method *m;
+    Cfg g;
+    int nlocals, width;
+    int *depth;        /* operand stack depth at each block entry */
+    Lat *in;           /* per block: nlocals locals then the stack */
+    bool *executable;
+    int *work;
+    bool *queued;
+    int nwork;
+} Sccp;
+
+static const Lat lat_bottom = { LAT_BOTTOM, false, 0, 0 };
+
+static Lat lat_int(int v) {
+    Lat l = { LAT_CONST, false, v, 0 };
+    return l;
+}
+
+static Lat lat_float(float v) {
+    Lat l = { LAT_CONST, true, 0, v };
+    return l;
+}
+
+/* Java semantics for int arithmetic: wrap around, shifts mask their
+ * count, MIN_VALUE / -1 overflows back to MIN_VALUE. Division by zero
+ * throws at run time, so it is never folded. */
+bool eval_int_binop(Opcode op, int a, int b, int *out) {
+    uint32_t ua = (uint32_t)a, ub = (uint32_t)b;
+    switch (op) {
+    case OP_IADD: *out = (int)(ua + ub); return true;
+    case OP_ISUB: *out = (int)(ua - ub); return true;
+    case OP_IMUL: *out = (int)(ua * ub); return true;
+    case OP_IDIV:
+        if (b == 0) return false;
+        *out = (a == INT32_MIN && b == -1) ? a : a / b;
+        return true;
+    case OP_IREM:
+        if (b == 0) return false;
+        *out = (b == -1) ? 0 : a % b;
+        return true;
+    case OP_ISHL: *out = (int)(ua << (b & 31)); return true;
+    case OP_ISHR: *out = a >> (b & 31); return true;
+    case OP_IUSHR: *out = (int)(ua >> (b & 31)); return true;
+    case OP_IAND: *out = a & b; return true;
+    case OP_IOR: *out = a | b; return true;
+    case OP_IXOR: *out = a ^ b; return true;
+    default: return false;
+    }
+}
+
+float eval_float_binop(Opcode op, float a, float b) {
+    switch (op) {
+    case OP_FADD: return a + b;
+    case OP_FSUB: return a - b;
+    case OP_FMUL: return a * b;
+    default: return a / b;
+    }
+}
+
+/* f2i rounds toward zero, saturates and maps NaN to 0 */
+int java_f2i(float f) {
+    if (isnan(f)) return 0;
+    if (f >= 2147483648.0f) return INT32_MAX;
+    if (f <= -2147483648.0f) return INT32_MIN;
+    return (int)f;
+}
+
+int java_fcmp(float a, float b, int nan_result) {
+    if (isnan(a) || isnan(b)) return nan_result;
+    return a > b ? 1 : a < b ? -1 : 0;
+}
+
+bool eval_compare(Opcode op, int a, int b) {
+    switch (op) {
+    case OP_IFEQ: case OP_IF_ICMPEQ: return a == b;
+    case OP_IFNE: case OP_IF_ICMPNE: return a != b;
+    case OP_IFLT: case OP_IF_ICMPLT: return a < b;
+    case OP_IFGE: case OP_IF_ICMPGE: return a >= b;
+    case OP_IFGT: case OP_IF_ICMPGT: return a > b;
+    case OP_IFLE: case OP_IF_ICMPLE: return a <= b;
+    default: return false;
+    }
+}
+
+static bool lat_equal(const Lat *a, const Lat *b) {
+    if (a->kind != b->kind) return false;
+    if (a->kind != LAT_CONST) return true;
+    if (a->is_float != b->is_float) return false;
+    return a->is_float ? memcmp(&a->f, &b->f, sizeof(float)) == 0 : a->i == b->i;
+}
+
+/* dst = dst meet src; returns true if dst changed */
+static bool lat_meet(Lat *dst, const Lat *src) {
+    if (src->kind == LAT_TOP || dst->kind == LAT_BOTTOM) return false;
+    if (dst->kind == LAT_TOP) {
+        *dst = *src;
+        return true;
+    }
+    if (lat_equal(dst, src)) return false;
+    *dst = lat_bottom;
+    return true;
+}
+
+/* Folds one instruction into the state. Returns the branch decision for
+ * conditional jumps: 1 taken, 0 not taken, -1 unknown. */
+static int transfer(Sccp *s, Lat *st, int *sp, const Insn *in) {
+    Lat *stack = st + s->nlocals;
+    Lat a, b, r = lat_bottom;
+    int v;
+
+    switch (in->op) {
+    case OP_NOP:
+    case OP_LABEL:
+    case OP_GOTO:
+    case OP_RETURN:
+        return -1;
+    case OP_ICONST:
+        stack[(*sp)++] = lat_int(in->ival);
+        return -1;
+    case OP_FCONST:
+        stack[(*sp)++] = lat_float(in->fval);
+        return -1;
+    case OP_ILOAD:
+    case OP_FLOAD:
+        stack[(*sp)++] = st[in->ival];
+        return -1;
+    case OP_ISTORE:
+    case OP_FSTORE:
+    case OP_ASTORE:
+        st[in->ival] = stack[--(*sp)];
+        return -1;
+    case OP_DUP:
+        stack[*sp] = stack[*sp - 1];
+        (*sp)++;
+        return -1;
+    case OP_SWAP:
+        a = stack[*sp - 1];
+        stack[*sp - 1] = stack[*sp - 2];
+        stack[*sp - 2] = a;
+        return -1;
+    case OP_POP:
+        (*sp)--;
+        return -1;
+    default:
+        break;
+    }
+
+    if (insn_is_branch(in)) {
+        int pops = insn_pops(in);
+        b = pops == 2 ? stack[--(*sp)] : lat_int(0);
+        a = stack[--(*sp)];
+        if (a.kind == LAT_CONST && b.kind == LAT_CONST)
+            return eval_compare(in->op, a.i, b.i);
+        return -1;
+    }
+
+    int pops = insn_pops(in);
+    bool all_const = true, any_top = false;
+    for (int k = 0; k < pops; k++) {
+        all_const &= stack[*sp - 1 - k].kind == LAT_CONST;
+        any_top |= stack[*sp - 1 - k].kind == LAT_TOP;
+    }
+    b = pops >= 1 ? stack[*sp - 1] : lat_bottom;
+    a = pops >= 2 ? stack[*sp - 2] : lat_bottom;
+    *sp -= pops;
+
+    if (any_top && (opcode_flags(in->op) & (OPF_PURE | OPF_THROWS))) {
+        r.kind = LAT_TOP;
+    } else if (all_const) {
+        switch (in->op) {
+        case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IREM:
+        case OP_ISHL: case OP_ISHR: case OP_IUSHR: case OP_IAND: case OP_IOR: case OP_IXOR:
+            if (eval_int_binop(in->op, a.i, b.i, &v)) r = lat_int(v);
+            break;
+        case OP_INEG:
+            r = lat_int((int)(0u - (uint32_t)b.i));
+            break;
+        case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV:
+            r = lat_float(eval_float_binop(in->op, a.f, b.f));
+            break;
+        case OP_FNEG:
+            r = lat_float(-b.f);
+            break;
+        case OP_I2F:
+            r = lat_float((float)b.i);
+            break;
+        case OP_F2I:
+            r = lat_int(java_f2i(b.f));
+            break;
+        case OP_FCMPL:
+        case OP_FCMPG:
+            r = lat_int(java_fcmp(a.f, b.f, in->op == OP_FCMPL ? -1 : 1));
+            break;
+        default:
+            break;
+        }
+        /* Jasmin has no literal for NaN or infinities */
+        if (r.kind == LAT_CONST && r.is_float && !isfinite(r.f)) r = lat_bottom;
+    }
+    for (int k = 0; k < insn_pushes(in); k++) stack[(*sp)++] = r;
+    return -1;
+}
+
+static void enqueue(Sccp *s, int b) {
+    if (!s->queued[b]) {
+        s->queued[b] = true;
+        s->work[s->nwork++] = b;
+    }
+}
+
+static void flow_edge(Sccp *s, int to, const Lat *out, int sp) {
+    Lat *dst = &s->in[(size_t)to * s->width];
+    bool changed = !s->executable[to];
+    s->executable[to] = true;
+    for (int k = 0; k < s->nlocals + sp; k++) changed |= lat_meet(&dst[k], &out[k]);
+    if (changed) enqueue(s, to);
+}
+
+static void solve(Sccp *s) {
+    Lat *st = malloc(s->width * sizeof(Lat));
+    Lat *entry = s->in;
+    for (int k = 0; k < s->width; k++) entry[k] = lat_bottom;
+    s->executable[0] = true;
+    enqueue(s, 0);
+
+    while (s->nwork > 0) {
+        int b = s->work[--s->nwork];
+        s->queued[b] = false;
+        BasicBlock *bb = &s->g.blocks[b];
+        int sp = s->depth[b], decision = -1;
+        memcpy(st, &s->in[(size_t)b * s->width], s->width * sizeof(Lat));
+        for (int i = bb->start; i < bb->end; i++) {
+            decision = transfer(s, st, &sp, &s->m->code[i]);
+        }
+        const Insn *last = &s->m->code[bb->end - 1];
+        if ((opcode_flags(last->op) & OPF_BRANCH) && decision >= 0) {
+            /* only the side the constant condition selects is executable */
+            int target = decision ? s->g.label_block[last->ival] : (b + 1 < s->g.nblocks ? b + 1 : -1);
+            if (target >= 0) flow_edge(s, target, st, sp);
+            continue;
+        }
+        for (int k = 0; k < bb->nsucc; k++) flow_edge(s, bb->succ[k], st, sp);
+    }
+    free(st);
+}
+
+static void emit(Insn **out, int *len, int *cap, Insn in) {
+    if (*len == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *out = realloc(*out, *cap * sizeof(Insn));
+    }
+    (*out)[(*len)++] = in;
+}
+
+static Insn const_insn(const Lat *l, int lineno) {
+    Insn in;
+    memset(&in, 0, sizeof(in));
+    in.lineno = lineno;
+    if (l->is_float) {
+        in.op = OP_FCONST;
+        in.fval = l->f;
+    } else {
+        in.op = OP_ICONST;
+        in.ival = l->i;
+    }
+    return in;
+}
+
+/* Rewrites constant results and decided branches in executable blocks */
+static int rewrite(Sccp *s) {
+    Method *m = s->m;
+    Insn *out = NULL;
+    int len = 0, cap = 0, changes = 0;
+    Lat *st = malloc(s->width * sizeof(Lat));
+
+    for (int b = 0; b < s->g.nblocks; b++) {
+        BasicBlock *bb = &s->g.blocks[b];
+        if (!s->executable[b]) {
+            for (int i = bb->start; i < bb->end; i++) emit(&out, &len, &cap, m->code[i]);
+            continue;
+        }
+        int sp = s->depth[b];
+        memcpy(st, &s->in[(size_t)b * s->width], s->width * sizeof(Lat));
+        for (int i = bb->start; i < bb->end; i++) {
+            Insn in = m->code[i];
+            int pops = insn_pops(&in);
+            int decision = transfer(s, st, &sp, &in);
+            Insn pop = { OP_POP, 0, 0, NULL, in.lineno };
+
+            if ((opcode_flags(in.op) & OPF_BRANCH) && decision >= 0) {
+                for (int k = 0; k < pops; k++) emit(&out, &len, &cap, pop);
+                if (decision) {
+                    in.op = OP_GOTO;
+                    emit(&out, &len, &cap, in);
+                }
+                changes++;
+                continue;
+            }
+            bool folds = in.op != OP_ICONST && in.op != OP_FCONST && insn_pushes(&in) == 1 &&
+                         in.op != OP_DUP && (opcode_flags(in.op) & (OPF_PURE | OPF_THROWS)) &&
+                         sp > 0 && st[s->nlocals + sp - 1].kind == LAT_CONST;
+            if (folds) {
+                for (int k = 0; k < pops; k++) emit(&out, &len, &cap, pop);
+                emit(&out, &len, &cap, const_insn(&st[s->nlocals + sp - 1], in.lineno));
+                free(in.sval);
+                changes++;
+                continue;
+            }
+            emit(&out, &len, &cap, in);
+        }
+    }
+    free(st);
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = cap;
+    return changes;
+}
+
+int pass_sccp(Method *m) {
+    Sccp s;
+    int changes = 0;
+
+    for (int i = 0; i < m->len; i++) {
+        if (m->code[i].op == OP_RAW) return 0;
+    }
+    memset(&s, 0, sizeof(s));
+    s.m = m;
+    cfg_build(&s.g, m);
+    if (s.g.nblocks == 0) {
+        cfg_free(&s.g);
+        return 0;
+    }
+    s.depth = malloc(s.g.nblocks * sizeof(int));
+    int maxdepth = cfg_stack_depths(&s.g, s.depth);
+    if (maxdepth >= 0) {
+        s.nlocals = m->next_local;
+        s.width = s.nlocals + maxdepth + 1;
+        s.in = calloc((size_t)s.g.nblocks * s.width, sizeof(Lat)); /* LAT_TOP */
+        s.executable = calloc(s.g.nblocks, sizeof(bool));
+        s.queued = calloc(s.g.nblocks, sizeof(bool));
+        s.work = malloc(s.g.nblocks * sizeof(int));
+        solve(&s);
+        changes = rewrite(&s);
+        free(s.in);
+        free(s.executable);
+        free(s.queued);
+        free(s.work);
+    }
+    free(s.depth);
+    cfg_free(&s.g);
+    return changes;
+}
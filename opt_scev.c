@@ -0,0 +1,310 @@
+/* Closed forms for counted loops that only accumulate.
+ *
+ * The body of such a loop is straight-line code made of the counter's
+ * increment and updates s = s + P(i), where P is a polynomial of degree at
+ * most two in the counter with constant coefficients. Written in terms of
+ * the iteration number k, i = i0 + c * k, so after T iterations
+ *
+ *     s = s0 + P(i0) * T + Q1 * T(T-1)/2 + Q2 * (T-1)T(2T-1)/6
+ *
+ * and i = i0 + c * T. Everything is computed modulo 2^32, which gives the
+ * same result as running the loop with i32 wraparound.
+ *
+ * With a constant start and bound the whole sum is a constant. Otherwise
+ * the loop must step by 1 or -1 and P must be affine; T is then computed
+ * at run time in long arithmetic so that T(T-1) cannot overflow. */
+#include "compiler_common.h"
+#include <stdint.h>
+
+typedef struct {
+    uint32_t c[3];     /* coefficients of 1, i, i^2; i is the counter at iteration start */
+    int acc;           /* accumulator slot the value depends on, -1 if none */
+    uint32_t acc_coef;
+} Poly;
+
+typedef struct {
+    int slot;
+    uint32_t c[3];
+} Update;
+
+static bool poly_is_const(const Poly *p) {
+    return p->acc < 0 && p->c[1] == 0 && p->c[2] == 0;
+}
+
+static bool poly_add(Poly *a, const Poly *b, bool sub) {
+    if (a->acc >= 0 && b->acc >= 0 && a->acc != b->acc) return false;
+    for (int k = 0; k < 3; k++) a->c[k] = sub ? a->c[k] - b->c[k] : a->c[k] + b->c[k];
+    if (b->acc >= 0) {
+        a->acc_coef = (a->acc >= 0 ? a->acc_coef : 0) + (sub ? 0u - b->acc_coef : b->acc_coef);
+        a->acc = b->acc;
+    }
+    return true;
+}
+
+static void poly_scale(Poly *p, uint32_t f) {
+    for (int k = 0; k < 3; k++) p->c[k] *= f;
+    p->acc_coef *= f;
+}
+
+static bool poly_mul(Poly *a, const Poly *b) {
+    if (poly_is_const(b)) {
+        poly_scale(a, b->c[0]);
+        return true;
+    }
+    if (poly_is_const(a)) {
+        uint32_t f = a->c[0];
+        *a = *b;
+        poly_scale(a, f);
+        return true;
+    }
+    if (a->acc >= 0 || b->acc >= 0) return false;
+    if ((a->c[2] && (b->c[1] || b->c[2])) || (b->c[2] && a->c[1])) return false;
+    uint32_t r[3];
+    r[0] = a->c[0] * b->c[0];
+    r[1] = a->c[0] * b->c[1] + a->c[1] * b->c[0];
+    r[2] = a->c[0] * b->c[2] + a->c[1] * b->c[1] + a->c[2] * b->c[0];
+    memcpy(a->c, r, sizeof(r));
+    return true;
+}
+
+/* Reads the body as accumulator updates; false if it does anything else */
+static bool read_updates(const Method *m, const CountedLoop *cl, Update *ups, int *nups) {
+    Poly *stack = malloc((cl->latch - cl->head + 1) * sizeof(Poly));
+    int sp = 0;
+    bool stepped = false, ok = true;
+    *nups = 0;
+    for (int i = cl->head + 4; i < cl->latch && ok; i++) {
+        const Insn *in = &m->code[i];
+        Poly p = { { 0, 0, 0 }, -1, 0 };
+        int slot, step;
+        if (sp == 0 && iv_match_increment(m, i, &slot, &step) && slot == cl->slot) {
+            stepped = true;
+            i += 3;
+            continue;
+        }
+        switch (in->op) {
+        case OP_ICONST:
+            p.c[0] = (uint32_t)in->ival;
+            stack[sp++] = p;
+            break;
+        case OP_ILOAD:
+            if (in->ival == cl->slot) {
+                /* after the increment the counter reads one step ahead */
+                p.c[0] = stepped ? (uint32_t)cl->step : 0;
+                p.c[1] = 1;
+            } else if (cl->bound.op == OP_ILOAD && in->ival == cl->bound.ival) {
+                ok = false;
+            } else {
+                p.acc = in->ival;
+                p.acc_coef = 1;
+            }
+            stack[sp++] = p;
+            break;
+        case OP_IADD:
+        case OP_ISUB:
+        case OP_IMUL:
+            sp--;
+            if (in->op == OP_IMUL)
+                ok = poly_mul(&stack[sp - 1], &stack[sp]);
+            else
+                ok = poly_add(&stack[sp - 1], &stack[sp], in->op == OP_ISUB);
+            break;
+        case OP_ISHL:
+            sp--;
+            ok = poly_is_const(&stack[sp]);
+            if (ok) poly_scale(&stack[sp - 1], 1u << (stack[sp].c[0] & 31));
+            break;
+        case OP_INEG:
+            poly_scale(&stack[sp - 1], 0xffffffffu);
+            break;
+        case OP_ISTORE:
+            p = stack[--sp];
+            ok = in->ival != cl->slot && p.acc == in->ival && p.acc_coef == 1;
+            for (int k = 0; k < *nups && ok; k++) ok = ups[k].slot != in->ival;
+            if (ok) {
+                ups[*nups].slot = in->ival;
+                memcpy(ups[*nups].c, p.c, sizeof(p.c));
+                (*nups)++;
+            }
+            break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+    free(stack);
+    return ok && sp == 0;
+}
+
+/* sum of k^e for k < t, modulo 2^32 */
+static uint32_t power_sum(long long t, int e) {
+    if (t <= 0) return 0;
+    unsigned long long a = t, b = t - 1, c = 2 * t - 1;
+    if (e == 0) return (uint32_t)a;
+    if (a % 2 == 0) a /= 2; else b /= 2;
+    if (e == 1) return (uint32_t)a * (uint32_t)b;
+    if (a % 3 == 0) a /= 3; else if (b % 3 == 0) b /= 3; else c /= 3;
+    return (uint32_t)a * (uint32_t)b * (uint32_t)c;
+}
+
+static void emit(Insn *out, int *len, Opcode op, int ival, int lineno) {
+    Insn in = { op, ival, 0, NULL, lineno };
+    out[(*len)++] = in;
+}
+
+/* Constant start and bound: every update adds a constant */
+static void emit_constant(const CountedLoop *cl, const Update *ups, int nups, Insn *out, int *len, int lineno) {
+    uint32_t i0 = (uint32_t)cl->start, c = (uint32_t)cl->step;
+    for (int u = 0; u < nups; u++) {
+        const uint32_t *p = ups[u].c;
+        uint32_t q0 = p[0] + p[1] * i0 + p[2] * i0 * i0;
+        uint32_t q1 = p[1] * c + 2u * p[2] * i0 * c;
+        uint32_t q2 = p[2] * c * c;
+        uint32_t sum = q0 * power_sum(cl->trips, 0) + q1 * power_sum(cl->trips, 1) +
+                       q2 * power_sum(cl->trips, 2);
+        emit(out, len, OP_ILOAD, ups[u].slot, lineno);
+        emit(out, len, OP_ICONST, (int)sum, lineno);
+        emit(out, len, OP_IADD, 0, lineno);
+        emit(out, len, OP_ISTORE, ups[u].slot, lineno);
+    }
+    emit(out, len, OP_ICONST, (int)(i0 + c * (uint32_t)cl->trips), lineno);
+    emit(out, len, OP_ISTORE, cl->slot, lineno);
+}
+
+/* T = max(0, bound - i [+ 1]) in a long, then the affine sums */
+static void emit_runtime(Method *m, const CountedLoop *cl, const Update *ups, int nups,
+                         Insn *out, int *len, int lineno) {
+    bool up = cl->step > 0;
+    bool inclusive = cl->exit_op == OP_IF_ICMPGT || cl->exit_op == OP_IF_ICMPLT;
+    int t = method_new_local(m);
+    method_new_local(m); /* a long takes two slots */
+    int pos = method_new_label(m, "trips");
+
+    if (up) {
+        out[(*len)++] = cl->bound;
+        emit(out, len, OP_I2L, 0, lineno);
+        emit(out, len, OP_ILOAD, cl->slot, lineno);
+        emit(out, len, OP_I2L, 0, lineno);
+    } else {
+        emit(out, len, OP_ILOAD, cl->slot, lineno);
+        emit(out, len, OP_I2L, 0, lineno);
+        out[(*len)++] = cl->bound;
+        emit(out, len, OP_I2L, 0, lineno);
+    }
+    emit(out, len, OP_LSUB, 0, lineno);
+    if (inclusive) {
+        emit(out, len, OP_LCONST, 1, lineno);
+        emit(out, len, OP_LADD, 0, lineno);
+    }
+    emit(out, len, OP_LDUP, 0, lineno);
+    emit(out, len, OP_LCONST, 0, lineno);
+    emit(out, len, OP_LCMP, 0, lineno);
+    emit(out, len, OP_IFGT, pos, lineno);
+    emit(out, len, OP_LPOP, 0, lineno);
+    emit(out, len, OP_LCONST, 0, lineno);
+    emit(out, len, OP_LABEL, pos, lineno);
+    emit(out, len, OP_LSTORE, t, lineno);
+
+    for (int u = 0; u < nups; u++) {
+        const uint32_t *p = ups[u].c;
+        /* s += T * (p0 + p1 * i0) + p1 * c * (T(T-1) >>> 1) */
+        emit(out, len, OP_ILOAD, ups[u].slot, lineno);
+        emit(out, len, OP_LLOAD, t, lineno);
+        emit(out, len, OP_L2I, 0, lineno);
+        emit(out, len, OP_ILOAD, cl->slot, lineno);
+        emit(out, len, OP_ICONST, (int)p[1], lineno);
+        emit(out, len, OP_IMUL, 0, lineno);
+        emit(out, len, OP_ICONST, (int)p[0], lineno);
+        emit(out, len, OP_IADD, 0, lineno);
+        emit(out, len, OP_IMUL, 0, lineno);
+        emit(out, len, OP_IADD, 0, lineno);
+        emit(out, len, OP_LLOAD, t, lineno);
+        emit(out, len, OP_LDUP, 0, lineno);
+        emit(out, len, OP_LCONST, 1, lineno);
+        emit(out, len, OP_LSUB, 0, lineno);
+        emit(out, len, OP_LMUL, 0, lineno);
+        emit(out, len, OP_ICONST, 1, lineno);
+        emit(out, len, OP_LUSHR, 0, lineno);
+        emit(out, len, OP_L2I, 0, lineno);
+        emit(out, len, OP_ICONST, (int)(p[1] * (uint32_t)cl->step), lineno);
+        emit(out, len, OP_IMUL, 0, lineno);
+        emit(out, len, OP_IADD, 0, lineno);
+        emit(out, len, OP_ISTORE, ups[u].slot, lineno);
+    }
+    emit(out, len, OP_ILOAD, cl->slot, lineno);
+    emit(out, len, OP_LLOAD, t, lineno);
+    emit(out, len, OP_L2I, 0, lineno);
+    emit(out, len, up ? OP_IADD : OP_ISUB, 0, lineno);
+    emit(out, len, OP_ISTORE, cl->slot, lineno);
+}
+
+/* Run-time trip counts need a unit step towards the bound, and an
+ * inclusive bound that the counter can pass without wrapping */
+static bool runtime_ok(const CountedLoop *cl, const Update *ups, int nups) {
+    bool up = cl->step == 1 && (cl->exit_op == OP_IF_ICMPGE || cl->exit_op == OP_IF_ICMPGT);
+    bool down = cl->step == -1 && (cl->exit_op == OP_IF_ICMPLE || cl->exit_op == OP_IF_ICMPLT);
+    if (!up && !down) return false;
+    if (cl->exit_op == OP_IF_ICMPGT || cl->exit_op == OP_IF_ICMPLT) {
+        if (cl->bound.op != OP_ICONST) return false;
+        if (cl->bound.ival == (up ? 2147483647 : -2147483647 - 1)) return false;
+    }
+    for (int u = 0; u < nups; u++) {
+        if (ups[u].c[2]) return false;
+    }
+    return true;
+}
+
+static int close_loop(Method *m, Cfg *g, int l, const int *depth, bool allow_runtime) {
+    CountedLoop cl;
+    if (!counted_loop_match(g, l, depth, &cl)) return 0;
+    bool constant = cl.trips >= 0;
+    if (!constant && !allow_runtime) return 0;
+    for (int i = cl.head + 4; i < cl.latch; i++) {
+        if (m->code[i].op == OP_LABEL || insn_is_branch(&m->code[i])) return 0;
+    }
+    Update *ups = malloc((cl.latch - cl.head + 1) * sizeof(Update));
+    int nups;
+    if (!read_updates(m, &cl, ups, &nups) || (!constant && !runtime_ok(&cl, ups, nups))) {
+        free(ups);
+        return 0;
+    }
+
+    int cap = m->len + 24 + nups * 24;
+    Insn *out = malloc(cap * sizeof(Insn));
+    int len = cl.head + 1;
+    int lineno = m->code[cl.head].lineno;
+    memcpy(out, m->code, len * sizeof(Insn)); /* up to and including the header label */
+    if (constant)
+        emit_constant(&cl, ups, nups, out, &len, lineno);
+    else
+        emit_runtime(m, &cl, ups, nups, out, &len, lineno);
+    emit(out, &len, OP_GOTO, cl.exit_label, lineno);
+    for (int i = cl.head + 1; i <= cl.latch; i++) free(m->code[i].sval);
+    memcpy(out + len, m->code + cl.latch + 1, (m->len - cl.latch - 1) * sizeof(Insn));
+    len += m->len - cl.latch - 1;
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = cap;
+    free(ups);
+    return 1;
+}
+
+/* Closes one loop per call, preferring constant trip counts: the caller
+ * propagates constants in between, which may give later loops constant
+ * start values. */
+int pass_scev(Method *m) {
+    Cfg g;
+    int changes = 0;
+    cfg_build(&g, m);
+    int *depth = malloc((g.nblocks + 1) * sizeof(int));
+    if (g.nblocks > 0 && cfg_stack_depths(&g, depth) >= 0) {
+        cfg_find_loops(&g);
+        for (int runtime = 0; runtime < 2 && !changes; runtime++) {
+            for (int l = 0; l < g.nloops && !changes; l++) changes = close_loop(m, &g, l, depth, runtime);
+        }
+    }
+    free(depth);
+    cfg_free(&g);
+    return changes;
+}
@@ -0,0 +1,297 @@
+/* Loop unrolling for counted loops.
+ *
+ * A counted loop is an innermost loop shaped the way WhileStmt emits it:
+ *
+ *     L_h: iload i; bound; if_icmpXX L_exit; body; goto L_h
+ *
+ * where i is changed by exactly one increment i = i + c that runs once per
+ * iteration and bound is a constant or a local the loop does not store.
+ *
+ * When the start value and the bound are constants the trip count is worked
+ * out from them, or by running the counter when it could wrap around.
+ * Small loops are then fully unrolled; larger ones run T % k copies of the
+ * body in front of a loop holding k copies. With an unknown trip count the k-copy loop is only
+ * entered while at least k iterations remain, which is checked as
+ * bound - i > (k - 1) * c. A wrapped difference comes out negative, so the
+ * check errs towards the original loop, which stays behind as the
+ * remainder loop. */
+#include "compiler_common.h"
+
+#define UNROLL_MAX_BODY  512       /* instructions in one unrolled iteration */
+#define UNROLL_MAX_TRIPS (1 << 20) /* longest trip count worth simulating */
+#define UNROLL_MAX_ROUNDS 64
+
+static bool is_innermost(const Cfg *g, int l) {
+    for (int o = 0; o < g->nloops; o++) {
+        if (o != l && g->loops[o].header != g->loops[l].header && g->loops[l].body[g->loops[o].header])
+            return false;
+    }
+    return true;
+}
+
+/* Value the counter holds on entry when the only entry is a fall-through
+ * from a block that ends with a constant store to it */
+static bool find_start_value(const Cfg *g, const Loop *lp, int slot, int *value) {
+    const Method *m = g->m;
+    int h = lp->header;
+    int outside = 0;
+    for (int p = 0; p < g->blocks[h].npreds; p++) outside += !lp->body[g->blocks[h].preds[p]];
+    if (outside != 1 || lp->body[h - 1]) return false;
+    const BasicBlock *prev = &g->blocks[h - 1];
+    if (prev->end == prev->start) return false;
+    if (opcode_flags(m->code[prev->end - 1].op) & (OPF_BRANCH | OPF_JUMP | OPF_END)) return false;
+    for (int i = prev->end - 1; i > prev->start; i--) {
+        if (!(opcode_flags(m->code[i].op) & OPF_STORE) || m->code[i].ival != slot) continue;
+        if (m->code[i - 1].op != OP_ICONST) return false;
+        *value = m->code[i - 1].ival;
+        return true;
+    }
+    return false;
+}
+
+/* Iterations of a counted loop with constant start and bound. Runs the
+ * counter when it might wrap instead of reaching the bound. */
+static long long trip_count(Opcode exit_op, int start, int bound, int step) {
+    bool up = step > 0 && (exit_op == OP_IF_ICMPGE || exit_op == OP_IF_ICMPGT);
+    bool down = step < 0 && (exit_op == OP_IF_ICMPLE || exit_op == OP_IF_ICMPLT);
+    if (up || down) {
+        /* last counter value that still enters the body */
+        long long last = (long long)bound + (exit_op == OP_IF_ICMPGE ? -1 : exit_op == OP_IF_ICMPLE ? 1 : 0);
+        long long dist = up ? last - start : start - last;
+        long long mag = up ? step : -(long long)step;
+        if (dist < 0) return 0;
+        long long t = dist / mag + 1;
+        long long next = start + t * (long long)step;
+        if (next >= -2147483648LL && next <= 2147483647LL) return t;
+    }
+    long long t = 0;
+    int x = start;
+    while (!eval_compare(exit_op, x, bound) && t <= UNROLL_MAX_TRIPS) {
+        x = (int)((unsigned)x + (unsigned)step);
+        t++;
+    }
+    return t <= UNROLL_MAX_TRIPS ? t : -1;
+}
+
+bool counted_loop_match(const Cfg *g, int l, const int *depth, CountedLoop *cl) {
+    const Method *m = g->m;
+    const Loop *lp = &g->loops[l];
+    int h = lp->header;
+    int head = cfg_preheader_at(g, lp);
+    if (head < 0 || depth[h] != 0 || !is_innermost(g, l)) return false;
+    if (g->blocks[h].end - g->blocks[h].start != 4) return false;
+
+    const Insn *load = &m->code[head + 1], *bound = &m->code[head + 2], *br = &m->code[head + 3];
+    if (load->op != OP_ILOAD || br->op < OP_IF_ICMPEQ || br->op > OP_IF_ICMPLE) return false;
+    if (bound->op != OP_ICONST && !(bound->op == OP_ILOAD && bound->ival != load->ival)) return false;
+    int exit_block = g->label_block[br->ival];
+    if (exit_block < 0 || lp->body[exit_block]) return false;
+
+    /* a single back edge, at the end of a contiguous body */
+    int latch_block = -1;
+    for (int b = 0; b < g->nblocks; b++) {
+        if (!lp->body[b]) continue;
+        for (int s = 0; s < g->blocks[b].nsucc; s++) {
+            if (g->blocks[b].succ[s] != h) continue;
+            if (latch_block >= 0) return false;
+            latch_block = b;
+        }
+    }
+    if (latch_block < 0) return false;
+    int latch = g->blocks[latch_block].end - 1;
+    if (m->code[latch].op != OP_GOTO) return false;
+    for (int b = 0; b < g->nblocks; b++) {
+        bool in_range = g->blocks[b].start >= head && g->blocks[b].end <= latch + 1;
+        if (lp->body[b] != in_range) return false;
+    }
+
+    int increments = 0, inc_block = -1;
+    for (int i = head + 4; i < latch; i++) {
+        const Insn *in = &m->code[i];
+        int slot, step;
+        if (in->op == OP_RAW || (opcode_flags(in->op) & OPF_END)) return false;
+        if (insn_is_branch(in) && (g->label_block[in->ival] < 0 || !lp->body[g->label_block[in->ival]] ||
+                                   g->label_block[in->ival] == h))
+            return false;
+        if (iv_match_increment(m, i, &slot, &step) && slot == load->ival &&
+            g->insn_block[i] == g->insn_block[i + 3]) {
+            increments++;
+            inc_block = g->insn_block[i];
+            cl->step = step;
+            i += 3;
+            continue;
+        }
+        if ((opcode_flags(in->op) & OPF_STORE) &&
+            (in->ival == load->ival || (bound->op == OP_ILOAD && in->ival == bound->ival)))
+            return false;
+    }
+    if (increments != 1 || cl->step == 0 || !cfg_dominates(g, inc_block, latch_block)) return false;
+
+    cl->head = head;
+    cl->latch = latch;
+    cl->slot = load->ival;
+    cl->bound = *bound;
+    cl->exit_op = br->op;
+    cl->exit_label = br->ival;
+    cl->trips = -1;
+
+    cl->start_known = find_start_value(g, lp, cl->slot, &cl->start);
+    if (bound->op == OP_ICONST && cl->start_known)
+        cl->trips = trip_count(cl->exit_op, cl->start, bound->ival, cl->step);
+    return true;
+}
+
+static void emit(Insn *out, int *len, Opcode op, int ival, int lineno) {
+    Insn in = { op, ival, 0, NULL, lineno };
+    out[(*len)++] = in;
+}
+
+/* Appends one copy of the body with its labels renamed */
+static void copy_body(Method *m, const CountedLoop *cl, Insn *out, int *len) {
+    int nlabels = m->nlabels;
+    int *rename = malloc((nlabels + 1) * sizeof(int));
+    for (int k = 0; k < nlabels; k++) rename[k] = -1;
+    for (int i = cl->head + 4; i < cl->latch; i++) {
+        if (m->code[i].op == OP_LABEL) rename[m->code[i].ival] = method_new_label(m, "u");
+    }
+    for (int i = cl->head + 4; i < cl->latch; i++) {
+        Insn in = m->code[i];
+        if (in.sval) in.sval = strdup(in.sval);
+        if ((in.op == OP_LABEL || insn_is_branch(&in)) && in.ival < nlabels && rename[in.ival] >= 0)
+            in.ival = rename[in.ival];
+        out[(*len)++] = in;
+    }
+    free(rename);
+}
+
+/* Loop test of the k-copy loop: the original exit branch, plus a jump to
+ * the remainder loop when fewer than k iterations may be left */
+static void emit_test(const CountedLoop *cl, int k, int rem, Insn *out, int *len) {
+    int lineno = out[*len - 1].lineno;
+    emit(out, len, OP_ILOAD, cl->slot, lineno);
+    out[(*len)++] = cl->bound;
+    emit(out, len, cl->exit_op, cl->exit_label, lineno);
+    if (rem < 0) return;
+    bool up = cl->step > 0;
+    if (up) {
+        out[(*len)++] = cl->bound;
+        emit(out, len, OP_ILOAD, cl->slot, lineno);
+    } else {
+        emit(out, len, OP_ILOAD, cl->slot, lineno);
+        out[(*len)++] = cl->bound;
+    }
+    emit(out, len, OP_ISUB, 0, lineno);
+    long long span = (long long)(k - 1) * (up ? cl->step : -(long long)cl->step);
+    emit(out, len, OP_ICONST, (int)span, lineno);
+    /* i < B needs B - i > span; i <= B needs B - i >= span */
+    bool strict = cl->exit_op == OP_IF_ICMPGE || cl->exit_op == OP_IF_ICMPLE;
+    emit(out, len, strict ? OP_IF_ICMPLE : OP_IF_ICMPLT, rem, lineno);
+}
+
+static bool unknown_trips_ok(const CountedLoop *cl, int k) {
+    bool up = cl->exit_op == OP_IF_ICMPGE || cl->exit_op == OP_IF_ICMPGT;
+    bool down = cl->exit_op == OP_IF_ICMPLE || cl->exit_op == OP_IF_ICMPLT;
+    if (!(up && cl->step > 0) && !(down && cl->step < 0)) return false;
+    long long span = (long long)(k - 1) * (cl->step > 0 ? cl->step : -(long long)cl->step);
+    return span <= 0x7fffffffLL;
+}
+
+typedef struct {
+    int *labels;
+    int n, cap;
+} LabelSet;
+
+static void label_set_add(LabelSet *s, int label) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 8;
+        s->labels = realloc(s->labels, s->cap * sizeof(int));
+    }
+    s->labels[s->n++] = label;
+}
+
+static bool label_set_has(const LabelSet *s, int label) {
+    for (int k = 0; k < s->n; k++) {
+        if (s->labels[k] == label) return true;
+    }
+    return false;
+}
+
+/* Headers in done are unrolled loops or their remainders; they are left alone */
+static int unroll_loop(Method *m, Cfg *g, int l, const int *depth, LabelSet *done) {
+    CountedLoop cl;
+    if (!counted_loop_match(g, l, depth, &cl)) return 0;
+    int body_len = cl.latch - cl.head - 4;
+    int k = g_opt.unroll_factor;
+    long long copies_before, copies_in_loop;
+    bool full = cl.trips >= 0 && cl.trips * body_len <= g_opt.unroll_full_limit;
+
+    if (full) {
+        copies_before = cl.trips;
+        copies_in_loop = 0;
+    } else {
+        if (k < 2 || (long long)body_len * k > UNROLL_MAX_BODY) return 0;
+        if (cl.trips >= 0 && cl.trips < k) return 0;
+        if (cl.trips < 0 && !unknown_trips_ok(&cl, k)) return 0;
+        copies_before = cl.trips >= 0 ? cl.trips % k : 0;
+        copies_in_loop = k;
+    }
+
+    int hdr = m->code[cl.head].ival;
+    int start = method_new_label(m, "unroll");
+    cfg_redirect_entries(g, &g->loops[l], start);
+    int top = full ? -1 : (copies_before ? method_new_label(m, "unroll") : start);
+    int rem = !full && cl.trips < 0 ? method_new_label(m, "rem") : -1;
+    label_set_add(done, hdr);
+    if (top >= 0) label_set_add(done, top);
+
+    int cap = m->len + (int)(copies_before + copies_in_loop) * body_len + 16;
+    Insn *out = malloc(cap * sizeof(Insn));
+    int len = 0;
+    memcpy(out, m->code, cl.head * sizeof(Insn));
+    len = cl.head;
+    int lineno = m->code[cl.head].lineno;
+    emit(out, &len, OP_LABEL, start, lineno);
+    for (long long c = 0; c < copies_before; c++) copy_body(m, &cl, out, &len);
+    if (full) {
+        emit(out, &len, OP_GOTO, cl.exit_label, lineno);
+    } else {
+        if (top != start) emit(out, &len, OP_LABEL, top, lineno);
+        emit_test(&cl, k, rem, out, &len);
+        for (long long c = 0; c < copies_in_loop; c++) copy_body(m, &cl, out, &len);
+        emit(out, &len, OP_GOTO, top, lineno);
+        if (rem >= 0) emit(out, &len, OP_LABEL, rem, lineno);
+    }
+    /* the original loop follows: the remainder loop, or dead code */
+    memcpy(out + len, m->code + cl.head, (m->len - cl.head) * sizeof(Insn));
+    len += m->len - cl.head;
+    free(m->code);
+    m->code = out;
+    m->len = len;
+    m->cap = cap;
+    return 1;
+}
+
+int pass_unroll(Method *m) {
+    int total = 0;
+    LabelSet done = { NULL, 0, 0 };
+    for (int round = 0; round < UNROLL_MAX_ROUNDS; round++) {
+        Cfg g;
+        int changes = 0;
+        cfg_build(&g, m);
+        int *depth = malloc((g.nblocks + 1) * sizeof(int));
+        if (g.nblocks > 0 && cfg_stack_depths(&g, depth) >= 0) {
+            cfg_find_loops(&g);
+            for (int l = 0; l < g.nloops && !changes; l++) {
+                int head = g.blocks[g.loops[l].header].start;
+                if (m->code[head].op == OP_LABEL && label_set_has(&done, m->code[head].ival)) continue;
+                changes = unroll_loop(m, &g, l, depth, &done);
+            }
+        }
+        free(depth);
+        cfg_free(&g);
+        if (!changes) break;
+        total += changes;
+    }
+    free(done.labels);
+    return total;
+}
@@ -0,0 +1,217 @@
+/* Method-level optimization pipeline */
+#include "compiler_common.h"
+#include "cache.h"
+#include <time.h>
+#include <unistd.h>
+
+#define PEVAL_DEFAULT_FUEL 10000000L
+
+OptOptions g_opt = { 2, false, false, 4, 256, 0, EMIT_JASMIN, false, REPORT_OFF, NULL, 0, SYMTAB_OFF, NULL, 1, 1, NULL, CACHE_DEFAULT_MAX };
+
+static bool is_plain_push(Opcode op) {
+    switch (op) {
+    case OP_ICONST: case OP_FCONST: case OP_SCONST:
+    case OP_ILOAD: case OP_FLOAD: case OP_ALOAD: case OP_GETSTATIC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* "a; b; swap" with two plain pushes is "b; a". This puts compound
+ * assignments into the i = i + c shape the loop passes look for. */
+static int remove_operand_swaps(Method *m) {
+    int changes = 0;
+    for (int i = 2; i < m->len; i++) {
+        if (m->code[i].op != OP_SWAP) continue;
+        if (!is_plain_push(m->code[i - 2].op) || !is_plain_push(m->code[i - 1].op)) continue;
+        Insn tmp = m->code[i - 2];
+        m->code[i - 2] = m->code[i - 1];
+        m->code[i - 1] = tmp;
+        m->code[i].op = OP_NOP;
+        changes++;
+    }
+    if (changes) method_compact(m);
+    return changes;
+}
+
+/* Passes in pipeline order of first use, with the lowest -O level that
+ * turns each on; level 3 passes only run when asked for with -f<pass> */
+typedef enum { P_SWAP, P_SCCP, P_DCE, P_SCEV, P_LICM, P_IV, P_UNROLL, P_CSE, P_SSA, P_COUNT } PassId;
+
+typedef struct {
+    const char *name;
+    int (*run)(Method *m);
+    int level;
+} PassInfo;
+
+typedef struct {
+    int runs;
+    long changes;
+    double seconds;
+} PassStats;
+
+static const PassInfo passes[P_COUNT] = {
+    [P_SWAP]   = { "swap",   remove_operand_swaps, 1 },
+    [P_SCCP]   = { "sccp",   pass_sccp,            1 },
+    [P_DCE]    = { "dce",    pass_dce,             1 },
+    [P_SCEV]   = { "scev",   pass_scev,            2 },
+    [P_LICM]   = { "licm",   pass_licm,            2 },
+    [P_IV]     = { "iv",     pass_iv,              2 },
+    [P_UNROLL] = { "unroll", pass_unroll,          2 },
+    [P_CSE]    = { "cse",    pass_cse,             1 },
+    [P_SSA]    = { "ssa",    pass_ssa,             3 },
+};
+
+static int pass_override[P_COUNT]; /* 1 for -f<pass>, -1 for -fno-<pass>, 0 to follow -O */
+static PassStats pass_stats[P_COUNT];
+
+static bool set_pass_flag(const char *name, int value) {
+    for (int p = 0; p < P_COUNT; p++) {
+        if (strcmp(passes[p].name, name) == 0) {
+            pass_override[p] = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -O<n>, -f<pass>, -fno-<pass>, --pass-stats, --dump-ir, --unroll=<factor>,
+ * --unroll-full=<instructions>, --partial-eval[=<fuel>], --emit=<backend>,
+ * --run, --time-report[=json], --trace=<file>, -v, -vv, --verbose=<n>,
+ * --symtab=json:<file>, --symtab=bin:<file>, --threads=<n>, --cache[=<dir>],
+ * --cache-size=<MiB> */
+bool opt_parse_flag(const char *arg) {
+    if (strncmp(arg, "-O", 2) == 0 && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') {
+        g_opt.level = arg[2] - '0';
+        return true;
+    }
+    if (strncmp(arg, "--unroll=", 9) == 0) {
+        g_opt.unroll_factor = atoi(arg + 9) > 1 ? atoi(arg + 9) : 1;
+        return true;
+    }
+    if (strncmp(arg, "--unroll-full=", 14) == 0) {
+        g_opt.unroll_full_limit = atoi(arg + 14);
+        return true;
+    }
+    if (strcmp(arg, "--emit=jasmin") == 0 || strcmp(arg, "--emit=x86") == 0 || strcmp(arg, "--emit=c") == 0) {
+        g_opt.emit = arg[7] == 'x' ? EMIT_X86 : arg[7] == 'c' ? EMIT_C : EMIT_JASMIN;
+        return true;
+    }
+    if (strcmp(arg, "--time-report") == 0 || strcmp(arg, "--time-report=json") == 0) {
+        g_opt.time_report = arg[13] ? REPORT_JSON : REPORT_TEXT;
+        return true;
+    }
+    if (strncmp(arg, "--trace=", 8) == 0 && arg[8]) {
+        g_opt.trace_file = arg + 8;
+        return true;
+    }
+    if (strcmp(arg, "-v") == 0 || strcmp(arg, "-vv") == 0) {
+        g_opt.verbose = (int)strlen(arg) - 1;
+        return true;
+    }
+    if (strncmp(arg, "--verbose=", 10) == 0) {
+        g_opt.verbose = atoi(arg + 10);
+        return true;
+    }
+    if ((strncmp(arg, "--symtab=json:", 14) == 0 || strncmp(arg, "--symtab=bin:", 13) == 0) &&
+        strchr(arg, ':')[1]) {
+        g_opt.symtab_format = arg[9] == 'j' ? SYMTAB_JSON : SYMTAB_BINARY;
+        g_opt.symtab_file = strchr(arg, ':') + 1;
+        return true;
+    }
+    if (strncmp(arg, "--threads=", 10) == 0) {
+        g_opt.threads = atoi(arg + 10);
+        if (g_opt.threads <= 0) g_opt.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        return true;
+    }
+    if (strcmp(arg, "--cache") == 0 || (strncmp(arg, "--cache=", 8) == 0 && arg[8])) {
+        g_opt.cache_dir = arg[7] ? arg + 8 : cache_default_dir();
+        return true;
+    }
+    if (strncmp(arg, "--cache-size=", 13) == 0) {
+        g_opt.cache_max = atol(arg + 13) << 20;
+        return true;
+    }
+    if (strcmp(arg, "--run") == 0) {
+        g_opt.run = true;
+        return true;
+    }
+    if (strcmp(arg, "--dump-ir") == 0) {
+        g_opt.dump_ir = true;
+        return true;
+    }
+    if (strcmp(arg, "--pass-stats") == 0) {
+        g_opt.pass_stats = true;
+        return true;
+    }
+    if (strncmp(arg, "-fno-", 5) == 0) return set_pass_flag(arg + 5, -1);
+    if (strncmp(arg, "-f", 2) == 0) return set_pass_flag(arg + 2, 1);
+    if (strcmp(arg, "--partial-eval") == 0) {
+        g_opt.peval_fuel = PEVAL_DEFAULT_FUEL;
+        return true;
+    }
+    if (strncmp(arg, "--partial-eval=", 15) == 0) {
+        g_opt.peval_fuel = atol(arg + 15);
+        return true;
+    }
+    return false;
+}
+
+static bool pass_enabled(PassId p) {
+    if (pass_override[p]) return pass_override[p] > 0;
+    return g_opt.level >= passes[p].level;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Runs one pass if it is enabled; returns its change count */
+static int run_pass(PassId p, Method *m) {
+    if (!pass_enabled(p)) return 0;
+    phase_begin(passes[p].name);
+    /* the counts are shared by every thread, but --threads rules out
+     * --pass-stats, so they are only kept when they will be printed */
+    double t0 = g_opt.pass_stats ? now_seconds() : 0;
+    int changes = passes[p].run(m);
+    if (g_opt.pass_stats) {
+        pass_stats[p].seconds += now_seconds() - t0;
+        pass_stats[p].runs++;
+        pass_stats[p].changes += changes;
+    }
+    phase_end();
+    if (g_opt.dump_ir) ir_dump_method(stderr, m, passes[p].name);
+    return changes;
+}
+
+void opt_print_stats(FILE *out) {
+    fprintf(out, "%-8s %8s %10s %12s\n", "pass", "runs", "changes", "time (ms)");
+    for (int p = 0; p < P_COUNT; p++) {
+        if (!pass_enabled(p)) continue;
+        fprintf(out, "%-8s %8d %10ld %12.3f\n", passes[p].name, pass_stats[p].runs,
+                pass_stats[p].changes, pass_stats[p].seconds * 1e3);
+    }
+}
+
+/* SCCP leaves the operands of folded instructions behind as pops; the loop
+ * passes match instruction shapes, so those are cleaned up right away */
+static void propagate_constants(Method *m) {
+    run_pass(P_SCCP, m);
+    run_pass(P_DCE, m);
+}
+
+void optimize_method(Method *m) {
+    if (g_opt.dump_ir) ir_dump_method(stderr, m, "input");
+    run_pass(P_SWAP, m);
+    propagate_constants(m);
+    while (run_pass(P_SCEV, m)) propagate_constants(m);
+    run_pass(P_LICM, m);
+    run_pass(P_IV, m);
+    if (run_pass(P_UNROLL, m)) run_pass(P_SCCP, m);
+    run_pass(P_CSE, m);
+    run_pass(P_DCE, m);
+    run_pass(P_SSA, m);
+}
@@ -0,0 +1,211 @@
+/* Compile-time evaluation of main (--partial-eval).
+ *
+ * Programs in this language read no input, so running main's buffered
+ * code here gives exactly the text the JVM would print. When the run ends
+ * normally within the fuel budget, main is replaced by a few prints of
+ * that text. Anything the interpreter does not model (unknown calls, raw
+ * instructions, division by zero, running out of fuel) leaves the method
+ * as it was. */
+#include "compiler_common.h"
+#include "runtime.h"
+
+#define PEVAL_CHUNK 16384 /* characters per string constant, well under the 64K class file limit */
+#define PEVAL_OUT   "java/lang/System/out Ljava/io/PrintStream;"
+#define PEVAL_PRINT "java/io/PrintStream/print(Ljava/lang/String;)V"
+
+typedef enum { V_NONE, V_INT, V_FLOAT, V_LONG, V_STR, V_STREAM } Kind;
+
+typedef struct {
+    Kind kind;
+    int i;
+    float f;
+    long long l;
+    char *s;   /* escaped as in a Jasmin string literal; owned by the arena */
+} Value;
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} Text;
+
+typedef struct {
+    char **strs;
+    int n, cap;
+} Arena;
+
+static void text_append(Text *t, const char *s, size_t n) {
+    if (t->len + n + 1 > t->cap) {
+        t->cap = (t->len + n + 1) * 2;
+        t->buf = realloc(t->buf, t->cap);
+    }
+    memcpy(t->buf + t->len, s, n);
+    t->len += n;
+    t->buf[t->len] = '\0';
+}
+
+static char *arena_add(Arena *a, char *s) {
+    if (a->n == a->cap) {
+        a->cap = a->cap ? a->cap * 2 : 64;
+        a->strs = realloc(a->strs, a->cap * sizeof(char *));
+    }
+    return a->strs[a->n++] = s;
+}
+
+/* Runs the method; returns false if it cannot be evaluated completely */
+static bool run(const Method *m, long fuel, Text *text, Arena *arena) {
+    int *label_at = malloc((m->nlabels + 1) * sizeof(int));
+    Value *locals = calloc(m->next_local + 2, sizeof(Value));
+    int stack_cap = 256, sp = 0;
+    Value *stack = malloc(stack_cap * sizeof(Value));
+    bool ok = false;
+    char buf[64];
+
+    for (int i = 0; i < m->len; i++) {
+        if (m->code[i].op == OP_LABEL) label_at[m->code[i].ival] = i;
+    }
+    for (int pc = 0; pc < m->len; pc++) {
+        const Insn *in = &m->code[pc];
+        Value a, b, r = { V_NONE, 0, 0, 0, NULL };
+        if (--fuel < 0) goto done;
+        if (sp + 2 >= stack_cap) {
+            stack_cap *= 2;
+            stack = realloc(stack, stack_cap * sizeof(Value));
+        }
+        int pops = in->op == OP_RAW ? 0 : insn_pops(in);
+        if (pops > sp) goto done;
+        b = pops >= 1 ? stack[sp - 1] : r;
+        a = pops >= 2 ? stack[sp - 2] : r;
+
+        switch (in->op) {
+        case OP_NOP:
+        case OP_LABEL:
+            continue;
+        case OP_ICONST: r.kind = V_INT; r.i = in->ival; break;
+        case OP_FCONST: r.kind = V_FLOAT; r.f = in->fval; break;
+        case OP_LCONST: r.kind = V_LONG; r.l = in->ival; break;
+        case OP_SCONST: r.kind = V_STR; r.s = in->sval; break;
+        case OP_ILOAD: case OP_FLOAD: case OP_ALOAD: case OP_LLOAD:
+            r = locals[in->ival];
+            if (r.kind == V_NONE) goto done;
+            break;
+        case OP_ISTORE: case OP_FSTORE: case OP_ASTORE: case OP_LSTORE:
+            locals[in->ival] = stack[--sp];
+            continue;
+        case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IREM:
+        case OP_ISHL: case OP_ISHR: case OP_IUSHR: case OP_IAND: case OP_IOR: case OP_IXOR:
+            r.kind = V_INT;
+            if (!eval_int_binop(in->op, a.i, b.i, &r.i)) goto done;
+            break;
+        case OP_INEG: r.kind = V_INT; r.i = (int)(0u - (uint32_t)b.i); break;
+        case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV:
+            r.kind = V_FLOAT;
+            r.f = eval_float_binop(in->op, a.f, b.f);
+            break;
+        case OP_FNEG: r.kind = V_FLOAT; r.f = -b.f; break;
+        case OP_I2F: r.kind = V_FLOAT; r.f = (float)b.i; break;
+        case OP_F2I: r.kind = V_INT; r.i = java_f2i(b.f); break;
+        case OP_FCMPL: case OP_FCMPG:
+            r.kind = V_INT;
+            r.i = java_fcmp(a.f, b.f, in->op == OP_FCMPL ? -1 : 1);
+            break;
+        case OP_LADD: r.kind = V_LONG; r.l = (long long)((uint64_t)a.l + (uint64_t)b.l); break;
+        case OP_LSUB: r.kind = V_LONG; r.l = (long long)((uint64_t)a.l - (uint64_t)b.l); break;
+        case OP_LMUL: r.kind = V_LONG; r.l = (long long)((uint64_t)a.l * (uint64_t)b.l); break;
+        case OP_LUSHR: r.kind = V_LONG; r.l = (long long)((uint64_t)a.l >> (b.i & 63)); break;
+        case OP_LCMP: r.kind = V_INT; r.i = (a.l > b.l) - (a.l < b.l); break;
+        case OP_I2L: r.kind = V_LONG; r.l = b.i; break;
+        case OP_L2I: r.kind = V_INT; r.i = (int)(uint32_t)(uint64_t)b.l; break;
+        case OP_DUP: case OP_LDUP:
+            stack[sp++] = b;
+            continue;
+        case OP_POP: case OP_LPOP:
+            sp--;
+            continue;
+        case OP_SWAP:
+            stack[sp - 1] = a;
+            stack[sp - 2] = b;
+            continue;
+        case OP_GOTO:
+            pc = label_at[in->ival];
+            continue;
+        case OP_GETSTATIC:
+            if (strcmp(in->sval, PEVAL_OUT) != 0) goto done;
+            r.kind = V_STREAM;
+            break;
+        case OP_INVOKESTATIC:
+            if (strcmp(in->sval, "java/lang/String/valueOf(I)Ljava/lang/String;") == 0)
+                snprintf(buf, sizeof(buf), "%d", b.i);
+            else if (strcmp(in->sval, "java/lang/String/valueOf(F)Ljava/lang/String;") == 0)
+                rt_float_to_string(b.f, buf, sizeof(buf));
+            else
+                goto done;
+            r.kind = V_STR;
+            r.s = arena_add(arena, strdup(buf));
+            break;
+        case OP_INVOKEVIRTUAL:
+            if (a.kind != V_STREAM || b.kind != V_STR) goto done;
+            if (strcmp(in->sval, PEVAL_PRINT) == 0) {
+                text_append(text, b.s, strlen(b.s));
+            } else if (strcmp(in->sval, "java/io/PrintStream/println(Ljava/lang/String;)V") == 0) {
+                text_append(text, b.s, strlen(b.s));
+                text_append(text, "\\n", 2);
+            } else {
+                goto done;
+            }
+            sp -= 2;
+            continue;
+        case OP_RETURN:
+            ok = true;
+            goto done;
+        default:
+            if (!insn_is_branch(in) || in->op == OP_GOTO) goto done;
+            sp -= pops;
+            if (eval_compare(in->op, pops == 2 ? a.i : b.i, pops == 2 ? b.i : 0)) pc = label_at[in->ival];
+            continue;
+        }
+        sp -= pops;
+        stack[sp++] = r;
+    }
+done:
+    free(label_at);
+    free(locals);
+    free(stack);
+    return ok;
+}
+
+/* Length of the escape sequence or character starting at s */
+static size_t token_len(const char *s) {
+    if (s[0] != '\\' || s[1] == '\0') return 1;
+    if (s[1] == 'u') return 6;
+    return 2;
+}
+
+bool partial_eval(Method *m, long fuel) {
+    Text text = { NULL, 0, 0 };
+    Arena arena = { NULL, 0, 0 };
+    bool ok = run(m, fuel, &text, &arena);
+    for (int k = 0; k < arena.n; k++) free(arena.strs[k]);
+    free(arena.strs);
+    if (!ok) {
+        free(text.buf);
+        return false;
+    }
+
+    for (int i = 0; i < m->len; i++) free(m->code[i].sval);
+    m->len = 0;
+    size_t pos = 0;
+    while (pos < text.len) {
+        size_t end = pos;
+        while (end < text.len && end - pos < PEVAL_CHUNK) end += token_len(text.buf + end);
+        Insn *in = method_insert(m, m->len, OP_GETSTATIC, 0);
+        in->sval = strdup(PEVAL_OUT);
+        in = method_insert(m, m->len, OP_SCONST, 0);
+        in->sval = strndup(text.buf + pos, end - pos);
+        in = method_insert(m, m->len, OP_INVOKEVIRTUAL, 0);
+        in->sval = strdup(PEVAL_PRINT);
+        pos = end;
+    }
+    method_insert(m, m->len, OP_RETURN, 0);
+    free(text.buf);
+    return true;
+}
@@ -0,0 +1,327 @@
+/* Process pool for batch compilation (-j <n>), and a thread pool for the
+ * methods of one file (--threads=<n>).
+ *
+ * Only the parser's scope state is per file (its ParseState); the scanner
+ * still reads yyin and counts yylineno in globals, and code generation
+ * writes through fout and one method buffer. Diagnostics and
+ * --run output also go straight to stdout, which a process can capture per
+ * file and a thread cannot. So the jobs run in forked workers rather than
+ * threads: worker k takes jobs k, k + n, k + 2n, ... and starts from
+ * the parent's state, which is cheaper than a process per file. A worker
+ * captures each job's stdout in a temporary file and sends it back as
+ * one frame; the parent prints the frames in job order, so the output is
+ * the same for any number of workers. A job that calls exit()
+ * (a --run program dividing by zero) still sends its frame from an atexit
+ * handler, and the batch ends after printing it, as it does with -j 1. A
+ * job that kills its worker outright counts as failed and a new worker
+ * picks up the rest. */
+#include "compiler_common.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+    int index;
+    int ok;
+    int exited; /* the job called exit() */
+    long len;   /* bytes of output after the header */
+} Frame;
+
+typedef struct {
+    pid_t pid;
+    int fd;         /* read end of the frame pipe, -1 when not running */
+    int next;       /* next job this worker's slot is to start from */
+    int first;      /* the job its current process started from */
+    char *buf;
+    size_t len, cap;
+} Worker;
+
+typedef struct {
+    char *out;
+    long len;
+    bool done, ok, exited;
+} Result;
+
+/* The job a worker is in the middle of, for its atexit handler */
+static int child_index = -1;
+static FILE *child_tmp;
+static int child_fd;
+
+static void write_all(int fd, const void *p, size_t n) {
+    const char *c = p;
+    while (n > 0) {
+        ssize_t k = write(fd, c, n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return;
+        c += k;
+        n -= k;
+    }
+}
+
+/* Sends the captured output of the current job */
+static void send_frame(bool ok, bool exited) {
+    fflush(stdout);
+    Frame f = { child_index, ok, exited, lseek(fileno(child_tmp), 0, SEEK_END) };
+    write_all(child_fd, &f, sizeof(f));
+    lseek(fileno(child_tmp), 0, SEEK_SET);
+    char chunk[8192];
+    long left = f.len;
+    while (left > 0) {
+        ssize_t k = read(fileno(child_tmp), chunk, left < (long)sizeof(chunk) ? left : (long)sizeof(chunk));
+        if (k <= 0) break;
+        write_all(child_fd, chunk, k);
+        left -= k;
+    }
+    fclose(child_tmp);
+    child_index = -1;
+}
+
+static void child_exit(void) {
+    if (child_index >= 0) send_frame(false, true);
+}
+
+static void worker_main(int first, int stride, int n, int fd, bool (*work)(int, void *), void *ctx) {
+    child_fd = fd;
+    atexit(child_exit);
+    for (int i = first; i < n; i += stride) {
+        child_tmp = tmpfile();
+        if (!child_tmp) break;
+        dup2(fileno(child_tmp), 1);
+        child_index = i;
+        send_frame(work(i, ctx), false);
+    }
+    _exit(0);
+}
+
+static bool worker_start(Worker *w, int stride, int n, bool (*work)(int, void *), void *ctx) {
+    int fds[2];
+    if (pipe(fds) < 0) return false;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        worker_main(w->next, stride, n, fds[1], work, ctx);
+    }
+    close(fds[1]);
+    w->pid = pid;
+    w->fd = fds[0];
+    w->first = w->next;
+    w->len = 0;
+    return true;
+}
+
+/* Moves every complete frame out of the worker's buffer */
+static void take_frames(Worker *w, Result *rs, int stride) {
+    size_t pos = 0;
+    while (w->len - pos >= sizeof(Frame)) {
+        Frame f;
+        memcpy(&f, w->buf + pos, sizeof(f));
+        if (w->len - pos - sizeof(f) < (size_t)f.len) break;
+        Result *r = &rs[f.index];
+        r->out = malloc(f.len + 1);
+        memcpy(r->out, w->buf + pos + sizeof(f), f.len);
+        r->len = f.len;
+        r->ok = f.ok;
+        r->exited = f.exited;
+        r->done = true;
+        w->next = f.index + stride;
+        pos += sizeof(f) + f.len;
+    }
+    memmove(w->buf, w->buf + pos, w->len - pos);
+    w->len -= pos;
+}
+
+/* Runs work(0..n-1) in up to jobs workers; returns how many failed */
+int pool_run(int n, int jobs, bool (*work)(int index, void *ctx), void *ctx) {
+    int nw = jobs < n ? jobs : n;
+    Worker *ws = calloc(nw + 1, sizeof(Worker));
+    Result *rs = calloc(n + 1, sizeof(Result));
+    struct pollfd *pfd = calloc(nw + 1, sizeof(struct pollfd));
+    int *live = calloc(nw + 1, sizeof(int));
+    int printed = 0, failed = 0;
+
+    for (int k = 0; k < nw; k++) {
+        ws[k].fd = -1;
+        ws[k].next = k;
+    }
+    for (;;) {
+        int nlive = 0;
+        for (int k = 0; k < nw; k++) {
+            Worker *w = &ws[k];
+            if (w->fd < 0 && w->next < n && !worker_start(w, nw, n, work, ctx)) {
+                /* no process to spare: run the job here, unordered */
+                rs[w->next].ok = work(w->next, ctx);
+                rs[w->next].done = true;
+                w->next += nw;
+            }
+            if (w->fd >= 0) {
+                pfd[nlive] = (struct pollfd){ w->fd, POLLIN, 0 };
+                live[nlive++] = k;
+            }
+        }
+        while (printed < n && rs[printed].done) {
+            Result *r = &rs[printed++];
+            fwrite(r->out, 1, r->len, stdout);
+            if (!r->ok) failed++;
+            free(r->out);
+            if (r->exited) {
+                /* stop where the serial loop would have */
+                fflush(stdout);
+                for (int k = 0; k < nw; k++) {
+                    if (ws[k].fd >= 0) kill(ws[k].pid, SIGKILL);
+                }
+                exit(1);
+            }
+        }
+        if (nlive == 0) break;
+        if (poll(pfd, nlive, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int p = 0; p < nlive; p++) {
+            if (!pfd[p].revents) continue;
+            Worker *w = &ws[live[p]];
+            if (w->cap - w->len < 65536) {
+                w->cap = w->cap * 2 + 65536;
+                w->buf = realloc(w->buf, w->cap);
+            }
+            ssize_t k = read(w->fd, w->buf + w->len, w->cap - w->len);
+            if (k < 0 && errno == EINTR) continue;
+            if (k > 0) {
+                w->len += k;
+                take_frames(w, rs, nw);
+                continue;
+            }
+            /* finished, or died; a restart resumes after its last frame */
+            close(w->fd);
+            w->fd = -1;
+            waitpid(w->pid, NULL, 0);
+            if (w->next == w->first && w->next < n) {
+                /* died without a frame: the job itself crashed, skip it */
+                rs[w->next].done = true;
+                w->next += nw;
+            }
+        }
+    }
+    fflush(stdout);
+    for (int k = 0; k < nw; k++) free(ws[k].buf);
+    free(live);
+    free(pfd);
+    free(rs);
+    free(ws);
+    return failed;
+}
+
+/* ------------------------------------------------------------------ */
+/* Threads                                                             */
+/* ------------------------------------------------------------------ */
+
+/* pool_for gives each thread an equal slice of the jobs. A thread takes
+ * jobs from the front of its own slice; once that is empty it steals the
+ * back half of the largest slice left, so a few slow jobs do not leave the
+ * other threads idle. next and end change under the slice's lock but are
+ * stored atomically, so the search for a victim can read them without it. */
+typedef struct {
+    pthread_mutex_t lock;
+    int next, end;  /* jobs [next, end) not taken yet */
+} Slice;
+
+typedef struct {
+    Slice *slices;
+    int nthreads;
+    void (*work)(int index, void *ctx);
+    void *ctx;
+} ForPool;
+
+typedef struct {
+    ForPool *pool;
+    int self;
+} ForThread;
+
+static int slice_take(Slice *s) {
+    pthread_mutex_lock(&s->lock);
+    int i = s->next < s->end ? s->next : -1;
+    if (i >= 0) __atomic_store_n(&s->next, i + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&s->lock);
+    return i;
+}
+
+/* Moves the back half of the fullest other slice into the thread's own;
+ * false when there is nothing left anywhere */
+static bool slice_steal(ForPool *p, int self) {
+    for (;;) {
+        int victim = -1, most = 0;
+        for (int k = 0; k < p->nthreads; k++) {
+            /* a hint, rechecked under the lock below */
+            int left = __atomic_load_n(&p->slices[k].end, __ATOMIC_RELAXED) -
+                       __atomic_load_n(&p->slices[k].next, __ATOMIC_RELAXED);
+            if (k != self && left > most) {
+                most = left;
+                victim = k;
+            }
+        }
+        if (victim < 0) return false;
+        Slice *v = &p->slices[victim];
+        pthread_mutex_lock(&v->lock);
+        int left = v->end - v->next, lo = v->end, hi = v->end;
+        if (left > 0) {
+            lo = v->end - (left + 1) / 2;
+            __atomic_store_n(&v->end, lo, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (lo == hi) continue;  /* emptied in the meantime */
+        Slice *s = &p->slices[self];
+        pthread_mutex_lock(&s->lock);
+        __atomic_store_n(&s->next, lo, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->end, hi, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&s->lock);
+        return true;
+    }
+}
+
+static void *for_thread(void *arg) {
+    ForThread *t = arg;
+    ForPool *p = t->pool;
+    do {
+        for (int i; (i = slice_take(&p->slices[t->self])) >= 0;) p->work(i, p->ctx);
+    } while (slice_steal(p, t->self));
+    return NULL;
+}
+
+/* Runs work(0..n-1) on up to threads threads, the caller's included */
+void pool_for(int n, int threads, void (*work)(int index, void *ctx), void *ctx) {
+    int nt = threads < n ? threads : n;
+    if (nt <= 1) {
+        for (int i = 0; i < n; i++) work(i, ctx);
+        return;
+    }
+    ForPool p = { calloc(nt, sizeof(Slice)), nt, work, ctx };
+    ForThread *ts = calloc(nt, sizeof(ForThread));
+    pthread_t *tids = calloc(nt, sizeof(pthread_t));
+    bool *started = calloc(nt, sizeof(bool));
+    for (int k = 0; k < nt; k++) {
+        pthread_mutex_init(&p.slices[k].lock, NULL);
+        p.slices[k].next = (int)((long)n * k / nt);
+        p.slices[k].end = (int)((long)n * (k + 1) / nt);
+        ts[k] = (ForThread){ &p, k };
+    }
+    /* a thread that cannot be started leaves its slice to be stolen */
+    for (int k = 1; k < nt; k++) started[k] = pthread_create(&tids[k], NULL, for_thread, &ts[k]) == 0;
+    for_thread(&ts[0]);
+    for (int k = 1; k < nt; k++) {
+        if (started[k]) pthread_join(tids[k], NULL);
+    }
+    for (int k = 0; k < nt; k++) pthread_mutex_destroy(&p.slices[k].lock);
+    free(started);
+    free(tids);
+    free(ts);
+    free(p.slices);
+}
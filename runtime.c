@@ -0,0 +1,177 @@
+/* Runtime support for native programs; see runtime.h */
+#include "runtime.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RT_BUF_SIZE 65536
+
+static char out_buf[RT_BUF_SIZE];
+static size_t out_len;
+
+void rt_flush(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t n = write(1, out_buf + done, out_len - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    out_len = 0;
+}
+
+static void put(const char *s, size_t n) {
+    while (n > 0) {
+        if (out_len == RT_BUF_SIZE) rt_flush();
+        size_t k = RT_BUF_SIZE - out_len < n ? RT_BUF_SIZE - out_len : n;
+        memcpy(out_buf + out_len, s, k);
+        out_len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+void rt_print(const char *s) {
+    put(s, strlen(s));
+}
+
+void rt_println(const char *s) {
+    put(s, strlen(s));
+    put("\n", 1);
+}
+
+void rt_print_int(int32_t v) {
+    char buf[16];
+    put(buf, snprintf(buf, sizeof(buf), "%d", v));
+}
+
+void rt_println_int(int32_t v) {
+    rt_print_int(v);
+    put("\n", 1);
+}
+
+void rt_print_float(float f) {
+    char buf[64];
+    rt_float_to_string(f, buf, sizeof(buf));
+    rt_print(buf);
+}
+
+void rt_println_float(float f) {
+    rt_print_float(f);
+    put("\n", 1);
+}
+
+const char *rt_str_int(int32_t v) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", v);
+    return strdup(buf);
+}
+
+const char *rt_str_float(float f) {
+    char buf[64];
+    rt_float_to_string(f, buf, sizeof(buf));
+    return strdup(buf);
+}
+
+/* The shortest digits that read back as f, in plain notation for
+ * 1e-3 <= |f| < 1e7 and as d.dddE<n> otherwise */
+void rt_float_to_string(float f, char *buf, size_t size) {
+    if (isnan(f)) {
+        snprintf(buf, size, "NaN");
+        return;
+    }
+    if (isinf(f)) {
+        snprintf(buf, size, f > 0 ? "Infinity" : "-Infinity");
+        return;
+    }
+    if (f == 0) {
+        snprintf(buf, size, signbit(f) ? "-0.0" : "0.0");
+        return;
+    }
+    char sci[64];
+    for (int prec = 0; prec < 9; prec++) {
+        snprintf(sci, sizeof(sci), "%.*e", prec, f);
+        if (strtof(sci, NULL) == f) break;
+    }
+    bool neg = sci[0] == '-';
+    char *mant = sci + neg;
+    char *e = strchr(mant, 'e');
+    int exp = atoi(e + 1);
+    char digits[32];
+    int nd = 0;
+    for (char *p = mant; p < e; p++) {
+        if (isdigit((unsigned char)*p)) digits[nd++] = *p;
+    }
+    while (nd > 1 && digits[nd - 1] == '0') nd--;
+    digits[nd] = '\0';
+
+    char out[64];
+    int k = 0;
+    if (neg) out[k++] = '-';
+    float mag = fabsf(f);
+    if (mag >= 1e-3f && mag < 1e7f) {
+        if (exp >= 0) {
+            for (int d = 0; d <= exp; d++) out[k++] = d < nd ? digits[d] : '0';
+            out[k++] = '.';
+            if (nd > exp + 1) {
+                for (int d = exp + 1; d < nd; d++) out[k++] = digits[d];
+            } else {
+                out[k++] = '0';
+            }
+        } else {
+            out[k++] = '0';
+            out[k++] = '.';
+            for (int z = 0; z < -exp - 1; z++) out[k++] = '0';
+            for (int d = 0; d < nd; d++) out[k++] = digits[d];
+        }
+        out[k] = '\0';
+    } else {
+        out[k++] = digits[0];
+        out[k++] = '.';
+        if (nd > 1) {
+            for (int d = 1; d < nd; d++) out[k++] = digits[d];
+        } else {
+            out[k++] = '0';
+        }
+        snprintf(out + k, sizeof(out) - k, "E%d", exp);
+    }
+    snprintf(buf, size, "%s", out);
+}
+
+static void divide_by_zero(void) {
+    rt_flush();
+    fprintf(stderr, "Exception in thread \"main\" java.lang.ArithmeticException: / by zero\n");
+    exit(1);
+}
+
+int32_t rt_idiv(int32_t a, int32_t b) {
+    if (b == 0) divide_by_zero();
+    if (b == -1) return (int32_t)(0u - (uint32_t)a);
+    return a / b;
+}
+
+int32_t rt_irem(int32_t a, int32_t b) {
+    if (b == 0) divide_by_zero();
+    if (b == -1) return 0;
+    return a % b;
+}
+
+int32_t rt_f2i(float f) {
+    if (isnan(f)) return 0;
+    if (f >= 2147483648.0f) return INT32_MAX;
+    if (f <= -2147483648.0f) return INT32_MIN;
+    return (int32_t)f;
+}
+
+int32_t rt_fcmpl(float a, float b) {
+    if (isnan(a) || isnan(b)) return -1;
+    return (a > b) - (a < b);
+}
+
+int32_t rt_fcmpg(float a, float b) {
+    if (isnan(a) || isnan(b)) return 1;
+    return (a > b) - (a < b);
+}
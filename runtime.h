@@ -0,0 +1,34 @@
+/* Runtime for natively compiled programs (--emit=x86, --emit=c), also
+ * linked into mycompiler, which formats floats with it at compile time
+ * and prints through it under --run. Output goes
+ * through one buffer that is flushed when full, on errors and by rt_flush.
+ * Strings are NUL-terminated and already unescaped. */
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void rt_print(const char *s);
+void rt_println(const char *s);
+void rt_print_int(int32_t v);
+void rt_println_int(int32_t v);
+void rt_print_float(float f);
+void rt_println_float(float f);
+void rt_flush(void);
+
+/* String.valueOf; the result stays valid until the program exits */
+const char *rt_str_int(int32_t v);
+const char *rt_str_float(float f);
+
+/* Float.toString */
+void rt_float_to_string(float f, char *buf, size_t size);
+
+/* JVM semantics for operations C or the CPU define differently */
+int32_t rt_idiv(int32_t a, int32_t b);
+int32_t rt_irem(int32_t a, int32_t b);
+int32_t rt_f2i(float f);
+int32_t rt_fcmpl(float a, float b);
+int32_t rt_fcmpg(float a, float b);
+
+#endif /* RUNTIME_H */
@@ -0,0 +1,732 @@
+/* SSA form of a buffered method.
+ *
+ * Construction runs the stack code of every reachable block symbolically:
+ * loads, stores, dup, pop and swap only move value numbers around, and
+ * every other instruction becomes an IrValue whose operands are the values
+ * it pops. Blocks with several predecessors get a phi for every local slot
+ * and every stack entry live on entry; phis that merge one value only are
+ * then replaced by it, and values nothing observable depends on are dropped.
+ *
+ * Lowering (the stackifier) leaves a value on the operand stack when its
+ * only use is the instruction that directly follows its expression tree;
+ * operands are always pushed in order, so no swap is ever needed. Other
+ * values get a fresh local, constants are re-pushed at every use, and phis
+ * become copies at the end of each predecessor: all sources are pushed
+ * before the first target is stored, which makes the copies parallel. */
+#include "compiler_common.h"
+
+void list_push(IntList *l, int x) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 4;
+        l->v = realloc(l->v, l->cap * sizeof(int));
+    }
+    l->v[l->n++] = x;
+}
+
+static void list_prepend(IntList *l, int x) {
+    list_push(l, x);
+    memmove(l->v + 1, l->v, (l->n - 1) * sizeof(int));
+    l->v[0] = x;
+}
+
+static int new_value(IrFunc *f, int block, IrKind kind, Opcode op, IrType type) {
+    if (f->nvals == f->cap) {
+        f->cap = f->cap ? f->cap * 2 : 64;
+        f->vals = realloc(f->vals, f->cap * sizeof(IrValue));
+    }
+    IrValue *v = &f->vals[f->nvals];
+    memset(v, 0, sizeof(*v));
+    v->kind = kind;
+    v->op = op;
+    v->type = type;
+    v->block = block;
+    return f->nvals++;
+}
+
+static void add_arg(IrValue *v, int arg) {
+    v->args = realloc(v->args, (v->nargs + 1) * sizeof(int));
+    v->args[v->nargs++] = arg;
+}
+
+static IrType descriptor_type(char c) {
+    switch (c) {
+    case 'I': case 'Z': return IR_INT;
+    case 'F': return IR_FLOAT;
+    case 'J': return IR_LONG;
+    case 'V': return IR_VOID;
+    default: return IR_REF;
+    }
+}
+
+static IrType slot_type(Opcode op) {
+    switch (op) {
+    case OP_ILOAD: case OP_ISTORE: return IR_INT;
+    case OP_FLOAD: case OP_FSTORE: return IR_FLOAT;
+    case OP_ALOAD: case OP_ASTORE: return IR_REF;
+    case OP_LLOAD: case OP_LSTORE: return IR_LONG;
+    default: return IR_VOID;
+    }
+}
+
+static IrType result_type(const Insn *in) {
+    switch (in->op) {
+    case OP_SCONST: return IR_REF;
+    case OP_LCMP: case OP_L2I: case OP_F2I: case OP_FCMPL: case OP_FCMPG: return IR_INT;
+    case OP_GETSTATIC: return descriptor_type(strchr(in->sval, ' ')[1]);
+    case OP_INVOKESTATIC:
+    case OP_INVOKEVIRTUAL: return descriptor_type(strchr(in->sval, ')')[1]);
+    default:
+        if (opcode_yields_float(in->op)) return IR_FLOAT;
+        if (opcode_flags(in->op) & OPF_LONG) return IR_LONG;
+        return IR_INT;
+    }
+}
+
+static bool value_is_pure(const IrFunc *f, const IrValue *v) {
+    if (v->kind != IR_INSN) return true;
+    if (opcode_flags(v->op) & OPF_PURE) return true;
+    if (v->op == OP_INVOKESTATIC) return strncmp(v->sval, "java/lang/String/valueOf(", 25) == 0;
+    if (v->op == OP_IDIV || v->op == OP_IREM) {
+        const IrValue *d = &f->vals[v->args[1]];
+        return d->kind == IR_INSN && d->op == OP_ICONST && d->ival != 0;
+    }
+    return false;
+}
+
+/* Values re-pushed at each use instead of being kept in a local */
+static bool value_is_constant(const IrValue *v) {
+    if (v->kind != IR_INSN) return false;
+    return v->op == OP_ICONST || v->op == OP_FCONST || v->op == OP_SCONST ||
+           v->op == OP_LCONST || v->op == OP_GETSTATIC;
+}
+
+static int find(int *repl, int v) {
+    while (repl[v] != v) v = repl[v] = repl[repl[v]];
+    return v;
+}
+
+/* Replaces phis that merge a single value (besides themselves) */
+static void remove_trivial_phis(IrFunc *f) {
+    int *repl = malloc(f->nvals * sizeof(int));
+    for (int v = 0; v < f->nvals; v++) repl[v] = v;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < f->nvals; v++) {
+            IrValue *x = &f->vals[v];
+            if (x->kind != IR_PHI || repl[v] != v) continue;
+            int same = -1;
+            bool trivial = true;
+            for (int a = 0; a < x->nargs && trivial; a++) {
+                int arg = find(repl, x->args[a]);
+                if (arg == v || arg == same) continue;
+                if (same >= 0) trivial = false;
+                same = arg;
+            }
+            if (trivial && same >= 0) {
+                repl[v] = same;
+                changed = true;
+            }
+        }
+    }
+    for (int v = 0; v < f->nvals; v++) {
+        IrValue *x = &f->vals[v];
+        for (int a = 0; a < x->nargs; a++) x->args[a] = find(repl, x->args[a]);
+        if (repl[v] != v) x->dead = true;
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *bb = &f->blocks[b];
+        for (int a = 0; a < bb->nterm_args; a++) bb->term_args[a] = find(repl, bb->term_args[a]);
+    }
+    free(repl);
+}
+
+/* Keeps effects, branch operands and everything they depend on */
+static void remove_dead_values(IrFunc *f) {
+    bool *live = calloc(f->nvals, sizeof(bool));
+    int *work = malloc(f->nvals * sizeof(int));
+    int n = 0;
+    for (int v = 0; v < f->nvals; v++) {
+        if (!f->vals[v].dead && !value_is_pure(f, &f->vals[v])) {
+            live[v] = true;
+            work[n++] = v;
+        }
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int a = 0; a < f->blocks[b].nterm_args; a++) {
+            int v = f->blocks[b].term_args[a];
+            if (!live[v]) {
+                live[v] = true;
+                work[n++] = v;
+            }
+        }
+    }
+    while (n > 0) {
+        const IrValue *x = &f->vals[work[--n]];
+        for (int a = 0; a < x->nargs; a++) {
+            if (!live[x->args[a]]) {
+                live[x->args[a]] = true;
+                work[n++] = x->args[a];
+            }
+        }
+    }
+    for (int v = 0; v < f->nvals; v++) f->vals[v].dead = !live[v];
+    free(live);
+    free(work);
+}
+
+/* Gives stack phis the type of their operands; false on a mismatch */
+static bool resolve_phi_types(IrFunc *f) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < f->nvals; v++) {
+            IrValue *x = &f->vals[v];
+            if (x->kind != IR_PHI || x->dead) continue;
+            for (int a = 0; a < x->nargs; a++) {
+                IrType t = f->vals[x->args[a]].type;
+                if (t == IR_VOID) continue;
+                if (x->type == IR_VOID) {
+                    x->type = t;
+                    changed = true;
+                } else if (x->type != t) {
+                    return false;
+                }
+            }
+        }
+    }
+    for (int v = 0; v < f->nvals; v++) {
+        if (!f->vals[v].dead && f->vals[v].type == IR_VOID && f->vals[v].kind == IR_PHI) return false;
+    }
+    return true;
+}
+
+bool ir_build(IrFunc *f, Method *m) {
+    memset(f, 0, sizeof(*f));
+    f->m = m;
+    Cfg g;
+    cfg_build(&g, m);
+    int *depth = malloc((g.nblocks + 1) * sizeof(int));
+    int nslots = m->next_local;
+    IrType *types = calloc(nslots + 1, sizeof(IrType));
+    int **exit_locals = calloc(g.nblocks + 1, sizeof(int *));
+    int **exit_stack = calloc(g.nblocks + 1, sizeof(int *));
+    int *stack = NULL;
+    /* the entry block has no phis, so nothing may jump back to it */
+    bool ok = g.nblocks > 0 && g.blocks[0].npreds == 0 && cfg_stack_depths(&g, depth) >= 0;
+
+    /* every slot keeps one type throughout the method */
+    for (int i = 0; i < m->len && ok; i++) {
+        const Insn *in = &m->code[i];
+        IrType t = slot_type(in->op);
+        if (in->op == OP_RAW) ok = false;
+        if (t == IR_VOID || !ok) continue;
+        if (types[in->ival] != IR_VOID && types[in->ival] != t) ok = false;
+        types[in->ival] = t;
+    }
+    if (!ok) goto done;
+
+    cfg_find_loops(&g);
+    f->nblocks = g.nblocks;
+    f->blocks = calloc(g.nblocks, sizeof(IrBlock));
+    stack = malloc((m->len + 1) * sizeof(int));
+    for (int b = 0; b < g.nblocks; b++) {
+        IrBlock *bb = &f->blocks[b];
+        const BasicBlock *cb = &g.blocks[b];
+        bb->reachable = g.idom[b] >= 0;
+        bb->idom = b == 0 ? -1 : g.idom[b];
+        bb->label = m->code[cb->start].op == OP_LABEL ? m->code[cb->start].ival : -1;
+        bb->nsucc = cb->nsucc;
+        bb->succ[0] = cb->succ[0];
+        bb->succ[1] = cb->succ[1];
+        bb->entry_depth = depth[b];
+        for (int p = 0; p < cb->npreds; p++) {
+            if (g.idom[cb->preds[p]] >= 0) list_push(&bb->preds, cb->preds[p]);
+        }
+        bb->term = OP_GOTO;
+    }
+
+    for (int k = 0; k < g.nrpo; k++) {
+        int b = g.rpo[k];
+        IrBlock *bb = &f->blocks[b];
+        const BasicBlock *cb = &g.blocks[b];
+        int *locals = malloc((nslots + 1) * sizeof(int));
+        int sp = 0;
+
+        if (b == 0) {
+            for (int s = 0; s < nslots; s++) {
+                locals[s] = -1;
+                if (types[s] == IR_VOID) continue;
+                locals[s] = new_value(f, b, IR_ARG, OP_NOP, types[s]);
+                f->vals[locals[s]].ival = s;
+            }
+        } else if (bb->preds.n == 1) {
+            memcpy(locals, exit_locals[bb->preds.v[0]], nslots * sizeof(int));
+            memcpy(stack, exit_stack[bb->preds.v[0]], bb->entry_depth * sizeof(int));
+            sp = bb->entry_depth;
+        } else {
+            for (int s = 0; s < nslots; s++) {
+                locals[s] = types[s] == IR_VOID ? -1 : new_value(f, b, IR_PHI, OP_NOP, types[s]);
+                if (locals[s] >= 0) list_push(&bb->phis, locals[s]);
+            }
+            for (; sp < bb->entry_depth; sp++) {
+                stack[sp] = new_value(f, b, IR_PHI, OP_NOP, IR_VOID);
+                list_push(&bb->phis, stack[sp]);
+            }
+        }
+
+        for (int i = cb->start; i < cb->end; i++) {
+            const Insn *in = &m->code[i];
+            int x, pops = insn_pops(in);
+            switch (in->op) {
+            case OP_NOP: case OP_LABEL:
+                break;
+            case OP_ILOAD: case OP_FLOAD: case OP_ALOAD: case OP_LLOAD:
+                stack[sp++] = locals[in->ival];
+                break;
+            case OP_ISTORE: case OP_FSTORE: case OP_ASTORE: case OP_LSTORE:
+                locals[in->ival] = stack[--sp];
+                break;
+            case OP_DUP: case OP_LDUP:
+                stack[sp] = stack[sp - 1];
+                sp++;
+                break;
+            case OP_POP: case OP_LPOP:
+                sp--;
+                break;
+            case OP_SWAP:
+                x = stack[sp - 1];
+                stack[sp - 1] = stack[sp - 2];
+                stack[sp - 2] = x;
+                break;
+            default:
+                if (insn_is_branch(in) || (opcode_flags(in->op) & OPF_END)) {
+                    if (insn_is_branch(in) && g.label_block[in->ival] < 0) ok = false;
+                    bb->term = in->op;
+                    bb->term_label = in->ival;
+                    bb->lineno = in->lineno;
+                    for (int a = 0; a < pops; a++) bb->term_args[a] = stack[sp - pops + a];
+                    bb->nterm_args = pops;
+                    sp -= pops;
+                    break;
+                }
+                x = new_value(f, b, IR_INSN, in->op, insn_pushes(in) ? result_type(in) : IR_VOID);
+                IrValue *v = &f->vals[x];
+                v->ival = in->ival;
+                v->fval = in->fval;
+                v->sval = in->sval ? strdup(in->sval) : NULL;
+                v->lineno = in->lineno;
+                for (int a = 0; a < pops; a++) add_arg(v, stack[sp - pops + a]);
+                sp -= pops;
+                list_push(&bb->insns, x);
+                if (insn_pushes(in)) stack[sp++] = x;
+                break;
+            }
+        }
+        exit_locals[b] = locals;
+        exit_stack[b] = malloc((sp + 1) * sizeof(int));
+        memcpy(exit_stack[b], stack, sp * sizeof(int));
+    }
+
+    /* phi operands, in predecessor order */
+    for (int b = 0; b < f->nblocks && ok; b++) {
+        IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable || b == 0 || bb->preds.n < 2) continue;
+        int k = 0;
+        for (int s = 0; s < nslots; s++) {
+            if (types[s] == IR_VOID) continue;
+            IrValue *phi = &f->vals[bb->phis.v[k++]];
+            for (int p = 0; p < bb->preds.n; p++) add_arg(phi, exit_locals[bb->preds.v[p]][s]);
+        }
+        for (int d = 0; d < bb->entry_depth; d++) {
+            IrValue *phi = &f->vals[bb->phis.v[k++]];
+            for (int p = 0; p < bb->preds.n; p++) add_arg(phi, exit_stack[bb->preds.v[p]][d]);
+        }
+    }
+    if (ok) {
+        remove_trivial_phis(f);
+        remove_dead_values(f);
+        ok = resolve_phi_types(f);
+    }
+
+done:
+    for (int b = 0; b < g.nblocks; b++) {
+        free(exit_locals[b]);
+        free(exit_stack[b]);
+    }
+    free(exit_locals);
+    free(exit_stack);
+    free(stack);
+    free(types);
+    free(depth);
+    cfg_free(&g);
+    if (!ok) ir_free(f);
+    return ok;
+}
+
+void ir_free(IrFunc *f) {
+    for (int v = 0; v < f->nvals; v++) {
+        free(f->vals[v].args);
+        free(f->vals[v].sval);
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        free(f->blocks[b].preds.v);
+        free(f->blocks[b].phis.v);
+        free(f->blocks[b].insns.v);
+    }
+    free(f->vals);
+    free(f->blocks);
+    memset(f, 0, sizeof(*f));
+}
+
+/* True if entering block to needs phi copies */
+bool ir_has_copies(const IrFunc *f, int to) {
+    const IrBlock *bb = &f->blocks[to];
+    for (int k = 0; k < bb->phis.n; k++) {
+        if (!f->vals[bb->phis.v[k]].dead) return true;
+    }
+    return false;
+}
+
+/* String.valueOf of an int ('I') or float ('F') */
+bool ir_is_value_of(const IrValue *v, char type) {
+    return v->kind == IR_INSN && v->op == OP_INVOKESTATIC &&
+           strncmp(v->sval, "java/lang/String/valueOf(", 25) == 0 && v->sval[25] == type;
+}
+
+/* Marks the valueOf results whose only use is a print in the same block,
+ * so a native backend can format the number straight into the output */
+bool *ir_fused_prints(const IrFunc *f) {
+    int *uses = calloc(f->nvals + 1, sizeof(int));
+    bool *fused = calloc(f->nvals + 1, sizeof(bool));
+    for (int v = 0; v < f->nvals; v++) {
+        if (f->vals[v].dead) continue;
+        for (int a = 0; a < f->vals[v].nargs; a++) uses[f->vals[v].args[a]]++;
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int a = 0; a < f->blocks[b].nterm_args; a++) uses[f->blocks[b].term_args[a]]++;
+    }
+    for (int v = 0; v < f->nvals; v++) {
+        const IrValue *p = &f->vals[v];
+        if (p->dead || p->kind != IR_INSN || p->op != OP_INVOKEVIRTUAL || p->nargs != 2) continue;
+        const IrValue *s = &f->vals[p->args[1]];
+        if ((ir_is_value_of(s, 'I') || ir_is_value_of(s, 'F')) && uses[p->args[1]] == 1 && s->block == p->block)
+            fused[p->args[1]] = true;
+    }
+    free(uses);
+    return fused;
+}
+
+/* ------------------------------------------------------------------ */
+/* Textual dump                                                        */
+/* ------------------------------------------------------------------ */
+
+static const char *type_name(IrType t) {
+    static const char *names[] = { "void", "i", "f", "l", "a" };
+    return names[t];
+}
+
+static void dump_operands(FILE *out, const int *args, int n) {
+    for (int a = 0; a < n; a++) fprintf(out, "%s v%d", a ? "," : "", args[a]);
+}
+
+void ir_dump(FILE *out, const IrFunc *f, const char *tag) {
+    char buf[64];
+    fprintf(out, "function %s ; %s\n", f->m->name, tag);
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable) continue;
+        fprintf(out, "b%d:", b);
+        if (bb->preds.n) {
+            fprintf(out, " ; preds");
+            for (int p = 0; p < bb->preds.n; p++) fprintf(out, " b%d", bb->preds.v[p]);
+        }
+        if (bb->idom >= 0) fprintf(out, ", idom b%d", bb->idom);
+        fprintf(out, "\n");
+        for (int k = 0; k < bb->phis.n; k++) {
+            const IrValue *v = &f->vals[bb->phis.v[k]];
+            if (v->dead) continue;
+            fprintf(out, "  v%d:%s = phi", bb->phis.v[k], type_name(v->type));
+            for (int a = 0; a < v->nargs; a++)
+                fprintf(out, "%s [v%d, b%d]", a ? "," : "", v->args[a], bb->preds.v[a]);
+            fprintf(out, "\n");
+        }
+        if (b == 0) {
+            for (int x = 0; x < f->nvals; x++) {
+                const IrValue *v = &f->vals[x];
+                if (v->kind == IR_ARG && !v->dead)
+                    fprintf(out, "  v%d:%s = arg %d\n", x, type_name(v->type), v->ival);
+            }
+        }
+        for (int k = 0; k < bb->insns.n; k++) {
+            const IrValue *v = &f->vals[bb->insns.v[k]];
+            if (v->dead) continue;
+            fprintf(out, "  ");
+            if (v->type != IR_VOID) fprintf(out, "v%d:%s = ", bb->insns.v[k], type_name(v->type));
+            fprintf(out, "%s", v->op == OP_LCONST ? "lconst" : opcode_name(v->op));
+            if (v->op == OP_ICONST || v->op == OP_LCONST) {
+                fprintf(out, " %d", v->ival);
+            } else if (v->op == OP_FCONST) {
+                format_float(v->fval, buf, sizeof(buf));
+                fprintf(out, " %s", buf);
+            } else if (v->op == OP_SCONST) {
+                fprintf(out, " \"%s\"", v->sval);
+            } else if (v->sval) {
+                fprintf(out, " %s", v->sval);
+            }
+            dump_operands(out, v->args, v->nargs);
+            fprintf(out, "\n");
+        }
+        fprintf(out, "  %s", opcode_name(bb->term));
+        dump_operands(out, bb->term_args, bb->nterm_args);
+        if (bb->nsucc == 2) fprintf(out, " -> b%d, b%d\n", bb->succ[1], bb->succ[0]);
+        else if (bb->nsucc == 1) fprintf(out, " -> b%d\n", bb->succ[0]);
+        else fprintf(out, "\n");
+    }
+}
+
+void ir_dump_method(FILE *out, Method *m, const char *tag) {
+    IrFunc f;
+    if (!ir_build(&f, m)) {
+        fprintf(out, "function %s ; %s: not representable\n", m->name, tag);
+        return;
+    }
+    ir_dump(out, &f, tag);
+    ir_free(&f);
+}
+
+/* ------------------------------------------------------------------ */
+/* Stackifier                                                          */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    IrFunc *f;
+    Method *out;
+    int *uses;
+    int *slot;         /* local holding a value, -1 if none */
+    bool *on_stack;    /* value stays on the operand stack for its use */
+    IntList *loads;    /* per block position: values pushed right before it */
+    int *block_label;
+    int lineno;
+} Lower;
+
+static Insn *emit(Lower *lw, Opcode op, int ival) {
+    Insn *in = method_insert(lw->out, lw->out->len, op, ival);
+    in->lineno = lw->lineno;
+    return in;
+}
+
+static Opcode load_op(IrType t) {
+    static const Opcode ops[] = { OP_NOP, OP_ILOAD, OP_FLOAD, OP_LLOAD, OP_ALOAD };
+    return ops[t];
+}
+
+static Opcode store_op(IrType t) {
+    static const Opcode ops[] = { OP_NOP, OP_ISTORE, OP_FSTORE, OP_LSTORE, OP_ASTORE };
+    return ops[t];
+}
+
+static void emit_value_insn(Lower *lw, const IrValue *v) {
+    Insn *in = emit(lw, v->op, v->ival);
+    in->fval = v->fval;
+    in->sval = v->sval ? strdup(v->sval) : NULL;
+}
+
+/* Pushes a value kept outside the operand stack */
+static void materialize(Lower *lw, int x) {
+    const IrValue *v = &lw->f->vals[x];
+    if (value_is_constant(v)) emit_value_insn(lw, v);
+    else emit(lw, load_op(v->type), v->kind == IR_ARG ? v->ival : lw->slot[x]);
+}
+
+/* Marks the operands of the instruction at position pos (or the block
+ * terminator) that can stay on the stack. *p walks backwards over the
+ * block's instructions; loads for the other operands are attached to the
+ * position where the pushes for this instruction start. Returns that
+ * position. */
+static int stackify(Lower *lw, const IrBlock *bb, const int *args, int nargs, int pos, int *p) {
+    int start = pos;
+    for (int a = nargs - 1; a >= 0; a--) {
+        int x = args[a];
+        if (*p >= 0 && bb->insns.v[*p] == x && lw->uses[x] == 1) {
+            const IrValue *v = &lw->f->vals[x];
+            int at = (*p)--;
+            lw->on_stack[x] = true;
+            start = stackify(lw, bb, v->args, v->nargs, at, p);
+        } else {
+            list_prepend(&lw->loads[start], x);
+        }
+    }
+    return start;
+}
+
+/* Phi copies for the edge from -> to, as one parallel assignment */
+static void emit_copies(Lower *lw, int from, int to) {
+    const IrFunc *f = lw->f;
+    const IrBlock *bb = &f->blocks[to];
+    int idx = 0;
+    while (bb->preds.v[idx] != from) idx++;
+    int *targets = malloc((bb->phis.n + 1) * sizeof(int));
+    int n = 0;
+    for (int k = 0; k < bb->phis.n; k++) {
+        int phi = bb->phis.v[k];
+        const IrValue *v = &f->vals[phi];
+        if (v->dead || v->args[idx] == phi) continue;
+        materialize(lw, v->args[idx]);
+        targets[n++] = phi;
+    }
+    while (n > 0) {
+        int phi = targets[--n];
+        emit(lw, store_op(f->vals[phi].type), lw->slot[phi]);
+    }
+    free(targets);
+}
+
+static void emit_jump(Lower *lw, int to, int next) {
+    if (to != next) emit(lw, OP_GOTO, lw->block_label[to]);
+}
+
+void ir_lower(IrFunc *f, Method *m) {
+    Lower lw;
+    memset(&lw, 0, sizeof(lw));
+    lw.f = f;
+    lw.uses = calloc(f->nvals, sizeof(int));
+    lw.slot = malloc(f->nvals * sizeof(int));
+    lw.on_stack = calloc(f->nvals, sizeof(bool));
+    lw.block_label = malloc(f->nblocks * sizeof(int));
+
+    for (int x = 0; x < f->nvals; x++) {
+        const IrValue *v = &f->vals[x];
+        if (v->dead) continue;
+        for (int a = 0; a < v->nargs; a++) lw.uses[v->args[a]]++;
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int a = 0; a < f->blocks[b].nterm_args; a++) lw.uses[f->blocks[b].term_args[a]]++;
+    }
+    /* phi operands are read by the copies, never straight off the stack */
+    for (int x = 0; x < f->nvals; x++) {
+        if (f->vals[x].kind == IR_PHI && !f->vals[x].dead) {
+            for (int a = 0; a < f->vals[x].nargs; a++) lw.uses[f->vals[x].args[a]] += 2;
+        }
+    }
+
+    /* the new code reuses the method's labels and slots and adds its own */
+    Method fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.name = m->name;
+    fresh.labels = m->labels;
+    fresh.nlabels = m->nlabels;
+    fresh.labels_cap = m->labels_cap;
+    fresh.next_local = m->next_local;
+    lw.out = &fresh;
+    for (int x = 0; x < f->nvals; x++) {
+        const IrValue *v = &f->vals[x];
+        lw.slot[x] = -1;
+        if (v->dead || v->kind == IR_ARG || v->type == IR_VOID || value_is_constant(v)) continue;
+        if (v->kind == IR_INSN && lw.uses[x] == 0) continue;
+        lw.slot[x] = method_new_local(&fresh);
+        if (v->type == IR_LONG) method_new_local(&fresh);
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        lw.block_label[b] = bb->label >= 0 ? bb->label : method_new_label(&fresh, "B");
+    }
+
+    int *edge_from = malloc((f->nblocks + 1) * sizeof(int));
+    int *edge_label = malloc((f->nblocks + 1) * sizeof(int));
+    int nedges = 0;
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable) continue;
+        int next = b + 1;
+        while (next < f->nblocks && !f->blocks[next].reachable) next++;
+
+        /* drop dead values from the order, then find the stacked ones */
+        int n = 0;
+        for (int k = 0; k < bb->insns.n; k++) {
+            if (!f->vals[bb->insns.v[k]].dead) bb->insns.v[n++] = bb->insns.v[k];
+        }
+        bb->insns.n = n;
+        lw.loads = calloc(n + 1, sizeof(IntList));
+        int p = n - 1;
+        stackify(&lw, bb, bb->term_args, bb->nterm_args, n, &p);
+        while (p >= 0) {
+            int at = p--;
+            const IrValue *v = &f->vals[bb->insns.v[at]];
+            stackify(&lw, bb, v->args, v->nargs, at, &p);
+        }
+
+        lw.lineno = n ? f->vals[bb->insns.v[0]].lineno : bb->lineno;
+        emit(&lw, OP_LABEL, lw.block_label[b]);
+        for (int k = 0; k <= n; k++) {
+            for (int j = 0; j < lw.loads[k].n; j++) materialize(&lw, lw.loads[k].v[j]);
+            if (k == n) break;
+            int x = bb->insns.v[k];
+            const IrValue *v = &f->vals[x];
+            lw.lineno = v->lineno;
+            if (value_is_constant(v) && !lw.on_stack[x]) continue;
+            emit_value_insn(&lw, v);
+            if (lw.on_stack[x]) continue;
+            if (lw.slot[x] >= 0) emit(&lw, store_op(v->type), lw.slot[x]);
+            else if (v->type != IR_VOID) emit(&lw, v->type == IR_LONG ? OP_LPOP : OP_POP, 0);
+        }
+        for (int k = 0; k <= n; k++) free(lw.loads[k].v);
+        free(lw.loads);
+
+        if (bb->lineno) lw.lineno = bb->lineno;
+        if (opcode_flags(bb->term) & OPF_END) {
+            emit(&lw, bb->term, 0);
+        } else if (bb->term == OP_GOTO) {
+            if (bb->nsucc == 1) {
+                emit_copies(&lw, b, bb->succ[0]);
+                emit_jump(&lw, bb->succ[0], next);
+            }
+        } else {
+            int taken = bb->succ[bb->nsucc - 1];
+            int label = lw.block_label[taken];
+            if (ir_has_copies(f, taken)) {
+                label = method_new_label(&fresh, "E");
+                edge_from[nedges] = b;
+                edge_label[nedges++] = label;
+            }
+            emit(&lw, bb->term, label);
+            if (bb->nsucc == 2) {
+                emit_copies(&lw, b, bb->succ[0]);
+                emit_jump(&lw, bb->succ[0], next);
+            }
+        }
+    }
+    /* copies on taken branches live in blocks of their own */
+    for (int e = 0; e < nedges; e++) {
+        const IrBlock *bb = &f->blocks[edge_from[e]];
+        int taken = bb->succ[bb->nsucc - 1];
+        emit(&lw, OP_LABEL, edge_label[e]);
+        emit_copies(&lw, edge_from[e], taken);
+        emit(&lw, OP_GOTO, lw.block_label[taken]);
+    }
+
+    for (int i = 0; i < m->len; i++) free(m->code[i].sval);
+    free(m->code);
+    m->code = fresh.code;
+    m->len = fresh.len;
+    m->cap = fresh.cap;
+    m->labels = fresh.labels;
+    m->nlabels = fresh.nlabels;
+    m->labels_cap = fresh.labels_cap;
+    m->next_local = fresh.next_local;
+
+    free(edge_from);
+    free(edge_label);
+    free(lw.uses);
+    free(lw.slot);
+    free(lw.on_stack);
+    free(lw.block_label);
+}
+
+int pass_ssa(Method *m) {
+    IrFunc f;
+    if (!ir_build(&f, m)) return 0;
+    ir_lower(&f, m);
+    ir_free(&f);
+    return 1;
+}
@@ -0,0 +1,88 @@
+/* Symbol table dumps (--symtab=json:<file>, --symtab=bin:<file>).
+ *
+ * Each scope is written when it closes, innermost first, as the text dump
+ * at -vv shows them. "-" as the file means stderr.
+ *
+ * JSON: {"scopes": [{"level": n, "symbols": [{"index", "name", "mut",
+ * "type", "addr", "lineno", "func_sig"}, ...]}, ...]}
+ *
+ * Binary, all integers little-endian: the magic "SYMT" and a version byte
+ * (1), then per scope u32 level and u32 count, then per symbol u32 index,
+ * i32 mut, i32 addr, i32 lineno and the strings name, type and func_sig,
+ * each a u16 length and that many bytes. The file ends at the last scope. */
+#include "compiler_common.h"
+#include <stdint.h>
+
+#define SYMTAB_VERSION 1
+
+static FILE *out;
+static bool first_scope, first_symbol;
+
+static void put_u32(uint32_t v) {
+    for (int k = 0; k < 4; k++) fputc((v >> (8 * k)) & 0xff, out);
+}
+
+static void put_str(const char *s) {
+    size_t n = strlen(s);
+    if (n > 0xffff) n = 0xffff;
+    fputc(n & 0xff, out);
+    fputc(n >> 8, out);
+    fwrite(s, 1, n, out);
+}
+
+bool symtab_open(void) {
+    if (g_opt.symtab_format == SYMTAB_OFF) return true;
+    out = strcmp(g_opt.symtab_file, "-") == 0 ? stderr : fopen(g_opt.symtab_file, "wb");
+    if (!out) return false;
+    first_scope = true;
+    if (g_opt.symtab_format == SYMTAB_JSON) {
+        fprintf(out, "{\"scopes\": [");
+    } else {
+        fwrite("SYMT", 1, 4, out);
+        fputc(SYMTAB_VERSION, out);
+    }
+    return true;
+}
+
+void symtab_scope(int level, int count) {
+    if (!out) return;
+    if (g_opt.symtab_format == SYMTAB_BINARY) {
+        put_u32(level);
+        put_u32(count);
+        return;
+    }
+    if (!first_scope) fprintf(out, "]},");
+    fprintf(out, "\n  {\"level\": %d, \"symbols\": [", level);
+    first_scope = false;
+    first_symbol = true;
+}
+
+void symtab_symbol(int index, const char *name, int mut, const char *type, int addr, int lineno,
+                   const char *func_sig) {
+    if (!out) return;
+    if (g_opt.symtab_format == SYMTAB_BINARY) {
+        put_u32(index);
+        put_u32(mut);
+        put_u32(addr);
+        put_u32(lineno);
+        put_str(name);
+        put_str(type);
+        put_str(func_sig);
+        return;
+    }
+    fprintf(out, "%s\n    {\"index\": %d, \"name\": ", first_symbol ? "" : ",", index);
+    write_json_string(out, name);
+    fprintf(out, ", \"mut\": %d, \"type\": ", mut);
+    write_json_string(out, type);
+    fprintf(out, ", \"addr\": %d, \"lineno\": %d, \"func_sig\": ", addr, lineno);
+    write_json_string(out, func_sig);
+    fprintf(out, "}");
+    first_symbol = false;
+}
+
+void symtab_close(void) {
+    if (!out) return;
+    if (g_opt.symtab_format == SYMTAB_JSON) fprintf(out, "%s\n]}\n", first_scope ? "" : "]}");
+    if (out != stderr) fclose(out);
+    out = NULL;
+}
@@ -0,0 +1,72 @@
+#!/bin/sh
+# Per-method reuse of --cache (make test-cache): after an edit to one
+# function of a file, only that function and the file itself miss, and the
+# output is the same as without the cache.
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+entries() {
+    ls "$dir/cache" | wc -l
+}
+
+# compiles $1 through the cache and checks how many entries it added
+check() {
+    before=$(entries)
+    mkdir -p "$dir/src"
+    cp "$1" "$dir/src/prog.rs"
+    rm -rf "$dir/out" "$dir/plain"
+    ./mycompiler --cache="$dir/cache" -o "$dir/out" "$dir/src/prog.rs" > /dev/null
+    ./mycompiler -o "$dir/plain" "$dir/src/prog.rs" > /dev/null
+    added=$(($(entries) - before))
+    if [ "$added" -ne "$2" ]; then
+        echo "$3: $added new cache entries, expected $2"
+        failed=1
+    elif ! cmp -s "$dir/out/prog.j" "$dir/plain/prog.j"; then
+        echo "$3: output differs from a compile without the cache"
+        failed=1
+    else
+        echo "$3: ok"
+    fi
+}
+
+cat > "$dir/base.rs" << 'EOF'
+fn first() {
+    let mut i: i32 = 0;
+    while i < 3 {
+        println(i);
+        i = i + 1;
+    }
+}
+
+fn second() {
+    let mut j: i32 = 5;
+    while j > 0 {
+        print(j);
+        j = j - 2;
+    }
+    println("");
+}
+
+fn main() {
+    let mut k: i32 = 0;
+    while k < 2 {
+        println("main");
+        k = k + 1;
+    }
+}
+EOF
+
+# a new branch in first() also adds labels, which must not renumber the
+# labels of the functions after it
+sed 's/^        println(i);$/        if i > 1 {\n            println("big");\n        }\n        println(i);/' \
+    "$dir/base.rs" > "$dir/edited.rs"
+# the same functions on other lines
+{ echo; echo; cat "$dir/base.rs"; } > "$dir/moved.rs"
+
+mkdir "$dir/cache"
+check "$dir/base.rs" 4 "first compile (file and its 3 methods)"
+check "$dir/base.rs" 0 "same file again"
+check "$dir/edited.rs" 2 "one function edited (file and that method)"
+check "$dir/moved.rs" 1 "functions moved (file only)"
+exit $failed
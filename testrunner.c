@@ -0,0 +1,576 @@
+/* Regression runner (make test). Compiles all the inputs at once, then
+ * assembles and runs the results in a few long-lived JVMs (JvmService.java)
+ * and compares their output with the answers, with the same verdict as the
+ * judge.conf run: output equal up to CRs at line ends.
+ *
+ * usage: testrunner [-c] [-e <backend>] [-x <flag>]... [-j <n>] [-t <seconds>]
+ *                   [-o <dir>] [tests...]
+ *   -c  compile with --cache, and take the output of a .j file run before
+ *       from the same cache instead of running it again
+ *   -e  run the programs on jvm (default) or without one: run (mycompiler
+ *       --run), c (--emit=c) or x86 (--emit=x86), built with cc
+ *   -x  pass a flag on to mycompiler, e.g. -x -O0
+ *   -j  compilers and JVMs at once (default: CPUs, at most 4)
+ *   -t  time limit per test run (default 10, as judge.conf)
+ *   -o  where the .j files and outputs go (default /tmp/output)
+ * Tests default to the .rs files in input/; the answer of input/x.rs is
+ * answer/x.out.
+ * Exit status 1 if any test fails. */
+#include "cache.h"
+#include <errno.h>
+#include <glob.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_JOBS 4
+
+typedef struct {
+    const char *input;
+    char name[256];     /* input base name without .rs */
+    char dir[512];      /* mycompiler -o <dir>, and its log */
+    char jfile[1024];
+    pid_t pid;          /* compiler, or native run, while it runs */
+    double compile_ms, assemble_ms, run_ms;
+    bool done, passed, cached;
+    char detail[256];   /* why it failed */
+} Test;
+
+typedef struct {
+    pid_t pid;
+    int to, from;       /* request and reply pipes, -1 when there is no JVM */
+    int test;           /* the test it runs, -1 when idle */
+    double started;
+    char *buf;
+    size_t len, cap;
+} Jvm;
+
+static Test *tests;
+static int ntests;
+static const char *out_dir = "/tmp/output";
+static double time_limit = 10;
+static bool use_cache;
+static const char *backend = "jvm";
+static const char **extra_flags;
+static int nextra;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    size_t cap = 4096, n = 0, k;
+    char *s = malloc(cap);
+    while ((k = fread(s + n, 1, cap - n, f)) > 0) {
+        n += k;
+        if (n == cap) s = realloc(s, cap *= 2);
+    }
+    fclose(f);
+    *len = n;
+    return s;
+}
+
+static void fail(Test *t, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(t->detail, sizeof(t->detail), fmt, ap);
+    va_end(ap);
+    t->done = true;
+    t->passed = false;
+}
+
+/* ------------------------------------------------------------------ */
+/* Compiling                                                           */
+/* ------------------------------------------------------------------ */
+
+static void compile_start(Test *t) {
+    char log[600];
+    mkdir(t->dir, 0777);
+    snprintf(log, sizeof(log), "%s/compile.log", t->dir);
+    t->compile_ms = now_ms();
+    t->pid = fork();
+    if (t->pid == 0) {
+        FILE *f = fopen(log, "w");
+        if (f) {
+            dup2(fileno(f), 1);
+            dup2(fileno(f), 2);
+        }
+        const char *argv[nextra + 8];
+        int n = 0;
+        argv[n++] = "mycompiler";
+        if (use_cache) argv[n++] = "--cache";
+        if (strcmp(backend, "c") == 0) argv[n++] = "--emit=c";
+        if (strcmp(backend, "x86") == 0) argv[n++] = "--emit=x86";
+        for (int i = 0; i < nextra; i++) argv[n++] = extra_flags[i];
+        argv[n++] = "-o";
+        argv[n++] = t->dir;
+        argv[n++] = t->input;
+        argv[n] = NULL;
+        execv("./mycompiler", (char **)argv);
+        _exit(127);
+    }
+}
+
+static void compile_finish(Test *t, int status) {
+    t->compile_ms = now_ms() - t->compile_ms;
+    t->pid = 0;
+    glob_t g;
+    char pattern[600];
+    snprintf(pattern, sizeof(pattern), "%s/*.%s", t->dir,
+             strcmp(backend, "c") == 0 ? "c" : strcmp(backend, "x86") == 0 ? "s" : "j");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || glob(pattern, 0, NULL, &g) != 0) {
+        fail(t, "compile error, see %s/compile.log", t->dir);
+        return;
+    }
+    snprintf(t->jfile, sizeof(t->jfile), "%s", g.gl_pathv[0]);
+    globfree(&g);
+}
+
+/* Runs up to jobs compilers at a time. Children of other kinds (JVMs that
+ * died early) are reaped here too and noticed by their pipes. */
+static void compile_all(int jobs) {
+    int next = 0, running = 0;
+    while (next < ntests || running > 0) {
+        while (running < jobs && next < ntests) {
+            compile_start(&tests[next++]);
+            running++;
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) break;
+        for (int i = 0; i < next; i++) {
+            if (tests[i].pid == pid) {
+                compile_finish(&tests[i], status);
+                running--;
+                break;
+            }
+        }
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Running                                                             */
+/* ------------------------------------------------------------------ */
+
+static bool jvm_start(Jvm *j) {
+    int to[2], from[2];
+    j->to = j->from = -1;
+    j->test = -1;
+    j->len = 0;
+    if (pipe(to) < 0) return false;
+    if (pipe(from) < 0) {
+        close(to[0]);
+        close(to[1]);
+        return false;
+    }
+    j->pid = fork();
+    if (j->pid == 0) {
+        dup2(to[0], 0);
+        dup2(from[1], 1);
+        close(to[0]);
+        close(to[1]);
+        close(from[0]);
+        close(from[1]);
+        execlp("java", "java", "-cp", "jasmin.jar:.", "JvmService", (char *)NULL);
+        _exit(127);
+    }
+    close(to[0]);
+    close(from[1]);
+    if (j->pid < 0) {
+        close(to[1]);
+        close(from[0]);
+        return false;
+    }
+    j->to = to[1];
+    j->from = from[0];
+    return true;
+}
+
+static void jvm_stop(Jvm *j) {
+    if (j->to < 0) return;
+    close(j->to);
+    close(j->from);
+    kill(j->pid, SIGKILL);
+    waitpid(j->pid, NULL, 0);
+    j->to = j->from = -1;
+    j->test = -1;
+}
+
+/* Drops CRs before line ends, as git diff --ignore-cr-at-eol does */
+static size_t strip_cr(char *s, size_t n) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\r' && (i + 1 == n || s[i + 1] == '\n')) continue;
+        s[k++] = s[i];
+    }
+    return k;
+}
+
+static void compare(Test *t, char *out, size_t out_len) {
+    char path[600];
+    size_t ans_len;
+    snprintf(path, sizeof(path), "answer/%s.out", t->name);
+    char *ans = read_file(path, &ans_len);
+    if (!ans) {
+        fail(t, "no %s", path);
+        return;
+    }
+    out_len = strip_cr(out, out_len);
+    ans_len = strip_cr(ans, ans_len);
+    size_t i = 0;
+    int line = 1;
+    while (i < out_len && i < ans_len && out[i] == ans[i]) {
+        if (out[i++] == '\n') line++;
+    }
+    t->done = true;
+    t->passed = i == out_len && i == ans_len;
+    if (!t->passed) {
+        size_t a = i, b = i;
+        while (a > 0 && ans[a - 1] != '\n') a--;
+        while (b < ans_len && ans[b] != '\n') b++;
+        snprintf(t->detail, sizeof(t->detail), "line %d differs, expected \"%.*s\"", line,
+                 (int)(b - a > 60 ? 60 : b - a), ans + a);
+    }
+    free(ans);
+}
+
+/* Run results are filed under the .j file's text: the programs read no
+ * input, so the same code prints the same. Parts: the reply's header
+ * fields, the output and the message. */
+static char *run_key(const Test *t, size_t *len) {
+    size_t n;
+    char *code = read_file(t->jfile, &n);
+    if (!code) return NULL;
+    static const char tag[] = "JvmService run\n";
+    char *key = malloc(sizeof(tag) - 1 + n);
+    memcpy(key, tag, sizeof(tag) - 1);
+    memcpy(key + sizeof(tag) - 1, code, n);
+    free(code);
+    *len = sizeof(tag) - 1 + n;
+    return key;
+}
+
+static void run_result(Test *t, const char *status, long asm_us, long run_us, char *out, size_t out_len,
+                       const char *msg, size_t msg_len) {
+    t->assemble_ms = asm_us / 1e3;
+    t->run_ms = run_us / 1e3;
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s.out", out_dir, t->name);
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        fwrite(out, 1, out_len, f);
+        fclose(f);
+    }
+    if (strcmp(status, "ok") == 0) {
+        compare(t, out, out_len);
+    } else {
+        size_t n = 0;
+        while (n < msg_len && msg[n] != '\n') n++;
+        fail(t, "%s: %.*s", status, (int)(n > 160 ? 160 : n), msg);
+    }
+}
+
+/* Finishes t from the cache if it was run before */
+static bool run_cached(Test *t) {
+    size_t key_len, lens[3];
+    char *key = run_key(t, &key_len), *parts[3];
+    if (!key) return false;
+    bool hit = cache_get(key, key_len, 3, parts, lens);
+    free(key);
+    if (!hit) return false;
+    char status[32];
+    if (sscanf(parts[0], "%31s", status) == 1) {
+        run_result(t, status, 0, 0, parts[1], lens[1], parts[2], lens[2]);
+        t->cached = true;
+    } else {
+        hit = false;
+    }
+    for (int i = 0; i < 3; i++) free(parts[i]);
+    return hit;
+}
+
+/* Takes the reply of the JVM's test once it is complete */
+static bool jvm_reply(Jvm *j) {
+    char *eol = memchr(j->buf, '\n', j->len);
+    if (!eol) return false;
+    char status[32];
+    long asm_us, run_us;
+    size_t out_len, msg_len;
+    if (sscanf(j->buf, "%31s %ld %ld %zu %zu", status, &asm_us, &run_us, &out_len, &msg_len) != 5) {
+        fail(&tests[j->test], "bad reply from the JVM");
+        jvm_stop(j);
+        return true;
+    }
+    size_t head = eol + 1 - j->buf;
+    if (j->len < head + out_len + msg_len) return false;
+
+    Test *t = &tests[j->test];
+    char *out = j->buf + head, *msg = out + out_len;
+    /* errors of the JVM itself may not come back, so only these are kept */
+    size_t key_len;
+    char *key;
+    if (use_cache && (strcmp(status, "ok") == 0 || strcmp(status, "exception") == 0) &&
+        (key = run_key(t, &key_len))) {
+        const char *parts[3] = { status, out, msg };
+        size_t lens[3] = { strlen(status), out_len, msg_len };
+        cache_put(key, key_len, 3, parts, lens);
+        free(key);
+    }
+    run_result(t, status, asm_us, run_us, out, out_len, msg, msg_len);
+    size_t used = head + out_len + msg_len;
+    memmove(j->buf, j->buf + used, j->len - used);
+    j->len -= used;
+    j->test = -1;
+    return true;
+}
+
+static void run_all(int njvms) {
+    Jvm *jvms = calloc(njvms, sizeof(Jvm));
+    struct pollfd *pfd = calloc(njvms, sizeof(struct pollfd));
+    int *busy = calloc(njvms, sizeof(int));
+    for (int k = 0; k < njvms; k++) jvm_start(&jvms[k]);
+    compile_all(njvms);
+
+    int next = 0;
+    for (;;) {
+        int nbusy = 0;
+        bool failed = false;  /* a test failed to start, try the next */
+        double wait = -1;
+        for (int k = 0; k < njvms; k++) {
+            Jvm *j = &jvms[k];
+            while (j->test < 0 && next < ntests && (tests[next].done || (use_cache && run_cached(&tests[next]))))
+                next++;
+            if (j->test < 0 && next < ntests) {
+                if (j->to < 0 && !jvm_start(j)) continue;
+                Test *t = &tests[next++];
+                char line[1100];
+                int n = snprintf(line, sizeof(line), "run %s\n", t->jfile);
+                if (write(j->to, line, n) != n) {
+                    fail(t, "cannot reach the JVM (is java on the PATH?)");
+                    jvm_stop(j);
+                    failed = true;
+                    continue;
+                }
+                j->test = t - tests;
+                j->started = now_ms();
+            }
+            if (j->test < 0) continue;
+            double left = j->started + time_limit * 1e3 - now_ms();
+            if (wait < 0 || left < wait) wait = left > 0 ? left : 0;
+            pfd[nbusy] = (struct pollfd){ j->from, POLLIN, 0 };
+            busy[nbusy++] = k;
+        }
+        if (nbusy == 0 && failed) continue;
+        if (nbusy == 0) break;
+        if (poll(pfd, nbusy, (int)wait + 1) < 0 && errno != EINTR) break;
+        for (int p = 0; p < nbusy; p++) {
+            Jvm *j = &jvms[busy[p]];
+            if (pfd[p].revents) {
+                if (j->cap - j->len < 65536) {
+                    j->cap = j->cap * 2 + 65536;
+                    j->buf = realloc(j->buf, j->cap);
+                }
+                ssize_t n = read(j->from, j->buf + j->len, j->cap - j->len);
+                if (n > 0) {
+                    j->len += n;
+                    jvm_reply(j);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR) continue;
+                fail(&tests[j->test], "the JVM exited (is java on the PATH and JvmService.class built?)");
+                jvm_stop(j);
+            } else if (now_ms() - j->started > time_limit * 1e3) {
+                fail(&tests[j->test], "timed out after %g s", time_limit);
+                jvm_stop(j);
+            }
+        }
+    }
+    for (int k = 0; k < njvms; k++) {
+        jvm_stop(&jvms[k]);
+        free(jvms[k].buf);
+    }
+    for (int i = 0; i < ntests; i++) {
+        if (!tests[i].done) fail(&tests[i], "not run: no JVM could be started");
+    }
+    free(busy);
+    free(pfd);
+    free(jvms);
+}
+
+/* ------------------------------------------------------------------ */
+/* Running without a JVM                                               */
+/* ------------------------------------------------------------------ */
+
+/* Runs t's program in a shell, its output to <out_dir>/<name>.out and the
+ * rest to <dir>/run.log: mycompiler --run, or cc on the emitted file and
+ * then the program. The time limit is CPU time here (ulimit -t), and the
+ * run time includes the cc. */
+static void native_start(Test *t) {
+    char out[600], log[600], script[256];
+    snprintf(out, sizeof(out), "%s/%s.out", out_dir, t->name);
+    snprintf(log, sizeof(log), "%s/run.log", t->dir);
+    int limit = (int)time_limit + (time_limit > (int)time_limit);
+    if (strcmp(backend, "run") == 0)
+        snprintf(script, sizeof(script), "d=$1 in=$2; shift 2; ulimit -t %d; exec ./mycompiler --run \"$@\" -o \"$d\" \"$in\"",
+                 limit);
+    else
+        snprintf(script, sizeof(script), "cc -O2 -w -I. -o \"$1/Main\" \"$2\" runtime.c -lm || exit 125; ulimit -t %d; exec \"$1/Main\"",
+                 limit);
+    t->run_ms = now_ms();
+    t->pid = fork();
+    if (t->pid == 0) {
+        FILE *o = fopen(out, "wb"), *l = fopen(log, "w");
+        if (o) dup2(fileno(o), 1);
+        if (l) dup2(fileno(l), 2);
+        const char *argv[nextra + 8];
+        int n = 0;
+        argv[n++] = "sh";
+        argv[n++] = "-c";
+        argv[n++] = script;
+        argv[n++] = "sh";
+        argv[n++] = t->dir;
+        argv[n++] = strcmp(backend, "run") == 0 ? t->input : t->jfile;
+        for (int i = 0; i < nextra; i++) argv[n++] = extra_flags[i];
+        argv[n] = NULL;
+        execv("/bin/sh", (char **)argv);
+        _exit(127);
+    }
+}
+
+static void native_finish(Test *t, int status) {
+    t->run_ms = now_ms() - t->run_ms;
+    t->pid = 0;
+    if (WIFSIGNALED(status)) {
+        if (WTERMSIG(status) == SIGXCPU || WTERMSIG(status) == SIGKILL)
+            fail(t, "timed out after %g s", time_limit);
+        else
+            fail(t, "killed by signal %d, see %s/run.log", WTERMSIG(status), t->dir);
+        return;
+    }
+    if (WEXITSTATUS(status) == 125 && strcmp(backend, "run") != 0) {
+        fail(t, "cc failed, see %s/run.log", t->dir);
+        return;
+    }
+    if (WEXITSTATUS(status) != 0) {
+        fail(t, "exit status %d, see %s/run.log", WEXITSTATUS(status), t->dir);
+        return;
+    }
+    char path[600];
+    size_t len;
+    snprintf(path, sizeof(path), "%s/%s.out", out_dir, t->name);
+    char *out = read_file(path, &len);
+    if (!out) {
+        fail(t, "no %s", path);
+        return;
+    }
+    compare(t, out, len);
+    free(out);
+}
+
+/* As run_all, with jobs programs at once in place of the JVMs */
+static void native_all(int jobs) {
+    compile_all(jobs);
+    int next = 0, running = 0;
+    for (;;) {
+        while (running < jobs && next < ntests) {
+            Test *t = &tests[next++];
+            if (t->done) continue;
+            native_start(t);
+            running++;
+        }
+        if (running == 0) break;
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) break;
+        for (int i = 0; i < next; i++) {
+            if (tests[i].pid == pid) {
+                native_finish(&tests[i], status);
+                running--;
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus < MAX_JOBS ? (int)cpus : MAX_JOBS;
+    glob_t g = { 0 };
+    const char **inputs = calloc(argc, sizeof(char *));
+    int ninputs = 0;
+    extra_flags = calloc(argc, sizeof(char *));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+            if (strcmp(backend, "jvm") != 0 && strcmp(backend, "run") != 0 && strcmp(backend, "c") != 0 &&
+                strcmp(backend, "x86") != 0) {
+                fprintf(stderr, "unknown backend `%s`, expected jvm, run, c or x86\n", backend);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            extra_flags[nextra++] = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            time_limit = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else {
+            inputs[ninputs++] = argv[i];
+        }
+    }
+    if (jobs < 1) jobs = 1;
+    if (ninputs == 0 && glob("input/*.rs", 0, NULL, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+            inputs = realloc(inputs, (ninputs + 1) * sizeof(char *));
+            inputs[ninputs++] = g.gl_pathv[i];
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    mkdir(out_dir, 0777);
+    if (use_cache && !cache_open(cache_default_dir(), CACHE_DEFAULT_MAX)) use_cache = false;
+
+    double start = now_ms();
+    ntests = ninputs;
+    tests = calloc(ntests + 1, sizeof(Test));
+    for (int i = 0; i < ntests; i++) {
+        Test *t = &tests[i];
+        const char *base = strrchr(inputs[i], '/') ? strrchr(inputs[i], '/') + 1 : inputs[i];
+        t->input = inputs[i];
+        snprintf(t->name, sizeof(t->name), "%.*s", (int)strcspn(base, "."), base);
+        snprintf(t->dir, sizeof(t->dir), "%s/%s", out_dir, t->name);
+    }
+    if (strcmp(backend, "jvm") == 0)
+        run_all(jobs);
+    else
+        native_all(jobs);
+
+    int passed = 0;
+    printf("%-32s %12s %13s %8s  %s\n", "test", "compile (ms)", "assemble (ms)", "run (ms)", "result");
+    for (int i = 0; i < ntests; i++) {
+        const Test *t = &tests[i];
+        printf("%-32s %12.1f %13.1f %8.1f  %s\n", t->name, t->compile_ms, t->assemble_ms, t->run_ms,
+               t->passed ? (t->cached ? "ok, cached" : "ok") : t->detail);
+        if (t->passed) passed++;
+    }
+    printf("%d passed, %d failed in %.2f s\n", passed, ntests - passed, (now_ms() - start) / 1e3);
+    globfree(&g);
+    free(tests);
+    free(inputs);
+    free(extra_flags);
+    return passed == ntests ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+/* Per-phase time and memory report (--time-report).
+ *
+ * Phases are named by the code that runs them and nest: the scanner runs
+ * inside the parser, and each optimization pass inside the optimizer. The
+ * time and heap growth between two marks go to the innermost open phase
+ * only, so the rows add up to the time spent in phases at all. Heap
+ * figures are bytes in use according to glibc's allocator; peak RSS is the
+ * process high-water mark when a phase last ended.
+ *
+ * --trace=<file> writes the same phases, plus one span per method and
+ * counters, as Chrome trace events for chrome://tracing or Perfetto. The
+ * scanner's phase is left out there: it opens once per token, and its
+ * time is inside the parse span anyway. */
+#include "compiler_common.h"
+#include <sys/resource.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define MAX_PHASES 32
+#define MAX_DEPTH 16
+
+typedef struct {
+    const char *name;
+    long calls;
+    double wall, cpu;  /* seconds */
+    long heap;         /* bytes allocated and not freed */
+    long peak_rss;     /* KiB */
+} PhaseStat;
+
+static PhaseStat phases[MAX_PHASES];
+static int nphases;
+static int stack[MAX_DEPTH];
+static int depth;
+static int dropped;  /* open phases past the table limits, not recorded */
+static bool started;
+static double start_wall, start_cpu, last_wall, last_cpu;
+static long last_heap;
+
+static double clock_seconds(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return (long)mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static long peak_rss_kib(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+/* Charges everything since the last mark to the innermost open phase */
+static void mark(void) {
+    double w = clock_seconds(CLOCK_MONOTONIC), c = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    long h = heap_in_use();
+    if (!started) {
+        started = true;
+        start_wall = w;
+        start_cpu = c;
+    } else if (depth > 0) {
+        PhaseStat *s = &phases[stack[depth - 1]];
+        s->wall += w - last_wall;
+        s->cpu += c - last_cpu;
+        s->heap += h - last_heap;
+    }
+    last_wall = w;
+    last_cpu = c;
+    last_heap = h;
+}
+
+/* ------------------------------------------------------------------ */
+/* Trace events                                                        */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+    const char *name;
+    double ts;  /* microseconds */
+} Span;
+
+static FILE *trace_out;
+static double trace_start;
+static bool trace_first;
+static Span spans[MAX_DEPTH];
+static int nspans, spans_dropped;
+
+static double trace_now(void) {
+    return (clock_seconds(CLOCK_MONOTONIC) - trace_start) * 1e6;
+}
+
+/* s as a JSON string literal; --symtab=json uses it too */
+void write_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+        if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else if (*p < 0x20) fprintf(out, "\\u%04x", *p);
+        else fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+static void trace_event_start(void) {
+    fprintf(trace_out, "%s\n", trace_first ? "" : ",");
+    trace_first = false;
+}
+
+bool trace_open(const char *path) {
+    trace_out = fopen(path, "w");
+    if (!trace_out) return false;
+    trace_start = clock_seconds(CLOCK_MONOTONIC);
+    trace_first = true;
+    fprintf(trace_out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    return true;
+}
+
+/* name must stay valid until the matching trace_end */
+void trace_begin(const char *name) {
+    if (!trace_out) return;
+    if (nspans == MAX_DEPTH) {
+        spans_dropped++;
+        return;
+    }
+    spans[nspans++] = (Span){ name, trace_now() };
+}
+
+void trace_end(void) {
+    if (!trace_out || nspans == 0) return;
+    if (spans_dropped) {
+        spans_dropped--;
+        return;
+    }
+    const Span *s = &spans[--nspans];
+    trace_event_start();
+    fprintf(trace_out, "{\"name\": ");
+    write_json_string(trace_out, s->name);
+    fprintf(trace_out, ", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": 1}",
+            s->ts, trace_now() - s->ts);
+}
+
+void trace_counter(const char *name, long value) {
+    if (!trace_out) return;
+    trace_event_start();
+    fprintf(trace_out, "{\"name\": ");
+    write_json_string(trace_out, name);
+    fprintf(trace_out, ", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"args\": {\"value\": %ld}}",
+            trace_now(), value);
+}
+
+void trace_close(void) {
+    if (!trace_out) return;
+    trace_counter("heap bytes", heap_in_use());
+    fprintf(trace_out, "\n]}\n");
+    fclose(trace_out);
+    trace_out = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Phases                                                              */
+/* ------------------------------------------------------------------ */
+
+void phase_begin(const char *name) {
+    trace_begin(name);
+    time_begin(name);
+}
+
+void phase_end(void) {
+    trace_end();
+    time_end();
+}
+
+void time_begin(const char *name) {
+    if (g_opt.time_report == REPORT_OFF) return;
+    mark();
+    int k = 0;
+    while (k < nphases && strcmp(phases[k].name, name) != 0) k++;
+    if (depth == MAX_DEPTH || (k == nphases && nphases == MAX_PHASES)) {
+        dropped++;
+        return;
+    }
+    if (k == nphases) phases[nphases++].name = name;
+    phases[k].calls++;
+    stack[depth++] = k;
+}
+
+void time_end(void) {
+    if (g_opt.time_report == REPORT_OFF || depth == 0) return;
+    if (dropped) {
+        dropped--;
+        return;
+    }
+    mark();
+    PhaseStat *s = &phases[stack[--depth]];
+    long rss = peak_rss_kib();
+    if (rss > s->peak_rss) s->peak_rss = rss;
+}
+
+void time_report_print(FILE *out) {
+    if (g_opt.time_report == REPORT_OFF) return;
+    mark();
+    double wall = last_wall - start_wall, cpu = last_cpu - start_cpu;
+    if (g_opt.time_report == REPORT_JSON) {
+        fprintf(out, "{\"phases\": [");
+        for (int k = 0; k < nphases; k++) {
+            const PhaseStat *s = &phases[k];
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"calls\": %ld, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, "
+                         "\"heap_bytes\": %ld, \"peak_rss_kib\": %ld}",
+                    k ? "," : "", s->name, s->calls, s->wall * 1e3, s->cpu * 1e3, s->heap, s->peak_rss);
+        }
+        fprintf(out, "\n], \"total\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_rss_kib\": %ld}}\n",
+                wall * 1e3, cpu * 1e3, peak_rss_kib());
+        return;
+    }
+    fprintf(out, "%-14s %8s %12s %12s %12s %14s\n", "phase", "calls", "wall (ms)", "cpu (ms)", "heap (KiB)",
+            "peak RSS (KiB)");
+    for (int k = 0; k < nphases; k++) {
+        const PhaseStat *s = &phases[k];
+        fprintf(out, "%-14s %8ld %12.3f %12.3f %12.1f %14ld\n", s->name, s->calls, s->wall * 1e3, s->cpu * 1e3,
+                s->heap / 1024.0, s->peak_rss);
+    }
+    fprintf(out, "%-14s %8s %12.3f %12.3f %12s %14ld\n", "total", "", wall * 1e3, cpu * 1e3, "", peak_rss_kib());
+}
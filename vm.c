@@ -0,0 +1,463 @@
+/* Register bytecode interpreter (--run).
+ *
+ * main is taken to SSA form and every value gets a register; constants
+ * are loaded into their registers before the run, so instructions only
+ * name registers. Instructions are three-address (a = b op c; branches
+ * test a and b and jump to c) and dispatch by computed goto where the
+ * compiler has it, with a switch otherwise. A compare whose only use is
+ * the branch ending its block is fused with it, so the fcmp/lcmp + if<cond>
+ * pairs the front end emits for every condition cost one dispatch. Output
+ * goes through the same runtime as the native backends. */
+#include "compiler_common.h"
+#include "runtime.h"
+
+#if defined(__GNUC__)
+#define VM_THREADED
+#endif
+
+#define VM_OP_LIST \
+    X(MOV) \
+    X(IADD) X(ISUB) X(IMUL) X(IDIV) X(IREM) X(INEG) \
+    X(ISHL) X(ISHR) X(IUSHR) X(IAND) X(IOR) X(IXOR) \
+    X(FADD) X(FSUB) X(FMUL) X(FDIV) X(FNEG) X(I2F) X(F2I) X(FCMPL) X(FCMPG) \
+    X(LADD) X(LSUB) X(LMUL) X(LUSHR) X(LCMP) X(I2L) X(L2I) \
+    X(STR_I) X(STR_F) \
+    X(PRINT) X(PRINTLN) X(PRINT_I) X(PRINTLN_I) X(PRINT_F) X(PRINTLN_F) \
+    X(JMP) \
+    X(BEQ) X(BNE) X(BLT) X(BGE) X(BGT) X(BLE) \
+    X(BEQZ) X(BNEZ) X(BLTZ) X(BGEZ) X(BGTZ) X(BLEZ) \
+    X(FBEQ) X(FBNE) X(FBLT) X(FBGE) X(FBGT) X(FBLE) \
+    X(FBNLT) X(FBNGE) X(FBNGT) X(FBNLE) \
+    X(LBEQ) X(LBNE) X(LBLT) X(LBGE) X(LBGT) X(LBLE) \
+    X(RET)
+
+typedef enum {
+#define X(name) VM_##name,
+    VM_OP_LIST
+#undef X
+} VmOp;
+
+typedef union {
+    int32_t i;
+    float f;
+    int64_t l;
+    const char *s;
+} VmReg;
+
+typedef struct {
+    const void *h;  /* handler address once threaded */
+    VmOp op;
+    int a, b, c;
+} VmInsn;
+
+typedef struct {
+    VmInsn *code;
+    int len, cap;
+    VmReg *regs;
+    int nregs;
+    IntList strings;   /* registers holding unescaped string constants */
+    bool loaded;
+} VmProgram;
+
+static VmProgram prog;
+
+/* Translation state for one function */
+typedef struct {
+    VmProgram *p;
+    IrFunc *f;
+    int *reg;          /* per value */
+    int *copy_reg;     /* per phi: staging register for parallel copies */
+    int *block_pc;     /* first instruction of each block */
+    bool *fused;       /* valueOf printed straight away by rt_print_int/float */
+    bool *cmp_fused;   /* fcmp/lcmp folded into the branch after it */
+    IntList fixups;    /* instructions whose c is a block, not a pc */
+} VmGen;
+
+static int vm_emit(VmProgram *p, VmOp op, int a, int b, int c) {
+    if (p->len == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 64;
+        p->code = realloc(p->code, p->cap * sizeof(VmInsn));
+    }
+    p->code[p->len] = (VmInsn){ NULL, op, a, b, c };
+    return p->len++;
+}
+
+static void emit_branch(VmGen *g, VmOp op, int a, int b, int block) {
+    list_push(&g->fixups, vm_emit(g->p, op, a, b, block));
+}
+
+static int cond_index(Opcode op) {
+    switch (op) {
+    case OP_IFEQ: case OP_IF_ICMPEQ: return 0;
+    case OP_IFNE: case OP_IF_ICMPNE: return 1;
+    case OP_IFLT: case OP_IF_ICMPLT: return 2;
+    case OP_IFGE: case OP_IF_ICMPGE: return 3;
+    case OP_IFGT: case OP_IF_ICMPGT: return 4;
+    default: return 5;
+    }
+}
+
+static bool emit_value(VmGen *g, int id) {
+    const IrValue *v = &g->f->vals[id];
+    VmProgram *p = g->p;
+    const int *a = v->args;
+    int d = g->reg[id];
+    static const VmOp binops[OP_COUNT] = {
+        [OP_IADD] = VM_IADD, [OP_ISUB] = VM_ISUB, [OP_IMUL] = VM_IMUL,
+        [OP_IDIV] = VM_IDIV, [OP_IREM] = VM_IREM, [OP_ISHL] = VM_ISHL,
+        [OP_ISHR] = VM_ISHR, [OP_IUSHR] = VM_IUSHR, [OP_IAND] = VM_IAND,
+        [OP_IOR] = VM_IOR, [OP_IXOR] = VM_IXOR,
+        [OP_FADD] = VM_FADD, [OP_FSUB] = VM_FSUB, [OP_FMUL] = VM_FMUL,
+        [OP_FDIV] = VM_FDIV, [OP_FCMPL] = VM_FCMPL, [OP_FCMPG] = VM_FCMPG,
+        [OP_LADD] = VM_LADD, [OP_LSUB] = VM_LSUB, [OP_LMUL] = VM_LMUL,
+        [OP_LUSHR] = VM_LUSHR, [OP_LCMP] = VM_LCMP,
+    };
+    static const VmOp unops[OP_COUNT] = {
+        [OP_INEG] = VM_INEG, [OP_FNEG] = VM_FNEG, [OP_I2F] = VM_I2F,
+        [OP_F2I] = VM_F2I, [OP_I2L] = VM_I2L, [OP_L2I] = VM_L2I,
+    };
+
+    if (g->fused[id] || g->cmp_fused[id]) return true;
+    /* VM_MOV is 0, so a zero entry means "none" */
+    if (binops[v->op]) {
+        vm_emit(p, binops[v->op], d, g->reg[a[0]], g->reg[a[1]]);
+        return true;
+    }
+    if (unops[v->op]) {
+        vm_emit(p, unops[v->op], d, g->reg[a[0]], 0);
+        return true;
+    }
+
+    switch (v->op) {
+    case OP_ICONST:
+        p->regs[d].i = v->ival;
+        return true;
+    case OP_FCONST:
+        p->regs[d].f = v->fval;
+        return true;
+    case OP_LCONST:
+        p->regs[d].l = v->ival;
+        return true;
+    case OP_SCONST:
+        p->regs[d].s = string_unescape(v->sval, NULL);
+        list_push(&p->strings, d);
+        return true;
+    case OP_GETSTATIC:
+        /* System.out; printing goes through the runtime */
+        return strcmp(v->sval, "java/lang/System/out Ljava/io/PrintStream;") == 0;
+    case OP_INVOKESTATIC:
+        if (ir_is_value_of(v, 'I')) vm_emit(p, VM_STR_I, d, g->reg[a[0]], 0);
+        else if (ir_is_value_of(v, 'F')) vm_emit(p, VM_STR_F, d, g->reg[a[0]], 0);
+        else return false;
+        return true;
+    case OP_INVOKEVIRTUAL: {
+        bool ln = strcmp(v->sval, "java/io/PrintStream/println(Ljava/lang/String;)V") == 0;
+        if (!ln && strcmp(v->sval, "java/io/PrintStream/print(Ljava/lang/String;)V") != 0) return false;
+        const IrValue *s = &g->f->vals[a[1]];
+        if (!g->fused[a[1]]) vm_emit(p, ln ? VM_PRINTLN : VM_PRINT, 0, g->reg[a[1]], 0);
+        else if (ir_is_value_of(s, 'I')) vm_emit(p, ln ? VM_PRINTLN_I : VM_PRINT_I, 0, g->reg[s->args[0]], 0);
+        else vm_emit(p, ln ? VM_PRINTLN_F : VM_PRINT_F, 0, g->reg[s->args[0]], 0);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* The conditional branch ending bb, fused with the compare feeding it */
+static void emit_cond(VmGen *g, const IrBlock *bb, int target) {
+    const int *a = bb->term_args;
+    int c = cond_index(bb->term);
+    if (bb->nterm_args == 2) {
+        emit_branch(g, VM_BEQ + c, g->reg[a[0]], g->reg[a[1]], target);
+        return;
+    }
+    const IrValue *x = &g->f->vals[a[0]];
+    if (!g->cmp_fused[a[0]]) {
+        emit_branch(g, VM_BEQZ + c, g->reg[a[0]], 0, target);
+        return;
+    }
+    int l = g->reg[x->args[0]], r = g->reg[x->args[1]];
+    if (x->op == OP_LCMP) {
+        emit_branch(g, VM_LBEQ + c, l, r, target);
+        return;
+    }
+    /* C's float compares are false on NaN except !=; where the JVM takes
+     * the branch on NaN, test the negated opposite compare instead */
+    bool nan_taken = eval_compare(bb->term, x->op == OP_FCMPL ? -1 : 1, 0);
+    if (nan_taken == (bb->term == OP_IFNE)) {
+        emit_branch(g, VM_FBEQ + c, l, r, target);
+    } else {
+        static const VmOp negated[6] = { 0, 0, VM_FBNGE, VM_FBNLT, VM_FBNLE, VM_FBNGT };
+        emit_branch(g, negated[c], l, r, target);
+    }
+}
+
+/* Phi copies for the edge from -> to; staged through copy registers only
+ * when one copy would overwrite the source of another */
+static void emit_copies(VmGen *g, int from, int to) {
+    const IrFunc *f = g->f;
+    const IrBlock *bb = &f->blocks[to];
+    int idx = 0;
+    while (bb->preds.v[idx] != from) idx++;
+    bool overlap = false;
+    for (int k = 0; k < bb->phis.n; k++) {
+        const IrValue *v = &f->vals[bb->phis.v[k]];
+        if (v->dead || v->args[idx] == bb->phis.v[k]) continue;
+        for (int j = 0; j < bb->phis.n; j++) {
+            if (j != k && !f->vals[bb->phis.v[j]].dead && f->vals[bb->phis.v[j]].args[idx] == bb->phis.v[k])
+                overlap = true;
+        }
+    }
+    for (int pass = overlap ? 0 : 1; pass < 2; pass++) {
+        for (int k = 0; k < bb->phis.n; k++) {
+            int phi = bb->phis.v[k];
+            const IrValue *v = &f->vals[phi];
+            if (v->dead || v->args[idx] == phi) continue;
+            int src = pass == 0 || !overlap ? g->reg[v->args[idx]] : g->copy_reg[phi];
+            int dst = pass == 0 ? g->copy_reg[phi] : g->reg[phi];
+            vm_emit(g->p, VM_MOV, dst, src, 0);
+        }
+    }
+}
+
+/* Marks compares used only by the one-operand branch ending their block */
+static void find_fused_compares(VmGen *g) {
+    IrFunc *f = g->f;
+    int *uses = calloc(f->nvals + 1, sizeof(int));
+    for (int v = 0; v < f->nvals; v++) {
+        if (f->vals[v].dead) continue;
+        for (int k = 0; k < f->vals[v].nargs; k++) uses[f->vals[v].args[k]]++;
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int k = 0; k < f->blocks[b].nterm_args; k++) uses[f->blocks[b].term_args[k]]++;
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable || bb->nterm_args != 1) continue;
+        const IrValue *x = &f->vals[bb->term_args[0]];
+        bool is_cmp = x->op == OP_FCMPL || x->op == OP_FCMPG || x->op == OP_LCMP;
+        if (x->kind == IR_INSN && is_cmp && x->block == b && uses[bb->term_args[0]] == 1)
+            g->cmp_fused[bb->term_args[0]] = true;
+    }
+    free(uses);
+}
+
+static bool translate(VmGen *g) {
+    IrFunc *f = g->f;
+    VmProgram *p = g->p;
+    for (int v = 0; v < f->nvals; v++) {
+        if (f->vals[v].dead) continue;
+        g->reg[v] = p->nregs++;
+        if (f->vals[v].kind == IR_PHI) g->copy_reg[v] = p->nregs++;
+    }
+    /* every register starts out zero: parameters and System.out need nothing */
+    p->regs = calloc(p->nregs + 1, sizeof(VmReg));
+
+    IntList edges = { NULL, 0, 0 };
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable) continue;
+        int next = b + 1;
+        while (next < f->nblocks && !f->blocks[next].reachable) next++;
+        g->block_pc[b] = p->len;
+        for (int k = 0; k < bb->insns.n; k++) {
+            int id = bb->insns.v[k];
+            if (f->vals[id].dead) continue;
+            if (!emit_value(g, id)) {
+                free(edges.v);
+                return false;
+            }
+        }
+        if (opcode_flags(bb->term) & OPF_END) {
+            vm_emit(p, VM_RET, 0, 0, 0);
+            continue;
+        }
+        if (bb->term != OP_GOTO) {
+            int taken = bb->succ[bb->nsucc - 1];
+            if (ir_has_copies(f, taken)) {
+                /* to an edge block after the function, numbered past the CFG */
+                emit_cond(g, bb, f->nblocks + edges.n);
+                list_push(&edges, b);
+            } else {
+                emit_cond(g, bb, taken);
+            }
+            if (bb->nsucc < 2) continue;
+        } else if (bb->nsucc == 0) {
+            continue;
+        }
+        emit_copies(g, b, bb->succ[0]);
+        if (bb->succ[0] != next) emit_branch(g, VM_JMP, 0, 0, bb->succ[0]);
+    }
+    for (int e = 0; e < edges.n; e++) {
+        const IrBlock *bb = &f->blocks[edges.v[e]];
+        int taken = bb->succ[bb->nsucc - 1];
+        g->block_pc[f->nblocks + e] = p->len;
+        emit_copies(g, edges.v[e], taken);
+        emit_branch(g, VM_JMP, 0, 0, taken);
+    }
+    free(edges.v);
+    for (int k = 0; k < g->fixups.n; k++) {
+        VmInsn *in = &p->code[g->fixups.v[k]];
+        in->c = g->block_pc[in->c];
+    }
+    return true;
+}
+
+void vm_unload(void) {
+    for (int k = 0; k < prog.strings.n; k++) free((char *)prog.regs[prog.strings.v[k]].s);
+    free(prog.strings.v);
+    free(prog.code);
+    free(prog.regs);
+    memset(&prog, 0, sizeof(prog));
+}
+
+bool vm_load(Method *m) {
+    IrFunc f;
+    vm_unload();
+    if (!ir_build(&f, m)) return false;
+
+    VmGen g;
+    memset(&g, 0, sizeof(g));
+    g.p = &prog;
+    g.f = &f;
+    g.reg = calloc(f.nvals + 1, sizeof(int));
+    g.copy_reg = calloc(f.nvals + 1, sizeof(int));
+    /* blocks, then one edge block per conditional branch at most */
+    g.block_pc = calloc(2 * f.nblocks + 1, sizeof(int));
+    g.cmp_fused = calloc(f.nvals + 1, sizeof(bool));
+    g.fused = ir_fused_prints(&f);
+    find_fused_compares(&g);
+
+    bool ok = translate(&g);
+    free(g.reg);
+    free(g.copy_reg);
+    free(g.block_pc);
+    free(g.cmp_fused);
+    free(g.fused);
+    free(g.fixups.v);
+    ir_free(&f);
+    if (!ok) vm_unload();
+    prog.loaded = ok;
+    return ok;
+}
+
+static void vm_exec(VmProgram *p) {
+    VmReg *r = p->regs;
+    VmInsn *ip = p->code;
+    VmInsn *code = p->code;
+
+#ifdef VM_THREADED
+    static const void *handlers[] = {
+#define X(name) &&L_##name,
+        VM_OP_LIST
+#undef X
+    };
+    for (int k = 0; k < p->len; k++) code[k].h = handlers[code[k].op];
+#define CASE(name) L_##name:
+#define NEXT() goto *(++ip)->h
+#define JUMP(t) do { ip = code + (t); goto *ip->h; } while (0)
+    goto *ip->h;
+#else
+#define CASE(name) case VM_##name:
+#define NEXT() do { ip++; goto dispatch; } while (0)
+#define JUMP(t) do { ip = code + (t); goto dispatch; } while (0)
+dispatch:
+    switch (ip->op) {
+#endif
+
+#define A r[ip->a]
+#define B r[ip->b]
+#define C r[ip->c]
+#define WRAP(op) (int32_t)((uint32_t)B.i op (uint32_t)C.i)
+#define LWRAP(op) (int64_t)((uint64_t)B.l op (uint64_t)C.l)
+#define BRANCH(cond) do { if (cond) JUMP(ip->c); NEXT(); } while (0)
+
+    CASE(MOV) A = B; NEXT();
+    CASE(IADD) A.i = WRAP(+); NEXT();
+    CASE(ISUB) A.i = WRAP(-); NEXT();
+    CASE(IMUL) A.i = WRAP(*); NEXT();
+    CASE(IDIV) A.i = rt_idiv(B.i, C.i); NEXT();
+    CASE(IREM) A.i = rt_irem(B.i, C.i); NEXT();
+    CASE(INEG) A.i = (int32_t)(0u - (uint32_t)B.i); NEXT();
+    CASE(ISHL) A.i = (int32_t)((uint32_t)B.i << (C.i & 31)); NEXT();
+    CASE(ISHR) A.i = B.i >> (C.i & 31); NEXT();
+    CASE(IUSHR) A.i = (int32_t)((uint32_t)B.i >> (C.i & 31)); NEXT();
+    CASE(IAND) A.i = B.i & C.i; NEXT();
+    CASE(IOR) A.i = B.i | C.i; NEXT();
+    CASE(IXOR) A.i = B.i ^ C.i; NEXT();
+    CASE(FADD) A.f = B.f + C.f; NEXT();
+    CASE(FSUB) A.f = B.f - C.f; NEXT();
+    CASE(FMUL) A.f = B.f * C.f; NEXT();
+    CASE(FDIV) A.f = B.f / C.f; NEXT();
+    CASE(FNEG) A.f = -B.f; NEXT();
+    CASE(I2F) A.f = (float)B.i; NEXT();
+    CASE(F2I) A.i = rt_f2i(B.f); NEXT();
+    CASE(FCMPL) A.i = rt_fcmpl(B.f, C.f); NEXT();
+    CASE(FCMPG) A.i = rt_fcmpg(B.f, C.f); NEXT();
+    CASE(LADD) A.l = LWRAP(+); NEXT();
+    CASE(LSUB) A.l = LWRAP(-); NEXT();
+    CASE(LMUL) A.l = LWRAP(*); NEXT();
+    CASE(LUSHR) A.l = (int64_t)((uint64_t)B.l >> (C.i & 63)); NEXT();
+    CASE(LCMP) A.i = (B.l > C.l) - (B.l < C.l); NEXT();
+    CASE(I2L) A.l = B.i; NEXT();
+    CASE(L2I) A.i = (int32_t)(uint32_t)B.l; NEXT();
+    CASE(STR_I) A.s = rt_str_int(B.i); NEXT();
+    CASE(STR_F) A.s = rt_str_float(B.f); NEXT();
+    CASE(PRINT) rt_print(B.s); NEXT();
+    CASE(PRINTLN) rt_println(B.s); NEXT();
+    CASE(PRINT_I) rt_print_int(B.i); NEXT();
+    CASE(PRINTLN_I) rt_println_int(B.i); NEXT();
+    CASE(PRINT_F) rt_print_float(B.f); NEXT();
+    CASE(PRINTLN_F) rt_println_float(B.f); NEXT();
+    CASE(JMP) JUMP(ip->c);
+    CASE(BEQ) BRANCH(A.i == B.i);
+    CASE(BNE) BRANCH(A.i != B.i);
+    CASE(BLT) BRANCH(A.i < B.i);
+    CASE(BGE) BRANCH(A.i >= B.i);
+    CASE(BGT) BRANCH(A.i > B.i);
+    CASE(BLE) BRANCH(A.i <= B.i);
+    CASE(BEQZ) BRANCH(A.i == 0);
+    CASE(BNEZ) BRANCH(A.i != 0);
+    CASE(BLTZ) BRANCH(A.i < 0);
+    CASE(BGEZ) BRANCH(A.i >= 0);
+    CASE(BGTZ) BRANCH(A.i > 0);
+    CASE(BLEZ) BRANCH(A.i <= 0);
+    CASE(FBEQ) BRANCH(A.f == B.f);
+    CASE(FBNE) BRANCH(A.f != B.f);
+    CASE(FBLT) BRANCH(A.f < B.f);
+    CASE(FBGE) BRANCH(A.f >= B.f);
+    CASE(FBGT) BRANCH(A.f > B.f);
+    CASE(FBLE) BRANCH(A.f <= B.f);
+    CASE(FBNLT) BRANCH(!(A.f < B.f));
+    CASE(FBNGE) BRANCH(!(A.f >= B.f));
+    CASE(FBNGT) BRANCH(!(A.f > B.f));
+    CASE(FBNLE) BRANCH(!(A.f <= B.f));
+    CASE(LBEQ) BRANCH(A.l == B.l);
+    CASE(LBNE) BRANCH(A.l != B.l);
+    CASE(LBLT) BRANCH(A.l < B.l);
+    CASE(LBGE) BRANCH(A.l >= B.l);
+    CASE(LBGT) BRANCH(A.l > B.l);
+    CASE(LBLE) BRANCH(A.l <= B.l);
+    CASE(RET) return;
+
+#ifndef VM_THREADED
+    }
+#endif
+#undef A
+#undef B
+#undef C
+#undef WRAP
+#undef LWRAP
+#undef BRANCH
+#undef CASE
+#undef NEXT
+#undef JUMP
+}
+
+void vm_run(void) {
+    if (!prog.loaded) return;
+    vm_exec(&prog);
+    rt_flush();
+    vm_unload();
+}
@@ -0,0 +1,357 @@
+/* x86-64 backend (--emit=x86).
+ *
+ * Methods are taken to SSA form and every value gets an 8-byte slot in
+ * the frame; each instruction loads its operands into scratch registers,
+ * computes and stores the result. Phis are copied through a second slot
+ * per phi at the end of each predecessor, so the copies act in parallel.
+ * Printing, division and the float conversions and comparisons call the
+ * C runtime (runtime.c), which follows the JVM's rules. The output is
+ * GNU as syntax for the System V ABI; main becomes the C main. */
+#include "compiler_common.h"
+#include <stdint.h>
+
+typedef struct {
+    FILE *out;
+    IrFunc *f;
+    int *slot;       /* frame offset below %rbp per value, 0 if none */
+    int *copy_slot;  /* per phi: staging slot for parallel copies */
+    bool *fused;     /* valueOf printed straight away by rt_print_int/float */
+    IntList strings; /* values whose sval goes to .rodata */
+    const char *fname;
+} X86;
+
+static const char *cond_suffix(Opcode op) {
+    switch (op) {
+    case OP_IFEQ: case OP_IF_ICMPEQ: return "e";
+    case OP_IFNE: case OP_IF_ICMPNE: return "ne";
+    case OP_IFLT: case OP_IF_ICMPLT: return "l";
+    case OP_IFGE: case OP_IF_ICMPGE: return "ge";
+    case OP_IFGT: case OP_IF_ICMPGT: return "g";
+    case OP_IFLE: case OP_IF_ICMPLE: return "le";
+    default: return "mp";
+    }
+}
+
+static int slot_of(const X86 *x, int v) {
+    return x->slot[v];
+}
+
+static void load32(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovl -%d(%%rbp), %%%s\n", slot_of(x, v), reg);
+}
+
+static void load64(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovq -%d(%%rbp), %%%s\n", slot_of(x, v), reg);
+}
+
+static void loadss(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovss -%d(%%rbp), %%%s\n", slot_of(x, v), reg);
+}
+
+static void store32(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovl %%%s, -%d(%%rbp)\n", reg, slot_of(x, v));
+}
+
+static void store64(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovq %%%s, -%d(%%rbp)\n", reg, slot_of(x, v));
+}
+
+static void storess(X86 *x, int v, const char *reg) {
+    fprintf(x->out, "\tmovss %%%s, -%d(%%rbp)\n", reg, slot_of(x, v));
+}
+
+static bool emit_value(X86 *x, int id) {
+    const IrValue *v = &x->f->vals[id];
+    FILE *out = x->out;
+    const int *a = v->args;
+    static const char *int_ops[OP_COUNT] = {
+        [OP_IADD] = "addl", [OP_ISUB] = "subl", [OP_IMUL] = "imull",
+        [OP_IAND] = "andl", [OP_IOR] = "orl", [OP_IXOR] = "xorl",
+    };
+    static const char *shift_ops[OP_COUNT] = {
+        [OP_ISHL] = "sall", [OP_ISHR] = "sarl", [OP_IUSHR] = "shrl",
+    };
+    static const char *float_ops[OP_COUNT] = {
+        [OP_FADD] = "addss", [OP_FSUB] = "subss", [OP_FMUL] = "mulss", [OP_FDIV] = "divss",
+    };
+    static const char *calls[OP_COUNT] = {
+        [OP_IDIV] = "rt_idiv", [OP_IREM] = "rt_irem",
+    };
+
+    if (x->fused[id]) return true;
+    if (int_ops[v->op]) {
+        load32(x, a[0], "eax");
+        fprintf(out, "\t%s -%d(%%rbp), %%eax\n", int_ops[v->op], slot_of(x, a[1]));
+        store32(x, id, "eax");
+        return true;
+    }
+    if (shift_ops[v->op]) {
+        load32(x, a[0], "eax");
+        load32(x, a[1], "ecx");
+        fprintf(out, "\t%s %%cl, %%eax\n", shift_ops[v->op]);
+        store32(x, id, "eax");
+        return true;
+    }
+    if (float_ops[v->op]) {
+        loadss(x, a[0], "xmm0");
+        fprintf(out, "\t%s -%d(%%rbp), %%xmm0\n", float_ops[v->op], slot_of(x, a[1]));
+        storess(x, id, "xmm0");
+        return true;
+    }
+    if (calls[v->op]) {
+        load32(x, a[0], "edi");
+        load32(x, a[1], "esi");
+        fprintf(out, "\tcall %s\n", calls[v->op]);
+        store32(x, id, "eax");
+        return true;
+    }
+
+    switch (v->op) {
+    case OP_ICONST:
+        fprintf(out, "\tmovl $%d, -%d(%%rbp)\n", v->ival, slot_of(x, id));
+        return true;
+    case OP_FCONST: {
+        uint32_t bits;
+        memcpy(&bits, &v->fval, sizeof(bits));
+        fprintf(out, "\tmovl $%u, -%d(%%rbp)\n", bits, slot_of(x, id));
+        return true;
+    }
+    case OP_LCONST:
+        fprintf(out, "\tmovq $%d, -%d(%%rbp)\n", v->ival, slot_of(x, id));
+        return true;
+    case OP_SCONST:
+        fprintf(out, "\tleaq .L%s_s%d(%%rip), %%rax\n", x->fname, x->strings.n);
+        list_push(&x->strings, id);
+        store64(x, id, "rax");
+        return true;
+    case OP_GETSTATIC:
+        /* System.out; printing goes through the runtime */
+        if (strcmp(v->sval, "java/lang/System/out Ljava/io/PrintStream;") != 0) return false;
+        fprintf(out, "\tmovq $0, -%d(%%rbp)\n", slot_of(x, id));
+        return true;
+    case OP_INEG:
+        load32(x, a[0], "eax");
+        fprintf(out, "\tnegl %%eax\n");
+        store32(x, id, "eax");
+        return true;
+    case OP_FNEG:
+        load32(x, a[0], "eax");
+        fprintf(out, "\txorl $0x80000000, %%eax\n");
+        store32(x, id, "eax");
+        return true;
+    case OP_I2F:
+        fprintf(out, "\tcvtsi2ssl -%d(%%rbp), %%xmm0\n", slot_of(x, a[0]));
+        storess(x, id, "xmm0");
+        return true;
+    case OP_F2I:
+        loadss(x, a[0], "xmm0");
+        fprintf(out, "\tcall rt_f2i\n");
+        store32(x, id, "eax");
+        return true;
+    case OP_FCMPL:
+    case OP_FCMPG:
+        loadss(x, a[0], "xmm0");
+        loadss(x, a[1], "xmm1");
+        fprintf(out, "\tcall %s\n", v->op == OP_FCMPL ? "rt_fcmpl" : "rt_fcmpg");
+        store32(x, id, "eax");
+        return true;
+    case OP_LADD: case OP_LSUB: case OP_LMUL:
+        load64(x, a[0], "rax");
+        fprintf(out, "\t%s -%d(%%rbp), %%rax\n",
+                v->op == OP_LADD ? "addq" : v->op == OP_LSUB ? "subq" : "imulq", slot_of(x, a[1]));
+        store64(x, id, "rax");
+        return true;
+    case OP_LUSHR:
+        load64(x, a[0], "rax");
+        load32(x, a[1], "ecx");
+        fprintf(out, "\tshrq %%cl, %%rax\n");
+        store64(x, id, "rax");
+        return true;
+    case OP_LCMP:
+        load64(x, a[0], "rax");
+        fprintf(out, "\tcmpq -%d(%%rbp), %%rax\n", slot_of(x, a[1]));
+        fprintf(out, "\tsetg %%al\n\tsetl %%cl\n\tsubb %%cl, %%al\n\tmovsbl %%al, %%eax\n");
+        store32(x, id, "eax");
+        return true;
+    case OP_I2L:
+        fprintf(out, "\tmovslq -%d(%%rbp), %%rax\n", slot_of(x, a[0]));
+        store64(x, id, "rax");
+        return true;
+    case OP_L2I:
+        load32(x, a[0], "eax");
+        store32(x, id, "eax");
+        return true;
+    case OP_INVOKESTATIC:
+        if (ir_is_value_of(v, 'I')) {
+            load32(x, a[0], "edi");
+            fprintf(out, "\tcall rt_str_int\n");
+        } else if (ir_is_value_of(v, 'F')) {
+            loadss(x, a[0], "xmm0");
+            fprintf(out, "\tcall rt_str_float\n");
+        } else {
+            return false;
+        }
+        store64(x, id, "rax");
+        return true;
+    case OP_INVOKEVIRTUAL: {
+        bool ln = strcmp(v->sval, "java/io/PrintStream/println(Ljava/lang/String;)V") == 0;
+        if (!ln && strcmp(v->sval, "java/io/PrintStream/print(Ljava/lang/String;)V") != 0) return false;
+        const IrValue *s = &x->f->vals[a[1]];
+        if (x->fused[a[1]]) {
+            bool is_int = ir_is_value_of(s, 'I');
+            if (is_int) load32(x, s->args[0], "edi");
+            else loadss(x, s->args[0], "xmm0");
+            fprintf(out, "\tcall rt_%s_%s\n", ln ? "println" : "print", is_int ? "int" : "float");
+        } else {
+            load64(x, a[1], "rdi");
+            fprintf(out, "\tcall rt_%s\n", ln ? "println" : "print");
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* Phi copies for the edge from -> to, staged through copy slots */
+static void emit_copies(X86 *x, int from, int to) {
+    const IrBlock *bb = &x->f->blocks[to];
+    int idx = 0;
+    while (bb->preds.v[idx] != from) idx++;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int k = 0; k < bb->phis.n; k++) {
+            int phi = bb->phis.v[k];
+            const IrValue *v = &x->f->vals[phi];
+            if (v->dead || v->args[idx] == phi) continue;
+            int src = pass == 0 ? slot_of(x, v->args[idx]) : x->copy_slot[phi];
+            int dst = pass == 0 ? x->copy_slot[phi] : slot_of(x, phi);
+            fprintf(x->out, "\tmovq -%d(%%rbp), %%rax\n\tmovq %%rax, -%d(%%rbp)\n", src, dst);
+        }
+    }
+}
+
+static void write_string(FILE *out, const char *s) {
+    char *bytes = string_unescape(s, NULL);
+    fprintf(out, "\t.string \"");
+    for (const unsigned char *p = (const unsigned char *)bytes; *p; p++) {
+        if (*p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\') fputc(*p, out);
+        else fprintf(out, "\\%03o", *p);
+    }
+    fprintf(out, "\"\n");
+    free(bytes);
+}
+
+static bool emit_function(X86 *x) {
+    IrFunc *f = x->f;
+    FILE *out = x->out;
+    int frame = 0;
+    for (int v = 0; v < f->nvals; v++) {
+        if (f->vals[v].dead) continue;
+        frame += 8;
+        x->slot[v] = frame;
+        if (f->vals[v].kind == IR_PHI) {
+            frame += 8;
+            x->copy_slot[v] = frame;
+        }
+    }
+    frame = (frame + 15) & ~15;
+
+    fprintf(out, "\t.text\n\t.globl %s\n\t.type %s, @function\n%s:\n", x->fname, x->fname, x->fname);
+    fprintf(out, "\tpushq %%rbp\n\tmovq %%rsp, %%rbp\n");
+    if (frame) fprintf(out, "\tsubq $%d, %%rsp\n", frame);
+    for (int v = 0; v < f->nvals; v++) {
+        /* parameters are not supported; main's arguments are never read */
+        if (f->vals[v].kind == IR_ARG && !f->vals[v].dead) fprintf(out, "\tmovq $0, -%d(%%rbp)\n", x->slot[v]);
+    }
+
+    IntList edges = { NULL, 0, 0 };
+    for (int b = 0; b < f->nblocks; b++) {
+        const IrBlock *bb = &f->blocks[b];
+        if (!bb->reachable) continue;
+        int next = b + 1;
+        while (next < f->nblocks && !f->blocks[next].reachable) next++;
+        fprintf(out, ".L%s_b%d:\n", x->fname, b);
+        for (int k = 0; k < bb->insns.n; k++) {
+            int id = bb->insns.v[k];
+            if (f->vals[id].dead) continue;
+            if (!emit_value(x, id)) {
+                free(edges.v);
+                return false;
+            }
+        }
+        const int *a = bb->term_args;
+        if (opcode_flags(bb->term) & OPF_END) {
+            fprintf(out, "\tjmp .L%s_ret\n", x->fname);
+            continue;
+        }
+        if (bb->term != OP_GOTO) {
+            if (bb->nterm_args == 2) {
+                load32(x, a[0], "eax");
+                fprintf(out, "\tcmpl -%d(%%rbp), %%eax\n", slot_of(x, a[1]));
+            } else {
+                fprintf(out, "\tcmpl $0, -%d(%%rbp)\n", slot_of(x, a[0]));
+            }
+            int taken = bb->succ[bb->nsucc - 1];
+            if (ir_has_copies(f, taken)) {
+                fprintf(out, "\tj%s .L%s_e%d\n", cond_suffix(bb->term), x->fname, b);
+                list_push(&edges, b);
+            } else {
+                fprintf(out, "\tj%s .L%s_b%d\n", cond_suffix(bb->term), x->fname, taken);
+            }
+            if (bb->nsucc < 2) continue;
+        } else if (bb->nsucc == 0) {
+            continue;
+        }
+        emit_copies(x, b, bb->succ[0]);
+        if (bb->succ[0] != next) fprintf(out, "\tjmp .L%s_b%d\n", x->fname, bb->succ[0]);
+    }
+    for (int e = 0; e < edges.n; e++) {
+        const IrBlock *bb = &f->blocks[edges.v[e]];
+        int taken = bb->succ[bb->nsucc - 1];
+        fprintf(out, ".L%s_e%d:\n", x->fname, edges.v[e]);
+        emit_copies(x, edges.v[e], taken);
+        fprintf(out, "\tjmp .L%s_b%d\n", x->fname, taken);
+    }
+    free(edges.v);
+
+    fprintf(out, ".L%s_ret:\n", x->fname);
+    if (strcmp(x->fname, "main") == 0) fprintf(out, "\tcall rt_flush\n\txorl %%eax, %%eax\n");
+    fprintf(out, "\tleave\n\tret\n\t.size %s, .-%s\n", x->fname, x->fname);
+
+    if (x->strings.n) fprintf(out, "\t.section .rodata\n");
+    for (int k = 0; k < x->strings.n; k++) {
+        fprintf(out, ".L%s_s%d:\n", x->fname, k);
+        write_string(out, f->vals[x->strings.v[k]].sval);
+    }
+    fprintf(out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+    return true;
+}
+
+bool x86_write_method(FILE *out, Method *m) {
+    IrFunc f;
+    if (!ir_build(&f, m)) return false;
+
+    X86 x;
+    memset(&x, 0, sizeof(x));
+    x.out = out;
+    x.f = &f;
+    x.slot = calloc(f.nvals + 1, sizeof(int));
+    x.copy_slot = calloc(f.nvals + 1, sizeof(int));
+
+    /* main keeps its C name; other functions get a prefix */
+    char fname[128];
+    size_t n = strcspn(m->name, "(");
+    snprintf(fname, sizeof(fname), "%s%.*s", strncmp(m->name, "main(", 5) == 0 ? "" : "rs_", (int)n, m->name);
+    x.fname = fname;
+
+    /* print(valueOf(x)) formats x into the output buffer directly */
+    x.fused = ir_fused_prints(&f);
+
+    bool ok = emit_function(&x);
+    free(x.slot);
+    free(x.copy_slot);
+    free(x.fused);
+    free(x.strings.v);
+    ir_free(&f);
+    return ok;
+}
@@ -55,7 +55,7 @@
 #define YYSKELETON_NAME "yacc.c"
 
 /* Pure parsers.  */
-#define YYPURE 0
+#define YYPURE 2
 
 /* Push parsers.  */
 #define YYPUSH 0
@@ -70,10 +70,14 @@
 #line 5 "compiler.y"
 
     #include "compiler_common.h" //Extern variables that communicate with lex
+    #include "cache.h"
+    #include <ctype.h>
+    #include <stdarg.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
     // #define YYDEBUG 1
     // int yydebug = 1;
 
-    #define MAX_SYMBOLS 256
     #define MAX_SCOPE 10
 
     typedef struct {
@@ -86,71 +90,78 @@
     } Symbol;
 
     typedef struct {
-        Symbol symbols[MAX_SYMBOLS];
-        int count;
+        Symbol *symbols;  /* grows; kept for the next scope at this level */
+        int count, cap;
         int level;
     } Scope;
 
-    static Scope scope_stack[MAX_SCOPE];
-    static int scope_top = -1;
-    static int addr_counter = 0;
+    /* The parser's scope state for one file, passed to it as ps. Only this
+     * moved out of globals: the scanner (yyin, yylineno), the globals
+     * below and codegen.c's method buffer are still shared, so the front
+     * end compiles one file at a time per process. */
+    struct ParseState {
+        Scope scopes[MAX_SCOPE];
+        int scope_top;
+        int addr_counter;
+        int label_id;
+        bool has_error;
+    };
 
     extern int yylineno;
-    extern int yylex();
     extern FILE *yyin;
 
     int yylex_destroy ();
-    void yyerror (char const *s)
+    void yyerror (ParseState *ps, char const *s)
     {
         printf("error:%d: %s\n", yylineno, s);
     }
 
-    extern int yylineno;
-    extern int yylex();
-    extern FILE *yyin;
-
     /* Used to generate code */
     /* As printf; the usage: CODEGEN("%d - %s\n", 100, "Hello world"); */
-    /* We do not enforce the use of this macro */
-    #define CODEGEN(...) \
-        do { \
-            for (int i = 0; i < g_indent_cnt; i++) { \
-                fprintf(fout, "\t"); \
-            } \
-            fprintf(fout, __VA_ARGS__); \
-        } while (0)
+    /* Inside a method body the line is buffered and optimized (codegen.c) */
+    #define CODEGEN(...) code_emit(__VA_ARGS__)
 
     /* Symbol table function - you can add new functions if needed. */
     /* parameters and return type can be changed */
-    static void create_symbol();
-    static void init_symbol();
-    static int insert_symbol(const char *name, const char *type, int addr, int lineno, const char *sig);
-    static int lookup_symbol(const char *name);
-    static void dump_symbol();
-    static int next_addr();
-    static int get_scope_level();
-    static const char* get_symbol_type(const char *name);
+    static void create_symbol(ParseState *ps);
+    static void init_symbol(ParseState *ps);
+    static void free_symbols(ParseState *ps);
+    static int insert_symbol(ParseState *ps, const char *name, const char *type, int addr, int lineno, const char *sig);
+    static int lookup_symbol(ParseState *ps, const char *name);
+    static void dump_symbol(ParseState *ps);
+    static int next_addr(ParseState *ps);
+    static int get_scope_level(ParseState *ps);
+    static const char* get_symbol_type(ParseState *ps, const char *name);
+    static void trace_symbols(ParseState *ps);
 
     /* Global variables */
     bool g_has_error = false;
     FILE *fout = NULL;
     int g_indent_cnt = 0;
-    bool HAS_ERROR = false;
-    static int label_id = 0;
-    int last_if_id;
-
-    int is_mutable(const char* name) {
-        for (int i = scope_top; i >= 0; --i) {
-            for (int j = 0; j < scope_stack[i].count; ++j) {
-                if (strcmp(scope_stack[i].symbols[j].name, name) == 0) {
-                    return scope_stack[i].symbols[j].mut;
+
+    /* Reports an error in the source at the current line; the file then
+     * counts as failed, for the exit status of a batch and the cache */
+    static void compile_error(ParseState *ps, const char *fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        printf("error:%d: ", yylineno);
+        vprintf(fmt, ap);
+        va_end(ap);
+        ps->has_error = true;
+    }
+
+    int is_mutable(ParseState *ps, const char* name) {
+        for (int i = ps->scope_top; i >= 0; --i) {
+            for (int j = 0; j < ps->scopes[i].count; ++j) {
+                if (strcmp(ps->scopes[i].symbols[j].name, name) == 0) {
+                    return ps->scopes[i].symbols[j].mut;
                 }
             }
         }
         return 0;
     }
 
-#line 154 "y.tab.c"
+#line 165 "y.tab.c"
 
 # ifndef YY_CAST
 #  ifdef __cplusplus
@@ -241,19 +252,68 @@ extern int yydebug;
   };
   typedef enum yytokentype yytoken_kind_t;
 #endif
+/* Token kinds.  */
+#define YYEMPTY -2
+#define YYEOF 0
+#define YYerror 256
+#define YYUNDEF 257
+#define LET 258
+#define MUT 259
+#define NEWLINE 260
+#define INT 261
+#define FLOAT 262
+#define BOOL 263
+#define STR 264
+#define TRUE 265
+#define FALSE 266
+#define GEQ 267
+#define LEQ 268
+#define EQL 269
+#define NEQ 270
+#define LOR 271
+#define LAND 272
+#define ADD_ASSIGN 273
+#define SUB_ASSIGN 274
+#define MUL_ASSIGN 275
+#define DIV_ASSIGN 276
+#define REM_ASSIGN 277
+#define IF 278
+#define ELSE 279
+#define FOR 280
+#define WHILE 281
+#define LOOP 282
+#define PRINT 283
+#define PRINTLN 284
+#define FUNC 285
+#define RETURN 286
+#define BREAK 287
+#define ARROW 288
+#define AS 289
+#define IN 290
+#define DOTDOT 291
+#define RSHIFT 292
+#define LSHIFT 293
+#define INT_LIT 294
+#define FLOAT_LIT 295
+#define STRING_LIT 296
+#define IDENT 297
+#define ID 298
+#define LOWER_THAN_ASSIGN 299
+#define LOWER_THAN_ELSE 300
+#define IFX 301
 
 /* Value type.  */
 #if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
 union YYSTYPE
 {
-#line 94 "compiler.y"
+#line 107 "compiler.y"
 
     int i_val;
     float f_val;
     char *s_val;
     char* type; /* i32, f32, str, bool */
 
-#line 257 "y.tab.c"
+#line 317 "y.tab.c"
 
 };
 typedef union YYSTYPE YYSTYPE;
@@ -262,10 +322,9 @@ typedef union YYSTYPE YYSTYPE;
 #endif
 
 
-extern YYSTYPE yylval;
 
 
-int yyparse (void);
+int yyparse (ParseState *ps);
 
 
 #endif /* !YY_YY_Y_TAB_H_INCLUDED  */
@@ -379,6 +438,22 @@ typedef enum yysymbol_kind_t yysymbol_kind_t;
 
 
 
+/* Unqualified %code blocks.  */
+#line 114 "compiler.y"
+
+    int yylex(YYSTYPE *lval);
+
+    /* The scanner as the parser calls it, timed for --time-report; not
+     * traced, as that would be a span per token */
+    static int timed_yylex(YYSTYPE *lval) {
+        time_begin("lex");
+        int token = yylex(lval);
+        time_end();
+        return token;
+    }
+    #define yylex timed_yylex
+
+#line 457 "y.tab.c"
 
 #ifdef short
 # undef short
@@ -701,7 +776,7 @@ union yyalloc
 /* YYFINAL -- State number of the termination state.  */
 #define YYFINAL  8
 /* YYLAST -- Last index in YYTABLE.  */
-#define YYLAST   195
+#define YYLAST   186
 
 /* YYNTOKENS -- Number of terminals.  */
 #define YYNTOKENS  67
@@ -710,7 +785,7 @@ union yyalloc
 /* YYNRULES -- Number of rules.  */
 #define YYNRULES  96
 /* YYNSTATES -- Number of states.  */
-#define YYNSTATES  187
+#define YYNSTATES  186
 
 /* YYMAXUTOK -- Last valid token kind.  */
 #define YYMAXUTOK   301
@@ -764,16 +839,16 @@ static const yytype_int8 yytranslate[] =
 /* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
 static const yytype_int16 yyrline[] =
 {
-       0,   140,   140,   144,   145,   149,   150,   154,   154,   176,
-     177,   181,   182,   183,   184,   185,   186,   187,   188,   192,
-     193,   194,   195,   196,   197,   201,   214,   227,   232,   246,
-     252,   269,   288,   315,   342,   369,   396,   420,   420,   436,
-     437,   441,   455,   469,   483,   497,   511,   528,   528,   540,
-     553,   566,   579,   592,   605,   621,   656,   691,   691,   699,
-     700,   704,   716,   720,   724,   728,   732,   736,   753,   770,
-     787,   804,   812,   820,   824,   829,   834,   838,   843,   848,
-     852,   856,   861,   865,   872,   887,   891,   892,   893,   894,
-     895,   896,   897,   915,   916,   919,   923
+       0,   167,   167,   171,   172,   176,   177,   181,   181,   206,
+     207,   211,   212,   213,   214,   215,   216,   217,   218,   222,
+     223,   224,   225,   226,   227,   231,   244,   257,   262,   276,
+     282,   299,   318,   345,   372,   399,   426,   450,   450,   466,
+     467,   471,   485,   499,   513,   527,   541,   558,   558,   570,
+     583,   596,   609,   622,   635,   651,   686,   721,   721,   729,
+     730,   734,   746,   750,   754,   758,   762,   766,   783,   800,
+     817,   834,   842,   850,   854,   859,   864,   868,   873,   878,
+     882,   886,   891,   895,   902,   917,   921,   922,   923,   924,
+     925,   926,   927,   944,   945,   948,   952
 };
 #endif
 
@@ -814,7 +889,7 @@ yysymbol_name (yysymbol_kind_t yysymbol)
 }
 #endif
 
-#define YYPACT_NINF (-71)
+#define YYPACT_NINF (-64)
 
 #define yypact_value_is_default(Yyn) \
   ((Yyn) == YYPACT_NINF)
@@ -826,27 +901,27 @@ yysymbol_name (yysymbol_kind_t yysymbol)
 
 /* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
    STATE-NUM.  */
-static const yytype_int16 yypact[] =
+static const yytype_int8 yypact[] =
 {
-      18,   -71,   -13,    38,    18,   -71,   -71,     0,   -71,   -71,
-      10,   -71,   -19,   -71,   -71,   -71,    60,     9,   -71,   -71,
-     129,   129,   129,   129,    23,   -71,   -71,    14,   129,   129,
-     -71,   129,   129,   -71,   -71,   -71,   -71,   -71,   -71,   -71,
-     -71,   -71,    -3,    51,    52,   -71,   -10,    42,   -71,    40,
-     -71,   -71,    37,   -31,    30,   -71,   115,   -71,    32,    34,
-     -71,    59,   129,   129,   129,   129,   129,   129,    62,    53,
-     -34,   -71,   -71,   -71,   -71,   129,   129,   129,   129,   129,
-     129,   129,   129,   129,   129,   129,   129,   129,     3,   -30,
-     129,     3,   -19,   129,   129,   129,   129,   129,   129,   129,
-     -71,   -71,   -71,    55,    57,    61,    63,    64,    67,    69,
-     -71,   -71,   129,    52,   -71,   -45,   -45,   -45,   -45,   -45,
-     -45,    42,    42,   -71,   -71,   -71,   -71,   -71,   -71,   -71,
-     104,     3,   -71,   129,     3,    68,   -23,    91,   -45,   -45,
-     -45,   -45,   -45,   -45,   -19,   131,   -71,   -71,   -71,   -71,
-     -71,   -71,   -71,   -71,   -71,    71,    72,   -16,   -71,   129,
-     -71,   -19,   -71,   -71,   129,   129,   129,   129,   129,   129,
-      92,   -71,   129,   -71,    78,   -71,   -45,   -45,   -45,   -45,
-     -45,   -45,    79,    81,   -71,   -71,   -71
+       9,   -64,   -18,    32,     9,   -64,   -64,   -16,   -64,   -64,
+     -15,   -64,    -7,   -64,   -64,   -64,     8,     6,   -64,   -64,
+      48,   -64,    48,    48,   -17,   -64,   -64,   111,    48,    48,
+     -64,    48,    48,   -64,   -64,   -64,   -64,   -64,   -64,   -64,
+     -64,   -64,    12,    45,    52,   -64,   124,    30,   -64,    39,
+     -64,   -64,    31,   -42,    34,   -64,    15,    48,    37,    43,
+     -64,    62,    48,    48,    48,    48,    48,    48,    44,    59,
+     -37,   -64,   -64,   -64,   -64,    48,    48,    48,    48,    48,
+      48,    48,    48,    48,    48,    48,    48,    48,    47,   -40,
+      48,    47,    -7,    48,    48,    48,    48,    48,    48,    -7,
+     103,   -64,   -64,   -64,    49,    58,    60,    72,    73,    74,
+      80,   -64,   -64,    48,    52,   -64,    19,    19,    19,    19,
+      19,    19,    30,    30,   -64,   -64,   -64,   -64,   -64,   -64,
+     -64,   119,    47,   -64,    48,    47,    82,   -41,   112,    19,
+      19,    19,    19,    19,    19,   -64,    48,    48,    48,    48,
+      48,    48,   -64,   -64,   -64,   -64,   -64,   -64,   -64,   -64,
+     -64,    84,    87,   -29,   -64,    48,   -64,    -7,   -64,    19,
+      19,    19,    19,    19,    19,   101,   -64,    48,   -64,    89,
+     -64,    90,    92,   -64,   -64,   -64
 };
 
 /* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
@@ -856,39 +931,39 @@ static const yytype_int8 yydefact[] =
 {
        0,     6,     0,     0,     2,     4,     5,     0,     1,     3,
        0,     7,     0,    57,     8,     9,     0,     0,    90,    91,
-       0,     0,     0,     0,     0,    88,    89,    92,     0,     0,
+       0,    47,     0,     0,     0,    88,    89,    92,     0,     0,
       58,     0,     0,    10,    11,    12,    13,    14,    15,    16,
       17,    18,     0,    62,    64,    66,    73,    76,    80,    82,
-      85,    93,     0,     0,    92,    37,     0,    47,     0,     0,
+      85,    93,     0,     0,    92,    37,     0,     0,     0,     0,
       87,     0,     0,     0,     0,     0,     0,     0,     0,     0,
        0,    59,    83,    84,    61,     0,     0,     0,     0,     0,
        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
        0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
-      55,    56,    86,     0,     0,     0,     0,     0,     0,     0,
-      95,    94,     0,    63,    65,    69,    70,    72,    71,    67,
-      68,    74,    75,    77,    78,    79,    19,    20,    23,    21,
-       0,     0,    81,     0,     0,     0,     0,    40,    45,    46,
-      43,    44,    41,    42,     0,     0,    32,    33,    34,    35,
-      36,    31,    96,    60,    22,     0,     0,     0,    25,     0,
-      27,     0,    38,    48,     0,     0,     0,     0,     0,     0,
-       0,    30,     0,    29,     0,    39,    53,    54,    51,    52,
-      49,    50,     0,     0,    26,    24,    28
+       0,    55,    56,    86,     0,     0,     0,     0,     0,     0,
+       0,    95,    94,     0,    63,    65,    69,    70,    72,    71,
+      67,    68,    74,    75,    77,    78,    79,    19,    20,    23,
+      21,     0,     0,    81,     0,     0,     0,     0,    40,    45,
+      46,    43,    44,    41,    42,    48,     0,     0,     0,     0,
+       0,     0,    32,    33,    34,    35,    36,    31,    96,    60,
+      22,     0,     0,     0,    25,     0,    27,     0,    38,    53,
+      54,    51,    52,    49,    50,     0,    30,     0,    29,     0,
+      39,     0,     0,    26,    24,    28
 };
 
 /* YYPGOTO[NTERM-NUM].  */
 static const yytype_int16 yypgoto[] =
 {
-     -71,   -71,   -71,   134,   -71,   -71,   -71,   -71,   -70,   -71,
-     -71,   -71,   -71,   -71,   114,   -71,   -71,   -71,   -71,   -71,
-      -8,   -71,   -71,   -71,   -22,   -71,    66,    73,    -2,   -11,
-     -71,   -29,   -71,   -71
+     -64,   -64,   -64,   142,   -64,   -64,   -64,   -64,   -53,   -64,
+     -64,   -64,   -64,   -64,   -64,   -64,   -64,   -64,   -64,   -64,
+     -14,   -64,   -64,   -64,   -22,   -64,    75,    71,    26,   -63,
+     -64,   -23,   -64,   -64
 };
 
 /* YYDEFGOTO[NTERM-NUM].  */
 static const yytype_uint8 yydefgoto[] =
 {
-       0,     3,     4,     5,     6,    12,    16,    33,   132,    34,
-      35,    36,    92,   162,    55,    37,    99,   144,    38,    39,
+       0,     3,     4,     5,     6,    12,    16,    33,   133,    34,
+      35,    36,    92,   168,    55,    37,    57,    99,    38,    39,
       14,    15,    70,    41,    42,    43,    44,    45,    46,    47,
       48,    49,    50,    51
 };
@@ -898,50 +973,48 @@ static const yytype_uint8 yydefgoto[] =
    number is the opposite.  If YYTABLE_NINF, syntax error.  */
 static const yytype_uint8 yytable[] =
 {
-      58,    59,    72,    73,    77,    78,    69,    71,    40,   126,
-     127,   128,   129,    52,    90,   133,    83,    84,    56,    56,
-     111,   136,   159,     1,    91,   134,   112,    79,    80,   172,
-     160,     7,    62,    63,    64,    65,    66,   173,     8,    13,
-     103,   104,   105,   106,   107,   108,    81,    82,     2,    10,
-      74,    83,    84,    53,   130,   131,   123,   124,   125,    67,
-      11,   155,    60,    17,   157,    61,    68,    75,   135,    76,
-      18,    19,   121,   122,    88,   115,   116,   117,   118,   119,
-     120,    89,    68,    20,   137,   100,    21,   101,    22,    23,
-     153,   138,   139,   140,   141,   142,   143,   145,   102,    24,
-      25,    26,   109,   110,    27,    85,    86,    87,   146,    28,
-     147,   156,    29,   154,   148,   161,   149,   150,    13,    30,
-     151,   158,    31,   152,   170,   171,    32,    93,    94,    95,
-      96,   184,   182,   185,   186,    57,   163,   174,     9,    18,
-      19,   113,     0,   164,   165,   166,   167,     0,     0,   114,
-     183,     0,     0,   175,     0,     0,     0,     0,     0,     0,
-       0,     0,   176,   177,   178,   179,   180,   181,    24,    25,
-      26,    97,    98,    54,     0,     0,    83,    84,    28,     0,
-       0,    29,     0,     0,     0,     0,     0,   168,   169,     0,
-       0,    31,    83,    84,     0,    32
+      58,    59,    40,    90,   165,   134,    69,    71,    72,    73,
+      52,    17,   166,    91,     1,   135,   177,   112,    18,    19,
+     122,   123,    60,   113,   178,    61,     7,    93,    94,    95,
+      96,    20,     8,    10,    21,    11,    22,    23,   137,     2,
+     104,   105,   106,   107,   108,   109,    56,    24,    25,    26,
+      53,    13,    27,   127,   128,   129,   130,    28,    18,    19,
+      29,    75,   124,   125,   126,    74,    13,    30,   136,    76,
+      31,    97,    98,    88,    32,    89,    83,    84,   138,   161,
+      83,    84,   163,   100,   110,   145,    68,    24,    25,    26,
+     101,   159,    54,    85,    86,    87,   102,    28,   131,   132,
+      29,   103,   152,   116,   117,   118,   119,   120,   121,   111,
+      31,   153,   162,   154,    32,   146,   147,   148,   149,   139,
+     140,   141,   142,   143,   144,   155,   156,   157,   160,    62,
+      63,    64,    65,    66,   158,   164,   167,   175,    77,    78,
+     176,   181,   183,   179,   184,   185,     9,   115,     0,     0,
+     114,     0,     0,   180,     0,   182,    67,     0,     0,   150,
+     151,    79,    80,    68,    83,    84,     0,     0,     0,     0,
+       0,     0,   169,   170,   171,   172,   173,   174,     0,     0,
+      81,    82,     0,     0,     0,    83,    84
 };
 
 static const yytype_int16 yycheck[] =
 {
-      22,    23,    31,    32,    14,    15,    28,    29,    16,     6,
-       7,     8,     9,     4,    45,    45,    61,    62,    20,    21,
-      54,    91,    45,     5,    55,    55,    60,    37,    38,    45,
-      53,    44,    18,    19,    20,    21,    22,    53,     0,    58,
-      62,    63,    64,    65,    66,    67,    56,    57,    30,    49,
-      53,    61,    62,    44,    51,    52,    85,    86,    87,    45,
-      50,   131,    39,     3,   134,    42,    52,    16,    90,    17,
-      10,    11,    83,    84,    34,    77,    78,    79,    80,    81,
-      82,    44,    52,    23,    92,    53,    26,    53,    28,    29,
-     112,    93,    94,    95,    96,    97,    98,    99,    39,    39,
-      40,    41,    40,    50,    44,    63,    64,    65,    53,    49,
-      53,   133,    52,     9,    53,    24,    53,    53,    58,    59,
-      53,    53,    62,    54,    53,    53,    66,    12,    13,    14,
-      15,    53,    40,    54,    53,    21,   144,   159,     4,    10,
-      11,    75,    -1,    12,    13,    14,    15,    -1,    -1,    76,
-     172,    -1,    -1,   161,    -1,    -1,    -1,    -1,    -1,    -1,
-      -1,    -1,   164,   165,   166,   167,   168,   169,    39,    40,
-      41,    56,    57,    44,    -1,    -1,    61,    62,    49,    -1,
-      -1,    52,    -1,    -1,    -1,    -1,    -1,    56,    57,    -1,
-      -1,    62,    61,    62,    -1,    66
+      22,    23,    16,    45,    45,    45,    28,    29,    31,    32,
+       4,     3,    53,    55,     5,    55,    45,    54,    10,    11,
+      83,    84,    39,    60,    53,    42,    44,    12,    13,    14,
+      15,    23,     0,    49,    26,    50,    28,    29,    91,    30,
+      62,    63,    64,    65,    66,    67,    20,    39,    40,    41,
+      44,    58,    44,     6,     7,     8,     9,    49,    10,    11,
+      52,    16,    85,    86,    87,    53,    58,    59,    90,    17,
+      62,    56,    57,    34,    66,    44,    61,    62,    92,   132,
+      61,    62,   135,    57,    40,    99,    52,    39,    40,    41,
+      53,   113,    44,    63,    64,    65,    53,    49,    51,    52,
+      52,    39,    53,    77,    78,    79,    80,    81,    82,    50,
+      62,    53,   134,    53,    66,    12,    13,    14,    15,    93,
+      94,    95,    96,    97,    98,    53,    53,    53,     9,    18,
+      19,    20,    21,    22,    54,    53,    24,    53,    14,    15,
+      53,    40,    53,   165,    54,    53,     4,    76,    -1,    -1,
+      75,    -1,    -1,   167,    -1,   177,    45,    -1,    -1,    56,
+      57,    37,    38,    52,    61,    62,    -1,    -1,    -1,    -1,
+      -1,    -1,   146,   147,   148,   149,   150,   151,    -1,    -1,
+      56,    57,    -1,    -1,    -1,    61,    62
 };
 
 /* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
@@ -953,20 +1026,20 @@ static const yytype_int8 yystos[] =
       23,    26,    28,    29,    39,    40,    41,    44,    49,    52,
       59,    62,    66,    74,    76,    77,    78,    82,    85,    86,
       87,    90,    91,    92,    93,    94,    95,    96,    97,    98,
-      99,   100,     4,    44,    44,    81,    95,    81,    91,    91,
+      99,   100,     4,    44,    44,    81,    95,    83,    91,    91,
       39,    42,    18,    19,    20,    21,    22,    45,    52,    91,
       89,    91,    98,    98,    53,    16,    17,    14,    15,    37,
       38,    56,    57,    61,    62,    63,    64,    65,    34,    44,
-      45,    55,    79,    12,    13,    14,    15,    56,    57,    83,
-      53,    53,    39,    91,    91,    91,    91,    91,    91,    40,
-      50,    54,    60,    93,    94,    95,    95,    95,    95,    95,
-      95,    96,    96,    98,    98,    98,     6,     7,     8,     9,
-      51,    52,    75,    45,    55,    91,    75,    87,    95,    95,
-      95,    95,    95,    95,    84,    95,    53,    53,    53,    53,
-      53,    53,    54,    91,     9,    75,    91,    75,    53,    45,
-      53,    24,    80,    87,    12,    13,    14,    15,    56,    57,
-      53,    53,    45,    53,    91,    87,    95,    95,    95,    95,
-      95,    95,    40,    91,    53,    54,    53
+      45,    55,    79,    12,    13,    14,    15,    56,    57,    84,
+      95,    53,    53,    39,    91,    91,    91,    91,    91,    91,
+      40,    50,    54,    60,    93,    94,    95,    95,    95,    95,
+      95,    95,    96,    96,    98,    98,    98,     6,     7,     8,
+       9,    51,    52,    75,    45,    55,    91,    75,    87,    95,
+      95,    95,    95,    95,    95,    87,    12,    13,    14,    15,
+      56,    57,    53,    53,    53,    53,    53,    53,    54,    91,
+       9,    75,    91,    75,    53,    45,    53,    24,    80,    95,
+      95,    95,    95,    95,    95,    53,    53,    45,    53,    91,
+      87,    40,    91,    53,    54,    53
 };
 
 /* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
@@ -991,7 +1064,7 @@ static const yytype_int8 yyr2[] =
        2,     1,     1,     1,     1,     1,     1,     1,     1,     1,
        1,     1,     2,     1,     5,     5,     7,     5,     8,     6,
        6,     4,     4,     4,     4,     4,     4,     0,     5,     2,
-       0,     3,     3,     3,     3,     3,     3,     0,     5,     3,
+       0,     3,     3,     3,     3,     3,     3,     0,     4,     3,
        3,     3,     3,     3,     3,     3,     3,     0,     4,     1,
        3,     2,     1,     3,     1,     3,     1,     3,     3,     3,
        3,     3,     3,     1,     3,     3,     1,     3,     3,     3,
@@ -1025,7 +1098,7 @@ enum { YYENOMEM = -2 };
       }                                                           \
     else                                                          \
       {                                                           \
-        yyerror (YY_("syntax error: cannot back up")); \
+        yyerror (ps, YY_("syntax error: cannot back up")); \
         YYERROR;                                                  \
       }                                                           \
   while (0)
@@ -1058,7 +1131,7 @@ do {                                                                      \
     {                                                                     \
       YYFPRINTF (stderr, "%s ", Title);                                   \
       yy_symbol_print (stderr,                                            \
-                  Kind, Value); \
+                  Kind, Value, ps); \
       YYFPRINTF (stderr, "\n");                                           \
     }                                                                     \
 } while (0)
@@ -1070,10 +1143,11 @@ do {                                                                      \
 
 static void
 yy_symbol_value_print (FILE *yyo,
-                       yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep)
+                       yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, ParseState *ps)
 {
   FILE *yyoutput = yyo;
   YY_USE (yyoutput);
+  YY_USE (ps);
   if (!yyvaluep)
     return;
   YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
@@ -1088,12 +1162,12 @@ yy_symbol_value_print (FILE *yyo,
 
 static void
 yy_symbol_print (FILE *yyo,
-                 yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep)
+                 yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep, ParseState *ps)
 {
   YYFPRINTF (yyo, "%s %s (",
              yykind < YYNTOKENS ? "token" : "nterm", yysymbol_name (yykind));
 
-  yy_symbol_value_print (yyo, yykind, yyvaluep);
+  yy_symbol_value_print (yyo, yykind, yyvaluep, ps);
   YYFPRINTF (yyo, ")");
 }
 
@@ -1127,7 +1201,7 @@ do {                                                            \
 
 static void
 yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp,
-                 int yyrule)
+                 int yyrule, ParseState *ps)
 {
   int yylno = yyrline[yyrule];
   int yynrhs = yyr2[yyrule];
@@ -1140,7 +1214,7 @@ yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp,
       YYFPRINTF (stderr, "   $%d = ", yyi + 1);
       yy_symbol_print (stderr,
                        YY_ACCESSING_SYMBOL (+yyssp[yyi + 1 - yynrhs]),
-                       &yyvsp[(yyi + 1) - (yynrhs)]);
+                       &yyvsp[(yyi + 1) - (yynrhs)], ps);
       YYFPRINTF (stderr, "\n");
     }
 }
@@ -1148,7 +1222,7 @@ yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp,
 # define YY_REDUCE_PRINT(Rule)          \
 do {                                    \
   if (yydebug)                          \
-    yy_reduce_print (yyssp, yyvsp, Rule); \
+    yy_reduce_print (yyssp, yyvsp, Rule, ps); \
 } while (0)
 
 /* Nonzero means print parse trace.  It is left uninitialized so that
@@ -1456,9 +1530,10 @@ yysyntax_error (YYPTRDIFF_T *yymsg_alloc, char **yymsg,
 
 static void
 yydestruct (const char *yymsg,
-            yysymbol_kind_t yykind, YYSTYPE *yyvaluep)
+            yysymbol_kind_t yykind, YYSTYPE *yyvaluep, ParseState *ps)
 {
   YY_USE (yyvaluep);
+  YY_USE (ps);
   if (!yymsg)
     yymsg = "Deleting";
   YY_SYMBOL_PRINT (yymsg, yykind, yyvaluep, yylocationp);
@@ -1469,13 +1544,6 @@ yydestruct (const char *yymsg,
 }
 
 
-/* Lookahead token kind.  */
-int yychar;
-
-/* The semantic value of the lookahead symbol.  */
-YYSTYPE yylval;
-/* Number of syntax errors so far.  */
-int yynerrs;
 
 
 
@@ -1485,8 +1553,21 @@ int yynerrs;
 `----------*/
 
 int
-yyparse (void)
+yyparse (ParseState *ps)
 {
+/* Lookahead token kind.  */
+int yychar;
+
+
+/* The semantic value of the lookahead symbol.  */
+/* Default value used for initialization, for pacifying older GCCs
+   or non-GCC compilers.  */
+YY_INITIAL_VALUE (static YYSTYPE yyval_default;)
+YYSTYPE yylval YY_INITIAL_VALUE (= yyval_default);
+
+    /* Number of syntax errors so far.  */
+    int yynerrs = 0;
+
     yy_state_fast_t yystate = 0;
     /* Number of tokens to shift before error messages enabled.  */
     int yyerrstatus = 0;
@@ -1642,7 +1723,7 @@ yybackup:
   if (yychar == YYEMPTY)
     {
       YYDPRINTF ((stderr, "Reading a token\n"));
-      yychar = yylex ();
+      yychar = yylex (&yylval);
     }
 
   if (yychar <= YYEOF)
@@ -1730,76 +1811,79 @@ yyreduce:
   switch (yyn)
     {
   case 7: /* $@1: %empty  */
-#line 154 "compiler.y"
+#line 181 "compiler.y"
                       {
-        create_symbol();
-        insert_symbol((yyvsp[-2].s_val), "func", -1, yylineno, "(V)V");
+        if (ps->scope_top < 0) create_symbol(ps);  // 所有 function 共用 global scope
+        insert_symbol(ps, (yyvsp[-2].s_val), "func", -1, yylineno, "(V)V");
+        ps->addr_counter = 0;  // local slot 從每個 function 的 0 開始
+        ps->label_id = 0;      /* labels are per method too, so a method's code
+                                * does not depend on the ones before it */
 
         // 如果是 main，產生帶參數的 main
         if (strcmp((yyvsp[-2].s_val), "main") == 0) {
-            CODEGEN("\n.method public static main([Ljava/lang/String;)V\n");
+            method_begin("main([Ljava/lang/String;)V");
         } else {
-            CODEGEN("\n.method public static %s()V\n", (yyvsp[-2].s_val));
+            char sig[96];
+            snprintf(sig, sizeof(sig), "%s()V", (yyvsp[-2].s_val));
+            method_begin(sig);
         }
-        CODEGEN(".limit stack 100\n");
-        CODEGEN(".limit locals 100\n");
         g_indent_cnt++;  // 進入 function 增加縮排
     }
-#line 1749 "y.tab.c"
+#line 1833 "y.tab.c"
     break;
 
   case 8: /* FunctionDeclStmt: FUNC ID '(' ')' $@1 Block  */
-#line 167 "compiler.y"
+#line 197 "compiler.y"
             {
         g_indent_cnt--;
         CODEGEN("return\n");
-        CODEGEN(".end method\n");
+        method_end();   // 最佳化後寫出 .method ... .end method
         free((yyvsp[-4].s_val));
     }
-#line 1760 "y.tab.c"
+#line 1844 "y.tab.c"
     break;
 
   case 19: /* Type: INT  */
-#line 192 "compiler.y"
+#line 222 "compiler.y"
               { (yyval.s_val) = "i32"; }
-#line 1766 "y.tab.c"
+#line 1850 "y.tab.c"
     break;
 
   case 20: /* Type: FLOAT  */
-#line 193 "compiler.y"
+#line 223 "compiler.y"
               { (yyval.s_val) = "f32"; }
-#line 1772 "y.tab.c"
+#line 1856 "y.tab.c"
     break;
 
   case 21: /* Type: STR  */
-#line 194 "compiler.y"
+#line 224 "compiler.y"
               { (yyval.s_val) = "str"; }
-#line 1778 "y.tab.c"
+#line 1862 "y.tab.c"
     break;
 
   case 22: /* Type: '&' STR  */
-#line 195 "compiler.y"
+#line 225 "compiler.y"
               { (yyval.s_val) = "str"; }
-#line 1784 "y.tab.c"
+#line 1868 "y.tab.c"
     break;
 
   case 23: /* Type: BOOL  */
-#line 196 "compiler.y"
+#line 226 "compiler.y"
               { (yyval.s_val) = "bool"; }
-#line 1790 "y.tab.c"
+#line 1874 "y.tab.c"
     break;
 
   case 24: /* Type: '[' Type ';' INT_LIT ']'  */
-#line 197 "compiler.y"
-                               { printf("INT_LIT %d\n", (yyvsp[-1].i_val)); (yyval.s_val) = "array"; }
-#line 1796 "y.tab.c"
+#line 227 "compiler.y"
+                               { if (g_opt.verbose >= 2) printf("INT_LIT %d\n", (yyvsp[-1].i_val)); (yyval.s_val) = "array"; }
+#line 1880 "y.tab.c"
     break;
 
   case 25: /* VarDeclStmt: LET ID '=' Expression ';'  */
-#line 201 "compiler.y"
+#line 231 "compiler.y"
                                 {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-3].s_val), (yyvsp[-1].type), addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-3].s_val), (yyvsp[-1].type), addr, yylineno, "-");
 
         if (strcmp((yyvsp[-1].type), "i32") == 0) {
             CODEGEN("istore %d\n", addr);  // 把 stack top 儲存到 local addr
@@ -1810,14 +1894,14 @@ yyreduce:
         }
         free((yyvsp[-3].s_val));
     }
-#line 1814 "y.tab.c"
+#line 1898 "y.tab.c"
     break;
 
   case 26: /* VarDeclStmt: LET ID ':' Type '=' Expression ';'  */
-#line 214 "compiler.y"
+#line 244 "compiler.y"
                                          {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-5].s_val), (yyvsp[-3].s_val), addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-5].s_val), (yyvsp[-3].s_val), addr, yylineno, "-");
 
         if (strcmp((yyvsp[-3].s_val), "i32") == 0) {
             CODEGEN("istore %d\n", addr); 
@@ -1828,24 +1912,24 @@ yyreduce:
         }
         free((yyvsp[-5].s_val));
     }
-#line 1832 "y.tab.c"
+#line 1916 "y.tab.c"
     break;
 
   case 27: /* VarDeclStmt: LET ID ':' Type ';'  */
-#line 227 "compiler.y"
+#line 257 "compiler.y"
                           {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-3].s_val), (yyvsp[-1].s_val), addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-3].s_val), (yyvsp[-1].s_val), addr, yylineno, "-");
         free((yyvsp[-3].s_val));
     }
-#line 1842 "y.tab.c"
+#line 1926 "y.tab.c"
     break;
 
   case 28: /* VarDeclStmt: LET MUT ID ':' Type '=' Expression ';'  */
-#line 232 "compiler.y"
+#line 262 "compiler.y"
                                              {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-5].s_val), (yyvsp[-3].s_val), addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-5].s_val), (yyvsp[-3].s_val), addr, yylineno, "-");
 
         if (strcmp((yyvsp[-3].s_val), "i32") == 0) {
             CODEGEN("istore %d\n", addr);
@@ -1854,28 +1938,28 @@ yyreduce:
         } else if (strcmp((yyvsp[-3].s_val), "str") == 0) {
             CODEGEN("astore %d\n", addr);
         }
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free((yyvsp[-5].s_val));
     }
-#line 1861 "y.tab.c"
+#line 1945 "y.tab.c"
     break;
 
   case 29: /* VarDeclStmt: LET MUT ID ':' Type ';'  */
-#line 246 "compiler.y"
+#line 276 "compiler.y"
                               {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-3].s_val), (yyvsp[-1].s_val), addr, yylineno, "-");
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-3].s_val), (yyvsp[-1].s_val), addr, yylineno, "-");
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free((yyvsp[-3].s_val));
     }
-#line 1872 "y.tab.c"
+#line 1956 "y.tab.c"
     break;
 
   case 30: /* VarDeclStmt: LET MUT ID '=' Expression ';'  */
-#line 252 "compiler.y"
+#line 282 "compiler.y"
                                     {
-        int addr = next_addr();
-        insert_symbol((yyvsp[-3].s_val), (yyvsp[-1].type), addr, yylineno, "-");
+        int addr = next_addr(ps);
+        insert_symbol(ps, (yyvsp[-3].s_val), (yyvsp[-1].type), addr, yylineno, "-");
 
         if (strcmp((yyvsp[-1].type), "i32") == 0) {
             CODEGEN("istore %d\n", addr);
@@ -1884,23 +1968,23 @@ yyreduce:
         } else if (strcmp((yyvsp[-1].type), "str") == 0) {
             CODEGEN("astore %d\n", addr);
         }
-        scope_stack[scope_top].symbols[scope_stack[scope_top].count - 1].mut = 1;
+        ps->scopes[ps->scope_top].symbols[ps->scopes[ps->scope_top].count - 1].mut = 1;
         free((yyvsp[-3].s_val));
     }
-#line 1891 "y.tab.c"
+#line 1975 "y.tab.c"
     break;
 
   case 31: /* AssignmentStmt: ID '=' Expression ';'  */
-#line 269 "compiler.y"
+#line 299 "compiler.y"
                             {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0)
                     CODEGEN("istore %d\n", addr);
                 else if (strcmp(type, "f32") == 0)
@@ -1911,20 +1995,20 @@ yyreduce:
         }
         free((yyvsp[-3].s_val));
     }
-#line 1915 "y.tab.c"
+#line 1999 "y.tab.c"
     break;
 
   case 32: /* AssignmentStmt: ID ADD_ASSIGN Expression ';'  */
-#line 288 "compiler.y"
+#line 318 "compiler.y"
                                    {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);   // put x onto stack
                     CODEGEN("swap\n"); // x on the top
@@ -1938,25 +2022,25 @@ yyreduce:
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free((yyvsp[-3].s_val));
     }
-#line 1947 "y.tab.c"
+#line 2031 "y.tab.c"
     break;
 
   case 33: /* AssignmentStmt: ID SUB_ASSIGN Expression ';'  */
-#line 315 "compiler.y"
+#line 345 "compiler.y"
                                    {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -1970,25 +2054,25 @@ yyreduce:
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free((yyvsp[-3].s_val));
     }
-#line 1979 "y.tab.c"
+#line 2063 "y.tab.c"
     break;
 
   case 34: /* AssignmentStmt: ID MUL_ASSIGN Expression ';'  */
-#line 342 "compiler.y"
+#line 372 "compiler.y"
                                    {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -2002,25 +2086,25 @@ yyreduce:
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free((yyvsp[-3].s_val));
     }
-#line 2011 "y.tab.c"
+#line 2095 "y.tab.c"
     break;
 
   case 35: /* AssignmentStmt: ID DIV_ASSIGN Expression ';'  */
-#line 369 "compiler.y"
+#line 399 "compiler.y"
                                    {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -2034,25 +2118,25 @@ yyreduce:
                     CODEGEN("fstore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free((yyvsp[-3].s_val));
     }
-#line 2043 "y.tab.c"
+#line 2127 "y.tab.c"
     break;
 
   case 36: /* AssignmentStmt: ID REM_ASSIGN Expression ';'  */
-#line 396 "compiler.y"
+#line 426 "compiler.y"
                                    {
-        int addr = lookup_symbol((yyvsp[-3].s_val));
+        int addr = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (addr == -1) {
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[-3].s_val));
         } else {
-            if (!is_mutable((yyvsp[-3].s_val))) {
-                printf("error:%d: cannot borrow immutable borrowed content `%s` as mutable\n", yylineno, (yyvsp[-3].s_val));
+            if (!is_mutable(ps, (yyvsp[-3].s_val))) {
+                compile_error(ps, "cannot borrow immutable borrowed content `%s` as mutable\n", (yyvsp[-3].s_val));
             } else {
-                const char* type = get_symbol_type((yyvsp[-3].s_val));
+                const char* type = get_symbol_type(ps, (yyvsp[-3].s_val));
                 if (strcmp(type, "i32") == 0) {
                     CODEGEN("iload %d\n", addr);
                     CODEGEN("swap\n");
@@ -2060,26 +2144,26 @@ yyreduce:
                     CODEGEN("istore %d\n", addr);
                 }
                 else if (strcmp(type, "str") == 0)
-                    printf("error:%d: invalid operation: `+=` not supported for str\n", yylineno);
+                    compile_error(ps, "invalid operation: `+=` not supported for str\n");
             }
         }
         free((yyvsp[-3].s_val));
     }
-#line 2069 "y.tab.c"
+#line 2153 "y.tab.c"
     break;
 
   case 37: /* @2: %empty  */
-#line 420 "compiler.y"
+#line 450 "compiler.y"
                      {
         int id = (yyvsp[0].i_val);
         (yyval.i_val) = id;  // 為 midrule 指定型別
         CODEGEN("L_if_%d:\n", id);
     }
-#line 2079 "y.tab.c"
+#line 2163 "y.tab.c"
     break;
 
   case 38: /* IfStmt: IF RelExprJump @2 Block OptElse  */
-#line 424 "compiler.y"
+#line 454 "compiler.y"
                     {
         int id = (yyvsp[-2].i_val);  // 取得 midrule 的 id（原本是 $2，現在在 $3）
         if ((yyvsp[0].i_val) != -1)
@@ -2089,28 +2173,28 @@ yyreduce:
             ; 
         CODEGEN("L_end_%d:\n", id); 
     }
-#line 2093 "y.tab.c"
+#line 2177 "y.tab.c"
     break;
 
   case 39: /* OptElse: ELSE Block  */
-#line 436 "compiler.y"
+#line 466 "compiler.y"
                  { (yyval.i_val) = 1; }
-#line 2099 "y.tab.c"
+#line 2183 "y.tab.c"
     break;
 
   case 40: /* OptElse: %empty  */
-#line 437 "compiler.y"
+#line 467 "compiler.y"
                   { (yyval.i_val) = -1; }
-#line 2105 "y.tab.c"
+#line 2189 "y.tab.c"
     break;
 
   case 41: /* RelExprJump: AddExpr '>' AddExpr  */
-#line 441 "compiler.y"
+#line 471 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpgt L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2120,16 +2204,16 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2124 "y.tab.c"
+#line 2208 "y.tab.c"
     break;
 
   case 42: /* RelExprJump: AddExpr '<' AddExpr  */
-#line 455 "compiler.y"
+#line 485 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmplt L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2139,16 +2223,16 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2143 "y.tab.c"
+#line 2227 "y.tab.c"
     break;
 
   case 43: /* RelExprJump: AddExpr EQL AddExpr  */
-#line 469 "compiler.y"
+#line 499 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpeq L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2158,16 +2242,16 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2162 "y.tab.c"
+#line 2246 "y.tab.c"
     break;
 
   case 44: /* RelExprJump: AddExpr NEQ AddExpr  */
-#line 483 "compiler.y"
+#line 513 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpne L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2177,16 +2261,16 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2181 "y.tab.c"
+#line 2265 "y.tab.c"
     break;
 
   case 45: /* RelExprJump: AddExpr GEQ AddExpr  */
-#line 497 "compiler.y"
+#line 527 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `>=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `>=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpge L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2196,16 +2280,16 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2200 "y.tab.c"
+#line 2284 "y.tab.c"
     break;
 
   case 46: /* RelExprJump: AddExpr LEQ AddExpr  */
-#line 511 "compiler.y"
+#line 541 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `<=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `<=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmple L_if_%d\n", id);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2215,37 +2299,37 @@ yyreduce:
         // CODEGEN("goto L_else_%d\n", id);
         // CODEGEN("L_if_%d:\n", id);
     }
-#line 2219 "y.tab.c"
+#line 2303 "y.tab.c"
     break;
 
   case 47: /* @3: %empty  */
-#line 528 "compiler.y"
-                        {
-        int id = label_id++;
+#line 558 "compiler.y"
+            {
+        int id = ps->label_id++;
         (yyval.i_val) = id;
         CODEGEN("L_loop_%d:\n", id);
     }
-#line 2229 "y.tab.c"
+#line 2313 "y.tab.c"
     break;
 
-  case 48: /* WhileStmt: WHILE RelExprJump @3 RelExprForWhileJump Block  */
-#line 532 "compiler.y"
+  case 48: /* WhileStmt: WHILE @3 RelExprForWhileJump Block  */
+#line 562 "compiler.y"
                                 {
         int id = (yyvsp[-2].i_val);
         CODEGEN("goto L_loop_%d\n", id);
-        CODEGEN("L_end_%d:\n", id);
+        CODEGEN("L_end_%d:\n", (yyvsp[-1].i_val));   // 條件不成立時跳到這裡
     }
-#line 2239 "y.tab.c"
+#line 2323 "y.tab.c"
     break;
 
   case 49: /* RelExprForWhileJump: AddExpr '>' AddExpr  */
-#line 540 "compiler.y"
+#line 570 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmple L_end_%d\n", id);  // <= 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2253,17 +2337,17 @@ yyreduce:
             CODEGEN("ifle L_end_%d\n", id);       // <= 就跳出
         }
     }
-#line 2257 "y.tab.c"
+#line 2341 "y.tab.c"
     break;
 
   case 50: /* RelExprForWhileJump: AddExpr '<' AddExpr  */
-#line 553 "compiler.y"
+#line 583 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpge L_end_%d\n", id);  // >= 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2271,17 +2355,17 @@ yyreduce:
             CODEGEN("ifge L_end_%d\n", id);       // >= 就跳出
         }
     }
-#line 2275 "y.tab.c"
+#line 2359 "y.tab.c"
     break;
 
   case 51: /* RelExprForWhileJump: AddExpr EQL AddExpr  */
-#line 566 "compiler.y"
+#line 596 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpne L_end_%d\n", id);  // != 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2289,17 +2373,17 @@ yyreduce:
             CODEGEN("ifne L_end_%d\n", id);       // != 就跳出
         }
     }
-#line 2293 "y.tab.c"
+#line 2377 "y.tab.c"
     break;
 
   case 52: /* RelExprForWhileJump: AddExpr NEQ AddExpr  */
-#line 579 "compiler.y"
+#line 609 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpeq L_end_%d\n", id);  // == 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2307,17 +2391,17 @@ yyreduce:
             CODEGEN("ifeq L_end_%d\n", id);       // == 就跳出
         }
     }
-#line 2311 "y.tab.c"
+#line 2395 "y.tab.c"
     break;
 
   case 53: /* RelExprForWhileJump: AddExpr GEQ AddExpr  */
-#line 592 "compiler.y"
+#line 622 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `>=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `>=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmplt L_end_%d\n", id);  // < 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2325,17 +2409,17 @@ yyreduce:
             CODEGEN("iflt L_end_%d\n", id);       // < 就跳出
         }
     }
-#line 2329 "y.tab.c"
+#line 2413 "y.tab.c"
     break;
 
   case 54: /* RelExprForWhileJump: AddExpr LEQ AddExpr  */
-#line 605 "compiler.y"
+#line 635 "compiler.y"
                           {
-        int id = label_id++;
+        int id = ps->label_id++;
         (yyval.i_val) = id;
 
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `<=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `<=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpgt L_end_%d\n", id);  // > 就跳出
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2343,11 +2427,11 @@ yyreduce:
             CODEGEN("ifgt L_end_%d\n", id);       // > 就跳出
         }
     }
-#line 2347 "y.tab.c"
+#line 2431 "y.tab.c"
     break;
 
   case 55: /* PrintStmt: PRINT Expression ';'  */
-#line 621 "compiler.y"
+#line 651 "compiler.y"
                            {
         if (strcmp((yyvsp[-1].type), "i32") == 0) {
             CODEGEN("invokestatic java/lang/String/valueOf(I)Ljava/lang/String;\n");
@@ -2360,7 +2444,7 @@ yyreduce:
             CODEGEN("swap\n");
             CODEGEN("invokevirtual java/io/PrintStream/print(Ljava/lang/String;)V\n");
         } else if (strcmp((yyvsp[-1].type), "bool") == 0) {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             // Stack top: boolean (int)
             CODEGEN("ifeq L_false_%d\n", curr);       // if 0 → false
             CODEGEN("ldc \"true\"\n");                // if != 0 → push "true"
@@ -2380,11 +2464,11 @@ yyreduce:
 
         (yyval.type) = "void";
     }
-#line 2384 "y.tab.c"
+#line 2468 "y.tab.c"
     break;
 
   case 56: /* PrintlnStmt: PRINTLN Expression ';'  */
-#line 656 "compiler.y"
+#line 686 "compiler.y"
                              {
         if (strcmp((yyvsp[-1].type), "i32") == 0) {
             CODEGEN("invokestatic java/lang/String/valueOf(I)Ljava/lang/String;\n");
@@ -2397,7 +2481,7 @@ yyreduce:
             CODEGEN("swap\n");
             CODEGEN("invokevirtual java/io/PrintStream/println(Ljava/lang/String;)V\n");
         } else if (strcmp((yyvsp[-1].type), "bool") == 0) {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             // Stack top: boolean (int)
             CODEGEN("ifeq L_false_%d\n", curr);       // if 0 → false
             CODEGEN("ldc \"true\"\n");                // if != 0 → push "true"
@@ -2417,39 +2501,39 @@ yyreduce:
 
         (yyval.type) = "void";
     }
-#line 2421 "y.tab.c"
+#line 2505 "y.tab.c"
     break;
 
   case 57: /* $@4: %empty  */
-#line 691 "compiler.y"
+#line 721 "compiler.y"
           {
-        create_symbol();    // 進入新scope時建立table
+        create_symbol(ps);    // 進入新scope時建立table
     }
-#line 2429 "y.tab.c"
+#line 2513 "y.tab.c"
     break;
 
   case 58: /* Block: '{' $@4 StatementList '}'  */
-#line 693 "compiler.y"
+#line 723 "compiler.y"
                         {
-        dump_symbol();      // 離開時丟出table
+        dump_symbol(ps);      // 離開時丟出table
     }
-#line 2437 "y.tab.c"
+#line 2521 "y.tab.c"
     break;
 
   case 59: /* ExpressionList: Expression  */
-#line 699 "compiler.y"
+#line 729 "compiler.y"
                  { (yyval.type) = (yyvsp[0].type); }
-#line 2443 "y.tab.c"
+#line 2527 "y.tab.c"
     break;
 
   case 60: /* ExpressionList: ExpressionList ',' Expression  */
-#line 700 "compiler.y"
+#line 730 "compiler.y"
                                     { (yyval.type) = (yyvsp[-2].type); }
-#line 2449 "y.tab.c"
+#line 2533 "y.tab.c"
     break;
 
   case 61: /* ExpressionStmt: Expression ';'  */
-#line 704 "compiler.y"
+#line 734 "compiler.y"
                      {
         if (strcmp((yyvsp[-1].type), "bool") == 0) {
             // DO NOTHING!
@@ -2458,51 +2542,51 @@ yyreduce:
             CODEGEN("pop\n"); // 清除堆疊上的值
         }
     }
-#line 2462 "y.tab.c"
+#line 2546 "y.tab.c"
     break;
 
   case 62: /* Expression: OrExpr  */
-#line 716 "compiler.y"
+#line 746 "compiler.y"
              { (yyval.type) = (yyvsp[0].type); }
-#line 2468 "y.tab.c"
+#line 2552 "y.tab.c"
     break;
 
   case 63: /* OrExpr: OrExpr LOR AndExpr  */
-#line 720 "compiler.y"
+#line 750 "compiler.y"
                          { 
         CODEGEN("ior\n"); 
         (yyval.type) = "bool"; 
     }
-#line 2477 "y.tab.c"
+#line 2561 "y.tab.c"
     break;
 
   case 64: /* OrExpr: AndExpr  */
-#line 724 "compiler.y"
+#line 754 "compiler.y"
               { (yyval.type) = (yyvsp[0].type); }
-#line 2483 "y.tab.c"
+#line 2567 "y.tab.c"
     break;
 
   case 65: /* AndExpr: AndExpr LAND RelExpr  */
-#line 728 "compiler.y"
+#line 758 "compiler.y"
                            { 
         CODEGEN("iand\n"); 
         (yyval.type) = "bool"; 
     }
-#line 2492 "y.tab.c"
+#line 2576 "y.tab.c"
     break;
 
   case 66: /* AndExpr: RelExpr  */
-#line 732 "compiler.y"
+#line 762 "compiler.y"
               { (yyval.type) = (yyvsp[0].type); }
-#line 2498 "y.tab.c"
+#line 2582 "y.tab.c"
     break;
 
   case 67: /* RelExpr: AddExpr '>' AddExpr  */
-#line 736 "compiler.y"
+#line 766 "compiler.y"
                           {
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `>`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `>`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpgt L_true_%d\n", curr);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2516,15 +2600,15 @@ yyreduce:
         CODEGEN("L_end_%d:\n", curr);
         (yyval.type) = "bool";
     }
-#line 2520 "y.tab.c"
+#line 2604 "y.tab.c"
     break;
 
   case 68: /* RelExpr: AddExpr '<' AddExpr  */
-#line 753 "compiler.y"
+#line 783 "compiler.y"
                           { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `<`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `<`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmplt L_true_%d\n", curr);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2538,15 +2622,15 @@ yyreduce:
         CODEGEN("L_end_%d:\n", curr);
         (yyval.type) = "bool";
     }
-#line 2542 "y.tab.c"
+#line 2626 "y.tab.c"
     break;
 
   case 69: /* RelExpr: AddExpr EQL AddExpr  */
-#line 770 "compiler.y"
+#line 800 "compiler.y"
                           { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `==`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `==`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpeq L_true_%d\n", curr);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2560,15 +2644,15 @@ yyreduce:
         CODEGEN("L_end_%d:\n", curr);
         (yyval.type) = "bool";
     }
-#line 2564 "y.tab.c"
+#line 2648 "y.tab.c"
     break;
 
   case 70: /* RelExpr: AddExpr NEQ AddExpr  */
-#line 787 "compiler.y"
+#line 817 "compiler.y"
                           { 
-        int curr = label_id++;
+        int curr = ps->label_id++;
         if (strcmp((yyvsp[-2].type), (yyvsp[0].type)) != 0) {
-            printf("error:%d: mismatched types in `!=`: %s and %s\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "mismatched types in `!=`: %s and %s\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else if (strcmp((yyvsp[-2].type), "i32") == 0) {
             CODEGEN("if_icmpne L_true_%d\n", curr);
         } else if (strcmp((yyvsp[-2].type), "f32") == 0) {
@@ -2582,114 +2666,114 @@ yyreduce:
         CODEGEN("L_end_%d:\n", curr);
         (yyval.type) = "bool";
     }
-#line 2586 "y.tab.c"
+#line 2670 "y.tab.c"
     break;
 
   case 71: /* RelExpr: AddExpr LSHIFT AddExpr  */
-#line 804 "compiler.y"
+#line 834 "compiler.y"
                              {
         if (!(strcmp((yyvsp[-2].type), "i32") == 0 && strcmp((yyvsp[0].type), "i32") == 0)) {
-            printf("error:%d: invalid operation: LSHIFT (mismatched types %s and %s)\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "invalid operation: LSHIFT (mismatched types %s and %s)\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else {
             CODEGEN("ishl\n");
         }
         (yyval.type) = "i32";
     }
-#line 2599 "y.tab.c"
+#line 2683 "y.tab.c"
     break;
 
   case 72: /* RelExpr: AddExpr RSHIFT AddExpr  */
-#line 812 "compiler.y"
+#line 842 "compiler.y"
                              { 
         if (!(strcmp((yyvsp[-2].type), "i32") == 0 && strcmp((yyvsp[0].type), "i32") == 0)) {
-            printf("error:%d: invalid operation: RSHIFT (mismatched types %s and %s)\n", yylineno, (yyvsp[-2].type), (yyvsp[0].type));
+            compile_error(ps, "invalid operation: RSHIFT (mismatched types %s and %s)\n", (yyvsp[-2].type), (yyvsp[0].type));
         } else {
             CODEGEN("iushr\n");
         }
         (yyval.type) = "i32";
     }
-#line 2612 "y.tab.c"
+#line 2696 "y.tab.c"
     break;
 
   case 73: /* RelExpr: AddExpr  */
-#line 820 "compiler.y"
+#line 850 "compiler.y"
               { (yyval.type) = (yyvsp[0].type); }
-#line 2618 "y.tab.c"
+#line 2702 "y.tab.c"
     break;
 
   case 74: /* AddExpr: AddExpr '+' MulExpr  */
-#line 824 "compiler.y"
+#line 854 "compiler.y"
                           { 
         if (strcmp((yyvsp[-2].type), "i32") == 0) CODEGEN("iadd\n");
         else if (strcmp((yyvsp[-2].type), "f32") == 0) CODEGEN("fadd\n");
         (yyval.type) = (yyvsp[-2].type);
     }
-#line 2628 "y.tab.c"
+#line 2712 "y.tab.c"
     break;
 
   case 75: /* AddExpr: AddExpr '-' MulExpr  */
-#line 829 "compiler.y"
+#line 859 "compiler.y"
                           { 
         if (strcmp((yyvsp[-2].type), "i32") == 0) CODEGEN("isub\n");
         else if (strcmp((yyvsp[-2].type), "f32") == 0) CODEGEN("fsub\n");
         (yyval.type) = (yyvsp[-2].type);
     }
-#line 2638 "y.tab.c"
+#line 2722 "y.tab.c"
     break;
 
   case 76: /* AddExpr: MulExpr  */
-#line 834 "compiler.y"
+#line 864 "compiler.y"
               { (yyval.type) = (yyvsp[0].type); }
-#line 2644 "y.tab.c"
+#line 2728 "y.tab.c"
     break;
 
   case 77: /* MulExpr: MulExpr '*' UnaryExpr  */
-#line 838 "compiler.y"
+#line 868 "compiler.y"
                             { 
         if (strcmp((yyvsp[-2].type), "i32") == 0) CODEGEN("imul\n");
         else if (strcmp((yyvsp[-2].type), "f32") == 0) CODEGEN("fmul\n");
         (yyval.type) = (yyvsp[-2].type);
     }
-#line 2654 "y.tab.c"
+#line 2738 "y.tab.c"
     break;
 
   case 78: /* MulExpr: MulExpr '/' UnaryExpr  */
-#line 843 "compiler.y"
+#line 873 "compiler.y"
                             { 
         if (strcmp((yyvsp[-2].type), "i32") == 0) CODEGEN("idiv\n");
         else if (strcmp((yyvsp[-2].type), "f32") == 0) CODEGEN("fdiv\n");
         (yyval.type) = (yyvsp[-2].type);
     }
-#line 2664 "y.tab.c"
+#line 2748 "y.tab.c"
     break;
 
   case 79: /* MulExpr: MulExpr '%' UnaryExpr  */
-#line 848 "compiler.y"
+#line 878 "compiler.y"
                             { 
         if (strcmp((yyvsp[-2].type), "i32") == 0) CODEGEN("irem\n");
         (yyval.type) = (yyvsp[-2].type); 
     }
-#line 2673 "y.tab.c"
+#line 2757 "y.tab.c"
     break;
 
   case 81: /* AsExpr: UnaryExpr AS Type  */
-#line 856 "compiler.y"
+#line 886 "compiler.y"
                         {
         if (strcmp((yyvsp[-2].type), "f32") == 0 && strcmp((yyvsp[0].s_val), "i32") == 0) CODEGEN("f2i\n");
         else if (strcmp((yyvsp[-2].type), "i32") == 0 && strcmp((yyvsp[0].s_val), "f32") == 0) CODEGEN("i2f\n");
         (yyval.type) = (yyvsp[0].s_val);
     }
-#line 2683 "y.tab.c"
+#line 2767 "y.tab.c"
     break;
 
   case 82: /* AsExpr: UnaryExpr  */
-#line 861 "compiler.y"
+#line 891 "compiler.y"
                 { (yyval.type) = (yyvsp[0].type); }
-#line 2689 "y.tab.c"
+#line 2773 "y.tab.c"
     break;
 
   case 83: /* UnaryExpr: '-' UnaryExpr  */
-#line 865 "compiler.y"
+#line 895 "compiler.y"
                     {
         if (strcmp((yyvsp[0].type), "i32") == 0)
             CODEGEN("ineg\n");
@@ -2697,17 +2781,17 @@ yyreduce:
             CODEGEN("fneg\n");
         (yyval.type) = (yyvsp[0].type);
     }
-#line 2701 "y.tab.c"
+#line 2785 "y.tab.c"
     break;
 
   case 84: /* UnaryExpr: '!' UnaryExpr  */
-#line 872 "compiler.y"
+#line 902 "compiler.y"
                     {
         if (strcmp((yyvsp[0].type), "bool") != 0) {
-            printf("error:%d: unary `!` can only be applied to bool, got %s\n", yylineno, (yyvsp[0].type));
+            compile_error(ps, "unary `!` can only be applied to bool, got %s\n", (yyvsp[0].type));
             (yyval.type) = strdup("bool");  // 為防止錯誤後續 propagation，可回傳預設型別
         } else {
-            int curr = label_id++;
+            int curr = ps->label_id++;
             CODEGEN("ifeq L_true_%d\n", curr);
             CODEGEN("iconst_0\n");
             CODEGEN("goto L_end_%d\n", curr);
@@ -2717,53 +2801,52 @@ yyreduce:
             (yyval.type) = strdup("bool");
         }
     }
-#line 2721 "y.tab.c"
+#line 2805 "y.tab.c"
     break;
 
   case 86: /* Primary: '"' STRING_LIT '"'  */
-#line 891 "compiler.y"
+#line 921 "compiler.y"
                          { CODEGEN("ldc \"%s\"\n", (yyvsp[-1].s_val)); (yyval.type) = "str"; free((yyvsp[-1].s_val)); }
-#line 2727 "y.tab.c"
+#line 2811 "y.tab.c"
     break;
 
   case 87: /* Primary: '"' '"'  */
-#line 892 "compiler.y"
+#line 922 "compiler.y"
               { CODEGEN("ldc \"\"\n"); (yyval.type) = "str"; }
-#line 2733 "y.tab.c"
+#line 2817 "y.tab.c"
     break;
 
   case 88: /* Primary: INT_LIT  */
-#line 893 "compiler.y"
+#line 923 "compiler.y"
                  { CODEGEN("ldc %d\n", (yyvsp[0].i_val)); (yyval.type) = "i32"; }
-#line 2739 "y.tab.c"
+#line 2823 "y.tab.c"
     break;
 
   case 89: /* Primary: FLOAT_LIT  */
-#line 894 "compiler.y"
+#line 924 "compiler.y"
                  { CODEGEN("ldc %f\n", (yyvsp[0].f_val)); (yyval.type) = "f32"; }
-#line 2745 "y.tab.c"
+#line 2829 "y.tab.c"
     break;
 
   case 90: /* Primary: TRUE  */
-#line 895 "compiler.y"
+#line 925 "compiler.y"
             { CODEGEN("iconst_1\n"); (yyval.type) = "bool"; }
-#line 2751 "y.tab.c"
+#line 2835 "y.tab.c"
     break;
 
   case 91: /* Primary: FALSE  */
-#line 896 "compiler.y"
+#line 926 "compiler.y"
             { CODEGEN("iconst_0\n"); (yyval.type) = "bool"; }
-#line 2757 "y.tab.c"
+#line 2841 "y.tab.c"
     break;
 
   case 92: /* Primary: ID  */
-#line 897 "compiler.y"
+#line 927 "compiler.y"
          {
-        int ref = lookup_symbol((yyvsp[0].s_val));
-        const char* type = get_symbol_type((yyvsp[0].s_val));
+        int ref = lookup_symbol(ps, (yyvsp[0].s_val));
+        const char* type = get_symbol_type(ps, (yyvsp[0].s_val));
         if (ref == -1) {
-            HAS_ERROR = true;
-            printf("error:%d: undefined: %s\n", yylineno, (yyvsp[0].s_val));
+            compile_error(ps, "undefined: %s\n", (yyvsp[0].s_val));
             (yyval.type) = strdup("undefined");
         } else {
             if (strcmp(type, "i32") == 0)
@@ -2776,36 +2859,35 @@ yyreduce:
         }
         free((yyvsp[0].s_val));
     }
-#line 2780 "y.tab.c"
+#line 2863 "y.tab.c"
     break;
 
   case 93: /* Primary: ArrayIndexExpr  */
-#line 915 "compiler.y"
+#line 944 "compiler.y"
                      { (yyval.type) = (yyvsp[0].type); }
-#line 2786 "y.tab.c"
+#line 2869 "y.tab.c"
     break;
 
   case 94: /* Primary: '[' ExpressionList ']'  */
-#line 916 "compiler.y"
+#line 945 "compiler.y"
                              {
         (yyval.type) = "array";
     }
-#line 2794 "y.tab.c"
+#line 2877 "y.tab.c"
     break;
 
   case 95: /* Primary: '(' Expression ')'  */
-#line 919 "compiler.y"
+#line 948 "compiler.y"
                          { (yyval.type) = (yyvsp[-1].type); }
-#line 2800 "y.tab.c"
+#line 2883 "y.tab.c"
     break;
 
   case 96: /* ArrayIndexExpr: ID '[' INT_LIT ']'  */
-#line 923 "compiler.y"
+#line 952 "compiler.y"
                          {
-        int ref = lookup_symbol((yyvsp[-3].s_val));
+        int ref = lookup_symbol(ps, (yyvsp[-3].s_val));
         if (ref == -1) {
-            HAS_ERROR = true;
-            printf("error:%d: undefined variable %s\n", yylineno, (yyvsp[-3].s_val));
+            compile_error(ps, "undefined variable %s\n", (yyvsp[-3].s_val));
         } else {
             // printf("IDENT (name=%s, address=%d)\n", $1, ref);
             // printf("INT_LIT %d\n", $3);
@@ -2813,11 +2895,11 @@ yyreduce:
         (yyval.type) = strdup("array");
         free((yyvsp[-3].s_val));
     }
-#line 2817 "y.tab.c"
+#line 2899 "y.tab.c"
     break;
 
 
-#line 2821 "y.tab.c"
+#line 2903 "y.tab.c"
 
       default: break;
     }
@@ -2891,7 +2973,7 @@ yyerrlab:
                 yysyntax_error_status = YYENOMEM;
               }
           }
-        yyerror (yymsgp);
+        yyerror (ps, yymsgp);
         if (yysyntax_error_status == YYENOMEM)
           YYNOMEM;
       }
@@ -2911,7 +2993,7 @@ yyerrlab:
       else
         {
           yydestruct ("Error: discarding",
-                      yytoken, &yylval);
+                      yytoken, &yylval, ps);
           yychar = YYEMPTY;
         }
     }
@@ -2967,7 +3049,7 @@ yyerrlab1:
 
 
       yydestruct ("Error: popping",
-                  YY_ACCESSING_SYMBOL (yystate), yyvsp);
+                  YY_ACCESSING_SYMBOL (yystate), yyvsp, ps);
       YYPOPSTACK (1);
       yystate = *yyssp;
       YY_STACK_PRINT (yyss, yyssp);
@@ -3005,7 +3087,7 @@ yyabortlab:
 | yyexhaustedlab -- YYNOMEM (memory exhaustion) comes here.  |
 `-----------------------------------------------------------*/
 yyexhaustedlab:
-  yyerror (YY_("memory exhausted"));
+  yyerror (ps, YY_("memory exhausted"));
   yyresult = 2;
   goto yyreturnlab;
 
@@ -3020,7 +3102,7 @@ yyreturnlab:
          user semantic actions for why this is necessary.  */
       yytoken = YYTRANSLATE (yychar);
       yydestruct ("Cleanup: discarding lookahead",
-                  yytoken, &yylval);
+                  yytoken, &yylval, ps);
     }
   /* Do not reclaim the symbols of the rule whose action triggered
      this YYABORT or YYACCEPT.  */
@@ -3029,7 +3111,7 @@ yyreturnlab:
   while (yyssp != yyss)
     {
       yydestruct ("Cleanup: popping",
-                  YY_ACCESSING_SYMBOL (+*yyssp), yyvsp);
+                  YY_ACCESSING_SYMBOL (+*yyssp), yyvsp, ps);
       YYPOPSTACK (1);
     }
 #ifndef yyoverflow
@@ -3041,64 +3123,351 @@ yyreturnlab:
   return yyresult;
 }
 
-#line 937 "compiler.y"
+#line 965 "compiler.y"
 
 
 /* C code section */
-int main(int argc, char *argv[])
-{
-    if (argc == 2) {
-        yyin = fopen(argv[1], "r");
-    } else {
-        yyin = stdin;
-    }
-    if (!yyin) {
-        printf("file `%s` doesn't exists or cannot be opened\n", argv[1]);
-        exit(1);
-    }
+
+/* Per-file codegen state back to how a fresh process starts; the parser
+ * starts each file from a new ParseState */
+static void reset_state() {
+    g_indent_cnt = 0;
+    g_has_error = false;
+    codegen_reset();
+    vm_unload();
+}
+
+/* Compiles yyin to out_path as class class_name; false on any error,
+ * though only codegen errors remove the output, as they always have */
+static bool compile_file(const char *out_path, const char *class_name) {
+    reset_state();
+    lex_reset(yyin);
 
     /* Codegen output init */
-    char *bytecode_filename = "hw3.j";
-    fout = fopen(bytecode_filename, "w");
-    CODEGEN(".source hw3.j\n");
-    CODEGEN(".class public Main\n");
+    fout = fopen(out_path, "w");
+    if (!fout) {
+        printf("file `%s` cannot be opened for writing\n", out_path);
+        return false;
+    }
+    if (g_opt.emit == EMIT_C) c_write_prelude(fout);
+    CODEGEN(".source %s\n", strrchr(out_path, '/') ? strrchr(out_path, '/') + 1 : out_path);
+    CODEGEN(".class public %s\n", class_name);
     CODEGEN(".super java/lang/Object\n");
 
     /* Symbol table init */
     // Add your code
-    init_symbol();
+    ParseState ps;
+    init_symbol(&ps);
 
     yylineno = 0;
-    yyparse();
+    phase_begin("parse");
+    bool parsed = yyparse(&ps) == 0;
+    phase_end();
+    codegen_finish();
 
     /* Symbol table dump */
     // Add your code
-    dump_symbol();
+    phase_begin("output");
+    /* an empty or all-comment input never opens a scope */
+    if (ps.scope_top >= 0) dump_symbol(&ps);
 
-	printf("Total lines: %d\n", yylineno);
+    if (g_opt.verbose >= 1) printf("Total lines: %d\n", yylineno);
     fclose(fout);
-    fclose(yyin);
+    phase_end();
 
     if (g_has_error) {
-        remove(bytecode_filename);
+        remove(out_path);
+    } else if (g_opt.run) {
+        fflush(stdout);
+        phase_begin("run");
+        vm_run();
+        phase_end();
+    }
+    free_symbols(&ps);
+    return parsed && !ps.has_error && !g_has_error;
+}
+
+/* ------------------------------------------------------------------ */
+/* --cache                                                             */
+/* ------------------------------------------------------------------ */
+
+/* Makefile passes a checksum of the sources */
+#ifndef COMPILER_VERSION
+#define COMPILER_VERSION __DATE__ " " __TIME__
+#endif
+
+/* The compiler and the options that shape its output, the start of every
+ * key; NULL when the cache is off */
+static char *cache_context;
+static size_t cache_context_len;
+
+/* stdout of the compile in progress; written out as well if --run ends
+ * the process early */
+static FILE *capture;
+static int capture_saved = -1;
+
+static char *read_stream(FILE *f, size_t *len) {
+    size_t cap = 4096, n = 0, k;
+    char *s = malloc(cap);
+    while ((k = fread(s + n, 1, cap - n, f)) > 0) {
+        n += k;
+        if (n == cap) s = realloc(s, cap *= 2);
+    }
+    *len = n;
+    return s;
+}
+
+/* Puts stdout back and returns what was written to it meanwhile */
+static char *capture_end(size_t *len) {
+    fflush(stdout);
+    dup2(capture_saved, 1);
+    close(capture_saved);
+    rewind(capture);
+    char *s = read_stream(capture, len);
+    fclose(capture);
+    capture = NULL;
+    fwrite(s, 1, *len, stdout);
+    return s;
+}
+
+static void capture_exit(void) {
+    size_t len;
+    if (capture) free(capture_end(&len));
+}
+
+static bool capture_begin(void) {
+    static bool registered;
+    fflush(stdout);
+    if (!(capture = tmpfile())) return false;
+    /* at the first capture, so that this runs before pool.c's handler */
+    if (!registered) atexit(capture_exit);
+    registered = true;
+    capture_saved = dup(1);
+    dup2(fileno(capture), 1);
+    return true;
+}
+
+/* compile_file through the --cache store: a source compiled before with
+ * the same compiler, options and output name gets its output file and
+ * messages back from there */
+static bool compile_cached(const char *out_path, const char *class_name) {
+    if (!cache_context) return compile_file(out_path, class_name);
+    size_t src_len;
+    char *src = read_stream(yyin, &src_len);
+    const char *base = strrchr(out_path, '/') ? strrchr(out_path, '/') + 1 : out_path;
+    size_t class_len = strlen(class_name) + 1, base_len = strlen(base) + 1;
+    size_t key_len = cache_context_len + class_len + base_len + src_len;
+    char *key = malloc(key_len);
+    memcpy(key, cache_context, cache_context_len);
+    memcpy(key + cache_context_len, class_name, class_len);
+    memcpy(key + cache_context_len + class_len, base, base_len);
+    memcpy(key + cache_context_len + class_len + base_len, src, src_len);
+
+    /* "<ok><has output file>", the output file, stdout */
+    char *parts[3];
+    size_t lens[3];
+    bool ok;
+    if (cache_get(key, key_len, 3, parts, lens)) {
+        ok = parts[0][0] == '1';
+        FILE *f = parts[0][1] == '1' ? fopen(out_path, "wb") : NULL;
+        if (f) {
+            fwrite(parts[1], 1, lens[1], f);
+            fclose(f);
+        } else {
+            remove(out_path);
+        }
+        fwrite(parts[2], 1, lens[2], stdout);
+        for (int k = 0; k < 3; k++) free(parts[k]);
+    } else {
+        FILE *in = yyin;
+        if (src_len > 0) yyin = fmemopen(src, src_len, "r");
+        bool captured = capture_begin();
+        ok = compile_file(out_path, class_name);
+        size_t log_len = 0, out_len = 0;
+        char *log = captured ? capture_end(&log_len) : NULL;
+        if (yyin != in) fclose(yyin);
+        yyin = in;
+        FILE *f = fopen(out_path, "rb");
+        char *out = f ? read_stream(f, &out_len) : NULL;
+        if (f) fclose(f);
+        char flags[3] = { ok ? '1' : '0', out ? '1' : '0', '\0' };
+        const char *ps[3] = { flags, out ? out : "", log ? log : "" };
+        size_t ls[3] = { 2, out_len, log_len };
+        if (captured) cache_put(key, key_len, 3, ps, ls);
+        free(out);
+        free(log);
+    }
+    free(key);
+    free(src);
+    return ok;
+}
+
+/* A Java class name from the file name: no directory or extension, and
+ * anything but letters, digits, _ and $ replaced by _ */
+static void class_name_of(const char *path, char *name, size_t size) {
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t n = strcspn(base, ".");
+    if (n == 0) n = strlen(base);
+    size_t k = 0;
+    if (isdigit((unsigned char)base[0]) && k + 1 < size) name[k++] = '_';
+    for (size_t i = 0; i < n && k + 1 < size; i++) {
+        unsigned char c = base[i];
+        name[k++] = isalnum(c) || c == '_' || c == '$' ? c : '_';
+    }
+    name[k] = '\0';
+}
+
+static const char *output_extension() {
+    return g_opt.emit == EMIT_X86 ? "s" : g_opt.emit == EMIT_C ? "c" : "j";
+}
+
+typedef struct {
+    const char **inputs;
+    char (*names)[256];
+    const char *outdir;
+} Batch;
+
+/* One batch file to <outdir>/<class>.<ext> */
+static bool compile_input(int i, void *ctx) {
+    Batch *b = ctx;
+    yyin = fopen(b->inputs[i], "r");
+    if (!yyin) {
+        printf("file `%s` doesn't exists or cannot be opened\n", b->inputs[i]);
+        return false;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.%s", b->outdir, b->names[i], output_extension());
+    if (g_opt.verbose >= 1) printf("> Compile `%s` to `%s`\n", b->inputs[i], path);
+    bool ok = compile_cached(path, b->names[i]);
+    fclose(yyin);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char **inputs = calloc(argc, sizeof(char *));
+    int ninputs = 0;
+    const char *outdir = NULL;
+    char flags[4096] = "";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outdir = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            g_opt.jobs = atoi(argv[++i]);
+            if (g_opt.jobs <= 0) g_opt.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            continue;
+        }
+        if (opt_parse_flag(argv[i])) {
+            /* these do not change what comes out */
+            if (strncmp(argv[i], "--cache", 7) != 0 && strncmp(argv[i], "--threads=", 10) != 0)
+                snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), " %s", argv[i]);
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            printf("unknown option `%s`\n", argv[i]);
+            exit(1);
+        }
+        inputs[ninputs++] = argv[i];
+    }
+    /* these collect over the whole run in this process only */
+    if (g_opt.jobs > 1 && (g_opt.trace_file || g_opt.symtab_format != SYMTAB_OFF ||
+                           g_opt.time_report != REPORT_OFF || g_opt.pass_stats)) {
+        printf("-j cannot be combined with --trace, --symtab, --time-report or --pass-stats\n");
+        exit(1);
+    }
+    if (g_opt.threads > 1 && (g_opt.trace_file || g_opt.time_report != REPORT_OFF || g_opt.pass_stats ||
+                              g_opt.dump_ir)) {
+        printf("--threads cannot be combined with --trace, --time-report, --pass-stats or --dump-ir\n");
+        exit(1);
+    }
+    if (g_opt.trace_file && !trace_open(g_opt.trace_file)) {
+        printf("file `%s` cannot be opened for the trace\n", g_opt.trace_file);
+        exit(1);
+    }
+    if (!symtab_open()) {
+        printf("file `%s` cannot be opened for the symbol table\n", g_opt.symtab_file);
+        exit(1);
+    }
+    /* a hit skips the compile, and with it these reports */
+    if (g_opt.cache_dir && !g_opt.trace_file && g_opt.symtab_format == SYMTAB_OFF &&
+        g_opt.time_report == REPORT_OFF && !g_opt.pass_stats && !g_opt.dump_ir &&
+        cache_open(g_opt.cache_dir, g_opt.cache_max)) {
+        cache_context_len = strlen("mycompiler " COMPILER_VERSION) + strlen(flags) + 1;
+        cache_context = malloc(cache_context_len + 1);
+        snprintf(cache_context, cache_context_len + 1, "mycompiler " COMPILER_VERSION "%s\n", flags);
+        codegen_cache(cache_context, cache_context_len);
+    }
+
+    int failed = 0;
+    if (!outdir && ninputs <= 1) {
+        /* one file (or stdin) to hw3.j as class Main */
+        yyin = ninputs ? fopen(inputs[0], "r") : stdin;
+        if (!yyin) {
+            printf("file `%s` doesn't exists or cannot be opened\n", inputs[0]);
+            exit(1);
+        }
+        char path[16];
+        snprintf(path, sizeof(path), "hw3.%s", output_extension());
+        compile_cached(path, "Main");
+        fclose(yyin);
+    } else {
+        /* batch: every file to <outdir>/<class>.<ext> */
+        Batch b = { inputs, calloc(ninputs, sizeof(*b.names)), outdir ? outdir : "." };
+        mkdir(b.outdir, 0777);
+        for (int i = 0; i < ninputs; i++) {
+            class_name_of(inputs[i], b.names[i], sizeof(b.names[i]));
+            for (int j = 0; j < i; j++) {
+                if (strcmp(b.names[i], b.names[j]) == 0) {
+                    printf("error: `%s` and `%s` both compile to class %s\n", inputs[j], inputs[i], b.names[i]);
+                    exit(1);
+                }
+            }
+        }
+        if (g_opt.jobs > 1) {
+            failed = pool_run(ninputs, g_opt.jobs, compile_input, &b);
+        } else {
+            for (int i = 0; i < ninputs; i++) {
+                if (!compile_input(i, &b)) failed++;
+            }
+        }
+        free(b.names);
     }
+
+    if (g_opt.pass_stats) opt_print_stats(stderr);
+    time_report_print(stderr);
+    trace_close();
+    symtab_close();
     yylex_destroy();
-    return 0;
+    free(cache_context);
+    free(inputs);
+    /* the single-file mode reports errors on stdout only, as it always has */
+    return outdir || ninputs > 1 ? failed > 0 : 0;
 }
 
-static void create_symbol() {
-    scope_top++;
-    scope_stack[scope_top].count = 0;
-    scope_stack[scope_top].level = scope_top;
-    printf("> Create symbol table (scope level %d)\n", scope_top);
+static void create_symbol(ParseState *ps) {
+    ps->scope_top++;
+    ps->scopes[ps->scope_top].count = 0;
+    ps->scopes[ps->scope_top].level = ps->scope_top;
+    if (g_opt.verbose >= 2) printf("> Create symbol table (scope level %d)\n", ps->scope_top);
 }
 
-static void init_symbol() {
-    scope_top = -1;
+static void init_symbol(ParseState *ps) {
+    memset(ps, 0, sizeof(*ps));
+    ps->scope_top = -1;
 }
 
-static int insert_symbol(const char *name, const char *type, int addr, int lineno, const char *sig) {
-    Scope *current = &scope_stack[scope_top];
+static void free_symbols(ParseState *ps) {
+    for (int i = 0; i < MAX_SCOPE; i++) free(ps->scopes[i].symbols);
+}
+
+static int insert_symbol(ParseState *ps, const char *name, const char *type, int addr, int lineno, const char *sig) {
+    Scope *current = &ps->scopes[ps->scope_top];
+    if (current->count == current->cap) {
+        current->cap = current->cap ? current->cap * 2 : 64;
+        current->symbols = realloc(current->symbols, current->cap * sizeof(Symbol));
+    }
     Symbol *s = &current->symbols[current->count++];
     strcpy(s->name, name);
     strcpy(s->type, type);
@@ -3112,13 +3481,15 @@ static int insert_symbol(const char *name, const char *type, int addr, int linen
         s->mut = 0;
     }
     strcpy(s->func_sig, sig);
-    printf("> Insert `%s` (addr: %d) to scope level %d\n", name, addr, get_scope_level());
+    method_name_local(addr, name);
+    if (g_opt.verbose >= 2) printf("> Insert `%s` (addr: %d) to scope level %d\n", name, addr, get_scope_level(ps));
+    trace_symbols(ps);
     return addr;
 }
 
-static int lookup_symbol(const char *name) {
-    for (int i = scope_top; i >= 0; i--) {
-        Scope *s = &scope_stack[i];
+static int lookup_symbol(ParseState *ps, const char *name) {
+    for (int i = ps->scope_top; i >= 0; i--) {
+        Scope *s = &ps->scopes[i];
         for (int j = 0; j < s->count; j++) {
             if (strcmp(s->symbols[j].name, name) == 0) {
                 return s->symbols[j].addr;
@@ -3128,22 +3499,39 @@ static int lookup_symbol(const char *name) {
     return -1;
 }
 
-static void dump_symbol() {
-    Scope *current = &scope_stack[scope_top];
-    printf("\n> Dump symbol table (scope level: %d)\n", current->level);
-    printf("%-10s%-10s%-10s%-10s%-10s%-10s%-10s\n",
-        "Index", "Name", "Mut", "Type", "Addr", "Lineno", "Func_sig");
+static void dump_symbol(ParseState *ps) {
+    Scope *current = &ps->scopes[ps->scope_top];
+    symtab_scope(current->level, current->count);
     for (int i = 0; i < current->count; i++) {
         Symbol *s = &current->symbols[i];
-        printf("%-10d%-10s%-10d%-10s%-10d%-10d%-10s\n",
-            i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+        symtab_symbol(i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+    }
+    if (g_opt.verbose >= 2) {
+        printf("\n> Dump symbol table (scope level: %d)\n", current->level);
+        printf("%-10s%-10s%-10s%-10s%-10s%-10s%-10s\n",
+            "Index", "Name", "Mut", "Type", "Addr", "Lineno", "Func_sig");
+        for (int i = 0; i < current->count; i++) {
+            Symbol *s = &current->symbols[i];
+            printf("%-10d%-10s%-10d%-10s%-10d%-10d%-10s\n",
+                i, s->name, s->mut, s->type, s->addr, s->lineno, s->func_sig);
+        }
+    }
+    ps->scope_top--;
+    trace_symbols(ps);
+}
+
+/* Symbols in all open scopes, as a --trace counter */
+static void trace_symbols(ParseState *ps) {
+    long n = 0;
+    for (int i = 0; i <= ps->scope_top; i++) {
+        n += ps->scopes[i].count;
     }
-    scope_top--;
+    trace_counter("symbols", n);
 }
 
-static const char* get_symbol_type(const char *name) {
-    for (int i = scope_top; i >= 0; i--) {
-        Scope *s = &scope_stack[i];
+static const char* get_symbol_type(ParseState *ps, const char *name) {
+    for (int i = ps->scope_top; i >= 0; i--) {
+        Scope *s = &ps->scopes[i];
         for (int j = 0; j < s->count; j++) {
             if (strcmp(s->symbols[j].name, name) == 0) {
                 return s->symbols[j].type;
@@ -3153,10 +3541,10 @@ static const char* get_symbol_type(const char *name) {
     return NULL;
 }
 
-static int next_addr() {
-    return addr_counter++;
+static int next_addr(ParseState *ps) {
+    return ps->addr_counter++;
 }
 
-static int get_scope_level() {
-    return scope_top;
+static int get_scope_level(ParseState *ps) {
+    return ps->scope_top;
 }